@@ -21,6 +21,10 @@
 #include "per/adc.h"
 #include "per/uart.h"
 #include "hid/midi.h"
+#include "hid/midi_clock.h"
+#include "hid/midi_ump.h"
+#include "hid/midi_router.h"
+#include "hid/midi_file.h"
 #include "hid/encoder.h"
 #include "hid/switch.h"
 #include "hid/switch3.h"
@@ -70,6 +74,7 @@
 #include "util/PersistentStorage.h"
 #include "util/Stack.h"
 #include "util/VoctCalibration.h"
+#include "util/VoiceAllocator.h"
 #include "util/WaveTableLoader.h"
 #include "util/WavWriter.h"
 #endif
@@ -191,14 +191,17 @@ void DaisyField::ChangeAudioCallback(AudioHandle::AudioCallback cb)
 
 void DaisyField::SetHidUpdateRates()
 {
+    const float rate = controls_scheduled_
+                           ? seed.audio_handle.GetControlTaskRate(analog_task_)
+                           : AudioCallbackRate();
     //set the hids to the new update rate
     for(size_t i = 0; i < KNOB_LAST; i++)
     {
-        knob[i].SetSampleRate(AudioCallbackRate());
+        knob[i].SetSampleRate(rate);
     }
     for(size_t i = 0; i < CV_LAST; i++)
     {
-        cv[i].SetSampleRate(AudioCallbackRate());
+        cv[i].SetSampleRate(rate);
     }
 }
 
@@ -276,6 +279,35 @@ void DaisyField::ProcessDigitalControls()
     gate_in_trig_ = gate_in.Trig();
 }
 
+AudioHandle::Result DaisyField::ScheduleControls(float analog_rate,
+                                                 float digital_rate)
+{
+    AudioHandle& audio = seed.audio_handle;
+    if(audio.AddControlTaskHz(
+           ProcessAnalogControlsTask, this, analog_rate, &analog_task_)
+       != AudioHandle::Result::OK)
+        return AudioHandle::Result::ERR;
+    if(audio.AddControlTaskHz(ProcessDigitalControlsTask, this, digital_rate)
+       != AudioHandle::Result::OK)
+    {
+        audio.RemoveControlTask(analog_task_);
+        return AudioHandle::Result::ERR;
+    }
+    controls_scheduled_ = true;
+    SetHidUpdateRates();
+    return AudioHandle::Result::OK;
+}
+
+void DaisyField::ProcessAnalogControlsTask(void* context)
+{
+    static_cast<DaisyField*>(context)->ProcessAnalogControls();
+}
+
+void DaisyField::ProcessDigitalControlsTask(void* context)
+{
+    static_cast<DaisyField*>(context)->ProcessDigitalControls();
+}
+
 void DaisyField::SetCvOut1(uint16_t val)
 {
     seed.dac.WriteValue(DacHandle::Channel::ONE, val);
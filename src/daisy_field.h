@@ -160,6 +160,17 @@ class DaisyField
         ProcessDigitalControls();
     }
 
+    /** Runs ProcessAnalogControls() and ProcessDigitalControls() from the audio
+     ** engine right before the audio callback, at their own rates, instead of
+     ** calling ProcessAllControls() in every callback.
+     ** The analog controls are filtered at the rate they actually run at.
+     ** Call once, after Init().
+     ** \param analog_rate target rate in Hz for the analog controls
+     ** \param digital_rate target rate in Hz for the digital controls
+     */
+    AudioHandle::Result ScheduleControls(float analog_rate  = 1000.f,
+                                         float digital_rate = 1000.f);
+
     /** Sets the output of CV out 1 to a value between 0-4095 that corresponds to 0-5V */
     void SetCvOut1(uint16_t val);
 
@@ -229,6 +240,12 @@ class DaisyField
     uint8_t              keyboard_state_[16];
     uint32_t             last_led_update_; // for vegas mode
     bool                 gate_in_trig_;    // True when triggered.
+
+    static void ProcessAnalogControlsTask(void* context);
+    static void ProcessDigitalControlsTask(void* context);
+
+    bool   controls_scheduled_ = false;
+    size_t analog_task_        = 0;
 };
 
 /** @} */
@@ -72,9 +72,12 @@ void DaisyLegio::Init(bool boost)
 
 void DaisyLegio::SetHidUpdateRates()
 {
+    const float rate = controls_scheduled_
+                           ? seed.audio_handle.GetControlTaskRate(analog_task_)
+                           : AudioCallbackRate();
     for(size_t i = 0; i < CONTROL_LAST; i++)
     {
-        controls[i].SetSampleRate(AudioCallbackRate());
+        controls[i].SetSampleRate(rate);
     }
 }
 
@@ -145,6 +148,35 @@ void DaisyLegio::ProcessDigitalControls()
     encoder.Debounce();
 }
 
+AudioHandle::Result DaisyLegio::ScheduleControls(float analog_rate,
+                                                 float digital_rate)
+{
+    AudioHandle& audio = seed.audio_handle;
+    if(audio.AddControlTaskHz(
+           ProcessAnalogControlsTask, this, analog_rate, &analog_task_)
+       != AudioHandle::Result::OK)
+        return AudioHandle::Result::ERR;
+    if(audio.AddControlTaskHz(ProcessDigitalControlsTask, this, digital_rate)
+       != AudioHandle::Result::OK)
+    {
+        audio.RemoveControlTask(analog_task_);
+        return AudioHandle::Result::ERR;
+    }
+    controls_scheduled_ = true;
+    SetHidUpdateRates();
+    return AudioHandle::Result::OK;
+}
+
+void DaisyLegio::ProcessAnalogControlsTask(void* context)
+{
+    static_cast<DaisyLegio*>(context)->ProcessAnalogControls();
+}
+
+void DaisyLegio::ProcessDigitalControlsTask(void* context)
+{
+    static_cast<DaisyLegio*>(context)->ProcessDigitalControls();
+}
+
 void DaisyLegio::ProcessAnalogControls()
 {
     for(size_t i = 0; i < CONTROL_LAST; i++)
@@ -111,6 +111,17 @@ class DaisyLegio
         ProcessAnalogControls();
     }
 
+    /** Runs ProcessAnalogControls() and ProcessDigitalControls() from the audio
+     ** engine right before the audio callback, at their own rates, instead of
+     ** calling ProcessAllControls() in every callback.
+     ** The analog controls are filtered at the rate they actually run at.
+     ** Call once, after Init().
+     ** \param analog_rate target rate in Hz for the analog controls
+     ** \param digital_rate target rate in Hz for the digital controls
+     */
+    AudioHandle::Result ScheduleControls(float analog_rate  = 1000.f,
+                                         float digital_rate = 1000.f);
+
     /** Returns true if gate in is HIGH */
     bool Gate();
 
@@ -137,6 +148,12 @@ class DaisyLegio
 
   private:
     void SetHidUpdateRates();
+
+    static void ProcessAnalogControlsTask(void* context);
+    static void ProcessDigitalControlsTask(void* context);
+
+    bool   controls_scheduled_ = false;
+    size_t analog_task_        = 0;
 };
 
 } // namespace daisy
\ No newline at end of file
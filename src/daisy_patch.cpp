@@ -53,9 +53,12 @@ void DaisyPatch::DelayMs(size_t del)
 
 void DaisyPatch::SetHidUpdateRates()
 {
+    const float rate = controls_scheduled_
+                           ? seed.audio_handle.GetControlTaskRate(analog_task_)
+                           : AudioCallbackRate();
     for(size_t i = 0; i < CTRL_LAST; i++)
     {
-        controls[i].SetSampleRate(AudioCallbackRate());
+        controls[i].SetSampleRate(rate);
     }
 }
 
@@ -69,6 +72,16 @@ void DaisyPatch::ChangeAudioCallback(AudioHandle::AudioCallback cb)
     seed.ChangeAudioCallback(cb);
 }
 
+void DaisyPatch::StartAudio(AudioHandle::RawAudioCallback cb)
+{
+    seed.StartAudio(cb);
+}
+
+void DaisyPatch::ChangeAudioCallback(AudioHandle::RawAudioCallback cb)
+{
+    seed.ChangeAudioCallback(cb);
+}
+
 void DaisyPatch::StopAudio()
 {
     seed.StopAudio();
@@ -130,6 +143,35 @@ void DaisyPatch::ProcessDigitalControls()
     encoder.Debounce();
 }
 
+AudioHandle::Result DaisyPatch::ScheduleControls(float analog_rate,
+                                                 float digital_rate)
+{
+    AudioHandle& audio = seed.audio_handle;
+    if(audio.AddControlTaskHz(
+           ProcessAnalogControlsTask, this, analog_rate, &analog_task_)
+       != AudioHandle::Result::OK)
+        return AudioHandle::Result::ERR;
+    if(audio.AddControlTaskHz(ProcessDigitalControlsTask, this, digital_rate)
+       != AudioHandle::Result::OK)
+    {
+        audio.RemoveControlTask(analog_task_);
+        return AudioHandle::Result::ERR;
+    }
+    controls_scheduled_ = true;
+    SetHidUpdateRates();
+    return AudioHandle::Result::OK;
+}
+
+void DaisyPatch::ProcessAnalogControlsTask(void* context)
+{
+    static_cast<DaisyPatch*>(context)->ProcessAnalogControls();
+}
+
+void DaisyPatch::ProcessDigitalControlsTask(void* context)
+{
+    static_cast<DaisyPatch*>(context)->ProcessDigitalControls();
+}
+
 // This will render the display with the controls as vertical bars
 void DaisyPatch::DisplayControls(bool invert)
 {
@@ -61,6 +61,17 @@ class DaisyPatch
     */
     void ChangeAudioCallback(AudioHandle::AudioCallback cb);
 
+    /** Starts the callback
+    \param cb raw callback function, receives the SAI buffers of both codecs
+    */
+    void StartAudio(AudioHandle::RawAudioCallback cb);
+
+    /**
+       Switch callback functions
+       \param cb New raw callback function.
+    */
+    void ChangeAudioCallback(AudioHandle::RawAudioCallback cb);
+
     /** Stops the audio */
     void StopAudio();
 
@@ -99,6 +110,17 @@ class DaisyPatch
         ProcessDigitalControls();
     }
 
+    /** Runs ProcessAnalogControls() and ProcessDigitalControls() from the audio
+     ** engine right before the audio callback, at their own rates, instead of
+     ** calling ProcessAllControls() in every callback.
+     ** The analog controls are filtered at the rate they actually run at.
+     ** Call once, after Init().
+     ** \param analog_rate target rate in Hz for the analog controls
+     ** \param digital_rate target rate in Hz for the digital controls
+     */
+    AudioHandle::Result ScheduleControls(float analog_rate  = 1000.f,
+                                         float digital_rate = 1000.f);
+
     /**
        Get value for a particular control
        \param k Which control to get
@@ -136,6 +158,12 @@ class DaisyPatch
     void InitGates();
 
     uint32_t screen_update_last_, screen_update_period_;
+
+    static void ProcessAnalogControlsTask(void* context);
+    static void ProcessDigitalControlsTask(void* context);
+
+    bool   controls_scheduled_ = false;
+    size_t analog_task_        = 0;
 };
 
 } // namespace daisy
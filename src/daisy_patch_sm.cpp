@@ -383,10 +383,7 @@ namespace patch_sm
     {
         audio.SetBlockSize(size);
         callback_rate_ = AudioSampleRate() / AudioBlockSize();
-        for(size_t i = 0; i < ADC_LAST; i++)
-        {
-            controls[i].SetSampleRate(callback_rate_);
-        }
+        SetHidUpdateRates();
     }
 
     void DaisyPatchSM::SetAudioSampleRate(float sr)
@@ -411,10 +408,7 @@ namespace patch_sm
         }
         audio.SetSampleRate(sai_sr);
         callback_rate_ = AudioSampleRate() / AudioBlockSize();
-        for(size_t i = 0; i < ADC_LAST; i++)
-        {
-            controls[i].SetSampleRate(callback_rate_);
-        }
+        SetHidUpdateRates();
     }
 
     void
@@ -422,10 +416,7 @@ namespace patch_sm
     {
         audio.SetSampleRate(sample_rate);
         callback_rate_ = AudioSampleRate() / AudioBlockSize();
-        for(size_t i = 0; i < ADC_LAST; i++)
-        {
-            controls[i].SetSampleRate(callback_rate_);
-        }
+        SetHidUpdateRates();
     }
 
     size_t DaisyPatchSM::AudioBlockSize()
@@ -451,6 +442,33 @@ namespace patch_sm
 
     void DaisyPatchSM::ProcessDigitalControls() {}
 
+    AudioHandle::Result DaisyPatchSM::ScheduleControls(float analog_rate)
+    {
+        if(audio.AddControlTaskHz(
+               ProcessAnalogControlsTask, this, analog_rate, &analog_task_)
+           != AudioHandle::Result::OK)
+            return AudioHandle::Result::ERR;
+        controls_scheduled_ = true;
+        SetHidUpdateRates();
+        return AudioHandle::Result::OK;
+    }
+
+    void DaisyPatchSM::ProcessAnalogControlsTask(void* context)
+    {
+        static_cast<DaisyPatchSM*>(context)->ProcessAnalogControls();
+    }
+
+    void DaisyPatchSM::SetHidUpdateRates()
+    {
+        const float rate = controls_scheduled_
+                               ? audio.GetControlTaskRate(analog_task_)
+                               : callback_rate_;
+        for(size_t i = 0; i < ADC_LAST; i++)
+        {
+            controls[i].SetSampleRate(rate);
+        }
+    }
+
     float DaisyPatchSM::GetAdcValue(int idx) { return controls[idx].Value(); }
 
     dsy_gpio_pin DaisyPatchSM::GetPin(const PinBank bank, const int idx)
@@ -132,6 +132,15 @@ namespace patch_sm
             ProcessDigitalControls();
         }
 
+        /** Runs ProcessAnalogControls() from the audio engine right before
+         *  the audio callback at the given rate, instead of calling 
+         *  ProcessAllControls() in every callback.
+         *  The controls are filtered at the rate they actually run at.
+         *  Call once, after Init().
+         *  \param analog_rate target rate in Hz for the analog controls
+         */
+        AudioHandle::Result ScheduleControls(float analog_rate = 1000.f);
+
         /** Returns the current value for one of the ADCs */
         float GetAdcValue(int idx);
 
@@ -310,6 +319,13 @@ namespace patch_sm
 
         float callback_rate_;
 
+        /** Sets the filter rate of the controls after the callback rate changed */
+        void        SetHidUpdateRates();
+        static void ProcessAnalogControlsTask(void* context);
+
+        bool   controls_scheduled_ = false;
+        size_t analog_task_        = 0;
+
         /** Background callback for updating the DACs. */
         Impl* pimpl_;
     };
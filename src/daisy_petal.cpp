@@ -98,15 +98,18 @@ void DaisyPetal::DelayMs(size_t del)
 
 void DaisyPetal::SetHidUpdateRates()
 {
+    const float rate = controls_scheduled_
+                           ? seed.audio_handle.GetControlTaskRate(analog_task_)
+                           : AudioCallbackRate();
     for(size_t i = 0; i < KNOB_LAST; i++)
     {
-        knob[i].SetSampleRate(AudioCallbackRate());
+        knob[i].SetSampleRate(rate);
     }
     for(size_t i = 0; i < FOOTSWITCH_LED_LAST; i++)
     {
         footswitch_led[i].SetSampleRate(AudioCallbackRate());
     }
-    expression.SetSampleRate(AudioCallbackRate());
+    expression.SetSampleRate(rate);
 }
 
 
@@ -203,6 +206,35 @@ void DaisyPetal::ProcessDigitalControls()
     }
 }
 
+AudioHandle::Result DaisyPetal::ScheduleControls(float analog_rate,
+                                                 float digital_rate)
+{
+    AudioHandle& audio = seed.audio_handle;
+    if(audio.AddControlTaskHz(
+           ProcessAnalogControlsTask, this, analog_rate, &analog_task_)
+       != AudioHandle::Result::OK)
+        return AudioHandle::Result::ERR;
+    if(audio.AddControlTaskHz(ProcessDigitalControlsTask, this, digital_rate)
+       != AudioHandle::Result::OK)
+    {
+        audio.RemoveControlTask(analog_task_);
+        return AudioHandle::Result::ERR;
+    }
+    controls_scheduled_ = true;
+    SetHidUpdateRates();
+    return AudioHandle::Result::OK;
+}
+
+void DaisyPetal::ProcessAnalogControlsTask(void* context)
+{
+    static_cast<DaisyPetal*>(context)->ProcessAnalogControls();
+}
+
+void DaisyPetal::ProcessDigitalControlsTask(void* context)
+{
+    static_cast<DaisyPetal*>(context)->ProcessDigitalControls();
+}
+
 
 void DaisyPetal::ClearLeds()
 {
@@ -138,6 +138,17 @@ class DaisyPetal
         ProcessDigitalControls();
     }
 
+    /** Runs ProcessAnalogControls() and ProcessDigitalControls() from the audio
+     ** engine right before the audio callback, at their own rates, instead of
+     ** calling ProcessAllControls() in every callback.
+     ** The analog controls are filtered at the rate they actually run at.
+     ** Call once, after Init().
+     ** \param analog_rate target rate in Hz for the analog controls
+     ** \param digital_rate target rate in Hz for the digital controls
+     */
+    AudioHandle::Result ScheduleControls(float analog_rate  = 1000.f,
+                                         float digital_rate = 1000.f);
+
 
     /** Get value per knob.
     \param k Which knob to get
@@ -193,6 +204,12 @@ class DaisyPetal
     inline uint16_t* adc_ptr(const uint8_t chn) { return seed.adc.GetPtr(chn); }
 
     LedDriverPca9685<2, true> led_driver_;
+
+    static void ProcessAnalogControlsTask(void* context);
+    static void ProcessDigitalControlsTask(void* context);
+
+    bool   controls_scheduled_ = false;
+    size_t analog_task_        = 0;
 };
 
 } // namespace daisy
@@ -94,9 +94,12 @@ void DaisyPod::DelayMs(size_t del)
 
 void DaisyPod::SetHidUpdateRates()
 {
+    const float rate = controls_scheduled_
+                           ? seed.audio_handle.GetControlTaskRate(analog_task_)
+                           : AudioCallbackRate();
     for(int i = 0; i < KNOB_LAST; i++)
     {
-        knobs[i]->SetSampleRate(AudioCallbackRate());
+        knobs[i]->SetSampleRate(rate);
     }
 }
 
@@ -183,6 +186,35 @@ void DaisyPod::ProcessDigitalControls()
     button2.Debounce();
 }
 
+AudioHandle::Result DaisyPod::ScheduleControls(float analog_rate,
+                                               float digital_rate)
+{
+    AudioHandle& audio = seed.audio_handle;
+    if(audio.AddControlTaskHz(
+           ProcessAnalogControlsTask, this, analog_rate, &analog_task_)
+       != AudioHandle::Result::OK)
+        return AudioHandle::Result::ERR;
+    if(audio.AddControlTaskHz(ProcessDigitalControlsTask, this, digital_rate)
+       != AudioHandle::Result::OK)
+    {
+        audio.RemoveControlTask(analog_task_);
+        return AudioHandle::Result::ERR;
+    }
+    controls_scheduled_ = true;
+    SetHidUpdateRates();
+    return AudioHandle::Result::OK;
+}
+
+void DaisyPod::ProcessAnalogControlsTask(void* context)
+{
+    static_cast<DaisyPod*>(context)->ProcessAnalogControls();
+}
+
+void DaisyPod::ProcessDigitalControlsTask(void* context)
+{
+    static_cast<DaisyPod*>(context)->ProcessDigitalControls();
+}
+
 void DaisyPod::ClearLeds()
 {
     // Using Color
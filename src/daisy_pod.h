@@ -105,6 +105,17 @@ class DaisyPod
         ProcessDigitalControls();
     }
 
+    /** Runs ProcessAnalogControls() and ProcessDigitalControls() from the audio
+     ** engine right before the audio callback, at their own rates, instead of
+     ** calling ProcessAllControls() in every callback.
+     ** The analog controls are filtered at the rate they actually run at.
+     ** Call once, after Init().
+     ** \param analog_rate target rate in Hz for the analog controls
+     ** \param digital_rate target rate in Hz for the digital controls
+     */
+    AudioHandle::Result ScheduleControls(float analog_rate  = 1000.f,
+                                         float digital_rate = 1000.f);
+
     /** & */
     float GetKnobValue(Knob k);
 
@@ -137,6 +148,12 @@ class DaisyPod
     void InitLeds();
     void InitKnobs();
     void InitMidi();
+
+    static void ProcessAnalogControlsTask(void* context);
+    static void ProcessDigitalControlsTask(void* context);
+
+    bool   controls_scheduled_ = false;
+    size_t analog_task_        = 0;
 };
 
 } // namespace daisy
@@ -67,6 +67,14 @@ class DaisySeed
     */
     void StartAudio(AudioHandle::AudioCallback cb);
 
+    /** Begins the audio for the seeds builtin audio.
+    the specified callback will get called whenever
+    new data is ready to be prepared.
+    This will use the raw callback, which receives the
+    unconverted SAI buffers.
+    */
+    void StartAudio(AudioHandle::RawAudioCallback cb);
+
     /** Changes to a new interleaved callback
      */
     void ChangeAudioCallback(AudioHandle::InterleavingAudioCallback cb);
@@ -75,6 +83,10 @@ class DaisySeed
      */
     void ChangeAudioCallback(AudioHandle::AudioCallback cb);
 
+    /** Changes to a new raw callback
+     */
+    void ChangeAudioCallback(AudioHandle::RawAudioCallback cb);
+
     /** Stops the audio if it is running. */
     void StopAudio();
 
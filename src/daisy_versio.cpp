@@ -86,9 +86,12 @@ void DaisyVersio::Init(bool boost)
 
 void DaisyVersio::SetHidUpdateRates()
 {
+    const float rate = controls_scheduled_
+                           ? seed.audio_handle.GetControlTaskRate(analog_task_)
+                           : AudioCallbackRate();
     for(size_t i = 0; i < KNOB_LAST; i++)
     {
-        knobs[i].SetSampleRate(AudioCallbackRate());
+        knobs[i].SetSampleRate(rate);
     }
 }
 
@@ -163,6 +166,22 @@ void DaisyVersio::ProcessAnalogControls()
     }
 }
 
+AudioHandle::Result DaisyVersio::ScheduleControls(float analog_rate)
+{
+    if(seed.audio_handle.AddControlTaskHz(
+           ProcessAnalogControlsTask, this, analog_rate, &analog_task_)
+       != AudioHandle::Result::OK)
+        return AudioHandle::Result::ERR;
+    controls_scheduled_ = true;
+    SetHidUpdateRates();
+    return AudioHandle::Result::OK;
+}
+
+void DaisyVersio::ProcessAnalogControlsTask(void* context)
+{
+    static_cast<DaisyVersio*>(context)->ProcessAnalogControls();
+}
+
 bool DaisyVersio::SwitchPressed()
 {
     return tap.Pressed();
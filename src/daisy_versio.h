@@ -110,6 +110,14 @@ class DaisyVersio
     /** Does what it says */
     inline void ProcessAllControls() { ProcessAnalogControls(); }
 
+    /** Runs ProcessAnalogControls() from the audio engine right before the
+     ** audio callback at the given rate, instead of calling ProcessAllControls()
+     ** in every callback. The knobs are filtered at the rate they actually run at.
+     ** Call once, after Init().
+     ** \param analog_rate target rate in Hz for the analog controls
+     */
+    AudioHandle::Result ScheduleControls(float analog_rate = 1000.f);
+
     /** Returns true if momentary switch is pressed */
     bool SwitchPressed();
 
@@ -139,6 +147,11 @@ class DaisyVersio
 
   private:
     void SetHidUpdateRates();
+
+    static void ProcessAnalogControlsTask(void* context);
+
+    bool   controls_scheduled_ = false;
+    size_t analog_task_        = 0;
 };
 
 } // namespace daisy
@@ -21,7 +21,7 @@ namespace daisy
 /** Parsed from the Status Byte, these are the common Midi Messages that can be handled. \n
 At this time only 3-byte messages are correctly parsed into MidiEvents.
 */
-enum MidiMessageType
+enum MidiMessageType : uint8_t
 {
     NoteOff,               /**< & */
     NoteOn,                /**< & */
@@ -36,7 +36,7 @@ enum MidiMessageType
     MessageLast,           /**< & */
 };
 
-enum SystemCommonType
+enum SystemCommonType : uint8_t
 {
     SystemExclusive,     /**< & */
     MTCQuarterFrame,     /**< & */
@@ -49,7 +49,7 @@ enum SystemCommonType
     SystemCommonLast,    /**< & */
 };
 
-enum SystemRealTimeType
+enum SystemRealTimeType : uint8_t
 {
     TimingClock,        /**< & */
     SRTUndefined0,      /**< & */
@@ -62,7 +62,7 @@ enum SystemRealTimeType
     SystemRealTimeLast, /**< & */
 };
 
-enum ChannelModeType
+enum ChannelModeType : uint8_t
 {
     AllSoundOff,         /**< & */
     ResetAllControllers, /**< & */
@@ -251,6 +251,7 @@ struct MidiEvent
     SystemCommonType   sc_type;
     SystemRealTimeType srt_type;
     ChannelModeType    cm_type;
+    uint32_t           timestamp; /**< System::GetTick() on arrival */
 
     /** Returns the data within the MidiEvent as a NoteOffEvent struct */
     NoteOffEvent AsNoteOff()
@@ -417,6 +418,148 @@ struct MidiEvent
     }
 };
 
+/** Compact MidiEvent for queueing, 12 bytes instead of the ~140 bytes of
+MidiEvent. The payload of a SysEx message is not stored in the event, it is
+kept in a MidiSysExBuffer that holds sysex_length bytes for this event.
+The accessors match those of MidiEvent.
+*/
+struct CompactMidiEvent
+{
+    MidiMessageType    type;         /**< & */
+    uint8_t            channel;      /**< & */
+    uint8_t            data[2];      /**< & */
+    SystemCommonType   sc_type;      /**< & */
+    SystemRealTimeType srt_type;     /**< & */
+    uint16_t           sysex_length; /**< SysEx payload bytes in the buffer */
+    uint32_t           timestamp;    /**< System::GetTick() on arrival */
+
+    /** Returns the channel mode type of a ChannelMode event */
+    ChannelModeType GetChannelModeType() const
+    {
+        return static_cast<ChannelModeType>(data[0] - 120);
+    }
+
+    /** Returns the event as a MidiEvent, without any SysEx payload */
+    MidiEvent ToMidiEvent() const
+    {
+        MidiEvent m;
+        m.type              = type;
+        m.channel           = channel;
+        m.data[0]           = data[0];
+        m.data[1]           = data[1];
+        m.sysex_message_len = 0;
+        m.sc_type           = sc_type;
+        m.srt_type          = srt_type;
+        m.timestamp         = timestamp;
+        m.cm_type           = ChannelModeLast;
+        if(type == ChannelMode)
+            m.cm_type = GetChannelModeType();
+        return m;
+    }
+
+    /** Returns the data within the event as a NoteOffEvent struct */
+    NoteOffEvent AsNoteOff() const
+    {
+        NoteOffEvent m;
+        m.channel  = channel;
+        m.note     = data[0];
+        m.velocity = data[1];
+        return m;
+    }
+
+    /** Returns the data within the event as a NoteOnEvent struct */
+    NoteOnEvent AsNoteOn() const
+    {
+        NoteOnEvent m;
+        m.channel  = channel;
+        m.note     = data[0];
+        m.velocity = data[1];
+        return m;
+    }
+
+    /** Returns the data within the event as a PolyphonicKeyPressureEvent struct */
+    PolyphonicKeyPressureEvent AsPolyphonicKeyPressure() const
+    {
+        PolyphonicKeyPressureEvent m;
+        m.channel  = channel;
+        m.note     = data[0];
+        m.pressure = data[1];
+        return m;
+    }
+
+    /** Returns the data within the event as a ControlChangeEvent struct.*/
+    ControlChangeEvent AsControlChange() const
+    {
+        ControlChangeEvent m;
+        m.channel        = channel;
+        m.control_number = data[0];
+        m.value          = data[1];
+        return m;
+    }
+
+    /** Returns the data within the event as a ProgramChangeEvent struct.*/
+    ProgramChangeEvent AsProgramChange() const
+    {
+        ProgramChangeEvent m;
+        m.channel = channel;
+        m.program = data[0];
+        return m;
+    }
+
+    /** Returns the data within the event as a ChannelPressureEvent struct.*/
+    ChannelPressureEvent AsChannelPressure() const
+    {
+        ChannelPressureEvent m;
+        m.channel  = channel;
+        m.pressure = data[0];
+        return m;
+    }
+
+    /** Returns the data within the event as a PitchBendEvent struct.*/
+    PitchBendEvent AsPitchBend() const
+    {
+        PitchBendEvent m;
+        m.channel = channel;
+        m.value   = ((uint16_t)data[1] << 7) + (data[0] - 8192);
+        return m;
+    }
+
+    /** Returns the data within the event as a ChannelModeEvent struct.*/
+    ChannelModeEvent AsChannelMode() const
+    {
+        ChannelModeEvent m;
+        m.channel    = channel;
+        m.event_type = GetChannelModeType();
+        m.value      = data[1];
+        return m;
+    }
+
+    /** Returns the data within the event as a MTCQuarterFrameEvent struct.*/
+    MTCQuarterFrameEvent AsMTCQuarterFrame() const
+    {
+        MTCQuarterFrameEvent m;
+        m.message_type = (data[0] & 0x70) >> 4;
+        m.value        = data[0] & 0x0f;
+        return m;
+    }
+
+    /** Returns the data within the event as a SongPositionPointerEvent struct.*/
+    SongPositionPointerEvent AsSongPositionPointer() const
+    {
+        SongPositionPointerEvent m;
+        m.position = ((uint16_t)data[1] << 7) | data[0];
+        return m;
+    }
+
+    /** Returns the data within the event as a SongSelectEvent struct.*/
+    SongSelectEvent AsSongSelect() const
+    {
+        SongSelectEvent m;
+        m.song = data[0];
+        return m;
+    }
+};
+
 /** @} */ // End midi_events
 
 /** @} */ // End midi
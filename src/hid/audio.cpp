@@ -1,4 +1,9 @@
+#include <string.h>
 #include "hid/audio.h"
+#include "hid/audio_convert.h"
+#include "hid/audio_scratch.h"
+#include "sys/system.h"
+#include "util/scopedirqblocker.h"
 
 namespace daisy
 {
@@ -10,17 +15,29 @@ namespace daisy
 // in the interest in encourage newcomers, and this also being an audio-centric platform
 // these buffers will always be present, and usable.
 //
-static const size_t kAudioMaxBufferSize = 1024;
-static const size_t kAudioMaxChannels   = 4;
+static const size_t kAudioMaxBlockSize    = DSY_AUDIO_MAX_BLOCKSIZE;
+static const size_t kAudioMaxChannels     = DSY_AUDIO_MAX_CHANNELS;
+static const size_t kAudioMaxSai          = 2;
+static const size_t kAudioMaxControlTasks = DSY_AUDIO_MAX_CONTROL_TASKS;
+// Two halves of stereo interleaved data per SAI
+static const size_t kAudioMaxBufferSize = kAudioMaxBlockSize * 2 * 2;
+
+static_assert(kAudioMaxChannels >= kAudioMaxSai * 2,
+              "DSY_AUDIO_MAX_CHANNELS must be at least 4, for two SAIs");
 
 // Static Global Buffers
-// 8kB in SRAM1, non-cached memory
+// 8kB in SRAM1, non-cached memory (with the default block size)
 // 1k samples in, 1k samples out, 4 bytes per sample.
 // One buffer per 2 channels (Interleaved on hardware)
 static int32_t DMA_BUFFER_MEM_SECTION
-    dsy_audio_rx_buffer[kAudioMaxChannels / 2][kAudioMaxBufferSize];
+    dsy_audio_rx_buffer[kAudioMaxSai][kAudioMaxBufferSize];
 static int32_t DMA_BUFFER_MEM_SECTION
-    dsy_audio_tx_buffer[kAudioMaxChannels / 2][kAudioMaxBufferSize];
+    dsy_audio_tx_buffer[kAudioMaxSai][kAudioMaxBufferSize];
+
+// Float buffers handed to the user callback.
+// Kept out of the interrupt stack, in DTCM for single-cycle access.
+static AudioScratchBuffer<kAudioMaxChannels, kAudioMaxBlockSize>
+    DTCM_MEM_SECTION dsy_audio_scratch;
 
 // ================================================================
 // Private Implementation Definition
@@ -35,10 +52,12 @@ class AudioHandle::Impl
     AudioHandle::Result DeInit();
     AudioHandle::Result Start(AudioHandle::AudioCallback callback);
     AudioHandle::Result Start(AudioHandle::InterleavingAudioCallback callback);
+    AudioHandle::Result Start(AudioHandle::RawAudioCallback callback);
     AudioHandle::Result Stop();
     AudioHandle::Result ChangeCallback(AudioHandle::AudioCallback callback);
     AudioHandle::Result
     ChangeCallback(AudioHandle::InterleavingAudioCallback callback);
+    AudioHandle::Result ChangeCallback(AudioHandle::RawAudioCallback callback);
 
     inline size_t GetChannels() const
     {
@@ -52,10 +71,47 @@ class AudioHandle::Impl
 
     AudioHandle::Result SetBlockSize(size_t size)
     {
-        size_t maxSize    = kAudioMaxBufferSize / 4;
-        config_.blocksize = size <= maxSize ? size : maxSize;
-        return size <= maxSize ? AudioHandle::Result::OK
-                               : AudioHandle::Result::ERR;
+        config_.blocksize
+            = size <= kAudioMaxBlockSize ? size : kAudioMaxBlockSize;
+        scheduler_.SetBlockRate(GetBlockRate());
+        UpdateBlockTicks();
+        return size <= kAudioMaxBlockSize ? AudioHandle::Result::OK
+                                          : AudioHandle::Result::ERR;
+    }
+
+    float GetBlockRate()
+    {
+        if(!sai1_.IsInitialized() || config_.blocksize == 0)
+            return 0.f;
+        return sai1_.GetSampleRate() / config_.blocksize;
+    }
+
+    // one block period in System::GetTick() ticks, which is also the
+    // deadline of the callback
+    void UpdateBlockTicks()
+    {
+        const float block_rate = GetBlockRate();
+        block_ticks_
+            = block_rate > 0.f ? (uint32_t)(System::GetTickFreq() / block_rate)
+                               : 0;
+#if DSY_AUDIO_INSTRUMENTATION
+        stats_.deadline_ticks = block_ticks_;
+#endif
+    }
+
+    size_t GetSampleOffset(uint32_t timestamp) const
+    {
+        if(block_ticks_ == 0)
+            return 0;
+        // Events from the previous block period are spread across this
+        // block, which delays every event by exactly one block.
+        const int32_t elapsed
+            = (int32_t)(timestamp - block_start_tick_) + (int32_t)block_ticks_;
+        if(elapsed <= 0)
+            return 0;
+        if((uint32_t)elapsed >= block_ticks_)
+            return config_.blocksize - 1;
+        return (uint64_t)elapsed * config_.blocksize / block_ticks_;
     }
 
     float GetSampleRate() { return sai1_.GetSampleRate(); }
@@ -84,8 +140,49 @@ class AudioHandle::Impl
 
     // Internal Callback
     static void InternalCallback(int32_t* in, int32_t* out, size_t size);
+    static void ProcessBlock(int32_t* in, int32_t* out, size_t size);
+
+#if DSY_AUDIO_INSTRUMENTATION
+    void ResetStats()
+    {
+        ScopedIrqBlocker irq_blocker;
+        stats_                = {};
+        stats_.deadline_ticks = block_ticks_;
+    }
 
-    void *callback_, *interleaved_callback_;
+    void RecordBlock(uint32_t start_ticks)
+    {
+        const uint32_t ticks = System::GetTick() - start_ticks;
+        stats_.blocks++;
+        stats_.last_ticks = ticks;
+        if(ticks > stats_.max_ticks)
+            stats_.max_ticks = ticks;
+        if(ticks >= stats_.deadline_ticks)
+        {
+            stats_.missed_deadlines++;
+            stats_.histogram[AudioHandle::kStatsHistogramBuckets]++;
+        }
+        else
+        {
+            stats_.histogram[ticks * AudioHandle::kStatsHistogramBuckets
+                             / stats_.deadline_ticks]++;
+        }
+        if(sai1_.IsRxDmaEventPending())
+            stats_.overlapped_events++;
+    }
+
+    AudioHandle::Stats stats_;
+#endif
+
+    void *callback_, *interleaved_callback_, *raw_callback_;
+
+    // Control-rate tasks, run before the callback
+    ControlScheduler<kAudioMaxControlTasks> scheduler_;
+
+    // System::GetTick() at the start of the current block, and the length
+    // of a block, for mapping timestamps to sample offsets
+    volatile uint32_t block_start_tick_;
+    uint32_t          block_ticks_;
 
     // Data
     AudioHandle::Config config_;
@@ -110,6 +207,8 @@ AudioHandle::Result AudioHandle::Impl::Init(const AudioHandle::Config config,
                                             SaiHandle                 sai)
 {
     config_ = config;
+    if(config_.blocksize > kAudioMaxBlockSize)
+        config_.blocksize = kAudioMaxBlockSize;
 
     /** Precompute input level adjustment */
     if(config_.postgain > 0.f)
@@ -131,6 +230,9 @@ AudioHandle::Result AudioHandle::Impl::Init(const AudioHandle::Config config,
     }
     buff_rx_[0] = dsy_audio_rx_buffer[0];
     buff_tx_[0] = dsy_audio_tx_buffer[0];
+    scheduler_.Init(GetBlockRate());
+    UpdateBlockTicks();
+    block_start_tick_ = 0;
     return Result::OK;
 }
 
@@ -169,6 +271,9 @@ AudioHandle::Result AudioHandle::Impl::DeInit()
 AudioHandle::Result
 AudioHandle::Impl::Start(AudioHandle::AudioCallback callback)
 {
+#if DSY_AUDIO_INSTRUMENTATION
+    ResetStats();
+#endif
     // Get instance of object
     if(sai2_.IsInitialized())
     {
@@ -182,12 +287,16 @@ AudioHandle::Impl::Start(AudioHandle::AudioCallback callback)
                    audio_handle.InternalCallback);
     callback_             = (void*)callback;
     interleaved_callback_ = nullptr;
+    raw_callback_         = nullptr;
     return Result::OK;
 }
 
 AudioHandle::Result
 AudioHandle::Impl::Start(AudioHandle::InterleavingAudioCallback callback)
 {
+#if DSY_AUDIO_INSTRUMENTATION
+    ResetStats();
+#endif
     // Get instance of object
     sai1_.StartDma(buff_rx_[0],
                    buff_tx_[0],
@@ -195,6 +304,29 @@ AudioHandle::Impl::Start(AudioHandle::InterleavingAudioCallback callback)
                    audio_handle.InternalCallback);
     interleaved_callback_ = (void*)callback;
     callback_             = nullptr;
+    raw_callback_         = nullptr;
+    return Result::OK;
+}
+
+AudioHandle::Result
+AudioHandle::Impl::Start(AudioHandle::RawAudioCallback callback)
+{
+#if DSY_AUDIO_INSTRUMENTATION
+    ResetStats();
+#endif
+    if(sai2_.IsInitialized())
+    {
+        // Start stream with no callback. Data will be filled externally.
+        sai2_.StartDma(
+            buff_rx_[1], buff_tx_[1], config_.blocksize * 2 * 2, nullptr);
+    }
+    sai1_.StartDma(buff_rx_[0],
+                   buff_tx_[0],
+                   config_.blocksize * 2 * 2,
+                   audio_handle.InternalCallback);
+    raw_callback_         = (void*)callback;
+    callback_             = nullptr;
+    interleaved_callback_ = nullptr;
     return Result::OK;
 }
 
@@ -214,6 +346,7 @@ AudioHandle::Impl::ChangeCallback(AudioHandle::AudioCallback callback)
     {
         callback_             = (void*)callback;
         interleaved_callback_ = nullptr;
+        raw_callback_         = nullptr;
         return Result::OK;
     }
     else
@@ -229,6 +362,23 @@ AudioHandle::Result AudioHandle::Impl::ChangeCallback(
     {
         interleaved_callback_ = (void*)callback;
         callback_             = nullptr;
+        raw_callback_         = nullptr;
+        return Result::OK;
+    }
+    else
+    {
+        return Result::ERR;
+    }
+}
+
+AudioHandle::Result
+AudioHandle::Impl::ChangeCallback(AudioHandle::RawAudioCallback callback)
+{
+    if(callback != nullptr)
+    {
+        raw_callback_         = (void*)callback;
+        callback_             = nullptr;
+        interleaved_callback_ = nullptr;
         return Result::OK;
     }
     else
@@ -263,16 +413,30 @@ AudioHandle::Impl::SetSampleRate(SaiHandle::Config::SampleRate samplerate)
             return Result::ERR;
         }
     }
+    scheduler_.SetBlockRate(GetBlockRate());
+    UpdateBlockTicks();
     return Result::OK;
 }
 
-// This turned into a very large function due to the bit-depth conversions..
-// I didn't want to do a conditional conversion in a single loop because it seemed
-// far less efficient, so this is where I landed.
-//
-// Using function pointers for the x2f and f2x functions would have been ideal, but
-// wasn't possible due to the different parameter/return types for each function.
+// Called by the SAI for every half of the DMA buffer.
+// Control-rate tasks that are due run first, so the callback sees their results.
+// The start of the block is recorded for GetSampleOffset(), and when
+// instrumentation is enabled, the whole block is timed.
 void AudioHandle::Impl::InternalCallback(int32_t* in, int32_t* out, size_t size)
+{
+    const uint32_t start_ticks     = System::GetTick();
+    audio_handle.block_start_tick_ = start_ticks;
+    audio_handle.scheduler_.Process();
+    ProcessBlock(in, out, size);
+#if DSY_AUDIO_INSTRUMENTATION
+    audio_handle.RecordBlock(start_ticks);
+#endif
+}
+
+// Sample-format conversion is done by the block kernels in hid/audio_convert.h.
+// The bit-depth is dispatched once per block there, and the postgain/output
+// compensation is folded into the conversion scale.
+void AudioHandle::Impl::ProcessBlock(int32_t* in, int32_t* out, size_t size)
 {
     // Convert from sai format to float, and call user callback
     size_t                      chns;
@@ -281,203 +445,81 @@ void AudioHandle::Impl::InternalCallback(int32_t* in, int32_t* out, size_t size)
     chns = audio_handle.GetChannels();
     if(chns == 0)
         return;
+    // Raw callbacks get the DMA buffers directly, no conversion at all
+    if(audio_handle.raw_callback_)
+    {
+        RawAudioCallback cb = (RawAudioCallback)audio_handle.raw_callback_;
+        RawBuffer        buffer;
+        buffer.in[0]     = in;
+        buffer.out[0]    = out;
+        buffer.in[1]     = nullptr;
+        buffer.out[1]    = nullptr;
+        buffer.num_sai   = chns / 2;
+        buffer.stride    = 2;
+        buffer.size      = size / 2;
+        buffer.bit_depth = bd;
+        if(chns > 2)
+        {
+            // offset needed for 2nd audio codec.
+            size_t offset = audio_handle.sai2_.GetOffset();
+            buffer.in[1]  = audio_handle.buff_rx_[1] + offset;
+            buffer.out[1] = audio_handle.buff_tx_[1] + offset;
+        }
+        cb(buffer);
+        return;
+    }
+    const float in_gain  = audio_handle.postgain_recip_;
+    const float out_gain = audio_handle.output_adjust_;
     // Handle Interleaved / Non Interleaved separate
     if(audio_handle.interleaved_callback_)
     {
         InterleavingAudioCallback cb
             = (InterleavingAudioCallback)audio_handle.interleaved_callback_;
-        float fin[size];
-        float fout[size];
-        // There _must_ be a more elegant way to do this....
-        // Convert from int to float
-        switch(bd)
-        {
-            case SaiHandle::Config::BitDepth::SAI_16BIT:
-                for(size_t i = 0; i < size; i += 2)
-                {
-                    fin[i] = s162f(in[i]) * audio_handle.postgain_recip_;
-                    fin[i + 1]
-                        = s162f(in[i + 1]) * audio_handle.postgain_recip_;
-                }
-                break;
-            case SaiHandle::Config::BitDepth::SAI_24BIT:
-                for(size_t i = 0; i < size; i += 2)
-                {
-                    fin[i] = s242f(in[i]) * audio_handle.postgain_recip_;
-                    fin[i + 1]
-                        = s242f(in[i + 1]) * audio_handle.postgain_recip_;
-                }
-                break;
-            case SaiHandle::Config::BitDepth::SAI_32BIT:
-                for(size_t i = 0; i < size; i += 2)
-                {
-                    fin[i] = s322f(in[i]) * audio_handle.postgain_recip_;
-                    fin[i + 1]
-                        = s322f(in[i + 1]) * audio_handle.postgain_recip_;
-                }
-                break;
-            default: break;
-        }
+        float* fin  = dsy_audio_scratch.InterleavedIn();
+        float* fout = dsy_audio_scratch.InterleavedOut();
+        SaiToFloat(in, fin, size, bd, in_gain);
         cb(fin, fout, size);
-        switch(bd)
-        {
-            case SaiHandle::Config::BitDepth::SAI_16BIT:
-                for(size_t i = 0; i < size; i += 2)
-                {
-                    out[i] = f2s16(fout[i] * audio_handle.output_adjust_);
-                    out[i + 1]
-                        = f2s16(fout[i + 1] * audio_handle.output_adjust_);
-                }
-                break;
-            case SaiHandle::Config::BitDepth::SAI_24BIT:
-                for(size_t i = 0; i < size; i += 2)
-                {
-                    out[i] = f2s24(fout[i] * audio_handle.output_adjust_);
-                    out[i + 1]
-                        = f2s24(fout[i + 1] * audio_handle.output_adjust_);
-                }
-                break;
-            case SaiHandle::Config::BitDepth::SAI_32BIT:
-                for(size_t i = 0; i < size; i += 2)
-                {
-                    out[i] = f2s32(fout[i] * audio_handle.output_adjust_);
-                    out[i + 1]
-                        = f2s32(fout[i + 1] * audio_handle.output_adjust_);
-                }
-                break;
-            default: break;
-        }
+        FloatToSai(fout, out, size, bd, out_gain);
     }
     else if(audio_handle.callback_)
     {
         AudioCallback cb = (AudioCallback)audio_handle.callback_;
         // offset needed for 2nd audio codec.
-        size_t offset    = audio_handle.sai2_.GetOffset();
-        size_t buff_size = chns > 2 ? size * 2 : size;
-        float  finbuff[buff_size], foutbuff[buff_size];
-        float* fin[chns];
-        float* fout[chns];
-        fin[0]  = finbuff;
-        fin[1]  = finbuff + (buff_size / chns);
-        fout[0] = foutbuff;
-        fout[1] = foutbuff + (buff_size / chns);
-        if(chns > 2)
+        // sai2_ has no implementation unless it was initialized.
+        size_t offset = chns > 2 ? audio_handle.sai2_.GetOffset() : 0;
+        size_t frames = size / 2;
+        if(!dsy_audio_scratch.Prepare(chns, frames))
         {
-            fin[2]  = fin[1] + (buff_size / chns);
-            fin[3]  = fin[2] + (buff_size / chns);
-            fout[2] = fout[1] + (buff_size / chns);
-            fout[3] = fout[2] + (buff_size / chns);
+            // never happens with the block size clamped, but silence is
+            // better than repeating the last block
+            memset(out, 0, size * sizeof(int32_t));
+            if(chns > 2)
+                memset(audio_handle.buff_tx_[1] + offset,
+                       0,
+                       size * sizeof(int32_t));
+            return;
         }
+        float** fin  = dsy_audio_scratch.In();
+        float** fout = dsy_audio_scratch.Out();
         // Deinterleave and scale
-        switch(bd)
-        {
-            case SaiHandle::Config::BitDepth::SAI_16BIT:
-                for(size_t i = 0; i < size; i += 2)
-                {
-                    fin[0][i / 2] = s162f(in[i]) * audio_handle.postgain_recip_;
-                    fin[1][i / 2]
-                        = s162f(in[i + 1]) * audio_handle.postgain_recip_;
-                    if(chns > 2)
-                    {
-                        fin[2][i / 2]
-                            = s162f(audio_handle.buff_rx_[1][offset + i])
-                              * audio_handle.postgain_recip_;
-                        fin[3][i / 2]
-                            = s162f(audio_handle.buff_rx_[1][offset + i + 1])
-                              * audio_handle.postgain_recip_;
-                    }
-                }
-                break;
-            case SaiHandle::Config::BitDepth::SAI_24BIT:
-                for(size_t i = 0; i < size; i += 2)
-                {
-                    fin[0][i / 2] = s242f(in[i]) * audio_handle.postgain_recip_;
-                    fin[1][i / 2]
-                        = s242f(in[i + 1]) * audio_handle.postgain_recip_;
-                    if(chns > 2)
-                    {
-                        fin[2][i / 2]
-                            = s242f(audio_handle.buff_rx_[1][offset + i])
-                              * audio_handle.postgain_recip_;
-                        fin[3][i / 2]
-                            = s242f(audio_handle.buff_rx_[1][offset + i + 1])
-                              * audio_handle.postgain_recip_;
-                    }
-                }
-                break;
-            case SaiHandle::Config::BitDepth::SAI_32BIT:
-                for(size_t i = 0; i < size; i += 2)
-                {
-                    fin[0][i / 2] = s322f(in[i]) * audio_handle.postgain_recip_;
-                    fin[1][i / 2]
-                        = s322f(in[i + 1]) * audio_handle.postgain_recip_;
-                    if(chns > 2)
-                    {
-                        fin[2][i / 2]
-                            = s322f(audio_handle.buff_rx_[1][offset + i])
-                              * audio_handle.postgain_recip_;
-                        fin[3][i / 2]
-                            = s322f(audio_handle.buff_rx_[1][offset + i + 1])
-                              * audio_handle.postgain_recip_;
-                    }
-                }
-                break;
-            default: break;
-        }
-        cb(fin, fout, size / 2);
+        SaiToFloatDeinterleave(in, fin[0], fin[1], frames, bd, in_gain);
+        if(chns > 2)
+            SaiToFloatDeinterleave(audio_handle.buff_rx_[1] + offset,
+                                   fin[2],
+                                   fin[3],
+                                   frames,
+                                   bd,
+                                   in_gain);
+        cb(fin, fout, frames);
         // Reinterleave and scale
-        switch(bd)
-        {
-            case SaiHandle::Config::BitDepth::SAI_16BIT:
-                for(size_t i = 0; i < size; i += 2)
-                {
-                    out[i]
-                        = f2s16(fout[0][i / 2] * audio_handle.output_adjust_);
-                    out[i + 1]
-                        = f2s16(fout[1][i / 2] * audio_handle.output_adjust_);
-                    if(chns > 2)
-                    {
-                        audio_handle.buff_tx_[1][offset + i] = f2s16(
-                            fout[2][i / 2] * audio_handle.output_adjust_);
-                        audio_handle.buff_tx_[1][offset + i + 1] = f2s16(
-                            fout[3][i / 2] * audio_handle.output_adjust_);
-                    }
-                }
-                break;
-            case SaiHandle::Config::BitDepth::SAI_24BIT:
-                for(size_t i = 0; i < size; i += 2)
-                {
-                    out[i]
-                        = f2s24(fout[0][i / 2] * audio_handle.output_adjust_);
-                    out[i + 1]
-                        = f2s24(fout[1][i / 2] * audio_handle.output_adjust_);
-                    if(chns > 2)
-                    {
-                        audio_handle.buff_tx_[1][offset + i] = f2s24(
-                            fout[2][i / 2] * audio_handle.output_adjust_);
-                        audio_handle.buff_tx_[1][offset + i + 1] = f2s24(
-                            fout[3][i / 2] * audio_handle.output_adjust_);
-                    }
-                }
-                break;
-            case SaiHandle::Config::BitDepth::SAI_32BIT:
-                for(size_t i = 0; i < size; i += 2)
-                {
-                    out[i]
-                        = f2s32(fout[0][i / 2] * audio_handle.output_adjust_);
-                    out[i + 1]
-                        = f2s32(fout[1][i / 2] * audio_handle.output_adjust_);
-                    if(chns > 2)
-                    {
-                        audio_handle.buff_tx_[1][offset + i] = f2s32(
-                            fout[2][i / 2] * audio_handle.output_adjust_);
-                        audio_handle.buff_tx_[1][offset + i + 1] = f2s32(
-                            fout[3][i / 2] * audio_handle.output_adjust_);
-                    }
-                }
-                break;
-            default: break;
-        }
+        FloatToSaiInterleave(fout[0], fout[1], out, frames, bd, out_gain);
+        if(chns > 2)
+            FloatToSaiInterleave(fout[2],
+                                 fout[3],
+                                 audio_handle.buff_tx_[1] + offset,
+                                 frames,
+                                 bd,
+                                 out_gain);
     }
 }
 
@@ -541,11 +583,77 @@ AudioHandle::Result AudioHandle::Start(InterleavingAudioCallback callback)
     return pimpl_->Start(callback);
 }
 
+AudioHandle::Result AudioHandle::Start(RawAudioCallback callback)
+{
+    return pimpl_->Start(callback);
+}
+
 AudioHandle::Result AudioHandle::Stop()
 {
     return pimpl_->Stop();
 }
 
+#if DSY_AUDIO_INSTRUMENTATION
+AudioHandle::Stats AudioHandle::GetStats() const
+{
+    ScopedIrqBlocker irq_blocker;
+    return pimpl_->stats_;
+}
+
+void AudioHandle::ResetStats()
+{
+    pimpl_->ResetStats();
+}
+#endif
+
+AudioHandle::Result AudioHandle::AddControlTask(ControlTask task,
+                                                void*       context,
+                                                size_t      period,
+                                                size_t*     id)
+{
+    return pimpl_->scheduler_.Add(task, context, period, id) ? Result::OK
+                                                              : Result::ERR;
+}
+
+AudioHandle::Result AudioHandle::AddControlTaskHz(ControlTask task,
+                                                  void*       context,
+                                                  float       rate_hz,
+                                                  size_t*     id)
+{
+    return pimpl_->scheduler_.AddHz(task, context, rate_hz, id) ? Result::OK
+                                                                 : Result::ERR;
+}
+
+AudioHandle::Result AudioHandle::RemoveControlTask(size_t id)
+{
+    return pimpl_->scheduler_.Remove(id) ? Result::OK : Result::ERR;
+}
+
+float AudioHandle::GetControlTaskRate(size_t id) const
+{
+    return pimpl_->scheduler_.GetRate(id);
+}
+
+AudioHandle::ControlTaskStats AudioHandle::GetControlTaskStats(size_t id) const
+{
+    return pimpl_->scheduler_.GetStats(id);
+}
+
+void AudioHandle::ResetControlTaskStats()
+{
+    pimpl_->scheduler_.ResetStats();
+}
+
+uint32_t AudioHandle::GetBlockStartTick() const
+{
+    return pimpl_->block_start_tick_;
+}
+
+size_t AudioHandle::GetSampleOffset(uint32_t timestamp) const
+{
+    return pimpl_->GetSampleOffset(timestamp);
+}
+
 AudioHandle::Result AudioHandle::ChangeCallback(AudioCallback callback)
 {
     return pimpl_->ChangeCallback(callback);
@@ -557,6 +665,11 @@ AudioHandle::ChangeCallback(InterleavingAudioCallback callback)
     return pimpl_->ChangeCallback(callback);
 }
 
+AudioHandle::Result AudioHandle::ChangeCallback(RawAudioCallback callback)
+{
+    return pimpl_->ChangeCallback(callback);
+}
+
 AudioHandle::Result AudioHandle::SetPostGain(float val)
 {
     return pimpl_->SetPostGain(val);
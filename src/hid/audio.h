@@ -2,6 +2,40 @@
 #define DSY_AUDIO_H /**< & */
 
 #include "per/sai.h"
+#include "hid/control_scheduler.h"
+
+/** Largest number of channels the audio callback can be configured for.
+ ** The float scratch memory used by the callback is sized from this, so it
+ ** can be raised for custom multichannel hardware. It can't be lower than 4,
+ ** the channels of two SAIs.
+ ** Define it when building libDaisy (e.g. -DDSY_AUDIO_MAX_CHANNELS=8) to override.
+ */
+#ifndef DSY_AUDIO_MAX_CHANNELS
+#define DSY_AUDIO_MAX_CHANNELS 4
+#endif
+
+/** Largest number of samples per channel in a single audio block.
+ ** Sizes both the SAI DMA buffers and the float scratch memory.
+ ** Define it when building libDaisy to override.
+ */
+#ifndef DSY_AUDIO_MAX_BLOCKSIZE
+#define DSY_AUDIO_MAX_BLOCKSIZE 256
+#endif
+
+/** Set to 1 when building libDaisy to measure every audio callback.
+ ** Enables AudioHandle::GetStats() and AudioHandle::ResetStats().
+ ** When 0, none of the measurement code or data is compiled in.
+ */
+#ifndef DSY_AUDIO_INSTRUMENTATION
+#define DSY_AUDIO_INSTRUMENTATION 0
+#endif
+
+/** Number of control-rate tasks that can be added to the AudioHandle.
+ ** Define it when building libDaisy to override.
+ */
+#ifndef DSY_AUDIO_MAX_CONTROL_TASKS
+#define DSY_AUDIO_MAX_CONTROL_TASKS 8
+#endif
 
 namespace daisy
 {
@@ -16,7 +50,7 @@ namespace daisy
  *             1. Create and Initialize an SaiHandle or two depending on your requirements
  *             2. Initialize the Audio Handle with the desired settings and the Initialized SaiHandle
  *             3. If the connected codec requires special configuration or initialization, do so
- *             4. Write a callback method using either the AudioCallback or the InterleavingAudioCallback format
+ *             4. Write a callback method using the AudioCallback, InterleavingAudioCallback, or RawAudioCallback format
  *             5. Start the Audio using one of the StartAudio function
  */
 class AudioHandle
@@ -92,6 +126,53 @@ class AudioHandle
                                               InterleavingOutputBuffer out,
                                               size_t                   size);
 
+    /** Raw audio block, exactly as transferred by the SAI DMA.
+     ** No format conversion or gain is applied, the words are in the
+     ** SAI bit-depth (e.g. right-justified 24-bit for the AK4556).
+     **
+     ** Each SAI carries one interleaved stereo pair, so sample `i` of channel `chn`
+     ** is located at `in[chn / stride][i * stride + (chn % stride)]`.
+     ** The InChannel/OutChannel helpers return the first word of a channel.
+     */
+    struct RawBuffer
+    {
+        /** DMA rx half-buffer per SAI, nullptr if the SAI is not in use */
+        const int32_t* in[2];
+
+        /** DMA tx half-buffer per SAI, nullptr if the SAI is not in use */
+        int32_t* out[2];
+
+        /** number of SAI peripherals in use (1 or 2) */
+        size_t num_sai;
+
+        /** number of words between consecutive samples of a single channel */
+        size_t stride;
+
+        /** number of samples per channel in this block */
+        size_t size;
+
+        /** bit depth of the SAI words */
+        SaiHandle::Config::BitDepth bit_depth;
+
+        /** \return pointer to the first input word of a channel, step by stride */
+        const int32_t* InChannel(size_t chn) const
+        {
+            return in[chn / stride] + (chn % stride);
+        }
+
+        /** \return pointer to the first output word of a channel, step by stride */
+        int32_t* OutChannel(size_t chn) const
+        {
+            return out[chn / stride] + (chn % stride);
+        }
+    };
+
+    /** Type for a Raw audio callback 
+     * The SAI DMA buffers are handed to the callback without being copied
+     * or converted to float. Useful for fixed-point processing and pass-through.
+     */
+    typedef void (*RawAudioCallback)(const RawBuffer& buffer);
+
     AudioHandle() : pimpl_(nullptr) {}
     ~AudioHandle() {}
 
@@ -127,6 +208,7 @@ class AudioHandle
 
     /** Sets the block size after initialization, and updates the internal configuration struct.
      ** Get BlockSize and other details via the GetConfig 
+     ** Sizes above DSY_AUDIO_MAX_BLOCKSIZE are clamped, and return Result::ERR.
      */
     Result SetBlockSize(size_t size);
 
@@ -152,6 +234,121 @@ class AudioHandle
      */
     Result Start(InterleavingAudioCallback callback);
 
+    /** Starts the Audio using the raw callback.
+     ** Works with both single and dual SAI configurations.
+     */
+    Result Start(RawAudioCallback callback);
+
+#if DSY_AUDIO_INSTRUMENTATION
+    /** Number of histogram buckets that divide up one block period */
+    static constexpr size_t kStatsHistogramBuckets = 8;
+
+    /** Timing measurements of the audio callback.
+     ** All durations are in System::GetTick() ticks, and include the
+     ** sample format conversion around the user callback.
+     */
+    struct Stats
+    {
+        /** number of callbacks measured since the last reset */
+        uint32_t blocks;
+
+        /** duration of the most recent callback */
+        uint32_t last_ticks;
+
+        /** longest callback since the last reset */
+        uint32_t max_ticks;
+
+        /** duration of one block period, the deadline for each callback */
+        uint32_t deadline_ticks;
+
+        /** number of callbacks that took longer than deadline_ticks */
+        uint32_t missed_deadlines;
+
+        /** number of DMA half/complete events that arrived before the
+         ** previous callback had returned */
+        uint32_t overlapped_events;
+
+        /** Callback durations. Bucket `i` counts durations in 
+         ** [i, i + 1) * deadline_ticks / kStatsHistogramBuckets, the final
+         ** bucket counts missed deadlines. */
+        uint32_t histogram[kStatsHistogramBuckets + 1];
+    };
+
+    /** Returns a consistent copy of the callback measurements. 
+     ** Safe to call from the main loop while audio is running.
+     */
+    Stats GetStats() const;
+
+    /** Clears all callback measurements. 
+     ** Starting the audio resets the measurements as well.
+     */
+    void ResetStats();
+#endif
+
+    /** Type for a control-rate task, called with the context it was added with */
+    typedef ControlScheduler<DSY_AUDIO_MAX_CONTROL_TASKS>::Task ControlTask;
+
+    /** Cost of a control-rate task, in System::GetTick() ticks */
+    typedef ControlScheduler<DSY_AUDIO_MAX_CONTROL_TASKS>::TaskStats
+        ControlTaskStats;
+
+    /** Adds a task that runs right before the audio callback every `period` blocks.
+     ** This is meant for control processing (ADCs, switches, etc.) that doesn't
+     ** need to run every block. Tasks with the same period are spread across
+     ** different blocks where possible.
+     ** Init() removes all tasks.
+     **
+     ** \param task function to call from the audio interrupt
+     ** \param context passed to the task, e.g. the object to process
+     ** \param period number of blocks between runs, at least 1
+     ** \param id optional, receives the id of the task for the other functions
+     ** \return Result::ERR if the period is 0 or DSY_AUDIO_MAX_CONTROL_TASKS are in use
+     */
+    Result AddControlTask(ControlTask task,
+                          void*       context,
+                          size_t      period,
+                          size_t*     id = nullptr);
+
+    /** Adds a task that runs right before the audio callback at approximately `rate_hz`.
+     ** The period is rounded to a whole number of blocks (at least one), and is
+     ** recomputed when the block size or samplerate changes.
+     ** Use GetControlTaskRate() for the actual rate.
+     */
+    Result AddControlTaskHz(ControlTask task,
+                            void*       context,
+                            float       rate_hz,
+                            size_t*     id = nullptr);
+
+    /** Removes a control-rate task */
+    Result RemoveControlTask(size_t id);
+
+    /** Returns the actual rate in Hz that a control-rate task runs at, 
+     ** or 0 if the id is not in use. */
+    float GetControlTaskRate(size_t id) const;
+
+    /** Returns the number of runs, and the last and longest duration of a 
+     ** control-rate task. Safe to call from the main loop while audio is running. */
+    ControlTaskStats GetControlTaskStats(size_t id) const;
+
+    /** Clears the cost measurements of all control-rate tasks */
+    void ResetControlTaskStats();
+
+    /** Returns System::GetTick() at the start of the current (or most recent)
+     ** audio callback.
+     */
+    uint32_t GetBlockStartTick() const;
+
+    /** Maps a System::GetTick() timestamp, e.g. of a MidiEvent, to a sample
+     ** offset within the current block, for sample-accurate event timing.
+     **
+     ** Events that arrived during the previous block period are spread across
+     ** the current block in the order and spacing they arrived in, so every
+     ** event is delayed by exactly one block instead of jittering by up to
+     ** one block. Older timestamps map to 0, newer ones to blocksize - 1.
+     ** Call from within the audio callback.
+     */
+    size_t GetSampleOffset(uint32_t timestamp) const;
+
     /** Stop the Audio*/
     Result Stop();
 
@@ -161,6 +358,9 @@ class AudioHandle
     /** Immediatley changes the audio callback to the interleaving callback passed in. */
     Result ChangeCallback(InterleavingAudioCallback callback);
 
+    /** Immediatley changes the audio callback to the raw callback passed in. */
+    Result ChangeCallback(RawAudioCallback callback);
+
 
     class Impl;
 
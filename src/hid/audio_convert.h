@@ -0,0 +1,249 @@
+#pragma once
+#ifndef DSY_AUDIO_CONVERT_H
+#define DSY_AUDIO_CONVERT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "daisy_core.h"
+#include "per/sai.h"
+
+namespace daisy
+{
+/** @brief Block conversion kernels between SAI words and float audio
+ *  @ingroup audio
+ *  @details These run once per block instead of once per sample:
+ *           the bit-depth is dispatched a single time, the gain is folded
+ *           into the fixed-point scale so each sample costs one multiply,
+ *           and all pointers are declared non-aliasing so the compiler can
+ *           keep the scale in a register and vectorize where possible.
+ *
+ *           SAI words hold one sample each, interleaved as { L0, R0, L1, R1, ... }.
+ *           The output clamp matches f2s16/f2s24/f2s32 from daisy_core.h.
+ *           On Cortex-M7 (FPv5) the clamp compiles to VMAXNM/VMINNM, so the
+ *           inner loops are branch-free.
+ */
+
+/** Per-format helpers used by the conversion kernels.
+ *  Unpack returns the sample left-justified (or sign-extended for 16-bit)
+ *  so that the float scale below produces the same value as s162f/s242f/s322f.
+ */
+struct SaiSample16
+{
+    static FORCE_INLINE int32_t Unpack(int32_t x) { return (int16_t)x; }
+    static FORCE_INLINE float   InScale() { return S162F_SCALE; }
+    static FORCE_INLINE float   OutScale() { return F2S16_SCALE; }
+};
+
+struct SaiSample24
+{
+    /** Shifting the 24-bit word to the top of the int32 sign-extends it
+     *  without the xor/sub of s242f, and is exact in float. */
+    static FORCE_INLINE int32_t Unpack(int32_t x)
+    {
+        return (int32_t)((uint32_t)x << 8);
+    }
+    static FORCE_INLINE float InScale() { return S322F_SCALE; }
+    static FORCE_INLINE float OutScale() { return F2S24_SCALE; }
+};
+
+struct SaiSample32
+{
+    static FORCE_INLINE int32_t Unpack(int32_t x) { return x; }
+    static FORCE_INLINE float   InScale() { return S322F_SCALE; }
+    static FORCE_INLINE float   OutScale() { return F2S32_SCALE; }
+};
+
+/** Clamps a pre-scaled float to +/- lim and truncates to int32 */
+FORCE_INLINE int32_t SaiPackScaled(float x, float lim)
+{
+    x = x <= -lim ? -lim : x;
+    x = x >= lim ? lim : x;
+    return (int32_t)x;
+}
+
+template <typename Format>
+inline void SaiToFloatBlock(const int32_t* __restrict in,
+                            float* __restrict out,
+                            size_t size,
+                            float  gain)
+{
+    const float scale = Format::InScale() * gain;
+    for(size_t i = 0; i < size; i += 2)
+    {
+        out[i]     = (float)Format::Unpack(in[i]) * scale;
+        out[i + 1] = (float)Format::Unpack(in[i + 1]) * scale;
+    }
+}
+
+template <typename Format>
+inline void FloatToSaiBlock(const float* __restrict in,
+                            int32_t* __restrict out,
+                            size_t size,
+                            float  gain)
+{
+    const float scale = Format::OutScale() * gain;
+    const float lim   = Format::OutScale() * FBIPMAX;
+    for(size_t i = 0; i < size; i += 2)
+    {
+        out[i]     = SaiPackScaled(in[i] * scale, lim);
+        out[i + 1] = SaiPackScaled(in[i + 1] * scale, lim);
+    }
+}
+
+template <typename Format>
+inline void SaiToFloatDeinterleaveBlock(const int32_t* __restrict in,
+                                        float* __restrict left,
+                                        float* __restrict right,
+                                        size_t frames,
+                                        float  gain)
+{
+    const float scale = Format::InScale() * gain;
+    for(size_t i = 0; i < frames; i++)
+    {
+        left[i]  = (float)Format::Unpack(in[2 * i]) * scale;
+        right[i] = (float)Format::Unpack(in[2 * i + 1]) * scale;
+    }
+}
+
+template <typename Format>
+inline void FloatToSaiInterleaveBlock(const float* __restrict left,
+                                      const float* __restrict right,
+                                      int32_t* __restrict out,
+                                      size_t frames,
+                                      float  gain)
+{
+    const float scale = Format::OutScale() * gain;
+    const float lim   = Format::OutScale() * FBIPMAX;
+    for(size_t i = 0; i < frames; i++)
+    {
+        out[2 * i]     = SaiPackScaled(left[i] * scale, lim);
+        out[2 * i + 1] = SaiPackScaled(right[i] * scale, lim);
+    }
+}
+
+/** Converts an interleaved block of SAI words to interleaved float.
+ *  \param in   SAI words
+ *  \param out  float destination, must not overlap in
+ *  \param size total number of samples (frames * 2)
+ *  \param bd   bit depth of the SAI words
+ *  \param gain factor applied to every sample (e.g. 1 / postgain)
+ */
+inline void SaiToFloat(const int32_t*              in,
+                       float*                      out,
+                       size_t                      size,
+                       SaiHandle::Config::BitDepth bd,
+                       float                       gain)
+{
+    switch(bd)
+    {
+        case SaiHandle::Config::BitDepth::SAI_16BIT:
+            SaiToFloatBlock<SaiSample16>(in, out, size, gain);
+            break;
+        case SaiHandle::Config::BitDepth::SAI_24BIT:
+            SaiToFloatBlock<SaiSample24>(in, out, size, gain);
+            break;
+        case SaiHandle::Config::BitDepth::SAI_32BIT:
+            SaiToFloatBlock<SaiSample32>(in, out, size, gain);
+            break;
+        default: break;
+    }
+}
+
+/** Converts an interleaved float block to interleaved SAI words, clamping
+ *  to full scale.
+ *  \param in   float source
+ *  \param out  SAI words, must not overlap in
+ *  \param size total number of samples (frames * 2)
+ *  \param bd   bit depth of the SAI words
+ *  \param gain factor applied to every sample before clamping
+ */
+inline void FloatToSai(const float*                in,
+                       int32_t*                    out,
+                       size_t                      size,
+                       SaiHandle::Config::BitDepth bd,
+                       float                       gain)
+{
+    switch(bd)
+    {
+        case SaiHandle::Config::BitDepth::SAI_16BIT:
+            FloatToSaiBlock<SaiSample16>(in, out, size, gain);
+            break;
+        case SaiHandle::Config::BitDepth::SAI_24BIT:
+            FloatToSaiBlock<SaiSample24>(in, out, size, gain);
+            break;
+        case SaiHandle::Config::BitDepth::SAI_32BIT:
+            FloatToSaiBlock<SaiSample32>(in, out, size, gain);
+            break;
+        default: break;
+    }
+}
+
+/** Splits a stereo block of SAI words into two float channels.
+ *  \param in     interleaved SAI words, frames * 2 long
+ *  \param left   destination for even words
+ *  \param right  destination for odd words
+ *  \param frames number of frames
+ *  \param bd     bit depth of the SAI words
+ *  \param gain   factor applied to every sample
+ */
+inline void SaiToFloatDeinterleave(const int32_t*              in,
+                                   float*                      left,
+                                   float*                      right,
+                                   size_t                      frames,
+                                   SaiHandle::Config::BitDepth bd,
+                                   float                       gain)
+{
+    switch(bd)
+    {
+        case SaiHandle::Config::BitDepth::SAI_16BIT:
+            SaiToFloatDeinterleaveBlock<SaiSample16>(
+                in, left, right, frames, gain);
+            break;
+        case SaiHandle::Config::BitDepth::SAI_24BIT:
+            SaiToFloatDeinterleaveBlock<SaiSample24>(
+                in, left, right, frames, gain);
+            break;
+        case SaiHandle::Config::BitDepth::SAI_32BIT:
+            SaiToFloatDeinterleaveBlock<SaiSample32>(
+                in, left, right, frames, gain);
+            break;
+        default: break;
+    }
+}
+
+/** Joins two float channels into a stereo block of SAI words.
+ *  \param left   source for even words
+ *  \param right  source for odd words
+ *  \param out    interleaved SAI words, frames * 2 long
+ *  \param frames number of frames
+ *  \param bd     bit depth of the SAI words
+ *  \param gain   factor applied to every sample before clamping
+ */
+inline void FloatToSaiInterleave(const float*                left,
+                                 const float*                right,
+                                 int32_t*                    out,
+                                 size_t                      frames,
+                                 SaiHandle::Config::BitDepth bd,
+                                 float                       gain)
+{
+    switch(bd)
+    {
+        case SaiHandle::Config::BitDepth::SAI_16BIT:
+            FloatToSaiInterleaveBlock<SaiSample16>(
+                left, right, out, frames, gain);
+            break;
+        case SaiHandle::Config::BitDepth::SAI_24BIT:
+            FloatToSaiInterleaveBlock<SaiSample24>(
+                left, right, out, frames, gain);
+            break;
+        case SaiHandle::Config::BitDepth::SAI_32BIT:
+            FloatToSaiInterleaveBlock<SaiSample32>(
+                left, right, out, frames, gain);
+            break;
+        default: break;
+    }
+}
+
+} // namespace daisy
+
+#endif
@@ -0,0 +1,71 @@
+#pragma once
+#ifndef DSY_AUDIO_SCRATCH_H
+#define DSY_AUDIO_SCRATCH_H
+
+#include <stddef.h>
+
+namespace daisy
+{
+/** @brief Statically sized float scratch memory for the audio callback
+ *  @ingroup audio
+ *  @details Holds the float input/output buffers that AudioHandle hands to
+ *           the user callback, so none of them live on the interrupt stack.
+ *           The pool is sized for max_channels * max_blocksize samples in each
+ *           direction, and contains no constructor so that it can be placed in
+ *           an uninitialized section like DTCM_MEM_SECTION.
+ *
+ *  @tparam max_channels  largest number of channels per block
+ *  @tparam max_blocksize largest number of samples per channel per block
+ */
+template <size_t max_channels, size_t max_blocksize>
+class AudioScratchBuffer
+{
+  public:
+    static_assert(max_channels >= 2,
+                  "Interleaved callbacks need room for at least 2 channels");
+
+    /** Lays out planar channel pointers for a block of the given size.
+     *  \param channels number of channels in the block
+     *  \param blocksize number of samples per channel
+     *  \return false if the block doesn't fit into the pool
+     */
+    bool Prepare(size_t channels, size_t blocksize)
+    {
+        if(channels > max_channels || blocksize > max_blocksize)
+            return false;
+        for(size_t i = 0; i < channels; i++)
+        {
+            in_ptrs_[i]  = in_ + (i * blocksize);
+            out_ptrs_[i] = out_ + (i * blocksize);
+        }
+        return true;
+    }
+
+    /** \return planar input pointers, valid after Prepare() */
+    float** In() { return in_ptrs_; }
+
+    /** \return planar output pointers, valid after Prepare() */
+    float** Out() { return out_ptrs_; }
+
+    /** \return contiguous input buffer of max_channels * max_blocksize samples */
+    float* InterleavedIn() { return in_; }
+
+    /** \return contiguous output buffer of max_channels * max_blocksize samples */
+    float* InterleavedOut() { return out_; }
+
+    /** \return the channel capacity of the pool */
+    static constexpr size_t GetMaxChannels() { return max_channels; }
+
+    /** \return the block size capacity of the pool */
+    static constexpr size_t GetMaxBlockSize() { return max_blocksize; }
+
+  private:
+    float  in_[max_channels * max_blocksize];
+    float  out_[max_channels * max_blocksize];
+    float* in_ptrs_[max_channels];
+    float* out_ptrs_[max_channels];
+};
+
+} // namespace daisy
+
+#endif
@@ -0,0 +1,270 @@
+#pragma once
+#ifndef DSY_CONTROL_SCHEDULER_H
+#define DSY_CONTROL_SCHEDULER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "sys/system.h"
+#include "util/scopedirqblocker.h"
+
+namespace daisy
+{
+/** @brief Runs control-rate tasks on the audio block clock
+ *  @ingroup audio
+ *  @details Each task runs once every `period` audio blocks. When a task is
+ *           added, its first run is placed in the block that currently has
+ *           the fewest other tasks due, so that tasks with the same period
+ *           don't all pile up in the same block.
+ *           Tasks can also be added with a rate in Hz. Their period is
+ *           derived from the block rate, and recomputed when it changes.
+ *
+ *           Process() is meant to be called from the audio interrupt once per
+ *           block. All other functions are meant for the main loop, and
+ *           briefly block interrupts while changing the task list.
+ *
+ *  @tparam max_tasks number of tasks that can be registered at once
+ */
+template <size_t max_tasks>
+class ControlScheduler
+{
+  public:
+    /** A task, called with the context pointer it was added with */
+    typedef void (*Task)(void* context);
+
+    /** Cost of a task, in System::GetTick() ticks */
+    struct TaskStats
+    {
+        /** number of times the task has run */
+        uint32_t runs;
+
+        /** duration of the most recent run */
+        uint32_t last_ticks;
+
+        /** longest run */
+        uint32_t max_ticks;
+    };
+
+    /** Removes all tasks and sets the block rate.
+     *  \param block_rate audio blocks per second
+     */
+    void Init(float block_rate)
+    {
+        ScopedIrqBlocker irq_blocker;
+        block_rate_ = block_rate;
+        for(size_t i = 0; i < max_tasks; i++)
+            slots_[i] = Slot();
+    }
+
+    /** Adds a task that runs every `period` blocks.
+     *  \param task function to call
+     *  \param context passed to the task
+     *  \param period number of blocks between runs, at least 1
+     *  \param id optional, receives the id used by the other functions
+     *  \return false if the period is 0 or no slot is free
+     */
+    bool Add(Task task, void* context, size_t period, size_t* id = nullptr)
+    {
+        return AddSlot(task, context, period, 0.f, id);
+    }
+
+    /** Adds a task that runs at (approximately) a target rate.
+     *  The period is the block rate divided by rate_hz, rounded to the
+     *  nearest block, and runs at least every block.
+     *  \return false if rate_hz isn't positive or no slot is free
+     */
+    bool AddHz(Task task, void* context, float rate_hz, size_t* id = nullptr)
+    {
+        if(!(rate_hz > 0.f))
+            return false;
+        return AddSlot(task, context, PeriodFor(rate_hz), rate_hz, id);
+    }
+
+    /** Removes a task. Returns false if the id isn't in use. */
+    bool Remove(size_t id)
+    {
+        if(id >= max_tasks || !slots_[id].task)
+            return false;
+        ScopedIrqBlocker irq_blocker;
+        slots_[id] = Slot();
+        return true;
+    }
+
+    /** Changes the block rate, e.g. after the block size or sample rate
+     *  changed. Tasks that were added with a rate in Hz are rescheduled.
+     */
+    void SetBlockRate(float block_rate)
+    {
+        ScopedIrqBlocker irq_blocker;
+        block_rate_ = block_rate;
+        for(size_t i = 0; i < max_tasks; i++)
+        {
+            Slot& slot = slots_[i];
+            if(!slot.task || slot.rate_hz <= 0.f)
+                continue;
+            slot.period = PeriodFor(slot.rate_hz);
+            if(slot.countdown > slot.period)
+                slot.countdown = slot.period;
+        }
+    }
+
+    /** Runs all tasks that are due in this block, and measures their cost.
+     *  Call once per audio block.
+     */
+    void Process()
+    {
+        for(size_t i = 0; i < max_tasks; i++)
+        {
+            Slot& slot = slots_[i];
+            if(!slot.task || --slot.countdown > 0)
+                continue;
+            slot.countdown       = slot.period;
+            const uint32_t start = System::GetTick();
+            slot.task(slot.context);
+            const uint32_t ticks = System::GetTick() - start;
+            slot.stats.runs++;
+            slot.stats.last_ticks = ticks;
+            if(ticks > slot.stats.max_ticks)
+                slot.stats.max_ticks = ticks;
+        }
+    }
+
+    /** \return the number of blocks between runs of a task, 0 if unused */
+    size_t GetPeriod(size_t id) const
+    {
+        return id < max_tasks && slots_[id].task ? slots_[id].period : 0;
+    }
+
+    /** \return the actual rate in Hz that a task runs at, 0 if unused */
+    float GetRate(size_t id) const
+    {
+        const size_t period = GetPeriod(id);
+        return period > 0 ? block_rate_ / period : 0.f;
+    }
+
+    /** \return a consistent copy of the cost measurements of a task */
+    TaskStats GetStats(size_t id) const
+    {
+        if(id >= max_tasks)
+            return TaskStats();
+        ScopedIrqBlocker irq_blocker;
+        return slots_[id].stats;
+    }
+
+    /** Clears the cost measurements of all tasks */
+    void ResetStats()
+    {
+        ScopedIrqBlocker irq_blocker;
+        for(size_t i = 0; i < max_tasks; i++)
+            slots_[i].stats = TaskStats();
+    }
+
+    /** \return the number of tasks that can be registered at once */
+    static constexpr size_t GetMaxTasks() { return max_tasks; }
+
+  private:
+    struct Slot
+    {
+        Slot()
+        : task(nullptr),
+          context(nullptr),
+          period(0),
+          countdown(0),
+          rate_hz(0.f),
+          stats()
+        {
+        }
+        Task      task;
+        void*     context;
+        size_t    period;
+        size_t    countdown; /**< blocks until the next run */
+        float     rate_hz;   /**< 0 if the task was added with a period */
+        TaskStats stats;
+    };
+
+    // Blocks looked ahead when choosing where to place a new task
+    static constexpr size_t kPlacementHorizon = 256;
+
+    size_t PeriodFor(float rate_hz) const
+    {
+        const float period = block_rate_ / rate_hz + 0.5f;
+        return period < 1.f ? 1 : (size_t)period;
+    }
+
+    bool AddSlot(Task    task,
+                 void*   context,
+                 size_t  period,
+                 float   rate_hz,
+                 size_t* id)
+    {
+        if(!task || period == 0)
+            return false;
+        size_t free = max_tasks;
+        for(size_t i = 0; i < max_tasks && free == max_tasks; i++)
+            if(!slots_[i].task)
+                free = i;
+        if(free == max_tasks)
+            return false;
+        // the search runs with interrupts enabled, so the other tasks may
+        // move on by a block or two, which only makes the placement a little
+        // less than ideal
+        const size_t countdown = FindLeastBusyStart(period);
+
+        ScopedIrqBlocker irq_blocker;
+        Slot&            slot = slots_[free];
+        slot                  = Slot();
+        slot.context          = context;
+        slot.period           = period;
+        slot.countdown        = countdown;
+        slot.rate_hz          = rate_hz;
+        // the slot becomes active once it has a task
+        slot.task = task;
+        if(id)
+            *id = free;
+        return true;
+    }
+
+    // Returns the countdown (1..period) for a new task with the given period,
+    // so that its runs collide with as few runs of the other tasks as
+    // possible within the next kPlacementHorizon blocks. Tasks with longer
+    // periods only try the first kPlacementHorizon starts.
+    size_t FindLeastBusyStart(size_t period) const
+    {
+        const size_t last
+            = period < kPlacementHorizon ? period : kPlacementHorizon;
+        size_t best = 1, best_collisions = SIZE_MAX;
+        for(size_t start = 1; start <= last; start++)
+        {
+            size_t collisions = 0;
+            for(size_t block = start; block <= kPlacementHorizon;
+                block += period)
+                collisions += TasksDueIn(block);
+            if(collisions < best_collisions)
+            {
+                best            = start;
+                best_collisions = collisions;
+            }
+        }
+        return best;
+    }
+
+    // Number of tasks that run `block` blocks from now (1 = the next block)
+    size_t TasksDueIn(size_t block) const
+    {
+        size_t due = 0;
+        for(size_t i = 0; i < max_tasks; i++)
+        {
+            const Slot& slot = slots_[i];
+            if(slot.task && block >= slot.countdown
+               && (block - slot.countdown) % slot.period == 0)
+                due++;
+        }
+        return due;
+    }
+
+    float block_rate_ = 0.f;
+    Slot  slots_[max_tasks];
+};
+
+} // namespace daisy
+
+#endif
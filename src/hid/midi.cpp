@@ -3,9 +3,12 @@
 namespace daisy
 {
 static constexpr size_t kDefaultMidiRxBufferCapacity = 256;
+static constexpr size_t kDefaultMidiTxBufferCapacity = 256;
 
 static uint8_t DMA_BUFFER_MEM_SECTION
     default_midi_rx_buffer[kDefaultMidiRxBufferCapacity];
+static uint8_t DMA_BUFFER_MEM_SECTION
+    default_midi_tx_buffer[kDefaultMidiTxBufferCapacity];
 
 MidiUartTransport::Config::Config()
 {
@@ -14,5 +17,7 @@ MidiUartTransport::Config::Config()
     tx                 = {DSY_GPIOB, 6};
     rx_buffer          = default_midi_rx_buffer;
     rx_buffer_capacity = kDefaultMidiRxBufferCapacity;
+    tx_buffer          = default_midi_tx_buffer;
+    tx_buffer_capacity = kDefaultMidiTxBufferCapacity;
 }
 } // namespace daisy
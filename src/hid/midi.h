@@ -57,6 +57,21 @@ class MidiUartTransport
          */
         size_t rx_buffer_capacity;
 
+        /** Pointer to buffer for DMA UART tx transfers in background.
+         *
+         *  @details Like rx_buffer, by default this uses a shared buffer in
+         *           DMA_BUFFER_MEM_SECTION, which can only be utilized for a
+         *           single UART peripheral.
+         */
+        uint8_t* tx_buffer;
+
+        /** Capacity in bytes of tx_buffer.
+         *
+         *  @details By default it's set to the size of the default shared
+         *           tx_buffer (256 bytes). Larger transmissions are split up.
+         */
+        size_t tx_buffer_capacity;
+
         Config();
     };
 
@@ -79,6 +94,9 @@ class MidiUartTransport
 
         rx_buffer_          = config.rx_buffer;
         rx_buffer_capacity_ = config.rx_buffer_capacity;
+        tx_buffer_          = config.tx_buffer;
+        tx_buffer_capacity_ = config.tx_buffer_capacity;
+        tx_busy_            = false;
 
         /** zero the rx buffer to ensure emptiness regardless of source memory */
         std::fill(rx_buffer_, rx_buffer_ + rx_buffer_capacity_, 0);
@@ -107,19 +125,70 @@ class MidiUartTransport
     inline void FlushRx() {}
 
 
-    /** @brief sends the buffer of bytes out of the UART peripheral */
+    /** @brief sends the buffer of bytes out of the UART peripheral
+     *  @details The bytes are copied to tx_buffer and sent with DMA in the
+     *           background, so buff can be reused as soon as this returns.
+     *           Waits for the previous transfer to finish first, and aborts
+     *           it if it takes much longer than it should, e.g. because the
+     *           DMA is queued behind another UART or its interrupt can't run.
+     */
     inline void Tx(uint8_t* buff, size_t size)
     {
-        uart_.BlockingTransmit(buff, size, 10);
+        while(size > 0)
+        {
+            if(!WaitForTx())
+            {
+                uart_.DmaTransmitAbort();
+                tx_busy_ = false;
+            }
+            const size_t chunk = std::min(size, tx_buffer_capacity_);
+            std::copy(buff, buff + chunk, tx_buffer_);
+            dsy_dma_clear_cache_for_buffer(tx_buffer_, chunk);
+            tx_busy_ = true;
+            if(uart_.DmaTransmit(tx_buffer_, chunk, nullptr, txCallback, this)
+               != UartHandler::Result::OK)
+            {
+                tx_busy_ = false;
+                uart_.BlockingTransmit(tx_buffer_, chunk, 10);
+            }
+            buff += chunk;
+            size -= chunk;
+        }
     }
 
   private:
+    /** Waits for the running transfer to finish
+     *  \return false if it didn't in time
+     */
+    bool WaitForTx()
+    {
+        // a full buffer takes 0.32ms per byte at 31250 baud
+        const uint32_t timeout = tx_buffer_capacity_ * 32 / 100 + 10;
+        const uint32_t start   = System::GetNow();
+        while(tx_busy_)
+        {
+            if(System::GetNow() - start > timeout)
+                return false;
+        }
+        return true;
+    }
+
     UartHandler         uart_;
     uint8_t*            rx_buffer_;
     size_t              rx_buffer_capacity_;
+    uint8_t*            tx_buffer_;
+    size_t              tx_buffer_capacity_;
+    volatile bool       tx_busy_;
     void*               parse_context_;
     MidiRxParseCallback parse_callback_;
 
+    /** Static callback for the end of a DMA transmission */
+    static void txCallback(void* context, UartHandler::Result res)
+    {
+        (void)res;
+        reinterpret_cast<MidiUartTransport*>(context)->tx_busy_ = false;
+    }
+
     /** Static callback for Uart MIDI that occurs when
          *  new data is available from the peripheral.
          *  The new data is transferred from the peripheral to the
@@ -151,7 +220,9 @@ class MidiUartTransport
 /**
     @brief Simple MIDI Handler \n
     Parses bytes from an input into valid MidiEvents. \n
-    The MidiEvents fill a FIFO queue that the user can pop messages from.
+    The MidiEvents fill a FIFO queue that the user can pop messages from. \n
+    The queue holds CompactMidiEvents, the payloads of SysEx messages are
+    stored separately in a buffer of kRxSysExBufferSize bytes.
     @author shensley
     @date March 2020
     @ingroup midi
@@ -160,7 +231,8 @@ template <typename Transport,
           size_t KRxEventQueueSize      = 64,
           size_t kTxMessageQueueSize    = 64,
           size_t kTxISRMessageQueueSize = 32,
-          size_t kTxBufferSize          = 256>
+          size_t kTxBufferSize          = 256,
+          size_t kRxSysExBufferSize     = 1024>
 class MidiHandler
 {
   public:
@@ -181,15 +253,15 @@ class MidiHandler
         config_ = config;
         transport_.Init(config_.transport_config);
         tx_buffer_.Init(config_.running_status_enabled);
+        rx_sysex_.Clear();
+        sysex_unread_ = 0;
+        parser_.SetSysExBuffer(&rx_sysex_);
         parser_.Init();
     }
 
     /** Starts listening on the selected input mode(s).
      * MidiEvent Queue will begin to fill, and can be checked with HasEvents() */
-    void StartReceive()
-    {
-        transport_.StartRx(MidiHandler::ParseCallback, this);
-    }
+    void StartReceive() { startReceive(transport_, 0); }
 
     /** Start listening */
     void Listen()
@@ -212,14 +284,69 @@ class MidiHandler
 
 
     /** Pops the oldest unhandled MidiEvent from the internal queue
+    The timestamp of the event can be turned into a sample offset in the
+    audio callback with AudioHandle::GetSampleOffset().
+    SysEx payloads longer than SYSEX_BUFFER_LEN bytes are truncated,
+    use PopCompactEvent() and ReadSysEx() to receive longer messages.
+    \return The event to be handled
+     */
+    MidiEvent PopEvent()
+    {
+        const CompactMidiEvent compact = PopCompactEvent();
+        MidiEvent              event   = compact.ToMidiEvent();
+        event.sysex_message_len = ReadSysEx(event.sysex_data, SYSEX_BUFFER_LEN);
+        return event;
+    }
+
+    /** Pops the oldest unhandled event from the internal queue, without
+    copying it into a (much larger) MidiEvent.
+    For SysEx messages, the payload of sysex_length bytes can be read with
+    ReadSysEx() until the next event is popped.
     \return The event to be handled
      */
-    MidiEvent PopEvent() { return rx_event_q_.PopFront(); }
+    CompactMidiEvent PopCompactEvent()
+    {
+        // drop what's left of the previous payload
+        rx_sysex_.Skip(sysex_unread_);
+        const CompactMidiEvent event = rx_event_q_.PopFront();
+        sysex_unread_                = event.sysex_length;
+        return event;
+    }
+
+    /** Reads the SysEx payload of the most recently popped event.
+    Can be called repeatedly to read a long message in parts.
+    \param dest buffer to copy the payload to
+    \param size maximum number of bytes to copy
+    \return number of bytes copied, 0 once the whole payload was read
+     */
+    size_t ReadSysEx(uint8_t* dest, size_t size)
+    {
+        if(size > sysex_unread_)
+            size = sysex_unread_;
+        const size_t read = rx_sysex_.Read(dest, size);
+        sysex_unread_ -= read;
+        return read;
+    }
 
     /** SendMessage
     Send raw bytes as message
+    \return false if the message queue is full
     */
-    void SendMessage(const MidiTxMessage& msg) { tx_msg_q_.PushBack(msg); }
+    bool SendMessage(const MidiTxMessage& msg)
+    {
+        return tx_msg_q_.PushBack(msg);
+    }
+
+    /** Queues a raw message, like SendMessage(const MidiTxMessage&), but
+    copies only the bytes of the message into the queue.
+    \param data a complete message, starting with its status byte
+    \param size number of bytes, at most MidiTxMessage::kMaxDataSize
+    \return false if the message queue is full
+    */
+    bool SendMessage(const uint8_t* data, size_t size)
+    {
+        return tx_msg_q_.EmplaceBack(data, size);
+    }
 
     /** Higher priority message queue for ISR (clock, etc)
      *  These are transmitted in FIFO order, but *before*
@@ -230,28 +357,59 @@ class MidiHandler
         tx_msg_q_isr_.PushBack(msg);
     }
 
-    /** Transmit enqueued messages*/
+    /** Transmit enqueued messages
+     *  All pending messages that fit into the kTxBufferSize bytes transmit
+     *  buffer are packed into one transfer, ISR messages first, with running
+     *  status applied if enabled. Messages that don't fit stay queued for
+     *  the next call.
+     */
     void TransmitMessages()
     {
-        // First process and transmit ISR queue
-        processAndTransmitMessageQueue(tx_msg_q_isr_);
-        // Then non-ISR queue
-        processAndTransmitMessageQueue(tx_msg_q_);
+        // First pack the ISR queue
+        if(packMessageQueue(tx_msg_q_isr_))
+        {
+            // Then the non-ISR queue
+            packMessageQueue(tx_msg_q_);
+        }
+        if(!tx_buffer_.IsEmpty())
+        {
+            transport_.Tx(const_cast<uint8_t*>(tx_buffer_.GetData()),
+                          tx_buffer_.GetSize());
+            tx_buffer_.Consume();
+        }
     }
 
     /** Feed in bytes to parser state machine from an external source.
         Populates internal FIFO queue with MIDI Messages.
 
+        Events are timestamped with System::GetTick() at the time of the call.
+
         \note  Normally application code won't need to use this method directly.
         \param byte MIDI byte to be parsed
     */
-    void Parse(uint8_t byte)
+    void Parse(uint8_t byte) { Parse(&byte, 1); }
+
+    /** Feeds a span of bytes to the parser, like Parse(uint8_t)
+        \param data MIDI bytes to be parsed
+        \param size number of bytes
+    */
+    void Parse(const uint8_t* data, size_t size)
     {
-        MidiEvent event;
-        if(parser_.Parse(byte, &event))
-        {
-            rx_event_q_.PushBack(event);
-        }
+        parser_.SetTimestamp(System::GetTick());
+        parser_.Parse(data, size, rx_event_q_);
+    }
+
+    /** Feeds USB-MIDI event packets to the parser, like Parse(), but
+        channel and real-time messages are decoded straight from the packet.
+        \note  Transports with a StartRxPackets() function, like
+               MidiUsbTransport, deliver their packets here.
+        \param packets 4 byte USB-MIDI event packets
+        \param size number of bytes
+    */
+    void ParseUsbPackets(const uint8_t* packets, size_t size)
+    {
+        parser_.SetTimestamp(System::GetTick());
+        parser_.ParseUsbPackets(packets, size, rx_event_q_);
     }
 
   private:
@@ -259,7 +417,9 @@ class MidiHandler
     Transport  transport_;
     MidiParser parser_;
 
-    FIFO<MidiEvent, KRxEventQueueSize>          rx_event_q_;
+    FIFO<CompactMidiEvent, KRxEventQueueSize>   rx_event_q_;
+    MidiSysExBuffer<kRxSysExBufferSize>         rx_sysex_;
+    size_t                                      sysex_unread_;
     FIFO<MidiTxMessage, kTxMessageQueueSize>    tx_msg_q_;
     FIFO<MidiTxMessage, kTxISRMessageQueueSize> tx_msg_q_isr_;
     MidiTxBuffer<kTxBufferSize>                 tx_buffer_;
@@ -267,33 +427,47 @@ class MidiHandler
     static void ParseCallback(uint8_t* data, size_t size, void* context)
     {
         MidiHandler* handler = reinterpret_cast<MidiHandler*>(context);
-        for(size_t i = 0; i < size; i++)
-        {
-            handler->Parse(data[i]);
-        }
+        handler->Parse(data, size);
+    }
+
+    static void
+    PacketCallback(const uint8_t* packets, size_t size, void* context)
+    {
+        MidiHandler* handler = reinterpret_cast<MidiHandler*>(context);
+        handler->ParseUsbPackets(packets, size);
+    }
+
+    /** Receives packets from transports that deliver them */
+    template <typename T>
+    auto startReceive(T& transport, int)
+        -> decltype(transport.StartRxPackets(PacketCallback, this))
+    {
+        return transport.StartRxPackets(PacketCallback, this);
+    }
+
+    /** Receives a byte stream from all other transports */
+    template <typename T>
+    void startReceive(T& transport, long)
+    {
+        transport.StartRx(ParseCallback, this);
     }
 
+    /** Moves messages from a queue to the tx buffer
+     *  \return false if the tx buffer is full
+     */
     template <typename Queue>
-    void processAndTransmitMessageQueue(Queue& queue)
+    bool packMessageQueue(Queue& queue)
     {
-        MidiTxMessage msg;
         while(!queue.IsEmpty())
         {
-            msg = queue.Front();
+            const MidiTxMessage& msg = queue.Front();
             // If we can't fit this message, don't pop it,
             // the tx buffer is full
             if(!tx_buffer_.WriteMessage(msg.data, msg.size))
-            {
-                break;
-            }
-            queue.PopFront();
-        }
-        if(!tx_buffer_.IsEmpty())
-        {
-            transport_.Tx(const_cast<uint8_t*>(tx_buffer_.GetData()),
-                          tx_buffer_.GetSize());
-            tx_buffer_.Consume();
+                return false;
+            queue.DropFront();
         }
+        return true;
     }
 };
 
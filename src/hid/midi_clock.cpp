@@ -0,0 +1,217 @@
+#include <math.h>
+#include "hid/midi_clock.h"
+#include "sys/system.h"
+
+using namespace daisy;
+
+constexpr uint32_t MidiClockFollower::kPulsesPerQuarter;
+constexpr uint32_t MidiClockFollower::kPulsesPerSongPosition;
+
+/** A clock that is off by more than this fraction of a period restarts
+ *  the PLL from the measured interval, instead of being filtered.
+ */
+static constexpr float kRelockError = 0.5f;
+
+/** Clocks that are missing for this many periods restart the PLL */
+static constexpr float kDropoutPulses = 4.f;
+
+/** Time over which the phase catches up with the PLL, in seconds */
+static constexpr float kCorrectionTime = 0.02f;
+
+static constexpr float kTwoPi = 6.28318531f;
+static constexpr float kSqrt2 = 1.41421356f;
+
+void MidiClockFollower::Init(float sample_rate, Config config)
+{
+    config_             = config;
+    ticks_per_sample_   = System::GetTickFreq() / sample_rate;
+    correction_samples_ = sample_rate * kCorrectionTime;
+    bandwidth_step_     = 0.f;
+    if(config.acquire_pulses > 0)
+    {
+        bandwidth_step_ = powf(config.bandwidth / config.acquire_bandwidth,
+                               1.f / config.acquire_pulses);
+    }
+
+    next_.next_pulse  = 0;
+    next_.next_tick   = 0;
+    next_.period      = 0.f;
+    next_.relocations = 0;
+    next_.running     = false;
+    next_.waiting     = false;
+    next_.locked      = false;
+    last_clock_       = 0;
+    num_clocks_       = 0;
+    bandwidth_        = config.acquire_bandwidth;
+    snapshot_.Reset(next_);
+
+    state_       = &snapshot_.Read();
+    relocations_ = 0;
+    pulse_       = 0;
+    phase_       = 0.f;
+    increment_   = 0.f;
+}
+
+void MidiClockFollower::Clock(uint32_t timestamp)
+{
+    const uint32_t interval = timestamp - last_clock_;
+    last_clock_             = timestamp;
+
+    if(num_clocks_ == 0
+       || (next_.period > 0.f && interval > next_.period * kDropoutPulses))
+    {
+        // first clock, or the first one after a gap: keep the old tempo
+        // (if any) until the next clock arrives
+        num_clocks_     = 1;
+        bandwidth_      = config_.acquire_bandwidth;
+        next_.next_tick = timestamp + static_cast<uint32_t>(next_.period);
+    }
+    else
+    {
+        const int32_t error_ticks = timestamp - next_.next_tick;
+        const float   error       = static_cast<float>(error_ticks);
+        if(next_.period == 0.f || fabsf(error) > next_.period * kRelockError)
+        {
+            // far off, e.g. a sudden tempo change: start over from the
+            // measured interval
+            num_clocks_     = 1;
+            bandwidth_      = config_.acquire_bandwidth;
+            next_.period    = static_cast<float>(interval);
+            next_.next_tick = timestamp + interval;
+        }
+        else
+        {
+            // narrow the loop down gradually while acquiring
+            bandwidth_ *= bandwidth_step_;
+            if(bandwidth_ < config_.bandwidth)
+                bandwidth_ = config_.bandwidth;
+            // critically damped second order loop
+            const float w = kTwoPi * bandwidth_;
+            const float b = kSqrt2 * w;
+            const float c = w * w;
+            next_.next_tick += static_cast<int32_t>(
+                lroundf(next_.period + b * error));
+            next_.period += c * error;
+        }
+        num_clocks_++;
+    }
+    next_.locked
+        = next_.period > 0.f && num_clocks_ >= config_.acquire_pulses;
+
+    if(next_.running)
+    {
+        next_.waiting = false;
+        next_.next_pulse++;
+    }
+    Publish();
+}
+
+void MidiClockFollower::Start()
+{
+    next_.next_pulse = 0;
+    next_.running    = true;
+    next_.waiting    = true;
+    next_.relocations++;
+    Publish();
+}
+
+void MidiClockFollower::Continue()
+{
+    next_.running = true;
+    next_.waiting = true;
+    next_.relocations++;
+    Publish();
+}
+
+void MidiClockFollower::Stop()
+{
+    next_.running = false;
+    Publish();
+}
+
+void MidiClockFollower::SetSongPosition(uint16_t midi_beats)
+{
+    next_.next_pulse = midi_beats * kPulsesPerSongPosition;
+    next_.waiting    = true;
+    next_.relocations++;
+    Publish();
+}
+
+void MidiClockFollower::BeginBlock(uint32_t block_start_tick, size_t size)
+{
+    state_ = &snapshot_.Read();
+    // the block renders the block period before the callback
+    const uint32_t block_ticks
+        = static_cast<uint32_t>(size * ticks_per_sample_ + 0.5f);
+    if(state_->relocations != relocations_)
+    {
+        relocations_ = state_->relocations;
+        GetPosition(*state_, block_start_tick - block_ticks, &pulse_, &phase_);
+    }
+
+    increment_ = 0.f;
+    if(!IsRunning() || state_->period == 0.f || size == 0)
+        return;
+
+    uint32_t   target_pulse;
+    float      target_phase;
+    const bool moving = GetPosition(
+        *state_, block_start_tick, &target_pulse, &target_phase);
+    const float distance
+        = static_cast<float>(static_cast<int32_t>(target_pulse - pulse_))
+          + (target_phase - phase_);
+
+    // advance at the tempo of the PLL, and spread the correction of the
+    // remaining error over several blocks
+    const float rate = moving ? ticks_per_sample_ / state_->period : 0.f;
+    const float correction = size > correction_samples_
+                                 ? static_cast<float>(size)
+                                 : correction_samples_;
+    increment_ = rate + (distance - rate * size) / correction;
+    if(increment_ < 0.f)
+        increment_ = 0.f;
+}
+
+float MidiClockFollower::GetTempo() const
+{
+    if(state_->period == 0.f)
+        return 0.f;
+    return 60.f * System::GetTickFreq() / (state_->period * kPulsesPerQuarter);
+}
+
+void MidiClockFollower::Publish()
+{
+    snapshot_.Publish(next_);
+}
+
+bool MidiClockFollower::GetPosition(const State& state,
+                                    uint32_t     tick,
+                                    uint32_t*    pulse,
+                                    float*       phase) const
+{
+    *phase = 0.f;
+    if(!state.running || state.waiting)
+    {
+        *pulse = state.next_pulse;
+        return false;
+    }
+    if(state.period == 0.f)
+    {
+        *pulse = state.next_pulse - 1;
+        return false;
+    }
+
+    // clocks relative to the next one
+    float clocks
+        = static_cast<int32_t>(tick - state.next_tick) / state.period;
+    bool moving = true;
+    if(clocks > config_.max_lead)
+    {
+        clocks = config_.max_lead;
+        moving = false;
+    }
+    const float whole = floorf(clocks);
+    *pulse            = state.next_pulse + static_cast<int32_t>(whole);
+    *phase            = clocks - whole;
+    return moving;
+}
@@ -0,0 +1,234 @@
+#pragma once
+#ifndef DSY_MIDI_CLOCK_H
+#define DSY_MIDI_CLOCK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "hid/MidiEvent.h"
+#include "util/ParameterSnapshot.h"
+
+namespace daisy
+{
+/** @brief Follows an external MIDI clock, with a smooth per-sample phase
+ *  @ingroup midi
+ *  @details Received timing clocks (24 per quarter note) are fed through a
+ *           second order software PLL that estimates the tempo and predicts
+ *           when the next clock is due, so the jitter of the transport
+ *           (USB in particular) is filtered out. Start, Stop, Continue and
+ *           Song Position Pointer messages move the song position.
+ *
+ *           The clock runs in two contexts. Events are passed to
+ *           ProcessEvent() wherever they are popped from the MidiHandler,
+ *           using the timestamps they were received with. The audio
+ *           callback calls BeginBlock() and then Process() once per sample.
+ *           The state is handed over with a ParameterSnapshot, so neither
+ *           side blocks the other.
+ *
+ *           Like AudioHandle::GetSampleOffset(), a block renders the block
+ *           period before the callback was started. The phase advances at
+ *           the estimated tempo and smoothly catches up with the predicted
+ *           position, and never runs backwards except when the song
+ *           position is moved.
+ *
+ *  Usage:
+ *  @code
+ *  MidiClockFollower clock;
+ *  clock.Init(hw.AudioSampleRate());
+ *
+ *  // audio callback
+ *  while(midi.HasEvents())
+ *      clock.ProcessEvent(midi.PopCompactEvent());
+ *  clock.BeginBlock(hw.audio_handle.GetBlockStartTick(), size);
+ *  for(size_t i = 0; i < size; i++)
+ *  {
+ *      const float beat_phase = clock.Process();
+ *      ...
+ *  }
+ *  @endcode
+ */
+class MidiClockFollower
+{
+  public:
+    /** MIDI timing clocks per quarter note */
+    static constexpr uint32_t kPulsesPerQuarter = 24;
+
+    /** MIDI timing clocks per Song Position Pointer step (a 16th note) */
+    static constexpr uint32_t kPulsesPerSongPosition = 6;
+
+    struct Config
+    {
+        /** Loop bandwidth of the PLL, relative to the clock rate.
+         *  Lower values filter more jitter, but follow tempo changes
+         *  more slowly.
+         */
+        float bandwidth = 0.005f;
+
+        /** Loop bandwidth when locking on to a new tempo. It narrows down
+         *  to bandwidth over acquire_pulses clocks.
+         */
+        float acquire_bandwidth = 0.1f;
+
+        /** Number of clocks it takes to lock on to a new tempo */
+        uint32_t acquire_pulses = 48;
+
+        /** How far the phase may run past the predicted time of the next
+         *  clock, in clocks. Rides out late clocks, but limits how far the
+         *  phase runs on when the clock stops without a Stop message.
+         */
+        float max_lead = 1.f;
+    };
+
+    MidiClockFollower() {}
+    ~MidiClockFollower() {}
+
+    /** Initializes the clock follower, stopped at song position 0
+     *  \param sample_rate audio sample rate in Hz
+     *  \param config PLL settings
+     */
+    void Init(float sample_rate, Config config);
+
+    /** Initializes the clock follower with the default Config */
+    void Init(float sample_rate) { Init(sample_rate, Config()); }
+
+    // ======== event side ========
+
+    /** Handles timing clock, Start, Stop, Continue and Song Position
+     *  Pointer messages and ignores all others.
+     *  \param event a MidiEvent or CompactMidiEvent
+     */
+    template <typename Event>
+    void ProcessEvent(const Event& event)
+    {
+        if(event.type == SystemRealTime)
+        {
+            switch(event.srt_type)
+            {
+                case TimingClock: Clock(event.timestamp); break;
+                case SystemRealTimeType::Start: Start(); break;
+                case SystemRealTimeType::Continue: Continue(); break;
+                case SystemRealTimeType::Stop: Stop(); break;
+                default: break;
+            }
+        }
+        else if(event.type == SystemCommon
+                && event.sc_type == SongPositionPointer)
+        {
+            SetSongPosition(((uint16_t)event.data[1] << 7) | event.data[0]);
+        }
+    }
+
+    /** Handles a timing clock
+     *  \param timestamp System::GetTick() value the clock was received at
+     */
+    void Clock(uint32_t timestamp);
+
+    /** Starts playback from the beginning with the next clock */
+    void Start();
+
+    /** Resumes playback from the current song position with the next clock */
+    void Continue();
+
+    /** Stops playback, the song position stays where it is */
+    void Stop();
+
+    /** Moves the song position
+     *  \param midi_beats position in 16th notes since the beginning
+     */
+    void SetSongPosition(uint16_t midi_beats);
+
+    // ======== audio side ========
+
+    /** Prepares the next audio block. Must be called before Process().
+     *  \param block_start_tick AudioHandle::GetBlockStartTick() of the
+     *         current callback
+     *  \param size number of samples in the block
+     */
+    void BeginBlock(uint32_t block_start_tick, size_t size);
+
+    /** Advances the phase by one sample
+     *  \return the phase within the current quarter note, 0 to 1
+     */
+    float Process()
+    {
+        phase_ += increment_;
+        if(phase_ >= 1.f)
+        {
+            const uint32_t whole = static_cast<uint32_t>(phase_);
+            pulse_ += whole;
+            phase_ -= whole;
+        }
+        return GetBeatPhase();
+    }
+
+    /** Returns the phase within the current quarter note, 0 to 1 */
+    float GetBeatPhase() const
+    {
+        return ((pulse_ % kPulsesPerQuarter) + phase_) / kPulsesPerQuarter;
+    }
+
+    /** Returns the number of whole clocks since the beginning of the song */
+    uint32_t GetPulse() const { return pulse_; }
+
+    /** Returns the phase within the current clock, 0 to 1 */
+    float GetPulsePhase() const { return phase_; }
+
+    /** Returns the number of clocks the phase advances per sample in the
+     *  current block
+     */
+    float GetPhaseIncrement() const { return increment_; }
+
+    /** Returns the estimated tempo in BPM, or 0 if it is not known yet */
+    float GetTempo() const;
+
+    /** Returns true while the song is playing */
+    bool IsRunning() const { return state_->running && !state_->waiting; }
+
+    /** Returns true once the PLL has settled on the tempo */
+    bool IsLocked() const { return state_->locked; }
+
+  private:
+    /** What the event side hands over to the audio side */
+    struct State
+    {
+        uint32_t next_pulse;  /**< song position of the next clock */
+        uint32_t next_tick;   /**< predicted time of the next clock */
+        float    period;      /**< ticks per clock, 0 if unknown */
+        uint32_t relocations; /**< counts moves of the song position */
+        bool     running;
+        bool     waiting; /**< started, but waiting for the first clock */
+        bool     locked;
+    };
+
+    void Publish();
+
+    /** Song position at a time, as whole clocks and phase.
+     *  \return false if the position stands still at that time
+     */
+    bool GetPosition(const State& state,
+                     uint32_t     tick,
+                     uint32_t*    pulse,
+                     float*       phase) const;
+
+    Config config_;
+    float  ticks_per_sample_;
+    float  correction_samples_;
+    float  bandwidth_step_; /**< narrows the loop while acquiring */
+
+    ParameterSnapshot<State> snapshot_;
+
+    // owned by the event side
+    State    next_;
+    uint32_t last_clock_;
+    uint32_t num_clocks_; /**< clocks since the PLL was (re)started */
+    float    bandwidth_;  /**< current loop bandwidth */
+
+    // owned by the audio side
+    const State* state_;
+    uint32_t     relocations_;
+    uint32_t     pulse_;
+    float        phase_;
+    float        increment_;
+};
+
+} // namespace daisy
+#endif
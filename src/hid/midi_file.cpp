@@ -0,0 +1,541 @@
+#include <cstring>
+#include "hid/midi_file.h"
+
+using namespace daisy;
+
+constexpr size_t MidiFilePlayer::kMaxTracks;
+constexpr size_t MidiFilePlayer::kTrackBufferSize;
+constexpr size_t MidiFilePlayer::kEventQueueSize;
+
+static constexpr uint32_t kDefaultTempo = 500000; // 120 bpm
+
+static uint32_t ReadBigEndian(const uint8_t* data, size_t size)
+{
+    uint32_t value = 0;
+    for(size_t i = 0; i < size; i++)
+        value = (value << 8) | data[i];
+    return value;
+}
+
+void MidiFilePlayer::Init(float sample_rate)
+{
+    sample_rate_       = sample_rate;
+    file_open_         = false;
+    num_tracks_        = 0;
+    ticks_per_quarter_ = 0;
+    ticks_per_second_  = 0.f;
+    heap_size_         = 0;
+    tempo_             = kDefaultTempo;
+    segment_tick_      = 0;
+    segment_sample_    = 0.;
+    samples_per_tick_  = 0.;
+    loop_offset_       = 0.;
+    end_tick_          = 0;
+    decoder_done_      = true;
+    pass_has_events_   = false;
+    looping_           = false;
+    seek_pending_      = false;
+    seek_tick_         = 0;
+    index_             = nullptr;
+    index_size_        = 0;
+    queue_.Init();
+    flush_request_.store(0);
+    flush_ack_.store(0);
+    playing_     = false;
+    position_    = 0;
+    block_start_ = 0;
+    block_end_   = 0;
+}
+
+MidiFilePlayer::Result MidiFilePlayer::Open(const char* path)
+{
+    Close();
+    if(f_open(&fil_, path, FA_READ | FA_OPEN_EXISTING) != FR_OK)
+        return Result::ERR_FILE_OPEN;
+    file_open_ = true;
+
+    uint8_t header[14];
+    UINT    bytesread;
+    if(f_read(&fil_, header, sizeof(header), &bytesread) != FR_OK
+       || bytesread != sizeof(header))
+    {
+        Close();
+        return Result::ERR_FILE_READ;
+    }
+    const uint32_t header_size = ReadBigEndian(header + 4, 4);
+    const uint16_t format      = ReadBigEndian(header + 8, 2);
+    const uint16_t num_chunks  = ReadBigEndian(header + 10, 2);
+    const uint16_t division    = ReadBigEndian(header + 12, 2);
+    if(memcmp(header, "MThd", 4) != 0 || header_size < 6 || format > 1
+       || num_chunks == 0 || (division & 0x7FFF) == 0)
+    {
+        Close();
+        return Result::ERR_FORMAT;
+    }
+    if(division & 0x8000)
+    {
+        // SMPTE frames per second and ticks per frame
+        const int8_t fps   = -static_cast<int8_t>(division >> 8);
+        ticks_per_second_  = (fps == 29 ? 29.97f : fps) * (division & 0xFF);
+        ticks_per_quarter_ = 0;
+    }
+    else
+    {
+        ticks_per_second_  = 0.f;
+        ticks_per_quarter_ = division;
+    }
+
+    // find the track chunks, and skip all others
+    const uint32_t file_size = f_size(&fil_);
+    uint32_t       offset    = 8 + header_size;
+    while(offset + 8 <= file_size && num_tracks_ < num_chunks)
+    {
+        uint8_t chunk[8];
+        if(f_lseek(&fil_, offset) != FR_OK
+           || f_read(&fil_, chunk, sizeof(chunk), &bytesread) != FR_OK
+           || bytesread != sizeof(chunk))
+        {
+            Close();
+            return Result::ERR_FILE_READ;
+        }
+        const uint32_t size = ReadBigEndian(chunk + 4, 4);
+        if(memcmp(chunk, "MTrk", 4) == 0)
+        {
+            if(num_tracks_ == kMaxTracks)
+            {
+                Close();
+                return Result::ERR_TOO_MANY_TRACKS;
+            }
+            Track& track      = tracks_[num_tracks_++];
+            track.start       = offset + 8;
+            track.end         = size < file_size - track.start
+                                    ? track.start + size
+                                    : file_size;
+            track.buffer_size = 0;
+        }
+        // a chunk that runs past the end of the file is the last one, and a
+        // corrupt size mustn't wrap the offset around
+        if(size > file_size - offset - 8)
+            break;
+        offset += 8 + size;
+    }
+    if(num_tracks_ == 0)
+    {
+        Close();
+        return Result::ERR_FORMAT;
+    }
+
+    Rewind();
+    Seek(0);
+    return Result::OK;
+}
+
+void MidiFilePlayer::Close()
+{
+    if(file_open_)
+        f_close(&fil_);
+    file_open_    = false;
+    num_tracks_   = 0;
+    heap_size_    = 0;
+    index_        = nullptr;
+    index_size_   = 0;
+    decoder_done_ = true;
+    seek_pending_ = false;
+    playing_      = false;
+    // drop what is queued
+    flush_request_.fetch_add(1);
+}
+
+size_t MidiFilePlayer::BuildIndex(SeekPoint* points,
+                                  size_t     max_points,
+                                  uint32_t   interval)
+{
+    index_      = nullptr;
+    index_size_ = 0;
+    if(!file_open_ || max_points < 2 || interval == 0)
+        return 0;
+
+    Rewind();
+    size_t   num_points = 0;
+    uint32_t next_tick  = 0;
+    while(heap_size_ > 0)
+    {
+        const uint32_t tick = tracks_[heap_[0]].position.tick;
+        if(tick >= next_tick)
+        {
+            if(num_points == max_points)
+            {
+                // keep every other point
+                for(size_t i = 1; 2 * i < num_points; i++)
+                    points[i] = points[2 * i];
+                num_points = (num_points + 1) / 2;
+                interval *= 2;
+                next_tick = points[num_points - 1].tick;
+                next_tick += interval - next_tick % interval;
+                continue;
+            }
+            MakeSeekPoint(&points[num_points++]);
+            next_tick = tick + interval - tick % interval;
+        }
+        CompactMidiEvent event;
+        uint32_t         event_tick;
+        ReadEvent(&event, &event_tick);
+    }
+
+    index_      = points;
+    index_size_ = num_points;
+    Rewind();
+    Seek(0);
+    return num_points;
+}
+
+void MidiFilePlayer::Prepare()
+{
+    // wait until the audio callback has dropped the queued events
+    if(!file_open_ || flush_request_.load() != flush_ack_.load())
+        return;
+
+    QueuedEvent queued;
+    if(seek_pending_)
+    {
+        seek_pending_ = false;
+
+        // start from the last seek point before the tick
+        size_t lo = 0, hi = index_size_;
+        while(lo < hi)
+        {
+            const size_t mid = (lo + hi) / 2;
+            if(index_[mid].tick <= seek_tick_)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if(lo > 0)
+            RestoreSeekPoint(index_[lo - 1]);
+        else
+            Rewind();
+        ScanTo(seek_tick_);
+
+        loop_offset_  = 0.;
+        queued.locate = true;
+        queued.sample = static_cast<uint64_t>(GetSongSample(seek_tick_) + .5);
+        queue_.Write(queued);
+    }
+
+    while(queue_.writable() > 0 && DecodeNext(&queued))
+        queue_.Write(queued);
+}
+
+void MidiFilePlayer::Seek(uint32_t tick)
+{
+    seek_tick_    = tick;
+    seek_pending_ = true;
+    flush_request_.fetch_add(1);
+}
+
+void MidiFilePlayer::BeginBlock(size_t size)
+{
+    const uint32_t request = flush_request_.load(std::memory_order_acquire);
+    if(request != flush_ack_.load(std::memory_order_relaxed))
+    {
+        queue_.Flush();
+        flush_ack_.store(request, std::memory_order_release);
+    }
+
+    auto span = queue_.PeekRead();
+    while(span.num_elements > 0 && span.data[0].locate)
+    {
+        position_ = span.data[0].sample;
+        queue_.CommitRead(1);
+        span = queue_.PeekRead();
+    }
+
+    block_start_ = position_;
+    if(playing_)
+        position_ += size;
+    block_end_ = position_;
+}
+
+bool MidiFilePlayer::PopEvent(CompactMidiEvent* event, size_t* offset)
+{
+    auto span = queue_.PeekRead();
+    if(span.num_elements == 0)
+        return false;
+    const QueuedEvent& queued = span.data[0];
+    // positions wrap around, so they are compared by their difference
+    if(queued.locate || static_cast<int32_t>(queued.sample - block_end_) >= 0)
+        return false;
+    const int32_t delay = queued.sample - block_start_;
+    *offset             = delay > 0 ? delay : 0;
+    *event              = queued.event;
+    queue_.CommitRead(1);
+    return true;
+}
+
+bool MidiFilePlayer::ReadByte(Track& track, uint8_t* byte)
+{
+    TrackPosition& position = track.position;
+    if(position.offset >= track.end)
+        return false;
+    if(position.offset < track.buffer_offset
+       || position.offset >= track.buffer_offset + track.buffer_size)
+    {
+        const uint32_t left = track.end - position.offset;
+        const uint32_t size = left < kTrackBufferSize ? left : kTrackBufferSize;
+        UINT           bytesread;
+        if(f_lseek(&fil_, position.offset) != FR_OK
+           || f_read(&fil_, track.buffer, size, &bytesread) != FR_OK
+           || bytesread == 0)
+            return false;
+        track.buffer_offset = position.offset;
+        track.buffer_size   = bytesread;
+    }
+    *byte = track.buffer[position.offset++ - track.buffer_offset];
+    return true;
+}
+
+bool MidiFilePlayer::ReadVarLen(Track& track, uint32_t* value)
+{
+    *value = 0;
+    for(size_t i = 0; i < 4; i++)
+    {
+        uint8_t byte;
+        if(!ReadByte(track, &byte))
+            return false;
+        *value = (*value << 7) | (byte & 0x7F);
+        if(!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+bool MidiFilePlayer::Skip(Track& track, uint32_t size)
+{
+    if(size > track.end - track.position.offset)
+        return false;
+    track.position.offset += size;
+    return true;
+}
+
+void MidiFilePlayer::ReadDelta(Track& track)
+{
+    uint32_t delta;
+    if(ReadVarLen(track, &delta))
+        track.position.tick += delta;
+    else
+        track.position.done = true;
+}
+
+bool MidiFilePlayer::ReadEvent(CompactMidiEvent* event, uint32_t* tick)
+{
+    Track&         track    = tracks_[heap_[0]];
+    TrackPosition& position = track.position;
+    *tick                   = position.tick;
+
+    uint8_t status, data[2] = {0, 0};
+    bool    ok       = ReadByte(track, &status);
+    bool    channel  = false;
+    size_t  num_data = 0;
+    if(ok && status < 0x80)
+    {
+        // running status
+        data[num_data++] = status;
+        status           = position.running_status;
+        ok               = status >= 0x80;
+    }
+    if(ok && status < 0xF0)
+    {
+        position.running_status = status;
+        const size_t size       = (status & 0xE0) == 0xC0 ? 1 : 2;
+        while(ok && num_data < size)
+            ok = ReadByte(track, &data[num_data++]);
+        channel = ok;
+    }
+    else if(ok)
+    {
+        // SysEx and meta events cancel the running status
+        position.running_status = 0;
+        uint8_t  type           = 0;
+        uint32_t size;
+        if(status == 0xFF)
+            ok = ReadByte(track, &type);
+        else if(status != 0xF0 && status != 0xF7)
+            ok = false;
+        ok = ok && ReadVarLen(track, &size);
+        if(ok && status == 0xFF && type == 0x51 && size == 3)
+        {
+            uint8_t tempo[3];
+            for(size_t i = 0; ok && i < 3; i++)
+                ok = ReadByte(track, &tempo[i]);
+            if(ok)
+                SetTempo(position.tick, ReadBigEndian(tempo, 3));
+        }
+        else if(ok && status == 0xFF && type == 0x2F)
+            position.done = true; // end of track
+        else
+            ok = ok && Skip(track, size);
+    }
+
+    if(ok && !position.done)
+        ReadDelta(track);
+    if(!ok || position.done)
+    {
+        position.done = true;
+        end_tick_     = position.tick > end_tick_ ? position.tick : end_tick_;
+        HeapPop();
+    }
+    else
+        HeapSiftDown(0);
+
+    if(!channel)
+        return false;
+    event->channel      = status & 0x0F;
+    event->data[0]      = data[0] & 0x7F;
+    event->data[1]      = data[1] & 0x7F;
+    event->sc_type      = SystemCommonLast;
+    event->srt_type     = SystemRealTimeLast;
+    event->sysex_length = 0;
+    event->timestamp    = 0;
+    event->type         = static_cast<MidiMessageType>((status >> 4) - 8);
+    if(event->type == NoteOn && event->data[1] == 0)
+        event->type = NoteOff;
+    else if(event->type == ControlChange && event->data[0] > 119)
+        event->type = ChannelMode;
+    return true;
+}
+
+bool MidiFilePlayer::DecodeNext(QueuedEvent* queued)
+{
+    while(true)
+    {
+        if(heap_size_ == 0)
+        {
+            // a song without length or channel messages can't loop
+            if(!looping_ || end_tick_ == 0 || !pass_has_events_)
+            {
+                decoder_done_ = true;
+                return false;
+            }
+            loop_offset_ += GetSongSample(end_tick_);
+            Rewind();
+        }
+        uint32_t tick;
+        if(ReadEvent(&queued->event, &tick))
+        {
+            const double sample = loop_offset_ + GetSongSample(tick);
+            queued->sample = static_cast<uint64_t>(sample + .5);
+            queued->locate   = false;
+            pass_has_events_ = true;
+            return true;
+        }
+    }
+}
+
+void MidiFilePlayer::ScanTo(uint32_t tick)
+{
+    while(heap_size_ > 0 && tracks_[heap_[0]].position.tick < tick)
+    {
+        CompactMidiEvent event;
+        uint32_t         event_tick;
+        if(ReadEvent(&event, &event_tick))
+            pass_has_events_ = true;
+    }
+}
+
+void MidiFilePlayer::Rewind()
+{
+    for(size_t t = 0; t < num_tracks_; t++)
+    {
+        Track& track                  = tracks_[t];
+        track.position.offset         = track.start;
+        track.position.tick           = 0;
+        track.position.running_status = 0;
+        track.position.done           = false;
+        ReadDelta(track);
+    }
+    HeapBuild();
+    segment_tick_   = 0;
+    segment_sample_ = 0.;
+    SetTempo(0, kDefaultTempo);
+    end_tick_        = 0;
+    decoder_done_    = false;
+    pass_has_events_ = false;
+}
+
+void MidiFilePlayer::RestoreSeekPoint(const SeekPoint& point)
+{
+    for(size_t t = 0; t < num_tracks_; t++)
+        tracks_[t].position = point.tracks[t];
+    HeapBuild();
+    segment_tick_   = point.tick;
+    segment_sample_ = point.sample;
+    SetTempo(point.tick, point.tempo);
+    // tracks that have ended did so before the point, and so may channel
+    // messages
+    end_tick_        = point.tick;
+    decoder_done_    = false;
+    pass_has_events_ = true;
+}
+
+void MidiFilePlayer::MakeSeekPoint(SeekPoint* point) const
+{
+    point->tick   = tracks_[heap_[0]].position.tick;
+    point->tempo  = tempo_;
+    point->sample = GetSongSample(point->tick);
+    for(size_t t = 0; t < num_tracks_; t++)
+        point->tracks[t] = tracks_[t].position;
+}
+
+void MidiFilePlayer::SetTempo(uint32_t tick, uint32_t tempo)
+{
+    segment_sample_ = GetSongSample(tick);
+    segment_tick_   = tick;
+    tempo_          = tempo;
+    if(ticks_per_second_ > 0.f)
+        samples_per_tick_ = sample_rate_ / ticks_per_second_;
+    else
+        samples_per_tick_ = tempo * 1e-6 * sample_rate_ / ticks_per_quarter_;
+}
+
+bool MidiFilePlayer::IsEarlier(uint8_t a, uint8_t b) const
+{
+    const uint32_t tick_a = tracks_[a].position.tick;
+    const uint32_t tick_b = tracks_[b].position.tick;
+    // on the same tick, earlier tracks go first
+    return tick_a < tick_b || (tick_a == tick_b && a < b);
+}
+
+void MidiFilePlayer::HeapBuild()
+{
+    heap_size_ = 0;
+    for(size_t t = 0; t < num_tracks_; t++)
+        if(!tracks_[t].position.done)
+            heap_[heap_size_++] = t;
+    for(size_t i = heap_size_ / 2; i-- > 0;)
+        HeapSiftDown(i);
+}
+
+void MidiFilePlayer::HeapSiftDown(size_t i)
+{
+    while(true)
+    {
+        const size_t left = 2 * i + 1, right = left + 1;
+        size_t       min  = i;
+        if(left < heap_size_ && IsEarlier(heap_[left], heap_[min]))
+            min = left;
+        if(right < heap_size_ && IsEarlier(heap_[right], heap_[min]))
+            min = right;
+        if(min == i)
+            return;
+        const uint8_t swap = heap_[i];
+        heap_[i]           = heap_[min];
+        heap_[min]         = swap;
+        i                  = min;
+    }
+}
+
+void MidiFilePlayer::HeapPop()
+{
+    heap_[0] = heap_[--heap_size_];
+    HeapSiftDown(0);
+}
@@ -0,0 +1,267 @@
+#pragma once
+#ifndef DSY_MIDI_FILE_H
+#define DSY_MIDI_FILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include "hid/MidiEvent.h"
+#include "util/ringbuffer.h"
+#include "ff.h"
+
+namespace daisy
+{
+/** @brief Plays Standard MIDI Files from an SD card
+ *  @ingroup midi
+ *  @details Format 0 and 1 files are streamed from FatFs, each track
+ *           through its own small read-ahead buffer, so the file is never
+ *           loaded as a whole. The tracks are merged in time order with a
+ *           min-heap on the tick of their next event, and tempo changes
+ *           are applied as they come.
+ *
+ *           The player runs in two contexts. Prepare() reads and merges
+ *           the tracks in the main loop, and queues the channel messages
+ *           with the sample they are due at. The audio callback calls
+ *           BeginBlock() and pops the events of the block with their
+ *           sample offset, so they can be rendered sample-accurately.
+ *           SysEx and meta events other than tempo changes are skipped.
+ *
+ *           Seek() moves the song position. Without an index the tracks
+ *           are read from the beginning up to the new position. An index
+ *           built with BuildIndex() holds the read position of every track
+ *           at regular intervals, so a seek only reads from the nearest
+ *           point before the new position.
+ *
+ *  Usage:
+ *  @code
+ *  MidiFilePlayer player;
+ *  player.Init(hw.AudioSampleRate());
+ *  player.Open("song.mid");
+ *  player.Start();
+ *
+ *  // audio callback
+ *  player.BeginBlock(size);
+ *  CompactMidiEvent event;
+ *  size_t           offset;
+ *  while(player.PopEvent(&event, &offset))
+ *      synth.HandleEvent(event, offset);
+ *
+ *  // main loop
+ *  while(1)
+ *      player.Prepare();
+ *  @endcode
+ */
+class MidiFilePlayer
+{
+  public:
+    /** Maximum number of tracks in a file */
+    static constexpr size_t kMaxTracks = 16;
+    /** Read-ahead buffer of each track, in bytes */
+    static constexpr size_t kTrackBufferSize = 128;
+    /** Number of events queued for the audio callback */
+    static constexpr size_t kEventQueueSize = 128;
+
+    enum class Result
+    {
+        OK,
+        ERR_FILE_OPEN,
+        ERR_FILE_READ,
+        ERR_FORMAT,          /**< not a format 0 or 1 Standard MIDI File */
+        ERR_TOO_MANY_TRACKS, /**< more than kMaxTracks */
+    };
+
+    /** Where a track continues */
+    struct TrackPosition
+    {
+        uint32_t offset;         /**< of the next unread byte in the file */
+        uint32_t tick;           /**< of the next event */
+        uint8_t  running_status; /**< & */
+        bool     done;           /**< the track has ended */
+    };
+
+    /** Entry of a seek index, the state of all tracks at a tick */
+    struct SeekPoint
+    {
+        uint32_t      tick;   /**< & */
+        uint32_t      tempo;  /**< microseconds per quarter note */
+        double        sample; /**< since the beginning of the song */
+        TrackPosition tracks[kMaxTracks];
+    };
+
+    MidiFilePlayer() {}
+    ~MidiFilePlayer() {}
+
+    /** Initializes the player, without a file
+     *  \param sample_rate audio sample rate in Hz
+     */
+    void Init(float sample_rate);
+
+    /** Opens a file, the player is stopped at its beginning. Takes effect
+     *  in the audio callback with the next BeginBlock().
+     */
+    Result Open(const char* path);
+
+    /** Closes the file, and drops the seek index */
+    void Close();
+
+    // ======== main loop side ========
+
+    /** Scans the whole file and records a seek point every interval ticks.
+     *  When there are more points than fit, every other point is dropped
+     *  and the interval is doubled, so the index always spans the whole
+     *  file. The player seeks back to the beginning.
+     *  \param points storage for the index, used until the next Open()
+     *  \param max_points size of points, at least 2
+     *  \param interval initial interval in ticks, e.g. one bar
+     *  \return number of points, 0 if the file couldn't be read
+     */
+    size_t
+    BuildIndex(SeekPoint* points, size_t max_points, uint32_t interval);
+
+    /** Reads the tracks and queues events for the audio callback. Call it
+     *  regularly, the queue holds kEventQueueSize events. */
+    void Prepare();
+
+    /** Moves the song position. Events at that tick are played, and notes
+     *  that started before it are not. Takes effect with the next
+     *  BeginBlock() and Prepare().
+     */
+    void Seek(uint32_t tick);
+
+    /** Moves the song position, as a Song Position Pointer does
+     *  \param midi_beats position in 16th notes since the beginning
+     */
+    void SetSongPosition(uint16_t midi_beats)
+    {
+        Seek(static_cast<uint32_t>(midi_beats) * ticks_per_quarter_ / 4);
+    }
+
+    /** Starts or resumes playback */
+    void Start() { playing_ = true; }
+
+    /** Pauses playback, notes that are on stay on */
+    void Stop() { playing_ = false; }
+
+    bool IsPlaying() const { return playing_; }
+
+    /** Sets whether the song starts over when it ends */
+    void SetLooping(bool loop) { looping_ = loop; }
+
+    bool GetLooping() const { return looping_; }
+
+    /** Returns true when all events of the file have been popped */
+    bool IsFinished() const { return decoder_done_ && queue_.isEmpty(); }
+
+    uint16_t GetNumTracks() const { return num_tracks_; }
+
+    /** Returns the ticks per quarter note, 0 for files with an SMPTE time
+     *  base */
+    uint16_t GetTicksPerQuarter() const { return ticks_per_quarter_; }
+
+    /** Returns the current tempo of the main loop side, in microseconds per
+     *  quarter note */
+    uint32_t GetTempo() const { return tempo_; }
+
+    // ======== audio callback side ========
+
+    /** Starts a block of the audio callback
+     *  \param size number of samples in the block
+     */
+    void BeginBlock(size_t size);
+
+    /** Pops the next event that is due in the current block
+     *  \param offset sample offset of the event within the block
+     *  \return false if there are no more events in the block
+     */
+    bool PopEvent(CompactMidiEvent* event, size_t* offset);
+
+    /** Returns the sample position at the start of the current block */
+    uint32_t GetPosition() const { return block_start_; }
+
+  private:
+    struct Track
+    {
+        uint32_t      start, end; /**< of the track data in the file */
+        TrackPosition position;
+        /** read-ahead buffer, holding the file from buffer_offset */
+        uint8_t  buffer[kTrackBufferSize];
+        uint32_t buffer_offset;
+        uint32_t buffer_size;
+    };
+
+    /** An event for the audio callback */
+    struct QueuedEvent
+    {
+        uint32_t         sample; /**< due time */
+        bool             locate; /**< moves the sample position to sample */
+        CompactMidiEvent event;
+    };
+
+    bool ReadByte(Track& track, uint8_t* byte);
+    bool ReadVarLen(Track& track, uint32_t* value);
+    bool Skip(Track& track, uint32_t size);
+    /** Reads the delta time of the next event of a track */
+    void ReadDelta(Track& track);
+    /** Reads the next event of the earliest track
+     *  \return true for channel messages, which are written to event
+     */
+    bool ReadEvent(CompactMidiEvent* event, uint32_t* tick);
+    /** Reads the next channel message of the song, and loops
+     *  \return false at the end of the song */
+    bool DecodeNext(QueuedEvent* event);
+    /** Reads all events before tick */
+    void ScanTo(uint32_t tick);
+    void Rewind();
+    void RestoreSeekPoint(const SeekPoint& point);
+    void MakeSeekPoint(SeekPoint* point) const;
+    void SetTempo(uint32_t tick, uint32_t tempo);
+    double GetSongSample(uint32_t tick) const
+    {
+        return segment_sample_ + (tick - segment_tick_) * samples_per_tick_;
+    }
+
+    // min-heap of the tracks that haven't ended, by tick and track number
+    bool IsEarlier(uint8_t a, uint8_t b) const;
+    void HeapBuild();
+    void HeapSiftDown(size_t i);
+    void HeapPop();
+
+    float    sample_rate_;
+    FIL      fil_;
+    bool     file_open_;
+    uint16_t num_tracks_;
+    uint16_t ticks_per_quarter_;
+    float    ticks_per_second_; /**< for SMPTE time bases, 0 otherwise */
+    Track    tracks_[kMaxTracks];
+    uint8_t  heap_[kMaxTracks];
+    size_t   heap_size_;
+
+    // main loop side
+    uint32_t   tempo_;
+    uint32_t   segment_tick_;   /**< tick of the last tempo change */
+    double     segment_sample_; /**< song sample of the last tempo change */
+    double     samples_per_tick_;
+    double     loop_offset_; /**< sample where the current repeat starts */
+    uint32_t   end_tick_;
+    bool       decoder_done_;
+    bool       pass_has_events_; /**< since the last Rewind() */
+    bool       looping_;
+    bool       seek_pending_;
+    uint32_t   seek_tick_;
+    SeekPoint* index_;
+    size_t     index_size_;
+
+    // handed over to the audio callback
+    SpscRingBuffer<QueuedEvent, kEventQueueSize> queue_;
+    std::atomic<uint32_t> flush_request_;
+    std::atomic<uint32_t> flush_ack_;
+    volatile bool         playing_;
+
+    // audio callback side
+    uint32_t position_;
+    uint32_t block_start_;
+    uint32_t block_end_;
+};
+
+} // namespace daisy
+#endif
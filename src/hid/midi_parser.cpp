@@ -2,193 +2,221 @@
 
 using namespace daisy;
 
+constexpr uint8_t MidiParser::kUsbPacketSize[16];
+
 bool MidiParser::Parse(uint8_t byte, MidiEvent* event_out)
 {
-    // reset parser when status byte is received
+    const CompactMidiEvent* message = ParseByte(byte);
+    if(message == nullptr)
+        return false;
+
+    if(event_out != nullptr)
+    {
+        *event_out = message->ToMidiEvent();
+        if(message->type == SystemCommon
+           && message->sc_type == SystemExclusive)
+        {
+            event_out->sysex_message_len = sysex_message_len_;
+            for(size_t i = 0; i < sysex_message_len_; i++)
+                event_out->sysex_data[i] = sysex_data_[i];
+        }
+    }
+    return true;
+}
+
+bool MidiParser::Parse(uint8_t byte, CompactMidiEvent* event_out)
+{
+    const CompactMidiEvent* message = ParseByte(byte);
+    if(message == nullptr)
+        return false;
+
+    if(event_out != nullptr)
+    {
+        *event_out = *message;
+    }
+    return true;
+}
+
+const CompactMidiEvent* MidiParser::ParseByte(uint8_t byte)
+{
+    // System Real-Time messages may come between any two bytes, even within
+    // another message, which carries on after them
+    if((byte & 0xF8) == 0xF8)
+    {
+        realtime_message_.type     = SystemRealTime;
+        realtime_message_.channel  = byte & kChannelMask;
+        realtime_message_.srt_type = static_cast<SystemRealTimeType>(
+            byte & kSystemRealTimeMask);
+        return &realtime_message_;
+    }
+
     bool did_parse = false;
 
-    if((byte & kStatusByteMask) && pstate_ != ParserSysEx)
+    // only a completed SysEx message has a payload
+    incoming_message_.sysex_length = 0;
+
+    // reset parser when status byte is received
+    if((byte & kStatusByteMask) && !(pstate_ == ParserSysEx && byte == 0xf7))
     {
+        // a SysEx message cut short by another status byte is dropped
+        if(pstate_ == ParserSysEx && sysex_buffer_ != nullptr)
+            sysex_buffer_->DiscardMessage();
         pstate_ = ParserEmpty;
     }
+    else if(pstate_ == ParserEmpty && !(byte & kStatusByteMask))
+    {
+        // Handle as running status, data bytes without one are ignored
+        if(running_status_ == MessageLast)
+            return nullptr;
+        incoming_message_.type = running_status_;
+        pstate_                = ParserHasStatus;
+    }
+
     switch(pstate_)
     {
         case ParserEmpty:
-            // check byte for valid Status Byte
-            if(byte & kStatusByteMask)
+            // Get MessageType, and Channel
+            incoming_message_.channel = byte & kChannelMask;
+            incoming_message_.type
+                = static_cast<MidiMessageType>((byte & kMessageMask) >> 4);
+            pstate_ = ParserHasStatus;
+
+            if(incoming_message_.type == SystemCommon)
             {
-                // Get MessageType, and Channel
-                incoming_message_.channel = byte & kChannelMask;
-                incoming_message_.type
-                    = static_cast<MidiMessageType>((byte & kMessageMask) >> 4);
-                if((byte & 0xF8) == 0xF8)
-                    incoming_message_.type = SystemRealTime;
-
-                // Validate, and move on.
-                if(incoming_message_.type < MessageLast)
+                // System Common messages cancel the running status
+                running_status_           = MessageLast;
+                incoming_message_.channel = 0;
+                incoming_message_.sc_type
+                    = static_cast<SystemCommonType>(byte & 0x07);
+                //sysex
+                if(incoming_message_.sc_type == SystemExclusive)
                 {
-                    pstate_ = ParserHasStatus;
-
-                    if(incoming_message_.type == SystemCommon)
-                    {
-                        incoming_message_.channel = 0;
-                        incoming_message_.sc_type
-                            = static_cast<SystemCommonType>(byte & 0x07);
-                        //sysex
-                        if(incoming_message_.sc_type == SystemExclusive)
-                        {
-                            pstate_                             = ParserSysEx;
-                            incoming_message_.sysex_message_len = 0;
-                        }
-                        //short circuit
-                        else if(incoming_message_.sc_type > SongSelect)
-                        {
-                            pstate_ = ParserEmpty;
-                            if(event_out != nullptr)
-                            {
-                                *event_out = incoming_message_;
-                            }
-                            did_parse = true;
-                        }
-                    }
-                    else if(incoming_message_.type == SystemRealTime)
-                    {
-                        incoming_message_.srt_type
-                            = static_cast<SystemRealTimeType>(
-                                byte & kSystemRealTimeMask);
-
-                        //short circuit to start
-                        pstate_ = ParserEmpty;
-                        if(event_out != nullptr)
-                        {
-                            *event_out = incoming_message_;
-                        }
-                        did_parse = true;
-                    }
-                    else // Channel Voice or Channel Mode
-                    {
-                        running_status_ = incoming_message_.type;
-                    }
+                    pstate_            = ParserSysEx;
+                    sysex_message_len_ = 0;
+                    if(sysex_buffer_ != nullptr)
+                        sysex_buffer_->BeginMessage();
                 }
-                // Else we'll keep waiting for a valid incoming status byte
-            }
-            else
-            {
-                // Handle as running status
-                incoming_message_.type    = running_status_;
-                incoming_message_.data[0] = byte & kDataByteMask;
-                //check for single byte running status, really this only applies to channel pressure though
-                if(running_status_ == ChannelPressure
-                   || running_status_ == ProgramChange
-                   || incoming_message_.sc_type == MTCQuarterFrame
-                   || incoming_message_.sc_type == SongSelect)
+                //short circuit
+                else if(incoming_message_.sc_type > SongSelect)
                 {
-                    //Send the single byte update
-                    pstate_ = ParserEmpty;
-                    if(event_out != nullptr)
-                    {
-                        *event_out = incoming_message_;
-                    }
+                    pstate_   = ParserEmpty;
                     did_parse = true;
                 }
-                else
-                {
-                    pstate_ = ParserHasData0; //we need to get the 2nd byte yet.
-                }
+            }
+            else // Channel Voice or Channel Mode
+            {
+                running_status_ = incoming_message_.type;
             }
             break;
         case ParserHasStatus:
-            if((byte & kStatusByteMask) == 0)
+            incoming_message_.data[0] = byte;
+            if(incoming_message_.type == SystemCommon
+                   ? incoming_message_.sc_type == MTCQuarterFrame
+                         || incoming_message_.sc_type == SongSelect
+                   : incoming_message_.type == ChannelPressure
+                         || incoming_message_.type == ProgramChange)
             {
-                incoming_message_.data[0] = byte & kDataByteMask;
-                if(running_status_ == ChannelPressure
-                   || running_status_ == ProgramChange
-                   || incoming_message_.sc_type == MTCQuarterFrame
-                   || incoming_message_.sc_type == SongSelect)
-                {
-                    //these are just one data byte, so we short circuit back to start
-                    pstate_ = ParserEmpty;
-                    if(event_out != nullptr)
-                    {
-                        *event_out = incoming_message_;
-                    }
-                    did_parse = true;
-                }
-                else
-                {
-                    pstate_ = ParserHasData0;
-                }
-
-                //ChannelModeMessages (reserved Control Changes)
-                if(running_status_ == ControlChange
-                   && incoming_message_.data[0] > 119)
-                {
-                    incoming_message_.type    = ChannelMode;
-                    running_status_           = ChannelMode;
-                    incoming_message_.cm_type = static_cast<ChannelModeType>(
-                        incoming_message_.data[0] - 120);
-                }
+                //these are just one data byte, so we short circuit back to start
+                pstate_   = ParserEmpty;
+                did_parse = true;
             }
             else
             {
-                // invalid message go back to start ;p
-                pstate_ = ParserEmpty;
+                pstate_ = ParserHasData0;
             }
             break;
         case ParserHasData0:
-            if((byte & kStatusByteMask) == 0)
-            {
-                incoming_message_.data[1] = byte & kDataByteMask;
-
-                //velocity 0 NoteOns are NoteOffs
-                if(running_status_ == NoteOn && incoming_message_.data[1] == 0)
-                {
-                    incoming_message_.type = NoteOff;
-                }
+            incoming_message_.data[1] = byte;
 
-                // At this point the message is valid, and we can complete this MidiEvent
-                if(event_out != nullptr)
-                {
-                    *event_out = incoming_message_;
-                }
-                did_parse = true;
+            //velocity 0 NoteOns are NoteOffs
+            if(incoming_message_.type == NoteOn
+               && incoming_message_.data[1] == 0)
+            {
+                incoming_message_.type = NoteOff;
             }
-            else
+            //ChannelModeMessages (reserved Control Changes)
+            else if(incoming_message_.type == ControlChange
+                    && incoming_message_.data[0] > 119)
             {
-                // invalid message go back to start ;p
-                pstate_ = ParserEmpty;
+                incoming_message_.type = ChannelMode;
             }
-            // Regardless, of whether the data was valid or not we go back to empty
-            // because either the message is queued for handling or its not.
-            pstate_ = ParserEmpty;
+
+            // At this point the message is valid, and we can complete this MidiEvent
+            did_parse = true;
+            pstate_   = ParserEmpty;
             break;
         case ParserSysEx:
             // end of sysex
             if(byte == 0xf7)
             {
                 pstate_ = ParserEmpty;
-                if(event_out != nullptr)
-                {
-                    *event_out = incoming_message_;
-                }
+                if(sysex_buffer_ != nullptr)
+                    incoming_message_.sysex_length
+                        = sysex_buffer_->GetPendingSize();
                 did_parse = true;
             }
-            else if(incoming_message_.sysex_message_len < SYSEX_BUFFER_LEN)
+            else
             {
-                incoming_message_
-                    .sysex_data[incoming_message_.sysex_message_len]
-                    = byte;
-                incoming_message_.sysex_message_len++;
+                if(sysex_message_len_ < SYSEX_BUFFER_LEN)
+                    sysex_data_[sysex_message_len_++] = byte;
+                // bytes that don't fit into the buffer are dropped
+                if(sysex_buffer_ != nullptr)
+                    sysex_buffer_->Append(byte);
             }
             break;
         default: break;
     }
 
-    return did_parse;
+    return did_parse ? &incoming_message_ : nullptr;
+}
+
+MidiParser::UsbPacketResult MidiParser::DecodeUsbPacket(const uint8_t* packet)
+{
+    const uint8_t cin    = packet[0] & 0x0F;
+    const uint8_t status = packet[1];
+    if(kUsbPacketSize[cin] == 0)
+        return UsbPacketInvalid; // reserved, or a cable event
+
+    // single byte real-time message, also in the middle of a SysEx message
+    if((cin == 0x5 || cin == 0xF) && (status & 0xF8) == 0xF8)
+    {
+        // like the byte parser, the channel holds the lower nibble
+        usb_message_.type     = SystemRealTime;
+        usb_message_.channel  = status & kChannelMask;
+        usb_message_.srt_type = static_cast<SystemRealTimeType>(
+            status & kSystemRealTimeMask);
+        usb_message_.sysex_length = 0;
+        return UsbPacketEvent;
+    }
+
+    // the CIN of a channel message is the upper nibble of its status
+    if(cin < 0x8 || cin > 0xE)
+        return UsbPacketBytes;
+    if((status >> 4) != cin)
+        return UsbPacketInvalid;
+
+    const MidiMessageType type
+        = static_cast<MidiMessageType>((status & kMessageMask) >> 4);
+    usb_message_.type         = type;
+    usb_message_.channel      = status & kChannelMask;
+    usb_message_.data[0]      = packet[2] & kDataByteMask;
+    usb_message_.data[1]      = packet[3] & kDataByteMask;
+    usb_message_.sysex_length = 0;
+
+    //velocity 0 NoteOns are NoteOffs
+    if(type == NoteOn && usb_message_.data[1] == 0)
+        usb_message_.type = NoteOff;
+    //ChannelModeMessages (reserved Control Changes)
+    else if(type == ControlChange && usb_message_.data[0] > 119)
+        usb_message_.type = ChannelMode;
+    return UsbPacketEvent;
 }
 
 void MidiParser::Reset()
 {
     pstate_                = ParserEmpty;
     incoming_message_.type = MessageLast;
+    running_status_        = MessageLast;
+    if(sysex_buffer_ != nullptr)
+        sysex_buffer_->DiscardMessage();
 }
@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include "hid/MidiEvent.h"
+#include "hid/midi_sysex.h"
 
 namespace daisy
 {
@@ -15,7 +16,13 @@ namespace daisy
 class MidiParser
 {
   public:
-    MidiParser(){};
+    MidiParser()
+    : pstate_(ParserEmpty),
+      incoming_message_(),
+      usb_message_(),
+      realtime_message_(),
+      running_status_(MessageLast),
+      sysex_buffer_(nullptr){};
     ~MidiParser() {}
 
     inline void Init() { Reset(); }
@@ -30,9 +37,122 @@ class MidiParser
      * @param event_out Pointer to output event object, value assigned on parse success
      * @return true     If a new event was parsed
      * @return false    If no new event was parsed
+     *
+     * @note SysEx payloads longer than SYSEX_BUFFER_LEN bytes are truncated.
+     *       Real-Time messages are parsed wherever they come, also between
+     *       the bytes of another message. A SysEx message that ends with a
+     *       status byte other than End of Exclusive is dropped. SysEx and
+     *       System Common messages cancel the running status.
      */
     bool Parse(uint8_t byte, MidiEvent *event_out);
 
+    /**
+     * @brief Parse one MIDI byte into a CompactMidiEvent, like the MidiEvent
+     *        version of Parse().
+     *        SysEx payloads are written to the buffer set with
+     *        SetSysExBuffer().
+     *        When a SysEx event is returned, its payload of sysex_length bytes
+     *        is still pending in that buffer. Call CommitMessage() on the
+     *        buffer to keep it, or DiscardMessage() if the event is dropped.
+     *
+     * @param byte      Raw MIDI byte to parse
+     * @param event_out Pointer to output event object, value assigned on parse success
+     * @return true     If a new event was parsed
+     * @return false    If no new event was parsed
+     */
+    bool Parse(uint8_t byte, CompactMidiEvent *event_out);
+
+    /**
+     * @brief Parses a span of MIDI bytes, and pushes every complete event
+     *        straight into a sink, without creating temporary events.
+     *        The sink can be a FIFO<CompactMidiEvent, N> or any other type
+     *        with a `bool PushBack(const CompactMidiEvent&)` function.
+     *        The SysEx payload of an event is committed to the buffer set
+     *        with SetSysExBuffer() if the sink accepts the event, and
+     *        discarded otherwise.
+     *
+     * @param data      Raw MIDI bytes to parse
+     * @param size      Number of bytes
+     * @param sink      Destination for the parsed events
+     * @return          Number of events that were accepted by the sink
+     */
+    template <typename Sink>
+    size_t Parse(const uint8_t *data, size_t size, Sink &sink)
+    {
+        size_t num_events = 0;
+        for(size_t i = 0; i < size; i++)
+        {
+            const CompactMidiEvent *event = ParseByte(data[i]);
+            if(event != nullptr && PushEvent(sink, *event))
+                num_events++;
+        }
+        return num_events;
+    }
+
+    /**
+     * @brief Parses a span of 4 byte USB-MIDI event packets, and pushes
+     *        every complete event into a sink, like the byte span version
+     *        of Parse().
+     *        Channel and real-time messages are decoded straight from their
+     *        packet, using the Code Index Number. The bytes of other system
+     *        messages and SysEx go through the byte parser, so SysEx
+     *        payloads end up in the buffer set with SetSysExBuffer().
+     *        Channel and real-time messages can be interleaved with the
+     *        packets of a SysEx message.
+     *
+     * @param packets   USB-MIDI event packets, the cable number is ignored
+     * @param size      Number of bytes, a trailing partial packet is ignored
+     * @param sink      Destination for the parsed events
+     * @return          Number of events that were accepted by the sink
+     */
+    template <typename Sink>
+    size_t ParseUsbPackets(const uint8_t *packets, size_t size, Sink &sink)
+    {
+        size_t num_events = 0;
+        for(size_t i = 0; i + 4 <= size; i += 4)
+        {
+            const uint8_t *packet = packets + i;
+            switch(DecodeUsbPacket(packet))
+            {
+                case UsbPacketEvent:
+                    if(PushEvent(sink, usb_message_))
+                        num_events++;
+                    break;
+                case UsbPacketBytes:
+                    for(uint8_t b = 1; b <= kUsbPacketSize[packet[0] & 0x0F];
+                        b++)
+                    {
+                        const CompactMidiEvent *event = ParseByte(packet[b]);
+                        if(event != nullptr && PushEvent(sink, *event))
+                            num_events++;
+                    }
+                    break;
+                default: break;
+            }
+        }
+        return num_events;
+    }
+
+    /**
+     * @brief Sets the buffer that SysEx payloads are written to,
+     *        or nullptr to only keep the legacy SysEx data of MidiEvent.
+     */
+    void SetSysExBuffer(MidiSysExBufferBase *buffer)
+    {
+        sysex_buffer_ = buffer;
+    }
+
+    /**
+     * @brief Sets the timestamp of the events that are completed from now on,
+     *        usually System::GetTick() when the bytes were received.
+     */
+    void SetTimestamp(uint32_t timestamp)
+    {
+        incoming_message_.timestamp = timestamp;
+        usb_message_.timestamp      = timestamp;
+        realtime_message_.timestamp = timestamp;
+    }
+
     /**
      * @brief Reset parser to default state
      */
@@ -47,16 +167,58 @@ class MidiParser
         ParserSysEx,
     };
 
-    ParserState     pstate_;
-    MidiEvent       incoming_message_;
-    MidiMessageType running_status_;
+    enum UsbPacketResult
+    {
+        UsbPacketEvent,  /**< usb_message_ holds the event */
+        UsbPacketBytes,  /**< the bytes need the byte parser */
+        UsbPacketInvalid,
+    };
+
+    /** Advances the state machine.
+     *  Returns the completed event, or nullptr. */
+    const CompactMidiEvent *ParseByte(uint8_t byte);
+
+    /** Decodes channel and real-time messages straight into usb_message_,
+     *  leaving the state of the byte parser alone */
+    UsbPacketResult DecodeUsbPacket(const uint8_t *packet);
+
+    /** Hands an event to a sink, and commits or discards its SysEx
+     *  payload. Returns true if the sink accepted it. */
+    template <typename Sink>
+    bool PushEvent(Sink &sink, const CompactMidiEvent &event)
+    {
+        const bool accepted = sink.PushBack(event);
+        if(event.sysex_length > 0)
+        {
+            if(accepted)
+                sysex_buffer_->CommitMessage();
+            else
+                sysex_buffer_->DiscardMessage();
+        }
+        return accepted;
+    }
+
+    ParserState          pstate_;
+    CompactMidiEvent     incoming_message_;
+    CompactMidiEvent     usb_message_;
+    CompactMidiEvent     realtime_message_;
+    MidiMessageType      running_status_;
+    MidiSysExBufferBase *sysex_buffer_;
+
+    // SysEx payload for the MidiEvent version of Parse()
+    uint8_t sysex_data_[SYSEX_BUFFER_LEN];
+    uint8_t sysex_message_len_;
 
     // Masks to check for message type, and byte content
-    const uint8_t kStatusByteMask     = 0x80;
-    const uint8_t kMessageMask        = 0x70;
-    const uint8_t kDataByteMask       = 0x7F;
-    const uint8_t kChannelMask        = 0x0F;
-    const uint8_t kSystemRealTimeMask = 0x07;
+    static constexpr uint8_t kStatusByteMask     = 0x80;
+    static constexpr uint8_t kMessageMask        = 0x70;
+    static constexpr uint8_t kDataByteMask       = 0x7F;
+    static constexpr uint8_t kChannelMask        = 0x0F;
+    static constexpr uint8_t kSystemRealTimeMask = 0x07;
+
+    /** MIDI bytes in a USB-MIDI packet, by Code Index Number */
+    static constexpr uint8_t kUsbPacketSize[16]
+        = {0, 0, 2, 3, 3, 1, 2, 3, 3, 3, 3, 3, 2, 2, 3, 1};
 };
 
 } // namespace daisy
@@ -0,0 +1,159 @@
+#include "hid/midi_router.h"
+
+using namespace daisy;
+
+constexpr size_t MidiRouter::kMaxPorts;
+
+void MidiRouter::Init()
+{
+    num_ports_        = 0;
+    callback_         = nullptr;
+    callback_context_ = nullptr;
+}
+
+void MidiRouter::Connect(size_t from, size_t to, bool connected)
+{
+    if(from >= num_ports_ || to >= num_ports_)
+        return;
+    if(connected)
+        ports_[from].destinations |= 1 << to;
+    else
+        ports_[from].destinations &= ~(1 << to);
+}
+
+void MidiRouter::SetPortConfig(size_t port, const PortConfig& config)
+{
+    if(port < num_ports_)
+        ports_[port].config = config;
+}
+
+void MidiRouter::SetEventCallback(EventCallback callback, void* context)
+{
+    callback_         = callback;
+    callback_context_ = context;
+}
+
+void MidiRouter::ResetStats(size_t port)
+{
+    PortStats& stats = ports_[port].stats;
+    stats.rx_events  = 0;
+    stats.filtered   = 0;
+    stats.tx_events  = 0;
+    stats.tx_bytes   = 0;
+    stats.dropped    = 0;
+}
+
+void MidiRouter::Process()
+{
+    for(size_t p = 0; p < num_ports_; p++)
+    {
+        Port&            port = ports_[p];
+        CompactMidiEvent event;
+        while(port.pop(port.handler, &event))
+        {
+            port.stats.rx_events++;
+            if(!port.config.in.Passes(event))
+            {
+                port.stats.filtered++;
+                continue;
+            }
+            if(IsChannelMessage(event))
+                event.channel = port.config.channel_map[event.channel] & 0x0F;
+            Forward(p, event);
+        }
+    }
+
+    // everything is queued, send it off
+    for(size_t p = 0; p < num_ports_; p++)
+        ports_[p].transmit(ports_[p].handler);
+}
+
+void MidiRouter::Forward(size_t from, CompactMidiEvent& event)
+{
+    const Port& source = ports_[from];
+
+    // SysEx payloads are read into the message, between the start and end
+    // bytes, as long as they fit
+    const uint8_t* sysex     = nullptr;
+    bool           too_long  = false;
+    const size_t   max_sysex = sizeof(message_) - 2;
+    if(event.sysex_length > 0)
+    {
+        too_long = event.sysex_length > max_sysex;
+        event.sysex_length
+            = source.read_sysex(source.handler, message_ + 1, max_sysex);
+        sysex = message_ + 1;
+    }
+
+    if(callback_)
+        callback_(event, sysex, from, callback_context_);
+    if(source.destinations == 0)
+        return;
+
+    const size_t size = ToBytes(event, sysex, message_);
+    for(size_t to = 0; to < num_ports_; to++)
+    {
+        Port& dest = ports_[to];
+        if(!(source.destinations & (1 << to)) || !dest.config.out.Passes(event))
+            continue;
+        if(too_long || size == 0 || !dest.send(dest.handler, message_, size))
+        {
+            dest.stats.dropped++;
+            continue;
+        }
+        dest.stats.tx_events++;
+        dest.stats.tx_bytes += size;
+    }
+}
+
+size_t MidiRouter::ToBytes(const CompactMidiEvent& event,
+                           const uint8_t*          sysex,
+                           uint8_t*                bytes)
+{
+    switch(event.type)
+    {
+        case NoteOff:
+        case NoteOn:
+        case PolyphonicKeyPressure:
+        case ControlChange:
+        case PitchBend:
+        case ChannelMode:
+        {
+            const uint8_t type = event.type == ChannelMode
+                                     ? static_cast<uint8_t>(ControlChange)
+                                     : static_cast<uint8_t>(event.type);
+            bytes[0]           = 0x80 | (type << 4) | (event.channel & 0x0F);
+            bytes[1]           = event.data[0] & 0x7F;
+            bytes[2]           = event.data[1] & 0x7F;
+            return 3;
+        }
+        case ProgramChange:
+        case ChannelPressure:
+            bytes[0] = 0x80 | (event.type << 4) | (event.channel & 0x0F);
+            bytes[1] = event.data[0] & 0x7F;
+            return 2;
+        case SystemCommon:
+            bytes[0] = 0xF0 | event.sc_type;
+            if(event.sc_type == SystemExclusive)
+            {
+                // the payload may already be in place
+                if(bytes + 1 != sysex)
+                    for(size_t i = 0; i < event.sysex_length; i++)
+                        bytes[1 + i] = sysex[i];
+                bytes[event.sysex_length + 1] = 0xF7;
+                return event.sysex_length + 2;
+            }
+            bytes[1] = event.data[0] & 0x7F;
+            bytes[2] = event.data[1] & 0x7F;
+            switch(event.sc_type)
+            {
+                case MTCQuarterFrame:
+                case SongSelect: return 2;
+                case SongPositionPointer: return 3;
+                case SysExEnd: return 0;
+                default: return 1;
+            }
+        case SystemRealTime: bytes[0] = 0xF8 | event.srt_type; return 1;
+        default: return 0;
+    }
+}
@@ -0,0 +1,247 @@
+#pragma once
+#ifndef DSY_MIDI_ROUTER_H
+#define DSY_MIDI_ROUTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "hid/MidiEvent.h"
+#include "hid/midi_util.h"
+
+namespace daisy
+{
+/** @brief Routes and merges MIDI between several MidiHandlers
+ *  @ingroup midi
+ *  @details Each port is a MidiHandler, with any transport. Process()
+ *           pops the events that the ports received, filters and remaps
+ *           them, and queues them on the ports they are routed to as
+ *           compact raw messages, without a MidiEvent in between. Then it
+ *           starts the transmission on every port, so an event is on its
+ *           way one Process() call after it was received.
+ *
+ *           Any port can be routed to any other ports, including itself
+ *           (MIDI thru), and several ports routed to the same port are
+ *           merged. Every event is forwarded as a whole message, so merged
+ *           streams don't interleave. Per-port counters report the
+ *           throughput, and events that were filtered or dropped.
+ *
+ *           SysEx messages up to SYSEX_BUFFER_LEN bytes are forwarded,
+ *           longer ones are dropped.
+ *
+ *  Usage, a DIN/USB bridge that also plays a synth:
+ *  @code
+ *  MidiUartHandler din;
+ *  MidiUsbHandler  usb;
+ *  MidiRouter      router;
+ *
+ *  router.Init();
+ *  MidiRouter::PortConfig config;
+ *  config.out.types &= ~MidiRouter::Filter::TypeBit(SystemRealTime);
+ *  const size_t din_port = router.AddPort(din);
+ *  const size_t usb_port = router.AddPort(usb, config); // no clock to USB
+ *  router.Connect(din_port, usb_port);
+ *  router.Connect(usb_port, din_port);
+ *  router.SetEventCallback(PlaySynth, nullptr);
+ *
+ *  while(1)
+ *  {
+ *      din.Listen();
+ *      router.Process();
+ *  }
+ *  @endcode
+ */
+class MidiRouter
+{
+  public:
+    /** Maximum number of ports */
+    static constexpr size_t kMaxPorts = 4;
+
+    /** Selects messages by channel and type */
+    struct Filter
+    {
+        /** Bit n passes channel n of channel messages */
+        uint16_t channels = 0xFFFF;
+        /** Bit n passes MidiMessageType n, see TypeBit() */
+        uint16_t types = 0xFFFF;
+
+        /** Returns true if the event passes the filter */
+        bool Passes(const CompactMidiEvent& event) const
+        {
+            if(!(types & TypeBit(event.type)))
+                return false;
+            return !IsChannelMessage(event)
+                   || (channels & (1 << event.channel));
+        }
+
+        static constexpr uint16_t TypeBit(MidiMessageType type)
+        {
+            return static_cast<uint16_t>(1u << type);
+        }
+    };
+
+    struct PortConfig
+    {
+        /** Events that are received from the port */
+        Filter in;
+        /** Events that are sent to the port */
+        Filter out;
+        /** Received channel messages on channel n are forwarded on
+         *  channel_map[n], after the in filter */
+        uint8_t channel_map[16];
+
+        PortConfig()
+        {
+            for(uint8_t ch = 0; ch < 16; ch++)
+                channel_map[ch] = ch;
+        }
+    };
+
+    /** Counters of a port, they wrap around */
+    struct PortStats
+    {
+        uint32_t rx_events; /**< events received from the port */
+        uint32_t filtered;  /**< received events rejected by the in filter */
+        uint32_t tx_events; /**< events queued to be sent to the port */
+        uint32_t tx_bytes;  /**< bytes queued to be sent to the port */
+        /** events for the port that didn't fit into its message queue, or
+         *  SysEx messages that were too long to forward */
+        uint32_t dropped;
+    };
+
+    /** Called with every received event that passes the in filter of its
+     *  port, after remapping.
+     *  \param sysex the payload of a SysEx event, nullptr for others
+     */
+    typedef void (*EventCallback)(const CompactMidiEvent& event,
+                                  const uint8_t*          sysex,
+                                  size_t                  port,
+                                  void*                   context);
+
+    MidiRouter() {}
+    ~MidiRouter() {}
+
+    /** Removes all ports */
+    void Init();
+
+    /** Adds a MidiHandler as a port, with the default PortConfig
+     *  \return the number of the port
+     */
+    template <typename Handler>
+    size_t AddPort(Handler& handler)
+    {
+        return AddPort(handler, PortConfig());
+    }
+
+    /** Adds a MidiHandler as a port. Its events are read by Process()
+     *  from now on, not by the application.
+     *  \return the number of the port, or kMaxPorts if all are taken
+     */
+    template <typename Handler>
+    size_t AddPort(Handler& handler, const PortConfig& config)
+    {
+        if(num_ports_ >= kMaxPorts)
+            return kMaxPorts;
+        Port& port        = ports_[num_ports_];
+        port.handler      = &handler;
+        port.pop          = &HandlerPort<Handler>::Pop;
+        port.read_sysex   = &HandlerPort<Handler>::ReadSysEx;
+        port.send         = &HandlerPort<Handler>::Send;
+        port.transmit     = &HandlerPort<Handler>::Transmit;
+        port.config       = config;
+        port.destinations = 0;
+        ResetStats(num_ports_);
+        return num_ports_++;
+    }
+
+    /** Forwards the events received on a port to another port, or to
+     *  itself for MIDI thru */
+    void Connect(size_t from, size_t to, bool connected = true);
+
+    /** Changes the configuration of a port */
+    void SetPortConfig(size_t port, const PortConfig& config);
+
+    const PortConfig& GetPortConfig(size_t port) const
+    {
+        return ports_[port].config;
+    }
+
+    /** Passes received events to the application as well */
+    void SetEventCallback(EventCallback callback, void* context);
+
+    /** Forwards all received events, and starts transmitting them */
+    void Process();
+
+    const PortStats& GetStats(size_t port) const { return ports_[port].stats; }
+
+    void ResetStats(size_t port);
+
+    size_t GetNumPorts() const { return num_ports_; }
+
+    /** Returns true for channel voice and channel mode messages */
+    static bool IsChannelMessage(const CompactMidiEvent& event)
+    {
+        return event.type < SystemCommon || event.type == ChannelMode;
+    }
+
+    /** Writes the raw MIDI message of an event
+     *  \param sysex payload of SysEx events
+     *  \param bytes destination, at least 3 bytes, or the SysEx payload
+     *         plus 2 bytes
+     *  \return number of bytes, 0 for invalid events
+     */
+    static size_t ToBytes(const CompactMidiEvent& event,
+                          const uint8_t*          sysex,
+                          uint8_t*                bytes);
+
+  private:
+    /** Type-erased access to a MidiHandler */
+    struct Port
+    {
+        void* handler;
+        bool (*pop)(void* handler, CompactMidiEvent* event);
+        size_t (*read_sysex)(void* handler, uint8_t* dest, size_t size);
+        bool (*send)(void* handler, const uint8_t* data, size_t size);
+        void (*transmit)(void* handler);
+
+        PortConfig config;
+        PortStats  stats;
+        uint8_t    destinations; /**< bit n forwards to port n */
+    };
+
+    template <typename Handler>
+    struct HandlerPort
+    {
+        static bool Pop(void* handler, CompactMidiEvent* event)
+        {
+            Handler* h = static_cast<Handler*>(handler);
+            if(!h->HasEvents())
+                return false;
+            *event = h->PopCompactEvent();
+            return true;
+        }
+        static size_t ReadSysEx(void* handler, uint8_t* dest, size_t size)
+        {
+            return static_cast<Handler*>(handler)->ReadSysEx(dest, size);
+        }
+        static bool Send(void* handler, const uint8_t* data, size_t size)
+        {
+            return static_cast<Handler*>(handler)->SendMessage(data, size);
+        }
+        static void Transmit(void* handler)
+        {
+            static_cast<Handler*>(handler)->TransmitMessages();
+        }
+    };
+
+    void Forward(size_t from, CompactMidiEvent& event);
+
+    Port          ports_[kMaxPorts];
+    size_t        num_ports_;
+    EventCallback callback_;
+    void*         callback_context_;
+
+    /** the message being forwarded */
+    uint8_t message_[MidiTxMessage::kMaxDataSize];
+};
+
+} // namespace daisy
+#endif
@@ -0,0 +1,148 @@
+#pragma once
+#ifndef DSY_MIDI_SYSEX_H
+#define DSY_MIDI_SYSEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+namespace daisy
+{
+/** @brief   Capacity-independent base class for MidiSysExBuffer.
+ *           Use MidiSysExBuffer instead.
+ *  @ingroup midi
+ */
+class MidiSysExBufferBase
+{
+  protected:
+    MidiSysExBufferBase(uint8_t* buffer, size_t size)
+    : buffer_(buffer), mask_(size - 1)
+    {
+        Clear();
+    }
+
+  public:
+    /** Removes all payloads, including a message that is being written.
+     *  Not thread-safe, call while nothing is parsed.
+     */
+    void Clear()
+    {
+        read_.store(0, std::memory_order_relaxed);
+        write_.store(0, std::memory_order_relaxed);
+        pending_ = 0;
+    }
+
+    /** Returns the total capacity in bytes */
+    size_t GetCapacity() const { return mask_ + 1; }
+
+    // ======== writer side (the parser) ========
+
+    /** Starts a new message, discarding a message that was not committed */
+    void BeginMessage() { pending_ = 0; }
+
+    /** Adds a byte to the current message.
+     *  \return false if the buffer is full and the byte was dropped
+     */
+    bool Append(uint8_t byte)
+    {
+        const size_t write = write_.load(std::memory_order_relaxed);
+        if(write + pending_ - read_.load(std::memory_order_acquire) > mask_)
+            return false;
+        buffer_[(write + pending_) & mask_] = byte;
+        pending_++;
+        return true;
+    }
+
+    /** Returns the number of bytes stored for the current message */
+    size_t GetPendingSize() const { return pending_; }
+
+    /** Makes the current message available to the reader */
+    void CommitMessage()
+    {
+        write_.store(write_.load(std::memory_order_relaxed) + pending_,
+                     std::memory_order_release);
+        pending_ = 0;
+    }
+
+    /** Discards the current message, e.g. if its event couldn't be queued */
+    void DiscardMessage() { pending_ = 0; }
+
+    // ======== reader side ========
+
+    /** Returns the number of committed bytes that can be read */
+    size_t GetReadable() const
+    {
+        return write_.load(std::memory_order_acquire)
+               - read_.load(std::memory_order_relaxed);
+    }
+
+    /** Copies up to size bytes to dest and removes them from the buffer.
+     *  \return the number of bytes that were read
+     */
+    size_t Read(uint8_t* dest, size_t size)
+    {
+        const size_t readable = GetReadable();
+        if(size > readable)
+            size = readable;
+        const size_t read = read_.load(std::memory_order_relaxed);
+        for(size_t i = 0; i < size; i++)
+            dest[i] = buffer_[(read + i) & mask_];
+        read_.store(read + size, std::memory_order_release);
+        return size;
+    }
+
+    /** Removes up to size bytes without reading them.
+     *  \return the number of bytes that were removed
+     */
+    size_t Skip(size_t size)
+    {
+        const size_t readable = GetReadable();
+        if(size > readable)
+            size = readable;
+        read_.store(read_.load(std::memory_order_relaxed) + size,
+                    std::memory_order_release);
+        return size;
+    }
+
+  private:
+    MidiSysExBufferBase(const MidiSysExBufferBase&) = delete;
+
+    uint8_t*     buffer_;
+    const size_t mask_;
+
+    /** free-running positions, owned by the reader and the writer */
+    std::atomic<size_t> read_;
+    std::atomic<size_t> write_;
+
+    /** bytes of the message that is being written, owned by the writer */
+    size_t pending_;
+};
+
+/** @brief   Byte storage for the payloads of received SysEx messages
+ *  @details The parser streams SysEx bytes into this buffer instead of into
+ *           the events, so messages of any length up to the capacity can be
+ *           received without making every queued event larger.
+ *           Payloads are stored back to back in the order of their events.
+ *           The parser and the reader may run in different contexts (e.g.
+ *           an interrupt and the main loop).
+ *  @tparam  size capacity in bytes, must be a power of two
+ *  @ingroup midi
+ */
+template <size_t size>
+class MidiSysExBuffer : public MidiSysExBufferBase
+{
+  public:
+    static_assert(size > 0 && (size & (size - 1)) == 0,
+                  "MidiSysExBuffer size must be a power of two");
+    static_assert(size <= 0x8000,
+                  "The length of a SysEx payload must fit CompactMidiEvent");
+
+    MidiSysExBuffer() : MidiSysExBufferBase(buffer_, size) {}
+
+  private:
+    uint8_t buffer_[size];
+};
+
+} // namespace daisy
+
+#endif
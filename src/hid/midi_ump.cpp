@@ -0,0 +1,528 @@
+#include "hid/midi_ump.h"
+
+using namespace daisy;
+
+// ================ UmpPacket ================
+
+static uint32_t UmpWord(UmpMessageType type,
+                        uint8_t        group,
+                        uint8_t        status,
+                        uint8_t        byte3,
+                        uint8_t        byte4)
+{
+    return (static_cast<uint32_t>(type) << 28)
+           | (static_cast<uint32_t>(group & 0x0F) << 24)
+           | (static_cast<uint32_t>(status) << 16)
+           | (static_cast<uint32_t>(byte3) << 8) | byte4;
+}
+
+bool UmpPacket::Decode(Midi2Event* event) const
+{
+    if(GetMessageType() != UmpMessageType::Midi2ChannelVoice)
+        return false;
+
+    const uint8_t byte3 = (words[0] >> 8) & 0xFF;
+    const uint8_t byte4 = words[0] & 0xFF;
+    event->type         = static_cast<Midi2Event::Type>(GetStatus() >> 4);
+    event->group        = GetGroup();
+    event->channel      = GetChannel();
+    event->index        = byte3 & 0x7F;
+    event->bank         = 0;
+    event->flags        = byte4;
+    event->velocity     = 0;
+    event->attribute    = 0;
+    event->value        = words[1];
+    switch(event->type)
+    {
+        case Midi2Event::NoteOff:
+        case Midi2Event::NoteOn:
+            event->velocity  = words[1] >> 16;
+            event->attribute = words[1] & 0xFFFF;
+            event->value     = 0;
+            break;
+        case Midi2Event::RegisteredController:
+        case Midi2Event::AssignableController:
+        case Midi2Event::RelativeRegisteredController:
+        case Midi2Event::RelativeAssignableController:
+            event->bank  = byte3 & 0x7F;
+            event->index = byte4 & 0x7F;
+            event->flags = 0;
+            break;
+        case Midi2Event::ProgramChange:
+            event->index = (words[1] >> 24) & 0x7F;
+            event->bank  = (words[1] >> 8) & 0x7F;
+            event->value = words[1] & 0x7F;
+            break;
+        default: break;
+    }
+    return true;
+}
+
+UmpPacket
+UmpPacket::Midi1(uint8_t group, uint8_t status, uint8_t data0, uint8_t data1)
+{
+    const UmpMessageType type = status >= 0xF0
+                                    ? UmpMessageType::System
+                                    : UmpMessageType::Midi1ChannelVoice;
+    UmpPacket packet = {};
+    packet.words[0]  = UmpWord(type, group, status, data0 & 0x7F, data1 & 0x7F);
+    return packet;
+}
+
+UmpPacket UmpPacket::Midi2(uint8_t  group,
+                           uint8_t  opcode,
+                           uint8_t  channel,
+                           uint8_t  byte3,
+                           uint8_t  byte4,
+                           uint32_t word1)
+{
+    UmpPacket packet = {};
+    packet.words[0]  = UmpWord(UmpMessageType::Midi2ChannelVoice,
+                              group,
+                              (opcode << 4) | (channel & 0x0F),
+                              byte3,
+                              byte4);
+    packet.words[1]  = word1;
+    return packet;
+}
+
+UmpPacket UmpPacket::NoteOn(uint8_t  group,
+                            uint8_t  channel,
+                            uint8_t  note,
+                            uint16_t velocity,
+                            uint8_t  attribute_type,
+                            uint16_t attribute)
+{
+    return Midi2(group,
+                 Midi2Event::NoteOn,
+                 channel,
+                 note & 0x7F,
+                 attribute_type,
+                 (static_cast<uint32_t>(velocity) << 16) | attribute);
+}
+
+UmpPacket UmpPacket::NoteOff(uint8_t  group,
+                             uint8_t  channel,
+                             uint8_t  note,
+                             uint16_t velocity,
+                             uint8_t  attribute_type,
+                             uint16_t attribute)
+{
+    return Midi2(group,
+                 Midi2Event::NoteOff,
+                 channel,
+                 note & 0x7F,
+                 attribute_type,
+                 (static_cast<uint32_t>(velocity) << 16) | attribute);
+}
+
+UmpPacket UmpPacket::PolyPressure(uint8_t  group,
+                                  uint8_t  channel,
+                                  uint8_t  note,
+                                  uint32_t value)
+{
+    return Midi2(
+        group, Midi2Event::PolyPressure, channel, note & 0x7F, 0, value);
+}
+
+UmpPacket UmpPacket::ControlChange(uint8_t  group,
+                                   uint8_t  channel,
+                                   uint8_t  index,
+                                   uint32_t value)
+{
+    return Midi2(
+        group, Midi2Event::ControlChange, channel, index & 0x7F, 0, value);
+}
+
+UmpPacket UmpPacket::RegisteredController(uint8_t  group,
+                                          uint8_t  channel,
+                                          uint8_t  bank,
+                                          uint8_t  index,
+                                          uint32_t value)
+{
+    return Midi2(group,
+                 Midi2Event::RegisteredController,
+                 channel,
+                 bank & 0x7F,
+                 index & 0x7F,
+                 value);
+}
+
+UmpPacket UmpPacket::AssignableController(uint8_t  group,
+                                          uint8_t  channel,
+                                          uint8_t  bank,
+                                          uint8_t  index,
+                                          uint32_t value)
+{
+    return Midi2(group,
+                 Midi2Event::AssignableController,
+                 channel,
+                 bank & 0x7F,
+                 index & 0x7F,
+                 value);
+}
+
+UmpPacket UmpPacket::ProgramChange(uint8_t group,
+                                   uint8_t channel,
+                                   uint8_t program,
+                                   bool    bank_valid,
+                                   uint8_t bank_msb,
+                                   uint8_t bank_lsb)
+{
+    return Midi2(group,
+                 Midi2Event::ProgramChange,
+                 channel,
+                 0,
+                 bank_valid ? 1 : 0,
+                 (static_cast<uint32_t>(program & 0x7F) << 24)
+                     | ((bank_msb & 0x7F) << 8) | (bank_lsb & 0x7F));
+}
+
+UmpPacket
+UmpPacket::ChannelPressure(uint8_t group, uint8_t channel, uint32_t value)
+{
+    return Midi2(group, Midi2Event::ChannelPressure, channel, 0, 0, value);
+}
+
+UmpPacket UmpPacket::PitchBend(uint8_t group, uint8_t channel, uint32_t value)
+{
+    return Midi2(group, Midi2Event::PitchBend, channel, 0, 0, value);
+}
+
+UmpPacket UmpPacket::PerNotePitchBend(uint8_t  group,
+                                      uint8_t  channel,
+                                      uint8_t  note,
+                                      uint32_t value)
+{
+    return Midi2(
+        group, Midi2Event::PerNotePitchBend, channel, note & 0x7F, 0, value);
+}
+
+// ================ UmpTranslator ================
+
+void UmpTranslator::Init(uint8_t group)
+{
+    group_ = group & 0x0F;
+    for(ChannelState& channel : channels_)
+    {
+        channel.bank_msb    = 0;
+        channel.bank_lsb    = 0;
+        channel.bank_valid  = false;
+        channel.param_msb   = 0x7F;
+        channel.param_lsb   = 0x7F;
+        channel.param_nrpn  = false;
+        channel.param_valid = false;
+        channel.data_msb    = 0;
+    }
+}
+
+bool UmpTranslator::ToUmp(const CompactMidiEvent& event, UmpPacket* packet)
+{
+    const uint8_t ch = event.channel & 0x0F;
+    switch(event.type)
+    {
+        case NoteOff:
+        case NoteOn:
+        {
+            const uint16_t velocity = Upscale(event.data[1], 7, 16);
+            const uint8_t  note     = event.data[0];
+            if(event.type == NoteOn)
+                *packet = UmpPacket::NoteOn(group_, ch, note, velocity);
+            else
+                *packet = UmpPacket::NoteOff(group_, ch, note, velocity);
+            return true;
+        }
+        case PolyphonicKeyPressure:
+            *packet = UmpPacket::PolyPressure(
+                group_, ch, event.data[0], Upscale(event.data[1], 7, 32));
+            return true;
+        case ControlChange:
+        case ChannelMode: return ControlChangeToUmp(event, packet);
+        case ProgramChange:
+        {
+            const ChannelState& state = channels_[ch];
+            *packet                   = UmpPacket::ProgramChange(group_,
+                                                   ch,
+                                                   event.data[0],
+                                                   state.bank_valid,
+                                                   state.bank_msb,
+                                                   state.bank_lsb);
+            return true;
+        }
+        case ChannelPressure:
+            *packet = UmpPacket::ChannelPressure(
+                group_, ch, Upscale(event.data[0], 7, 32));
+            return true;
+        case PitchBend:
+        {
+            const uint32_t bend = (event.data[1] << 7) | event.data[0];
+            *packet = UmpPacket::PitchBend(group_, ch, Upscale(bend, 14, 32));
+            return true;
+        }
+        case SystemCommon:
+            if(event.sc_type == SystemExclusive || event.sc_type == SysExEnd)
+                return false;
+            *packet = UmpPacket::Midi1(
+                group_, 0xF0 | event.sc_type, event.data[0], event.data[1]);
+            return true;
+        case SystemRealTime:
+            *packet = UmpPacket::Midi1(group_, 0xF8 | event.srt_type);
+            return true;
+        default: return false;
+    }
+}
+
+bool UmpTranslator::ControlChangeToUmp(const CompactMidiEvent& event,
+                                       UmpPacket*              packet)
+{
+    const uint8_t ch    = event.channel & 0x0F;
+    const uint8_t index = event.data[0];
+    const uint8_t value = event.data[1];
+    ChannelState& state = channels_[ch];
+    switch(index)
+    {
+        // bank select, sent with the next program change
+        case 0:
+            state.bank_msb   = value;
+            state.bank_valid = true;
+            return false;
+        case 32:
+            state.bank_lsb   = value;
+            state.bank_valid = true;
+            return false;
+        // parameter selection
+        case 98:
+        case 99:
+        case 100:
+        case 101:
+            if(index & 1)
+                state.param_msb = value;
+            else
+                state.param_lsb = value;
+            state.param_nrpn  = index < 100;
+            state.param_valid = state.param_msb != 0x7F
+                                || state.param_lsb != 0x7F;
+            state.data_msb    = 0;
+            return false;
+        // data entry
+        case 6:
+        case 38:
+        {
+            if(!state.param_valid)
+                return false;
+            uint8_t lsb = 0;
+            if(index == 6)
+                state.data_msb = value;
+            else
+                lsb = value;
+            const uint8_t  bank  = state.param_msb;
+            const uint8_t  param = state.param_lsb;
+            const uint32_t data
+                = Upscale((state.data_msb << 7) | lsb, 14, 32);
+            if(state.param_nrpn)
+                *packet = UmpPacket::AssignableController(
+                    group_, ch, bank, param, data);
+            else
+                *packet = UmpPacket::RegisteredController(
+                    group_, ch, bank, param, data);
+            return true;
+        }
+        default:
+            *packet = UmpPacket::ControlChange(
+                group_, ch, index, Upscale(value, 7, 32));
+            return true;
+    }
+}
+
+/** Writes a MIDI 1.0 message if it fits */
+static size_t WriteMidi(uint8_t*       bytes,
+                        size_t         size,
+                        size_t         pos,
+                        const uint8_t* message,
+                        size_t         length)
+{
+    if(pos + length > size)
+        return 0;
+    for(size_t i = 0; i < length; i++)
+        bytes[pos + i] = message[i];
+    return length;
+}
+
+size_t UmpTranslator::ToMidi(const UmpPacket& packet,
+                             uint8_t*         bytes,
+                             size_t           size) const
+{
+    const uint8_t  status = packet.GetStatus();
+    const uint8_t  byte3  = (packet.words[0] >> 8) & 0x7F;
+    const uint8_t  byte4  = packet.words[0] & 0x7F;
+    switch(packet.GetMessageType())
+    {
+        case UmpMessageType::System:
+        {
+            size_t length = 1;
+            if(status == 0xF2)
+                length = 3;
+            else if(status == 0xF1 || status == 0xF3)
+                length = 2;
+            const uint8_t message[3] = {status, byte3, byte4};
+            return WriteMidi(bytes, size, 0, message, length);
+        }
+        case UmpMessageType::Midi1ChannelVoice:
+        {
+            const uint8_t kind   = status & 0xF0;
+            const size_t  length = kind == 0xC0 || kind == 0xD0 ? 2 : 3;
+            const uint8_t message[3] = {status, byte3, byte4};
+            return WriteMidi(bytes, size, 0, message, length);
+        }
+        case UmpMessageType::Data64:
+        {
+            // 0: complete, 1: start, 2: continue, 3: end
+            const uint8_t form      = status >> 4;
+            uint8_t       num_bytes = status & 0x0F;
+            if(num_bytes > 6)
+                num_bytes = 6;
+            uint8_t message[8];
+            size_t  length = 0;
+            if(form == 0 || form == 1)
+                message[length++] = 0xF0;
+            for(uint8_t i = 0; i < num_bytes; i++)
+            {
+                const uint8_t word  = (i + 2) / 4;
+                const uint8_t shift = (3 - (i + 2) % 4) * 8;
+                message[length++] = (packet.words[word] >> shift) & 0x7F;
+            }
+            if(form == 0 || form == 3)
+                message[length++] = 0xF7;
+            return WriteMidi(bytes, size, 0, message, length);
+        }
+        case UmpMessageType::Midi2ChannelVoice: break;
+        default: return 0;
+    }
+
+    Midi2Event event;
+    packet.Decode(&event);
+    const uint8_t ch = event.channel;
+    uint8_t       message[12];
+    size_t        length = 0;
+    auto          add    = [&](uint8_t b0, uint8_t b1, uint8_t b2) {
+        message[length++] = b0;
+        message[length++] = b1;
+        message[length++] = b2;
+    };
+    switch(event.type)
+    {
+        case Midi2Event::NoteOn:
+        {
+            // velocity 0 would be a note off in MIDI 1.0
+            uint8_t velocity = Downscale(event.velocity, 16, 7);
+            if(velocity == 0)
+                velocity = 1;
+            add(0x90 | ch, event.index, velocity);
+            break;
+        }
+        case Midi2Event::NoteOff:
+            add(0x80 | ch, event.index, Downscale(event.velocity, 16, 7));
+            break;
+        case Midi2Event::PolyPressure:
+            add(0xA0 | ch, event.index, Downscale(event.value, 32, 7));
+            break;
+        case Midi2Event::ControlChange:
+            add(0xB0 | ch, event.index, Downscale(event.value, 32, 7));
+            break;
+        case Midi2Event::RegisteredController:
+        case Midi2Event::AssignableController:
+        {
+            const bool nrpn = event.type == Midi2Event::AssignableController;
+            const uint32_t data = Downscale(event.value, 32, 14);
+            add(0xB0 | ch, nrpn ? 99 : 101, event.bank);
+            add(0xB0 | ch, nrpn ? 98 : 100, event.index);
+            add(0xB0 | ch, 6, data >> 7);
+            add(0xB0 | ch, 38, data & 0x7F);
+            break;
+        }
+        case Midi2Event::ProgramChange:
+            if(event.flags & 1)
+            {
+                add(0xB0 | ch, 0, event.bank);
+                add(0xB0 | ch, 32, event.value);
+            }
+            add(0xC0 | ch, event.index, 0);
+            length--;
+            break;
+        case Midi2Event::ChannelPressure:
+            add(0xD0 | ch, Downscale(event.value, 32, 7), 0);
+            length--;
+            break;
+        case Midi2Event::PitchBend:
+        {
+            const uint32_t bend = Downscale(event.value, 32, 14);
+            add(0xE0 | ch, bend & 0x7F, bend >> 7);
+            break;
+        }
+        default: return 0;
+    }
+    return WriteMidi(bytes, size, 0, message, length);
+}
+
+size_t UmpTranslator::SysExToUmp(uint8_t        group,
+                                 const uint8_t* data,
+                                 size_t         size,
+                                 UmpPacket*     packets,
+                                 size_t         max_packets)
+{
+    const size_t num_packets = size == 0 ? 1 : (size + 5) / 6;
+    if(num_packets > max_packets)
+        return 0;
+    for(size_t p = 0; p < num_packets; p++)
+    {
+        const size_t  offset    = p * 6;
+        const uint8_t num_bytes = size - offset < 6 ? size - offset : 6;
+        uint8_t       form      = 2; // continue
+        if(num_packets == 1)
+            form = 0; // complete
+        else if(p == 0)
+            form = 1; // start
+        else if(p == num_packets - 1)
+            form = 3; // end
+
+        uint8_t payload[6] = {};
+        for(uint8_t i = 0; i < num_bytes; i++)
+            payload[i] = data[offset + i] & 0x7F;
+        packets[p].words[0] = UmpWord(UmpMessageType::Data64,
+                                      group,
+                                      (form << 4) | num_bytes,
+                                      payload[0],
+                                      payload[1]);
+        packets[p].words[1] = (static_cast<uint32_t>(payload[2]) << 24)
+                              | (payload[3] << 16) | (payload[4] << 8)
+                              | payload[5];
+        packets[p].words[2] = 0;
+        packets[p].words[3] = 0;
+    }
+    return num_packets;
+}
+
+uint32_t
+UmpTranslator::Upscale(uint32_t value, uint8_t src_bits, uint8_t dst_bits)
+{
+    // min-center-max scaling, from the UMP specification: values above the
+    // center repeat their lower bits, so the maximum maps to the maximum
+    const uint8_t  scale_bits = dst_bits - src_bits;
+    uint32_t       result     = value << scale_bits;
+    const uint32_t center     = 1u << (src_bits - 1);
+    if(value <= center)
+        return result;
+
+    const uint8_t repeat_bits  = src_bits - 1;
+    uint32_t      repeat_value = value & ((1u << repeat_bits) - 1);
+    if(scale_bits > repeat_bits)
+        repeat_value <<= scale_bits - repeat_bits;
+    else
+        repeat_value >>= repeat_bits - scale_bits;
+    while(repeat_value != 0)
+    {
+        result |= repeat_value;
+        repeat_value >>= repeat_bits;
+    }
+    return result;
+}
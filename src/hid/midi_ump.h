@@ -0,0 +1,355 @@
+#pragma once
+#ifndef DSY_MIDI_UMP_H
+#define DSY_MIDI_UMP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "hid/MidiEvent.h"
+#include "util/ringbuffer.h"
+
+namespace daisy
+{
+/** @brief Message types of the Universal MIDI Packet, in the upper nibble
+ *         of its first word
+ *  @ingroup midi
+ */
+enum class UmpMessageType : uint8_t
+{
+    Utility           = 0x0,
+    System            = 0x1, /**< MIDI 1.0 system common and real-time */
+    Midi1ChannelVoice = 0x2, /**< MIDI 1.0 channel voice */
+    Data64            = 0x3, /**< SysEx, 7-bit bytes */
+    Midi2ChannelVoice = 0x4, /**< MIDI 2.0 channel voice */
+    Data128           = 0x5, /**< SysEx, 8-bit bytes, and mixed data */
+    FlexData          = 0xD,
+    UmpStream         = 0xF,
+};
+
+/** @brief A decoded MIDI 2.0 channel voice message, at full resolution
+ *  @ingroup midi
+ */
+struct Midi2Event
+{
+    /** The opcode of the message */
+    enum Type : uint8_t
+    {
+        RegisteredPerNoteController  = 0x0,
+        AssignablePerNoteController  = 0x1,
+        RegisteredController         = 0x2, /**< RPN */
+        AssignableController         = 0x3, /**< NRPN */
+        RelativeRegisteredController = 0x4,
+        RelativeAssignableController = 0x5,
+        PerNotePitchBend             = 0x6,
+        NoteOff                      = 0x8,
+        NoteOn                       = 0x9,
+        PolyPressure                 = 0xA,
+        ControlChange                = 0xB,
+        ProgramChange                = 0xC,
+        ChannelPressure              = 0xD,
+        PitchBend                    = 0xE,
+        PerNoteManagement            = 0xF,
+    };
+
+    Type    type;    /**< & */
+    uint8_t group;   /**< & */
+    uint8_t channel; /**< & */
+    /** Note number of note and per-note messages, controller number of
+     *  control changes, index of RPNs and NRPNs, program number of
+     *  program changes */
+    uint8_t index;
+    /** Bank of RPNs and NRPNs, and the bank MSB of program changes */
+    uint8_t bank;
+    /** Index of per-note controllers, flags of per-note management and
+     *  program changes, attribute type of notes */
+    uint8_t  flags;
+    uint16_t velocity;  /**< 16-bit note velocity */
+    uint16_t attribute; /**< note attribute */
+    /** 32-bit controller, pressure or pitch bend value, pitch bend is
+     *  centered at 0x80000000. The bank LSB of program changes. */
+    uint32_t value;
+};
+
+/** @brief A Universal MIDI Packet of 1 to 4 32-bit words
+ *  @ingroup midi
+ *  @details The factory functions create MIDI 2.0 channel voice messages,
+ *           and Midi1() wraps MIDI 1.0 messages.
+ */
+struct UmpPacket
+{
+    uint32_t words[4];
+
+    /** Returns the number of words of a packet of a message type */
+    static uint8_t GetNumWords(UmpMessageType type)
+    {
+        // 32 bit: 0x0-0x2, 0x6-0x7, 64 bit: 0x3-0x4, 0x8-0xA,
+        // 96 bit: 0xB-0xC, 128 bit: 0x5, 0xD-0xF
+        static constexpr uint8_t kNumWords[16]
+            = {1, 1, 1, 2, 2, 4, 1, 1, 2, 2, 2, 3, 3, 4, 4, 4};
+        return kNumWords[static_cast<uint8_t>(type) & 0x0F];
+    }
+
+    /** Returns the number of words of this packet */
+    uint8_t GetNumWords() const { return GetNumWords(GetMessageType()); }
+
+    UmpMessageType GetMessageType() const
+    {
+        return static_cast<UmpMessageType>(words[0] >> 28);
+    }
+
+    uint8_t GetGroup() const { return (words[0] >> 24) & 0x0F; }
+
+    /** Returns the status byte of System and channel voice messages,
+     *  with the channel in the lower nibble */
+    uint8_t GetStatus() const { return (words[0] >> 16) & 0xFF; }
+
+    uint8_t GetChannel() const { return (words[0] >> 16) & 0x0F; }
+
+    /** Decodes a MIDI 2.0 channel voice message
+     *  \return false for all other message types
+     */
+    bool Decode(Midi2Event* event) const;
+
+    /** Wraps a MIDI 1.0 channel voice, system common or real-time message
+     *  \param status status byte, SysEx is not supported
+     */
+    static UmpPacket
+    Midi1(uint8_t group, uint8_t status, uint8_t data0 = 0, uint8_t data1 = 0);
+
+    static UmpPacket NoteOn(uint8_t  group,
+                            uint8_t  channel,
+                            uint8_t  note,
+                            uint16_t velocity,
+                            uint8_t  attribute_type = 0,
+                            uint16_t attribute      = 0);
+    static UmpPacket NoteOff(uint8_t  group,
+                             uint8_t  channel,
+                             uint8_t  note,
+                             uint16_t velocity,
+                             uint8_t  attribute_type = 0,
+                             uint16_t attribute      = 0);
+    static UmpPacket
+    PolyPressure(uint8_t group, uint8_t channel, uint8_t note, uint32_t value);
+    static UmpPacket ControlChange(uint8_t  group,
+                                   uint8_t  channel,
+                                   uint8_t  index,
+                                   uint32_t value);
+    static UmpPacket RegisteredController(uint8_t  group,
+                                          uint8_t  channel,
+                                          uint8_t  bank,
+                                          uint8_t  index,
+                                          uint32_t value);
+    static UmpPacket AssignableController(uint8_t  group,
+                                          uint8_t  channel,
+                                          uint8_t  bank,
+                                          uint8_t  index,
+                                          uint32_t value);
+    /** \param bank_valid false if the bank isn't changed */
+    static UmpPacket ProgramChange(uint8_t group,
+                                   uint8_t channel,
+                                   uint8_t program,
+                                   bool    bank_valid = false,
+                                   uint8_t bank_msb   = 0,
+                                   uint8_t bank_lsb   = 0);
+    static UmpPacket
+    ChannelPressure(uint8_t group, uint8_t channel, uint32_t value);
+    /** \param value centered at 0x80000000 */
+    static UmpPacket PitchBend(uint8_t group, uint8_t channel, uint32_t value);
+    /** \param value centered at 0x80000000 */
+    static UmpPacket PerNotePitchBend(uint8_t  group,
+                                      uint8_t  channel,
+                                      uint8_t  note,
+                                      uint32_t value);
+
+  private:
+    static UmpPacket Midi2(uint8_t  group,
+                           uint8_t  opcode,
+                           uint8_t  channel,
+                           uint8_t  byte3,
+                           uint8_t  byte4,
+                           uint32_t word1);
+};
+
+/** @brief Translates between MIDI 1.0 messages and Universal MIDI Packets
+ *  @ingroup midi
+ *  @details MIDI 1.0 events are translated to the MIDI 2.0 protocol as the
+ *           UMP specification describes: values are scaled up with the
+ *           min-center-max method, bank selects are merged into program
+ *           changes, and RPN and NRPN control change sequences become
+ *           registered and assignable controllers. As a MIDI 1.0 device
+ *           sends the data entry MSB and LSB separately, a controller is
+ *           sent when the MSB arrives, and again with the full value when
+ *           the LSB arrives.
+ *
+ *           MIDI 2.0 packets are translated back to MIDI 1.0 bytes, with
+ *           values scaled down. Note on velocities that round down to 0 are
+ *           sent as 1, so the note doesn't turn into a note off.
+ *
+ *  Usage, translating what the MidiParser receives into a UmpQueue:
+ *  @code
+ *  UmpTranslator translator;
+ *  translator.Init(0);
+ *
+ *  CompactMidiEvent event;
+ *  UmpPacket        packet;
+ *  if(parser.Parse(byte, &event) && translator.ToUmp(event, &packet))
+ *      queue.PushBack(packet);
+ *  @endcode
+ *  and sending a packet with a MidiHandler:
+ *  @code
+ *  MidiTxMessage msg;
+ *  msg.size = translator.ToMidi(packet, msg.data, sizeof(msg.data));
+ *  midi.SendMessage(msg);
+ *  @endcode
+ */
+class UmpTranslator
+{
+  public:
+    UmpTranslator() {}
+    ~UmpTranslator() {}
+
+    /** Forgets all bank and controller selections
+     *  \param group UMP group of the translated packets
+     */
+    void Init(uint8_t group);
+
+    /** Translates a MIDI 1.0 event to a MIDI 2.0 channel voice or a
+     *  System packet.
+     *  \return false if there is no packet for the event: for bank and
+     *          controller selections, which are remembered, and for SysEx,
+     *          which is translated with SysExToUmp().
+     */
+    bool ToUmp(const CompactMidiEvent& event, UmpPacket* packet);
+
+    /** Translates a packet to MIDI 1.0 bytes
+     *  \param bytes destination, a message with bank selects or an RPN
+     *         takes up to 12 bytes
+     *  \param size size of bytes
+     *  \return number of bytes written, 0 for packets that have no MIDI 1.0
+     *          equivalent, or don't fit
+     */
+    size_t ToMidi(const UmpPacket& packet, uint8_t* bytes, size_t size) const;
+
+    /** Splits a SysEx payload into 7-bit SysEx (Data 64) packets
+     *  \param data payload, without the 0xF0 and 0xF7 bytes
+     *  \param max_packets size of packets
+     *  \return number of packets, 0 if they don't fit
+     */
+    static size_t SysExToUmp(uint8_t        group,
+                             const uint8_t* data,
+                             size_t         size,
+                             UmpPacket*     packets,
+                             size_t         max_packets);
+
+    /** Scales a value up to more bits, so that minimum, center and
+     *  maximum of the range are kept */
+    static uint32_t
+    Upscale(uint32_t value, uint8_t src_bits, uint8_t dst_bits);
+
+    /** Scales a value down to fewer bits */
+    static uint32_t
+    Downscale(uint32_t value, uint8_t src_bits, uint8_t dst_bits)
+    {
+        return value >> (src_bits - dst_bits);
+    }
+
+  private:
+    /** Selections of a MIDI 1.0 channel */
+    struct ChannelState
+    {
+        uint8_t bank_msb;
+        uint8_t bank_lsb;
+        bool    bank_valid;
+        uint8_t param_msb; /**< RPN or NRPN */
+        uint8_t param_lsb;
+        bool    param_nrpn;
+        bool    param_valid;
+        uint8_t data_msb;
+    };
+
+    bool ControlChangeToUmp(const CompactMidiEvent& event, UmpPacket* packet);
+
+    uint8_t      group_;
+    ChannelState channels_[16];
+};
+
+/** @brief Single producer, single consumer queue of Universal MIDI Packets
+ *  @ingroup midi
+ *  @details The packets are stored as 32-bit words, so small packets don't
+ *           take up the space of large ones. Packets are only pushed and
+ *           popped as a whole, so the consumer never sees a partial packet.
+ *           One side can run in an interrupt.
+ *  @tparam kWords capacity in words, a power of two
+ */
+template <size_t kWords>
+class UmpQueue
+{
+  public:
+    UmpQueue() {}
+    ~UmpQueue() {}
+
+    /** Empties the queue. Only call while neither side is active. */
+    void Init() { words_.Init(); }
+
+    // ======== producer side ========
+
+    /** Adds a packet
+     *  \return false if it doesn't fit
+     */
+    bool PushBack(const UmpPacket& packet)
+    {
+        const size_t num_words = packet.GetNumWords();
+        if(words_.writable() < num_words)
+            return false;
+        words_.Write(packet.words, num_words);
+        return true;
+    }
+
+    /** Adds the whole packets of a word stream, e.g. from a transport
+     *  \return number of words used, less than num_words if the queue is
+     *          full or the stream ends with a partial packet
+     */
+    size_t PushWords(const uint32_t* words, size_t num_words)
+    {
+        size_t used = 0;
+        while(used < num_words)
+        {
+            const UmpMessageType type
+                = static_cast<UmpMessageType>(words[used] >> 28);
+            const size_t size = UmpPacket::GetNumWords(type);
+            if(used + size > num_words || words_.writable() < size)
+                break;
+            words_.Write(words + used, size);
+            used += size;
+        }
+        return used;
+    }
+
+    // ======== consumer side ========
+
+    bool IsEmpty() const { return words_.isEmpty(); }
+
+    /** Removes the oldest packet
+     *  \return false if the queue is empty
+     */
+    bool PopFront(UmpPacket* packet)
+    {
+        auto span = words_.PeekRead();
+        if(span.num_elements == 0)
+            return false;
+        packet->words[0] = span.data[0];
+        words_.Read(packet->words, packet->GetNumWords());
+        return true;
+    }
+
+    /** Returns the number of words in the queue */
+    size_t GetNumWords() const { return words_.readable(); }
+
+    /** Empties the queue, from the consumer side */
+    void Flush() { words_.Flush(); }
+
+  private:
+    SpscRingBuffer<uint32_t, kWords> words_;
+};
+
+} // namespace daisy
+#endif
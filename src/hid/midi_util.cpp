@@ -10,6 +10,12 @@ MidiTxMessage::MidiTxMessage()
     std::fill(data, data + kMaxDataSize, 0);
 }
 
+MidiTxMessage::MidiTxMessage(const uint8_t* message, size_t message_size)
+{
+    size = message_size < kMaxDataSize ? message_size : kMaxDataSize;
+    memcpy(data, message, size);
+}
+
 MidiTxMessage MidiTxMessage::NoteOn(uint8_t ch, uint8_t nn, uint8_t vel)
 {
     MidiTxMessage msg;
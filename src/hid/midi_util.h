@@ -15,6 +15,8 @@ struct MidiTxMessage
     size_t  size;
 
     MidiTxMessage();
+    /** Copies a raw message, truncated to kMaxDataSize bytes */
+    MidiTxMessage(const uint8_t* message, size_t message_size);
     ~MidiTxMessage() = default;
 
     static MidiTxMessage NoteOn(uint8_t ch, uint8_t nn, uint8_t vel);
@@ -40,20 +42,26 @@ class MidiTxBuffer
         rs_enabled_  = running_status_enabled;
     }
 
-    bool IsWriteable(size_t added) const { return size_ + added < kSize; }
+    bool IsWriteable(size_t added) const { return size_ + added <= kSize; }
 
     bool IsEmpty() const { return size_ == 0; }
 
     // Trims bytes out for running status (assumes first byte is status)
     bool WriteMessage(const uint8_t* data, size_t size)
     {
+        if(size == 0)
+            return true;
         if(!IsWriteable(size))
             return false;
 
+        const uint8_t status = data[0];
+        // Real-time messages can go anywhere without breaking running status
+        const bool is_real_time = status >= 0xf8;
+        // Only channel messages can use running status
         const bool is_valid_for_running_status
-            = rs_enabled_ && size > 1 && data[0] != 0xf0;
+            = rs_enabled_ && size > 1 && status < 0xf0;
 
-        if(is_valid_for_running_status && data[0] == last_status_)
+        if(is_valid_for_running_status && status == last_status_)
         {
             memcpy(&buf_[size_], data + 1, size - 1);
             size_ += size - 1;
@@ -62,7 +70,8 @@ class MidiTxBuffer
         {
             memcpy(&buf_[size_], data, size);
             size_ += size;
-            last_status_ = is_valid_for_running_status ? data[0] : 0;
+            if(!is_real_time)
+                last_status_ = is_valid_for_running_status ? status : 0;
         }
         return true;
     }
@@ -12,9 +12,18 @@ class MidiUsbTransport::Impl
 
     void StartRx(MidiRxParseCallback callback, void* context)
     {
-        rx_active_      = true;
-        parse_callback_ = callback;
-        parse_context_  = context;
+        rx_active_       = true;
+        parse_callback_  = callback;
+        packet_callback_ = nullptr;
+        parse_context_   = context;
+    }
+
+    void StartRxPackets(MidiRxPacketCallback callback, void* context)
+    {
+        rx_active_       = true;
+        parse_callback_  = nullptr;
+        packet_callback_ = callback;
+        parse_context_   = context;
     }
 
     bool RxActive() { return rx_active_; }
@@ -22,11 +31,13 @@ class MidiUsbTransport::Impl
     void Tx(uint8_t* buffer, size_t size);
 
     void UsbToMidi(uint8_t* buffer, uint8_t length);
+    bool ParsePackets(const uint8_t* buffer, size_t length);
     void MidiToUsb(uint8_t* buffer, size_t length);
     void Parse();
 
   private:
     void MidiToUsbSingle(uint8_t* buffer, size_t length);
+    void SendPackets();
 
     /** USB Handle for CDC transfers
          */
@@ -36,9 +47,10 @@ class MidiUsbTransport::Impl
     static constexpr size_t kBufferSize = 1024;
     bool                    rx_active_;
     // This corresponds to 256 midi messages
-    RingBuffer<uint8_t, kBufferSize> rx_buffer_;
-    MidiRxParseCallback              parse_callback_;
-    void*                            parse_context_;
+    SpscRingBuffer<uint8_t, kBufferSize> rx_buffer_;
+    MidiRxParseCallback                  parse_callback_;
+    MidiRxPacketCallback                 packet_callback_;
+    void*                                parse_context_;
 
     // simple, self-managed buffer
     uint8_t tx_buffer_[kBufferSize];
@@ -70,6 +82,10 @@ void ReceiveCallback(uint8_t* buffer, uint32_t* length)
 {
     if(midi_usb_handle.RxActive())
     {
+        // Fast path, the packets go straight to the parser
+        if(midi_usb_handle.ParsePackets(buffer, *length))
+            return;
+
         for(uint16_t i = 0; i < *length; i += 4)
         {
             size_t  remaining_bytes = *length - i;
@@ -98,18 +114,27 @@ void MidiUsbTransport::Impl::Init(Config config)
 
     usb_handle_.Init(periph);
 
-    rx_active_ = false;
+    rx_active_       = false;
+    parse_callback_  = nullptr;
+    packet_callback_ = nullptr;
     System::Delay(10);
     usb_handle_.SetReceiveCallback(ReceiveCallback, periph);
 }
 
 void MidiUsbTransport::Impl::Tx(uint8_t* buffer, size_t size)
+{
+    MidiToUsb(buffer, size);
+    SendPackets();
+}
+
+void MidiUsbTransport::Impl::SendPackets()
 {
     UsbHandle::Result result;
     int               attempt_count = config_.tx_retry_count;
     bool              should_retry;
 
-    MidiToUsb(buffer, size);
+    if(tx_ptr_ == 0)
+        return;
     do
     {
         if(config_.periph == Config::EXTERNAL)
@@ -150,9 +175,7 @@ void MidiUsbTransport::Impl::UsbToMidi(uint8_t* buffer, uint8_t length)
     // Only writing as many bytes as necessary
     for(uint8_t i = 0; i < code_index_size_[code_index]; i++)
     {
-        if(rx_buffer_.writable() > 0)
-            rx_buffer_.Write(buffer[1 + i]);
-        else
+        if(!rx_buffer_.Write(buffer[1 + i]))
         {
             rx_active_ = false; // disable on overflow
             break;
@@ -165,6 +188,10 @@ void MidiUsbTransport::Impl::MidiToUsbSingle(uint8_t* buffer, size_t size)
     if(size == 0)
         return;
 
+    // Make room for the first packet
+    if(tx_ptr_ + 4 > kBufferSize)
+        SendPackets();
+
     // Channel voice messages
     if((buffer[0] & 0xF0) != 0xF0)
     {
@@ -203,7 +230,7 @@ void MidiUsbTransport::Impl::MidiToUsbSingle(uint8_t* buffer, size_t size)
 
             tx_ptr_ += 4;
         }
-        if(0xF1 == buffer[0] || 0xF3 == buffer[0])
+        else if(0xF1 == buffer[0] || 0xF3 == buffer[0])
         // two byte messages
         {
             if(size != 2)
@@ -235,8 +262,11 @@ void MidiUsbTransport::Impl::MidiToUsbSingle(uint8_t* buffer, size_t size)
             // Sysex messages are split up into several 4 bytes packets
             // first ones use CIN 0x04
             // but packet containing the SysEx stop byte use a different CIN
+            // Long messages go out over several transfers
             for(i = 0; i + 3 < size; i += 3, tx_ptr_ += 4)
             {
+                if(tx_ptr_ + 4 > kBufferSize)
+                    SendPackets();
                 tx_buffer_[tx_ptr_]     = 0x04;
                 tx_buffer_[tx_ptr_ + 1] = buffer[i];
                 tx_buffer_[tx_ptr_ + 2] = buffer[i + 1];
@@ -247,6 +277,8 @@ void MidiUsbTransport::Impl::MidiToUsbSingle(uint8_t* buffer, size_t size)
             // 0x05 for 1 remaining byte
             // 0x06 for 2
             // 0x07 for 3
+            if(tx_ptr_ + 4 > kBufferSize)
+                SendPackets();
             tx_buffer_[tx_ptr_] = 0x05 + (size - i - 1);
             tx_ptr_++;
             for(; i < size; ++i, ++tx_ptr_)
@@ -260,40 +292,89 @@ void MidiUsbTransport::Impl::MidiToUsbSingle(uint8_t* buffer, size_t size)
 void MidiUsbTransport::Impl::MidiToUsb(uint8_t* buffer, size_t size)
 {
     // We'll assume your message starts with a status byte!
-    size_t status_index = 0;
-    while(status_index < size)
+    // Channel messages may use running status, which USB MIDI doesn't
+    // have, so the status is put back in for each message. Real-time
+    // messages may come between any two bytes of other messages, and are
+    // sent ahead of the message they interrupt. Within SysEx they are sent
+    // as part of it.
+    uint8_t message[3];
+    size_t  length   = 0; // bytes of message so far
+    size_t  expected = 0; // bytes in the whole message
+    size_t  i        = 0;
+    while(i < size)
     {
-        // Search for next status byte or end
-        size_t next_status = status_index;
-        for(size_t j = status_index + 1; j < size; j++)
+        const uint8_t byte = buffer[i];
+        if(byte >= 0xF8)
         {
-            if(buffer[j] & 0x80)
-            {
-                next_status = j;
-                break;
-            }
+            MidiToUsbSingle(buffer + i, 1);
+            i++;
+            continue;
         }
-        if(next_status == status_index)
+        if(byte == 0xF0)
         {
-            // Either we're at the end or it's malformed
-            next_status = size;
+            // SysEx messages run up to and including their end byte
+            size_t end = i + 1;
+            while(end < size && buffer[end - 1] != 0xF7)
+                end++;
+            MidiToUsbSingle(buffer + i, end - i);
+            length = expected = 0;
+            i                 = end;
+            continue;
+        }
+
+        if(byte & 0x80)
+        {
+            message[0] = byte;
+            length     = 1;
+            if(byte < 0xF0)
+                // program change and channel pressure have one data byte
+                expected = (byte & 0xE0) == 0xC0 ? 2 : 3;
+            else if(byte == 0xF2)
+                expected = 3;
+            else if(byte == 0xF1 || byte == 0xF3)
+                expected = 2;
+            else
+                expected = 1;
+        }
+        else if(length > 0)
+        {
+            message[length++] = byte;
+        }
+        i++;
+
+        if(length > 0 && length == expected)
+        {
+            MidiToUsbSingle(message, length);
+            // only channel messages keep their status
+            length = message[0] < 0xF0 ? 1 : 0;
+            if(length == 0)
+                expected = 0;
         }
-        MidiToUsbSingle(buffer + status_index, next_status - status_index);
-        status_index = next_status;
     }
 }
 
+bool MidiUsbTransport::Impl::ParsePackets(const uint8_t* buffer, size_t length)
+{
+    if(!packet_callback_)
+        return false;
+    packet_callback_(buffer, length - length % 4, parse_context_);
+    return true;
+}
+
 void MidiUsbTransport::Impl::Parse()
 {
     if(parse_callback_)
     {
-        uint8_t bytes[kBufferSize];
-        size_t  i = 0;
-        while(!rx_buffer_.isEmpty())
+        // Parse in place, rather than copying to the stack first.
+        // Unread bytes that wrap around the end are split into two parts.
+        for(int part = 0; part < 2; part++)
         {
-            bytes[i++] = rx_buffer_.Read();
+            auto bytes = rx_buffer_.PeekRead();
+            if(bytes.num_elements == 0)
+                break;
+            parse_callback_(bytes.data, bytes.num_elements, parse_context_);
+            rx_buffer_.CommitRead(bytes.num_elements);
         }
-        parse_callback_(bytes, i, parse_context_);
     }
 }
 
@@ -312,6 +393,12 @@ void MidiUsbTransport::StartRx(MidiRxParseCallback callback, void* context)
     pimpl_->StartRx(callback, context);
 }
 
+void MidiUsbTransport::StartRxPackets(MidiRxPacketCallback callback,
+                                      void*                context)
+{
+    pimpl_->StartRxPackets(callback, context);
+}
+
 bool MidiUsbTransport::RxActive()
 {
     return pimpl_->RxActive();
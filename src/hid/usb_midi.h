@@ -18,6 +18,10 @@ class MidiUsbTransport
                                         size_t   size,
                                         void*    context);
 
+    typedef void (*MidiRxPacketCallback)(const uint8_t* packets,
+                                         size_t         size,
+                                         void*          context);
+
     struct Config
     {
         enum Periph
@@ -45,7 +49,22 @@ class MidiUsbTransport
 
     void Init(Config config);
 
+    /** Starts receiving, and passes the received MIDI bytes to the callback
+     *  \param callback called with the MIDI bytes unpacked from the
+     *         USB-MIDI event packets
+     *  \param context passed to the callback
+     */
     void StartRx(MidiRxParseCallback callback, void* context);
+
+    /** Starts receiving, and passes the received USB-MIDI event packets
+     *  straight to the callback from the USB receive interrupt, without
+     *  unpacking them. Used by the MidiHandler, see
+     *  MidiParser::ParseUsbPackets().
+     *  \param callback called with whole 4 byte packets
+     *  \param context passed to the callback
+     */
+    void StartRxPackets(MidiRxPacketCallback callback, void* context);
+
     bool RxActive();
     void FlushRx();
     void Tx(uint8_t* buffer, size_t size);
@@ -1,20 +1,90 @@
+#include <cstddef>
 #include <cstring>
 #include "hid/wavplayer.h"
 
 using namespace daisy;
 
-void WavPlayer::Init(const char *search_path)
+constexpr size_t WavPlayer::kMaxVoices;
+constexpr size_t WavPlayer::kVoiceBufferSize;
+constexpr size_t WavPlayer::kMaxChannels;
+constexpr size_t WavPlayer::kHistory;
+constexpr size_t WavPlayer::kTail;
+constexpr size_t WavPlayer::kCacheLine;
+constexpr size_t WavPlayer::kMaxGaps;
+
+namespace
+{
+uint32_t ReadLE(const uint8_t *p, size_t bytes)
+{
+    uint32_t value = 0;
+    for(size_t i = 0; i < bytes; i++)
+        value |= uint32_t(p[i]) << (i * 8);
+    return value;
+}
+
+/** Cubic Hermite (Catmull-Rom) interpolation between x0 and x1 */
+inline float Hermite(float xm1, float x0, float x1, float x2, float t)
+{
+    const float c1 = 0.5f * (x1 - xm1);
+    const float c2 = xm1 - 2.5f * x0 + 2.f * x1 - 0.5f * x2;
+    const float c3 = 0.5f * (x2 - xm1) + 1.5f * (x0 - x1);
+    return ((c3 * t + c2) * t + c1) * t + x0;
+}
+
+/** Folds bytes into a 32-bit FNV-1a hash */
+uint32_t Fnv1a(uint32_t hash, const void *data, size_t size)
+{
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    for(size_t i = 0; i < size; i++)
+        hash = (hash ^ bytes[i]) * 16777619u;
+    return hash;
+}
+
+/** \return true for names that end in ".wav", in any case */
+bool IsWavFile(const char *name)
+{
+    const size_t len = strlen(name);
+    return len > 4 && name[len - 4] == '.'
+           && (name[len - 3] | 0x20) == 'w' && (name[len - 2] | 0x20) == 'a'
+           && (name[len - 1] | 0x20) == 'v';
+}
+
+const char *const kIndexFileName = "WAVPLAY.IDX";
+const uint32_t    kIndexMagic    = 0x31495657; /**< "WVI1" */
+const uint32_t    kFnvOffset     = 2166136261u;
+} // namespace
+
+void WavPlayer::Init(const char *search_path, bool use_index)
 {
     // First check for all .wav files, and add them to the list until its full or there are no more.
     // Only checks '/'
     FRESULT result = FR_OK;
     FILINFO fno;
     DIR     dir;
+    FIL     fil;
     char *  fn;
     file_sel_ = 0;
     file_cnt_ = 0;
-    playing_  = true;
-    looping_  = false;
+    for(auto &voice : voices_)
+    {
+        voice.file_open = false;
+        voice.looping   = false;
+        voice.active.store(false);
+        voice.stopped.store(true);
+    }
+    ResetStats();
+
+    // The files of the last Init(), which are reused as long as they haven't
+    // changed. They stay in index_.files[file_cnt_ ... cached - 1] while
+    // the new list is built in front of them.
+    char index_path[WAV_FILENAME_MAX];
+    strcpy(index_path, search_path);
+    strcat(index_path, kIndexFileName);
+    size_t         cached    = use_index ? ReadIndex(index_path) : 0;
+    const uint32_t signature = cached > 0 ? index_.signature : 0;
+    uint32_t       hash      = kFnvOffset;
+    const size_t   path_len  = strlen(search_path);
+
     // Open Dir and scan for files.
     if(f_opendir(&dir, search_path) != FR_OK)
     {
@@ -31,15 +101,67 @@ void WavPlayer::Init(const char *search_path)
             continue;
         // Now we'll check if its .wav and add to the list.
         fn = fno.fname;
-        if(file_cnt_ < kMaxFiles - 1)
+        if(file_cnt_ < kMaxFiles)
         {
-            if(strstr(fn, ".wav") || strstr(fn, ".WAV"))
+            if(IsWavFile(fn))
             {
-                strcpy(file_info_[file_cnt_].name, search_path);
-                strcat(file_info_[file_cnt_].name, fn);
+                const uint32_t size = fno.fsize;
+                hash = Fnv1a(hash, fn, strlen(fn));
+                hash = Fnv1a(hash, &size, sizeof(size));
+                hash = Fnv1a(hash, &fno.fdate, sizeof(fno.fdate));
+                hash = Fnv1a(hash, &fno.ftime, sizeof(fno.ftime));
+
+                // look for the file in the index
+                size_t found = cached;
+                for(size_t i = file_cnt_; i < cached; i++)
+                {
+                    const FileEntry &entry = index_.files[i];
+                    if(entry.size == size && entry.date == fno.fdate
+                       && entry.time == fno.ftime
+                       && strncmp(entry.info.name, search_path, path_len) == 0
+                       && strcmp(entry.info.name + path_len, fn) == 0)
+                    {
+                        found = i;
+                        break;
+                    }
+                }
+                FileEntry &entry = index_.files[file_cnt_];
+                if(found < cached)
+                {
+                    if(found != file_cnt_)
+                    {
+                        const FileEntry other = entry;
+                        entry                 = index_.files[found];
+                        index_.files[found]   = other;
+                    }
+                }
+                else
+                {
+                    // new or changed: the cached entry in its place moves to
+                    // the back, if there's room, and the header is read
+                    if(file_cnt_ < cached && cached < kMaxFiles)
+                        index_.files[cached++] = entry;
+                    strcpy(entry.info.name, search_path);
+                    strcat(entry.info.name, fn);
+                    entry.size = size;
+                    entry.date = fno.fdate;
+                    entry.time = fno.ftime;
+                    // Files that can't be played are kept in the index, so
+                    // that they aren't read again
+                    entry.info.format = WavSampleFormat::UNSUPPORTED;
+                    if(f_open(&fil,
+                              entry.info.name,
+                              (FA_OPEN_EXISTING | FA_READ))
+                       == FR_OK)
+                    {
+                        if(!ReadFileInfo(&fil, &entry.info))
+                            entry.info.format = WavSampleFormat::UNSUPPORTED;
+                        f_close(&fil);
+                    }
+                }
                 file_cnt_++;
-                // For now lets break anyway to test.
-                //                break;
+                if(cached < file_cnt_)
+                    cached = file_cnt_;
             }
         }
         else
@@ -48,119 +170,670 @@ void WavPlayer::Init(const char *search_path)
         }
     } while(result == FR_OK);
     f_closedir(&dir);
-    // Now we'll go through each file and load the WavInfo.
+
+    if(use_index && (hash != signature || file_cnt_ != index_.num_files))
+    {
+        index_.signature = hash;
+        WriteIndex(index_path, file_cnt_);
+    }
+
+    // Keep the files that can be played
+    size_t num_files = 0;
     for(size_t i = 0; i < file_cnt_; i++)
     {
-        size_t bytesread;
-        if(f_open(&fil_, file_info_[i].name, (FA_OPEN_EXISTING | FA_READ))
-           == FR_OK)
+        if(index_.files[i].info.format == WavSampleFormat::UNSUPPORTED)
+            continue;
+        if(num_files != i)
+            index_.files[num_files] = index_.files[i];
+        num_files++;
+    }
+    file_cnt_ = num_files;
+
+    // start the first file on voice 0 preemptively.
+    if(file_cnt_ > 0)
+        Play(0, 0, false);
+}
+
+size_t WavPlayer::ReadIndex(const char *path)
+{
+    FIL  fil;
+    UINT bytesread = 0;
+    index_.num_files = 0;
+    if(f_open(&fil, path, (FA_OPEN_EXISTING | FA_READ)) != FR_OK)
+        return 0;
+    // the header and all the files in one go
+    const FRESULT result = f_read(&fil, &index_, sizeof(index_), &bytesread);
+    f_close(&fil);
+    const size_t header = offsetof(Index, files);
+    if(result != FR_OK || bytesread < header || index_.magic != kIndexMagic
+       || index_.entry_size != sizeof(FileEntry)
+       || index_.num_files > kMaxFiles
+       || bytesread != header + index_.num_files * sizeof(FileEntry))
+    {
+        index_.num_files = 0;
+        return 0;
+    }
+    return index_.num_files;
+}
+
+void WavPlayer::WriteIndex(const char *path, size_t num_files)
+{
+    FIL  fil;
+    UINT written = 0;
+    index_.magic      = kIndexMagic;
+    index_.entry_size = sizeof(FileEntry);
+    index_.num_files  = num_files;
+    if(f_open(&fil, path, (FA_CREATE_ALWAYS | FA_WRITE)) != FR_OK)
+        return;
+    const size_t size = offsetof(Index, files) + num_files * sizeof(FileEntry);
+    if(f_write(&fil, &index_, size, &written) != FR_OK || written != size)
+    {
+        // a partial index would be read as invalid anyway
+        f_close(&fil);
+        f_unlink(path);
+        return;
+    }
+    f_close(&fil);
+}
+
+bool WavPlayer::ReadFileInfo(FIL *fil, WavFileInfo *info)
+{
+    WAV_FormatTypeDef &header = info->raw_data;
+    uint8_t            buf[40];
+    UINT               bytesread;
+    memset(&header, 0, sizeof(header));
+    info->format = WavSampleFormat::UNSUPPORTED;
+
+    if(f_read(fil, buf, 12, &bytesread) != FR_OK || bytesread != 12
+       || ReadLE(buf, 4) != kWavFileChunkId
+       || ReadLE(buf + 8, 4) != kWavFileWaveId)
+        return false;
+    header.ChunkId    = kWavFileChunkId;
+    header.FileSize   = ReadLE(buf + 4, 4);
+    header.FileFormat = kWavFileWaveId;
+
+    // Walk the chunks up to "data", skipping the ones we don't need
+    // ("LIST", "fact", "cue " ...). Chunks are padded to an even size.
+    const uint32_t file_size = f_size(fil);
+    uint32_t       pos       = 12;
+    bool           have_fmt  = false;
+    while(pos + 8 <= file_size)
+    {
+        if(f_lseek(fil, pos) != FR_OK
+           || f_read(fil, buf, 8, &bytesread) != FR_OK || bytesread != 8)
+            return false;
+        const uint32_t id   = ReadLE(buf, 4);
+        const uint32_t size = ReadLE(buf + 4, 4);
+        pos += 8;
+        if(id == kWavFileSubChunk1Id)
         {
-            // Populate the WAV Info
-            if(f_read(&fil_,
-                      (void *)&file_info_[i].raw_data,
-                      sizeof(WAV_FormatTypeDef),
-                      &bytesread)
-               != FR_OK)
-            {
-                // Maybe add return type
-                return;
-            }
-            f_close(&fil_);
+            const UINT len = size < sizeof(buf) ? size : sizeof(buf);
+            if(len < 16 || f_read(fil, buf, len, &bytesread) != FR_OK
+               || bytesread != len)
+                return false;
+            header.SubChunk1ID   = id;
+            header.SubChunk1Size = size;
+            header.AudioFormat   = ReadLE(buf, 2);
+            header.NbrChannels   = ReadLE(buf + 2, 2);
+            header.SampleRate    = ReadLE(buf + 4, 4);
+            header.ByteRate      = ReadLE(buf + 8, 4);
+            header.BlockAlign    = ReadLE(buf + 12, 2);
+            header.BitPerSample  = ReadLE(buf + 14, 2);
+            // the actual format code starts the sub-format GUID
+            uint16_t code = header.AudioFormat;
+            if(code == WAVE_FORMAT_EXTENSIBLE)
+                code = len >= 26 ? ReadLE(buf + 24, 2) : 0;
+            info->format = GetWavSampleFormat(code, header.BitPerSample);
+            have_fmt     = true;
+        }
+        else if(id == kWavFileSubChunk2Id)
+        {
+            if(!have_fmt)
+                return false;
+            header.SubChunk2ID   = id;
+            header.SubCHunk2Size
+                = size < file_size - pos ? size : file_size - pos;
+            info->data_offset    = pos;
+            const size_t frame_size
+                = header.NbrChannels * GetWavSampleSize(info->format);
+            return info->format != WavSampleFormat::UNSUPPORTED
+                   && frame_size > 0 && frame_size <= kRawSize
+                   && header.SampleRate > 0;
         }
+        if(size > file_size - pos)
+            break;
+        pos += size + (size & 1);
     }
-    // fill buffer with first file preemptively.
-    buff_state_ = BUFFER_STATE_PREPARE_0;
-    Open(0);
-    Prepare();
-    read_ptr_ = 0;
+    return false;
 }
 
+bool WavPlayer::Play(size_t voice_idx, size_t file, bool loop)
+{
+    if(voice_idx >= kMaxVoices || file >= file_cnt_)
+        return false;
+    Voice &voice = voices_[voice_idx];
 
-int WavPlayer::Open(size_t sel)
+    // the audio callback leaves the ring alone from here on
+    voice.active.store(false, std::memory_order_release);
+    CloseVoice(voice);
+
+    const WavFileInfo &info = index_.files[file].info;
+    if(f_open(&voice.fil, info.name, (FA_OPEN_EXISTING | FA_READ)) != FR_OK)
+        return false;
+    voice.file_open = true;
+    // With the cluster link map table, seeks and reads look up clusters in
+    // the table instead of following the chain in the FAT. Files in too
+    // many fragments for the table seek the usual way.
+    voice.clmt[0]   = DSY_WAVPLAYER_CLMT_SIZE;
+    voice.fil.cltbl = voice.clmt;
+    if(f_lseek(&voice.fil, CREATE_LINKMAP) != FR_OK)
+        voice.fil.cltbl = nullptr;
+
+    voice.file         = file;
+    voice.looping      = loop;
+    voice.num_channels = info.raw_data.NbrChannels;
+    voice.format       = info.format;
+    voice.frame_size   = voice.num_channels * GetWavSampleSize(info.format);
+    voice.data_start   = info.data_offset;
+    voice.data_size    = info.raw_data.SubCHunk2Size;
+    voice.data_size -= voice.data_size % voice.frame_size;
+    voice.read_pos   = 0;
+    voice.loop_start = 0;
+    voice.loop_end   = voice.data_size;
+    voice.rate       = double(info.raw_data.SampleRate) / samplerate_;
+    voice.speed.store(1.f);
+    if(voice.data_size == 0 || !FillLoopCache(voice) || !Start(voice, 0))
+    {
+        CloseVoice(voice);
+        return false;
+    }
+    return true;
+}
+
+bool WavPlayer::Start(Voice &voice, uint32_t pos)
 {
-    if(sel != file_sel_)
+    voice.read_pos = pos;
+    // the first frame follows a silent one
+    voice.phase = uint64_t(1) << 32;
+    memset(voice.history, 0, sizeof(voice.history));
+    voice.num_history = 1;
+    voice.tail        = 0;
+    voice.ring.Init();
+    voice.gaps.Init();
+    voice.gap_bytes.store(0);
+    // the ring starts at the offset of the file position in a cache line,
+    // so that the reads go straight into it
+    const uint32_t skip = (voice.data_start + pos) % kCacheLine;
+    voice.ring.CommitWrite(skip);
+    voice.ring.CommitRead(skip);
+    voice.written  = skip;
+    voice.consumed = skip;
+    voice.end.store(false);
+    voice.stopped.store(false);
+    if(f_lseek(&voice.fil, voice.data_start + pos) != FR_OK || !Refill(voice))
+        return false;
+    voice.active.store(true, std::memory_order_release);
+    return true;
+}
+
+bool WavPlayer::Seek(size_t voice_idx, uint32_t frame)
+{
+    if(voice_idx >= kMaxVoices || !voices_[voice_idx].file_open)
+        return false;
+    Voice         &voice = voices_[voice_idx];
+    const uint64_t pos   = uint64_t(frame) * voice.frame_size;
+    if(pos >= voice.data_size)
+        return false;
+    voice.active.store(false, std::memory_order_release);
+    if(!Start(voice, uint32_t(pos)))
     {
-        f_close(&fil_);
-        file_sel_ = sel < file_cnt_ ? sel : file_cnt_ - 1;
+        CloseVoice(voice);
+        return false;
     }
-    // Set Buffer Position
-    return f_open(
-        &fil_, file_info_[file_sel_].name, (FA_OPEN_EXISTING | FA_READ));
+    return true;
 }
 
-int WavPlayer::Close()
+bool WavPlayer::SetLoopPoints(size_t voice_idx, uint32_t start, uint32_t end)
+{
+    if(voice_idx >= kMaxVoices || !voices_[voice_idx].file_open)
+        return false;
+    Voice &voice = voices_[voice_idx];
+    if(start >= end || uint64_t(end) * voice.frame_size > voice.data_size)
+        return false;
+    voice.loop_start = start * voice.frame_size;
+    voice.loop_end   = end * voice.frame_size;
+    if(!FillLoopCache(voice))
+    {
+        // a read error ends the file where it is
+        voice.end.store(true, std::memory_order_release);
+        return false;
+    }
+    if(voice.looping)
+        voice.end.store(false, std::memory_order_release);
+    return true;
+}
+
+bool WavPlayer::FillLoopCache(Voice &voice)
 {
-    return f_close(&fil_);
+    // The cache ends on a sector boundary, so that seeking past it after a
+    // wrap doesn't read a sector. It starts at the offset of the loop start
+    // in a cache line, so that it is read straight from the card.
+    const uint32_t start  = voice.data_start + voice.loop_start;
+    const uint32_t offset = start % kCacheLine;
+    uint32_t       size   = DSY_WAVPLAYER_LOOP_CACHE_SIZE - start % kSectorSize;
+    if(size > voice.loop_end - voice.loop_start)
+        size = voice.loop_end - voice.loop_start;
+    if(f_lseek(&voice.fil, start) != FR_OK
+       || !ReadData(voice, start, voice.loop_cache + offset, size)
+       || f_lseek(&voice.fil, voice.data_start + voice.read_pos) != FR_OK)
+        return false;
+    voice.loop_cache_size   = size;
+    voice.loop_cache_offset = offset;
+    return true;
 }
 
-int16_t WavPlayer::Stream()
+size_t WavPlayer::RefillSize(const Voice &voice) const
 {
-    int16_t samp;
-    if(playing_)
+    const uint32_t stop = voice.looping ? voice.loop_end : voice.data_size;
+    if(voice.read_pos >= stop)
+        return voice.looping ? voice.loop_cache_size + WrapGap(voice) : 0;
+    return stop - voice.read_pos < kMinRefill ? stop - voice.read_pos
+                                              : kMinRefill;
+}
+
+size_t WavPlayer::WrapGap(const Voice &voice) const
+{
+    // only reads from the card after the cache need one, and without room
+    // for another gap they go through bounce_
+    if(voice.loop_start + voice.loop_cache_size >= voice.loop_end
+       || voice.gaps.writable() == 0)
+        return 0;
+    return (voice.data_start + voice.loop_start - voice.written) % kCacheLine;
+}
+
+bool WavPlayer::Refill(Voice &voice)
+{
+    const uint32_t stop = voice.looping ? voice.loop_end : voice.data_size;
+    if(voice.read_pos >= stop)
     {
-        samp = buff_[read_ptr_];
-        // Increment rpo
-        read_ptr_ = (read_ptr_ + 1) % kBufferSize;
-        if(read_ptr_ == 0)
-            buff_state_ = BUFFER_STATE_PREPARE_1;
-        else if(read_ptr_ == kBufferSize / 2)
-            buff_state_ = BUFFER_STATE_PREPARE_0;
+        if(!voice.looping)
+        {
+            voice.end.store(true, std::memory_order_release);
+            return true;
+        }
+        // The loop starts over from memory, and the card is read on from
+        // where the cache ends.
+        const size_t gap = WrapGap(voice);
+        if(voice.ring.writable() < gap + voice.loop_cache_size)
+            return true;
+        if(gap > 0)
+        {
+            // the audio callback learns of the gap before it can read it
+            voice.gaps.Write({voice.written, uint32_t(gap)});
+            voice.gap_bytes.fetch_add(gap, std::memory_order_relaxed);
+            voice.ring.Write(voice.loop_cache, gap);
+            voice.written += gap;
+        }
+        voice.ring.Write(voice.loop_cache + voice.loop_cache_offset,
+                         voice.loop_cache_size);
+        voice.written += voice.loop_cache_size;
+        voice.read_pos = voice.loop_start + voice.loop_cache_size;
+        return voice.read_pos >= voice.loop_end
+               || f_lseek(&voice.fil, voice.data_start + voice.read_pos)
+                      == FR_OK;
     }
-    else
+
+    // one contiguous read, straight into the ring
+    const auto span = voice.ring.PeekWrite();
+    size_t     size = span.num_elements;
+    if(size > stop - voice.read_pos)
+        size = stop - voice.read_pos;
+    // end on a sector boundary, so that the following reads are whole
+    // sectors, which FatFs transfers without copying
+    const size_t end = (voice.data_start + voice.read_pos + size) % kSectorSize;
+    if(size > end + kSectorSize && voice.read_pos + size < stop)
+        size -= end;
+
+    if(!ReadData(voice, voice.data_start + voice.read_pos, span.data, size))
+        return false;
+    voice.ring.CommitWrite(size);
+    voice.written += size;
+    voice.read_pos += size;
+    if(voice.read_pos == voice.data_size && !voice.looping)
+        voice.end.store(true, std::memory_order_release);
+    return true;
+}
+
+bool WavPlayer::ReadData(Voice &voice, uint32_t pos, uint8_t *dst, size_t size)
+{
+    // FatFs reads the whole sectors of a read straight to dst, where the SD
+    // DMA needs them on a cache line. The DMA ignores the low bits of the
+    // address, and the cache invalidate after it would clobber what shares
+    // the first and last line.
+    UINT bytesread = 0;
+    if((uintptr_t(dst) - pos) % kCacheLine == 0)
+        return f_read(&voice.fil, dst, size, &bytesread) == FR_OK
+               && bytesread == size;
+
+    // otherwise a sector at a time through bounce_
+    while(size > 0)
     {
-        samp = 0;
-        if(looping_)
-            playing_ = true;
+        size_t n = kSectorSize - pos % kSectorSize;
+        if(n > size)
+            n = size;
+        if(f_read(&voice.fil, bounce_, n, &bytesread) != FR_OK
+           || bytesread != n)
+            return false;
+        memcpy(dst, bounce_, n);
+        dst += n;
+        pos += n;
+        size -= n;
     }
-    return samp;
+    return true;
 }
 
 void WavPlayer::Prepare()
 {
-    if(buff_state_ != BUFFER_STATE_IDLE)
+    for(auto &voice : voices_)
     {
-        size_t offset, bytesread, rxsize;
-        bytesread = 0;
-        rxsize    = (kBufferSize / 2) * sizeof(buff_[0]);
-        offset    = buff_state_ == BUFFER_STATE_PREPARE_1 ? kBufferSize / 2 : 0;
-        f_read(&fil_, &buff_[offset], rxsize, &bytesread);
-        if(bytesread < rxsize || f_eof(&fil_))
+        if(voice.file_open && voice.stopped.load(std::memory_order_acquire))
         {
-            if(looping_)
-            {
-                Restart();
-                f_read(&fil_,
-                       &buff_[offset + (bytesread / 2)],
-                       rxsize - bytesread,
-                       &bytesread);
-            }
-            else
+            voice.active.store(false, std::memory_order_release);
+            CloseVoice(voice);
+        }
+    }
+
+    // Refill the voice that runs dry first, until all are topped up
+    while(true)
+    {
+        Voice *next          = nullptr;
+        size_t next_buffered = 0;
+        for(auto &voice : voices_)
+        {
+            if(!voice.file_open || voice.end.load(std::memory_order_relaxed))
+                continue;
+            const size_t writable = voice.ring.writable();
+            if(writable < RefillSize(voice))
+                continue;
+            const size_t buffered
+                = (kVoiceBufferSize - writable) / voice.frame_size;
+            if(next == nullptr || buffered < next_buffered)
             {
-                playing_ = false;
+                next          = &voice;
+                next_buffered = buffered;
             }
         }
-        buff_state_ = BUFFER_STATE_IDLE;
+        if(next == nullptr)
+            break;
+        if(!Refill(*next))
+        {
+            // a read error ends the file where it is
+            next->end.store(true, std::memory_order_release);
+        }
     }
 }
 
-void WavPlayer::Restart()
+void WavPlayer::CloseVoice(Voice &voice)
+{
+    if(voice.file_open)
+        f_close(&voice.fil);
+    voice.file_open = false;
+    voice.end.store(true);
+    voice.stopped.store(true);
+}
+
+void WavPlayer::Stop(size_t voice)
 {
-    playing_ = true;
-    f_lseek(&fil_,
-            sizeof(WAV_FormatTypeDef)
-                + file_info_[file_sel_].raw_data.SubChunk1Size);
+    if(voice < kMaxVoices)
+        voices_[voice].stopped.store(true, std::memory_order_release);
 }
 
-WavPlayer::BufferState WavPlayer::GetNextBuffState()
+bool WavPlayer::IsPlaying(size_t voice) const
 {
-    size_t next_samp;
-    next_samp = (read_ptr_ + 1) % kBufferSize;
-    if(next_samp < kBufferSize / 2)
+    return voice < kMaxVoices
+           && !voices_[voice].stopped.load(std::memory_order_acquire);
+}
+
+WavPlayer::VoiceStats WavPlayer::GetStats(size_t voice) const
+{
+    return voice < kMaxVoices ? voices_[voice].stats : VoiceStats{0, 0, 0};
+}
+
+void WavPlayer::SetLooping(size_t voice_idx, bool loop)
+{
+    if(voice_idx >= kMaxVoices)
+        return;
+    Voice &voice = voices_[voice_idx];
+    voice.looping = loop;
+    // a file that has been read to its end can still be extended
+    if(loop && voice.file_open && voice.read_pos == voice.data_size)
+        voice.end.store(false, std::memory_order_release);
+}
+
+void WavPlayer::SetSpeed(size_t voice, float speed)
+{
+    if(voice < kMaxVoices)
+        voices_[voice].speed.store(speed > 0.f ? speed : 0.f,
+                                   std::memory_order_relaxed);
+}
+
+void WavPlayer::ResetStats()
+{
+    for(auto &voice : voices_)
     {
-        return BUFFER_STATE_PREPARE_1;
+        voice.stats.underruns      = 0;
+        voice.stats.missing_frames = 0;
+        voice.stats.min_buffered   = UINT32_MAX;
     }
-    else
+}
+
+void WavPlayer::Decode(Voice &voice,
+                       size_t channels,
+                       size_t offset,
+                       size_t frames)
+{
+    float *dst[kMaxChannels];
+    for(size_t ch = 0; ch < channels; ch++)
+        dst[ch] = decoded_[ch] + offset;
+    // frames may wrap around the end of the ring, so they are copied out in
+    // pieces
+    while(frames > 0)
     {
-        return BUFFER_STATE_PREPARE_0;
+        size_t n = kRawSize / voice.frame_size;
+        if(n > frames)
+            n = frames;
+        // the frames stop at the next gap, which is skipped
+        const auto gap = voice.gaps.PeekRead();
+        if(gap.num_elements > 0)
+        {
+            const uint32_t before = gap.data->position - voice.consumed;
+            if(before < voice.frame_size)
+            {
+                // with what is left of a frame cut short by a new loop end
+                voice.ring.Read(raw_, before + gap.data->size);
+                voice.consumed += before + gap.data->size;
+                voice.gap_bytes.fetch_sub(gap.data->size,
+                                          std::memory_order_relaxed);
+                voice.gaps.CommitRead(1);
+                continue;
+            }
+            if(n > before / voice.frame_size)
+                n = before / voice.frame_size;
+        }
+        voice.ring.Read(raw_, n * voice.frame_size);
+        voice.consumed += n * voice.frame_size;
+        WavToFloat(raw_, voice.num_channels, dst, channels, n, voice.format);
+        for(size_t ch = 0; ch < channels; ch++)
+            dst[ch] += n;
+        frames -= n;
+    }
+}
+
+size_t WavPlayer::Stream(size_t       voice_idx,
+                         float *const *out,
+                         size_t        num_channels,
+                         size_t        size)
+{
+    size_t done = 0;
+    if(voice_idx < kMaxVoices)
+    {
+        Voice &voice = voices_[voice_idx];
+        if(voice.active.load(std::memory_order_acquire)
+           && !voice.stopped.load(std::memory_order_relaxed))
+        {
+            const bool end = voice.end.load(std::memory_order_acquire);
+            // the gaps in the ring aren't audio
+            const size_t readable = voice.ring.readable();
+            const size_t gaps     = voice.gap_bytes.load();
+            size_t       buffered
+                = (readable > gaps ? readable - gaps : 0) / voice.frame_size;
+            if(buffered < voice.stats.min_buffered)
+                voice.stats.min_buffered = buffered;
+
+            const size_t channels = voice.num_channels < kMaxChannels
+                                        ? voice.num_channels
+                                        : kMaxChannels;
+            const size_t played = channels < num_channels ? channels
+                                                          : num_channels;
+            const uint64_t step = uint64_t(
+                voice.rate * voice.speed.load(std::memory_order_relaxed)
+                    * 4294967296.0
+                + 0.5);
+            size_t kept = voice.num_history;
+            for(size_t ch = 0; ch < channels; ch++)
+                memcpy(decoded_[ch], voice.history[ch], sizeof(float) * kept);
+
+            // Frames are decoded after the history, and each output sample
+            // is interpolated from the frames around the phase, which
+            // advances by the ratio of the file rate to the output rate.
+            while(done < size)
+            {
+                // frames that the rest of the block reaches into
+                const uint64_t last = voice.phase + (size - done - 1) * step;
+                const size_t   need = size_t(last >> 32) + 3;
+                size_t         want = need > kept ? need - kept : 0;
+                if(want > kDecodeFrames)
+                    want = kDecodeFrames;
+                const size_t n = want < buffered ? want : buffered;
+                Decode(voice, channels, kept, n);
+                buffered -= n;
+                size_t len = kept + n;
+                if(n < want && end && buffered == 0 && voice.tail < kTail)
+                {
+                    // silence after the end, so that the last frame is
+                    // reached
+                    size_t pad = want - n;
+                    if(pad > kTail - voice.tail)
+                        pad = kTail - voice.tail;
+                    for(size_t ch = 0; ch < channels; ch++)
+                        memset(decoded_[ch] + len, 0, sizeof(float) * pad);
+                    voice.tail += pad;
+                    len += pad;
+                }
+
+                // outputs up to the last one that has a frame after it
+                size_t   m     = 0;
+                uint64_t phase = voice.phase;
+                while(done + m < size && (phase >> 32) + 2 < len)
+                {
+                    phase += step;
+                    m++;
+                }
+                if(m == 0 && len == kept)
+                    break;
+                for(size_t ch = 0; ch < played; ch++)
+                {
+                    const float *b = decoded_[ch];
+                    float       *o = out[ch] + done;
+                    if(step == (uint64_t(1) << 32)
+                       && (voice.phase & 0xffffffff) == 0)
+                    {
+                        memcpy(o, b + (voice.phase >> 32), sizeof(float) * m);
+                        continue;
+                    }
+                    uint64_t p = voice.phase;
+                    for(size_t i = 0; i < m; i++)
+                    {
+                        const size_t idx = p >> 32;
+                        const float  t   = (p & 0xffffffff) * 2.3283064e-10f;
+                        o[i]             = Hermite(
+                            b[idx - 1], b[idx], b[idx + 1], b[idx + 2], t);
+                        p += step;
+                    }
+                }
+                // mono files play on all channels
+                for(size_t ch = played; ch < num_channels; ch++)
+                    memcpy(out[ch] + done,
+                           out[played - 1] + done,
+                           sizeof(float) * m);
+                done += m;
+
+                // the frames from the one before the phase on are kept
+                size_t drop = size_t(phase >> 32) - 1;
+                if(drop > len)
+                    drop = len;
+                kept        = len - drop;
+                voice.phase = phase - (uint64_t(drop) << 32);
+                for(size_t ch = 0; ch < channels; ch++)
+                    memmove(decoded_[ch],
+                            decoded_[ch] + drop,
+                            sizeof(float) * kept);
+            }
+            for(size_t ch = 0; ch < channels; ch++)
+                memcpy(voice.history[ch], decoded_[ch], sizeof(float) * kept);
+            voice.num_history = kept;
+
+            if(done < size)
+            {
+                if(end && buffered == 0)
+                {
+                    voice.stopped.store(true, std::memory_order_release);
+                }
+                else
+                {
+                    voice.stats.underruns++;
+                    voice.stats.missing_frames += size - done;
+                }
+            }
+        }
+    }
+    for(size_t ch = 0; ch < num_channels; ch++)
+    {
+        for(size_t i = done; i < size; i++)
+            out[ch][i] = 0.f;
     }
+    return done;
+}
+
+int WavPlayer::Open(size_t sel)
+{
+    file_sel_ = sel < file_cnt_ ? sel : file_cnt_ - 1;
+    return Play(0, file_sel_, voices_[0].looping) ? FR_OK : FR_NO_FILE;
+}
+
+int WavPlayer::Close()
+{
+    Stop(0);
+    voices_[0].active.store(false, std::memory_order_release);
+    CloseVoice(voices_[0]);
+    return FR_OK;
+}
+
+int16_t WavPlayer::Stream()
+{
+    float  samp;
+    float *out = &samp;
+    Stream(0, &out, 1, 1);
+    return f2s16(samp);
+}
+
+void WavPlayer::Restart()
+{
+    if(!Seek(0, 0))
+        Play(0, file_sel_, voices_[0].looping);
+}
+
+void WavPlayer::SetLooping(bool loop)
+{
+    SetLooping(0, loop);
 }
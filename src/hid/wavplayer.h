@@ -1,47 +1,234 @@
 /* Current Limitations:
-- 1x Playback speed only
-- 16-bit, mono files only (otherwise fun weirdness can happen).
-- Only 1 file playing back at a time.
+- Forward playback only
+- Only the first two channels of a file are played.
 - Not sure how this would interfere with trying to use the SDCard/FatFs outside of
 this module. However, by using the extern'd SDFile, etc. I think that would break things.
 */
 #pragma once
 #ifndef DSY_WAVPLAYER_H
 #define DSY_WAVPLAYER_H /**< Macro */
+#include <atomic>
 #include "daisy_core.h"
 #include "util/wav_format.h"
+#include "util/wav_convert.h"
+#include "util/ringbuffer.h"
 #include "ff.h"
 
 #define WAV_FILENAME_MAX \
     256 /**< Maximum LFN (set to same in FatFs (ffconf.h) */
 
+/** Number of files the WavPlayer can play at the same time.
+ ** Each voice has its own read-ahead buffer and FatFs file object.
+ ** Define it when building libDaisy (e.g. -DDSY_WAVPLAYER_MAX_VOICES=16) to override.
+ */
+#ifndef DSY_WAVPLAYER_MAX_VOICES
+#define DSY_WAVPLAYER_MAX_VOICES 8
+#endif
+
+/** Number of files the WavPlayer lists, each takes about 320 bytes.
+ */
+#ifndef DSY_WAVPLAYER_MAX_FILES
+#define DSY_WAVPLAYER_MAX_FILES 8
+#endif
+
+/** Read-ahead buffer of each WavPlayer voice in bytes, a power of two.
+ ** Larger buffers ride out longer SD card stalls.
+ */
+#ifndef DSY_WAVPLAYER_VOICE_BUFFER_SIZE
+#define DSY_WAVPLAYER_VOICE_BUFFER_SIZE 8192
+#endif
+
+/** Entries of the FatFs cluster link map table of each WavPlayer voice.
+ ** A file in n fragments needs 2 * n + 1 entries, files with more fragments
+ ** seek by walking the FAT instead.
+ */
+#ifndef DSY_WAVPLAYER_CLMT_SIZE
+#define DSY_WAVPLAYER_CLMT_SIZE 64
+#endif
+
+/** Bytes at the loop start that each WavPlayer voice keeps in memory, a
+ ** multiple of 512. Loops shorter than this play without reading the card.
+ */
+#ifndef DSY_WAVPLAYER_LOOP_CACHE_SIZE
+#define DSY_WAVPLAYER_LOOP_CACHE_SIZE 2048
+#endif
+
 namespace daisy
 {
-// TODO: add bitrate, samplerate, length, etc.
 /** Struct containing details of Wav File. */
 struct WavFileInfo
 {
-    WAV_FormatTypeDef raw_data;               /**< Raw wav data */
+    /** Wav data, from the "fmt " chunk and the size of the "data" chunk */
+    WAV_FormatTypeDef raw_data;
     char              name[WAV_FILENAME_MAX]; /**< Wav filename */
+    uint32_t          data_offset; /**< position of the audio data */
+    WavSampleFormat   format;      /**< format of the audio data */
 };
 
-/* 
-TODO:
-- Make template-y to reduce memory usage.
-*/
+/** Wav Player that will load .wav files from an SD Card,
+and then stream them from a number of voices at the same time.
 
+Each voice reads its file through its own ring buffer. Prepare() runs in the
+main loop and refills the voices in deadline order, the voice with the least
+audio buffered first, with large reads that end on sector boundaries. The
+audio callback renders each voice with Stream(), a block of float samples at
+a time. When a voice runs out of buffered audio, it plays silence, and the
+underrun shows up in GetStats().
 
-/** Wav Player that will load .wav files from an SD Card,
-and then provide a method of accessing the samples with
-double-buffering. */
+Files can be 8, 16, 24 or 32-bit PCM, or 32-bit float, with any number of
+channels and any sample rate. Files at another rate than the one set with
+SetSampleRate() are converted with cubic (Hermite) interpolation, which
+also plays voices at any speed set with SetSpeed().
+
+Each voice builds a FatFs cluster link map table when it opens its file, so
+Seek() and loop wraps move within the file without walking the FAT. The
+start of the loop is kept in memory, and a wrap continues from there while
+the file is read on from the next sector.
+
+Init() keeps an index of the files it found, with their headers, in the file
+WAVPLAY.IDX next to them. The next Init() reads the index and the directory,
+and only opens the files that were added or changed since (a different
+size or modification time), so startup doesn't slow down with the number of
+files. The index is rewritten when the directory has changed.
+
+The single-file functions (Open(), Stream() without arguments, Restart(),
+SetLooping() ...) play on voice 0.
+
+Usage:
+\code
+WavPlayer sampler;
+sampler.SetSampleRate(hw.AudioSampleRate());
+sampler.Init("/");
+sampler.Play(0, 2);
+sampler.Play(1, 5, true);
+sampler.SetLoopPoints(1, 4800, 96000);
+
+// audio callback
+sampler.SetSpeed(0, 1.5f);
+sampler.Stream(0, voice_out, 2, size);
+
+// main loop
+while(1)
+    sampler.Prepare();
+\endcode
+*/
 class WavPlayer
 {
   public:
+    /** Number of voices */
+    static constexpr size_t kMaxVoices = DSY_WAVPLAYER_MAX_VOICES;
+    /** Read-ahead buffer of each voice, in bytes */
+    static constexpr size_t kVoiceBufferSize = DSY_WAVPLAYER_VOICE_BUFFER_SIZE;
+
+    /** Starvation counters of a voice */
+    struct VoiceStats
+    {
+        /** blocks that ran out of buffered audio */
+        uint32_t underruns;
+
+        /** frames that were replaced with silence */
+        uint32_t missing_frames;
+
+        /** fewest frames buffered at the start of a block */
+        uint32_t min_buffered;
+    };
+
     WavPlayer() {}
     ~WavPlayer() {}
 
-    /** Initializes the WavPlayer, loading up to max_files of wav files from an SD Card. */
-    void Init(const char* search_path);
+    /** Initializes the WavPlayer, loading up to max_files of wav files from an SD Card.
+     *  Files that aren't valid WAV files, or have an unsupported format, are
+     *  skipped.
+     *  \param search_path directory of the files, ending with a '/'
+     *  \param use_index whether to read and write the index of the files
+     */
+    void Init(const char* search_path, bool use_index = true);
+
+    /** Sets the sample rate of the audio callback, 48kHz by default.
+     *  Voices started after this convert their files to the new rate. */
+    void SetSampleRate(float samplerate) { samplerate_ = samplerate; }
+
+    /** \return the details of a file, nullptr if it doesn't exist */
+    const WavFileInfo* GetFileInfo(size_t file) const
+    {
+        return file < file_cnt_ ? &index_.files[file].info : nullptr;
+    }
+
+    // ======== main loop side ========
+
+    /** Starts playing a file on a voice, from its beginning. The voice stops
+     *  whatever it played before.
+     *  \param voice voice to play on
+     *  \param file index of the file
+     *  \param loop whether the file repeats when it ends
+     *  \return false if the file couldn't be read
+     */
+    bool Play(size_t voice, size_t file, bool loop = false);
+
+    /** Moves a voice to another position in its file. What is buffered is
+     *  dropped, and the voice carries on from the new position after a
+     *  single read.
+     *  \param voice voice that plays a file
+     *  \param frame position in the file, in frames at the rate of the file
+     *  \return false if the voice doesn't play, or frame is past the end
+     */
+    bool Seek(size_t voice, uint32_t frame);
+
+    /** Sets the part of its file that a looping voice repeats, the whole file
+     *  by default. Buffered audio plays as is, the new points apply from the
+     *  next time the voice reaches the end of the loop.
+     *  \param voice voice that plays a file
+     *  \param start first frame of the loop
+     *  \param end frame after the last frame of the loop
+     *  \return false if the voice doesn't play, or the loop is empty or
+     *          longer than the file
+     */
+    bool SetLoopPoints(size_t voice, uint32_t start, uint32_t end);
+
+    /** Sets whether a voice repeats its loop */
+    void SetLooping(size_t voice, bool loop);
+
+    /** Refills the voices, most urgent first, and closes the files of voices
+     *  that have stopped. Call it regularly from the main loop. */
+    void Prepare();
+
+    // ======== any context ========
+
+    /** Stops a voice. Safe to call from the audio callback. */
+    void Stop(size_t voice);
+
+    /** \return true while a voice plays a file */
+    bool IsPlaying(size_t voice) const;
+
+    /** \return the starvation counters of a voice */
+    VoiceStats GetStats(size_t voice) const;
+
+    /** Clears the starvation counters of all voices */
+    void ResetStats();
+
+    /** Sets the playback speed of a voice, 1 by default and with each
+     *  Play(). 2 plays an octave up, 0.5 an octave down, and 0 holds the
+     *  current sample. Safe to call from the audio callback, and takes
+     *  effect from the next block.
+     */
+    void SetSpeed(size_t voice, float speed);
+
+    // ======== audio callback side ========
+
+    /** Renders the next block of a voice into planar float buffers. Mono
+     *  files play on all channels, and channels past the second one are
+     *  ignored.
+     *  \param voice voice to render
+     *  \param out one buffer for each channel
+     *  \param num_channels number of buffers in out
+     *  \param size number of samples per channel
+     *  \return number of samples that came from the file, the rest of the
+     *          block is silence
+     */
+    size_t
+    Stream(size_t voice, float* const* out, size_t num_channels, size_t size);
+
+    // ======== single file on voice 0 ========
 
     /** Opens the file at index sel for reading.
     \param sel File to open
@@ -56,19 +243,16 @@ class WavPlayer
     /** \return The next sample if playing, otherwise returns 0 */
     int16_t Stream();
 
-    /** Collects buffer for playback when needed. */
-    void Prepare();
-
     /** Resets the playback position to the beginning of the file immediately */
     void Restart();
 
-    /** Sets whether or not the current file will repeat after completing playback. 
+    /** Sets whether or not the current file will repeat after completing playback.
     \param loop To loop or not to loop.
     */
-    inline void SetLooping(bool loop) { looping_ = loop; }
+    void SetLooping(bool loop);
 
     /** \return Whether the WavPlayer is looping or not. */
-    inline bool GetLooping() const { return looping_; }
+    inline bool GetLooping() const { return voices_[0].looping; }
 
     /** \return The number of files loaded by the WavPlayer */
     inline size_t GetNumberFiles() const { return file_cnt_; }
@@ -77,24 +261,134 @@ class WavPlayer
     inline size_t GetCurrentFile() const { return file_sel_; }
 
   private:
-    enum BufferState
+    /** Channels of a file that are played */
+    static constexpr size_t kMaxChannels = 2;
+    /** Frames before the read position kept for the interpolation */
+    static constexpr size_t kHistory = 4;
+    /** Silent frames that let the interpolation reach the last frame */
+    static constexpr size_t kTail = 2;
+    /** Size and alignment of what the SD card DMA writes and the data cache
+     *  invalidates */
+    static constexpr size_t kCacheLine = 32;
+    static_assert(kVoiceBufferSize % kCacheLine == 0,
+                  "DSY_WAVPLAYER_VOICE_BUFFER_SIZE must be at least 32");
+    /** Gaps that can be in the ring of a voice at a time */
+    static constexpr size_t kMaxGaps = 8;
+
+    /** Bytes in a ring that aren't audio. A loop wrap leaves the ring at
+     *  another offset in a cache line than the file, and a gap before the
+     *  loop start puts them back in step. */
+    struct Gap
     {
-        BUFFER_STATE_IDLE,
-        BUFFER_STATE_PREPARE_0,
-        BUFFER_STATE_PREPARE_1,
+        uint32_t position; /**< bytes written to the ring before it */
+        uint32_t size;
     };
 
-    BufferState GetNextBuffState();
-
-    static constexpr size_t kMaxFiles   = 8;
-    static constexpr size_t kBufferSize = 4096;
-    WavFileInfo             file_info_[kMaxFiles];
-    size_t                  file_cnt_, file_sel_;
-    BufferState             buff_state_;
-    int16_t                 buff_[kBufferSize];
-    size_t                  read_ptr_;
-    bool                    looping_, playing_;
-    FIL                     fil_;
+    struct Voice
+    {
+        // main loop side
+        FIL      fil;
+        bool     file_open;
+        size_t   file;
+        uint32_t data_start; /**< offset of the audio data in the file */
+        uint32_t data_size;
+        uint32_t read_pos; /**< bytes of audio data read */
+        bool     looping;
+        uint32_t loop_start, loop_end; /**< in bytes of audio data */
+        DWORD    clmt[DSY_WAVPLAYER_CLMT_SIZE];
+        /** the audio data from the loop start up to a sector boundary, from
+         *  loop_cache_offset on */
+        alignas(kCacheLine)
+            uint8_t loop_cache[DSY_WAVPLAYER_LOOP_CACHE_SIZE + kCacheLine];
+        uint32_t loop_cache_size;
+        uint32_t loop_cache_offset;
+        uint32_t written; /**< bytes written to the ring, gaps included */
+
+        // set by the main loop before the voice is activated
+        uint16_t        num_channels;
+        uint16_t        frame_size; /**< bytes per frame */
+        WavSampleFormat format;
+        double          rate; /**< file frames per output frame at speed 1 */
+
+        // handed over between the main loop and the audio callback
+        // The card is read straight into the ring by DMA, so it starts on a
+        // cache line, and no other field shares its last one.
+        alignas(kCacheLine) SpscRingBuffer<uint8_t, kVoiceBufferSize> ring;
+        SpscRingBuffer<Gap, kMaxGaps> gaps;
+        std::atomic<uint32_t>         gap_bytes; /**< in the ring */
+        std::atomic<bool> active;  /**< the audio callback reads the ring */
+        std::atomic<bool> end;     /**< the last byte is in the ring */
+        std::atomic<bool> stopped; /**< played to the end, or Stop() */
+        std::atomic<float> speed;
+
+        // audio callback side
+        uint64_t   phase; /**< read position in the decode buffer, 32.32 */
+        uint32_t   consumed; /**< bytes read from the ring, gaps included */
+        float      history[kMaxChannels][kHistory]; /**< last frames */
+        uint8_t    num_history;
+        uint8_t    tail; /**< silent frames appended after the end */
+        VoiceStats stats;
+    };
+
+    /** Reads the next part of the file of a voice into its ring */
+    bool Refill(Voice& voice);
+    /** Reads size bytes of the file of a voice from pos on to dst, through
+     *  bounce_ if DMA can't write to dst */
+    bool ReadData(Voice& voice, uint32_t pos, uint8_t* dst, size_t size);
+    /** \return the free space a voice needs for its next Refill() */
+    size_t RefillSize(const Voice& voice) const;
+    /** \return the size of the gap before the next loop wrap of a voice */
+    size_t WrapGap(const Voice& voice) const;
+    /** Refills a voice from a position in its file, and activates it */
+    bool Start(Voice& voice, uint32_t pos);
+    bool FillLoopCache(Voice& voice);
+    void CloseVoice(Voice& voice);
+    /** Walks the chunks of a file and fills in everything but the name */
+    static bool ReadFileInfo(FIL* fil, WavFileInfo* info);
+    /** Reads the index into index_
+     *  \return number of files in it, 0 if it isn't valid */
+    size_t ReadIndex(const char* path);
+    void   WriteIndex(const char* path, size_t num_files);
+    /** Decodes the next frames of a voice to decoded_ from offset on */
+    void Decode(Voice& voice, size_t channels, size_t offset, size_t frames);
+
+    static constexpr size_t kMaxFiles = DSY_WAVPLAYER_MAX_FILES;
+    /** Refills are at least this large, unless the file ends */
+    static constexpr size_t kMinRefill  = kVoiceBufferSize / 4;
+    static constexpr size_t kSectorSize = 512;
+    /** Frames decoded at a time, and bytes they are decoded from */
+    static constexpr size_t kDecodeFrames = 256;
+    static constexpr size_t kRawSize      = 1024;
+
+    /** A file, and what tells whether it has changed since it was read */
+    struct FileEntry
+    {
+        WavFileInfo info;
+        uint32_t    size;
+        uint16_t    date, time;
+    };
+
+    /** The index file, header and all, as it is read and written */
+    struct Index
+    {
+        uint32_t  magic;
+        uint16_t  entry_size; /**< sizeof(FileEntry) of the build */
+        uint16_t  num_files;
+        uint32_t  signature; /**< hash of the entries of the directory */
+        FileEntry files[kMaxFiles];
+    };
+
+    Index  index_;
+    size_t file_cnt_, file_sel_;
+    float  samplerate_ = 48000.f;
+    Voice  voices_[kMaxVoices];
+
+    // main loop scratch, for reads that can't go straight to a voice
+    alignas(kCacheLine) uint8_t bounce_[kSectorSize];
+
+    // audio callback scratch, shared by all voices
+    uint8_t raw_[kRawSize];
+    float   decoded_[kMaxChannels][kHistory + kDecodeFrames];
 };
 
 } // namespace daisy
@@ -1,12 +1,17 @@
 #include "per/sai.h"
 #include "daisy_core.h"
+#ifndef UNIT_TEST
 extern "C"
 {
 #include "util/hal_map.h"
 }
+#else
+#include <algorithm>
+#endif
 
 namespace daisy
 {
+#ifndef UNIT_TEST // for unit tests, a host implementation is provided below
 class SaiHandle::Impl
 {
   public:
@@ -43,6 +48,8 @@ class SaiHandle::Impl
     /** Offset stored for weird inter-SAI stuff.*/
     size_t dma_offset;
 
+    bool IsRxDmaEventPending();
+
     /** Callback that dispatches user callback from Cplt and HalfCplt DMA Callbacks */
     void InternalCallback(size_t offset);
 
@@ -301,6 +308,17 @@ void SaiHandle::Impl::InternalCallback(size_t offset)
         callback_(in, out, buff_size_ / 2);
 }
 
+bool SaiHandle::Impl::IsRxDmaEventPending()
+{
+    // The DMA IRQ handler clears the flag before dispatching the callback,
+    // so a set flag is always a new event.
+    DMA_HandleTypeDef* hdma = config_.a_dir == Config::Direction::RECEIVE
+                                  ? &sai_a_dma_handle_
+                                  : &sai_b_dma_handle_;
+    return __HAL_DMA_GET_FLAG(hdma, __HAL_DMA_GET_HT_FLAG_INDEX(hdma))
+           || __HAL_DMA_GET_FLAG(hdma, __HAL_DMA_GET_TC_FLAG_INDEX(hdma));
+}
+
 SaiHandle::Result
 SaiHandle::Impl::StartDmaTransfer(int32_t*                       buffer_rx,
                                   int32_t*                       buffer_tx,
@@ -341,28 +359,6 @@ SaiHandle::Result SaiHandle::Impl::StopDmaTransfer()
     return Result::OK;
 }
 
-float SaiHandle::Impl::GetSampleRate()
-{
-    switch(config_.sr)
-    {
-        case Config::SampleRate::SAI_8KHZ: return 8000.f;
-        case Config::SampleRate::SAI_16KHZ: return 16000.f;
-        case Config::SampleRate::SAI_32KHZ: return 32000.f;
-        case Config::SampleRate::SAI_48KHZ: return 48000.f;
-        case Config::SampleRate::SAI_96KHZ: return 96000.f;
-        default: return 48000.f;
-    }
-}
-size_t SaiHandle::Impl::GetBlockSize()
-{
-    // Buffer handled in halves, 2 samples per frame (1 per channel)
-    return buff_size_ / 2 / 2;
-}
-float SaiHandle::Impl::GetBlockRate()
-{
-    return GetSampleRate() / GetBlockSize();
-}
-
 void SaiHandle::Impl::InitPins()
 {
     bool             is_master;
@@ -536,6 +532,106 @@ extern "C" void HAL_SAI_RxCpltCallback(SAI_HandleTypeDef* hsai)
     }
 }
 
+#else // ifndef UNIT_TEST
+
+// ================================================================
+// Host implementation for unit tests
+// ================================================================
+
+// There is no SAI or DMA on the host. Instead, each call to
+// TransferForUnitTest() behaves like one half/complete DMA event:
+// it fills the next half of the rx buffer and runs the callback.
+class SaiHandle::Impl
+{
+  public:
+    SaiHandle::Result Init(const SaiHandle::Config& config)
+    {
+        config_ = config;
+        return SaiHandle::Result::OK;
+    }
+
+    SaiHandle::Result DeInit()
+    {
+        StopDmaTransfer();
+        return SaiHandle::Result::OK;
+    }
+
+    const SaiHandle::Config& GetConfig() const { return config_; }
+
+    SaiHandle::Result StartDmaTransfer(int32_t*                       buffer_rx,
+                                       int32_t*                       buffer_tx,
+                                       size_t                         size,
+                                       SaiHandle::CallbackFunctionPtr callback)
+    {
+        buff_rx_   = buffer_rx;
+        buff_tx_   = buffer_tx;
+        buff_size_ = size;
+        callback_  = callback;
+        // the first transfer lands in the first half
+        dma_offset = buff_size_ / 2;
+        running_   = true;
+        return SaiHandle::Result::OK;
+    }
+
+    SaiHandle::Result StopDmaTransfer()
+    {
+        running_ = false;
+        return SaiHandle::Result::OK;
+    }
+
+    float  GetSampleRate();
+    size_t GetBlockSize();
+    float  GetBlockRate();
+
+    bool IsRxDmaEventPending() { return rx_event_pending_; }
+
+    void Transfer(const int32_t* rx)
+    {
+        if(!running_)
+            return;
+        const size_t half = buff_size_ / 2;
+        dma_offset        = dma_offset == 0 ? half : 0;
+        std::copy(rx, rx + half, buff_rx_ + dma_offset);
+        if(callback_)
+            callback_(buff_rx_ + dma_offset, buff_tx_ + dma_offset, half);
+    }
+
+    SaiHandle::Config config_;
+
+    int32_t *                      buff_rx_, *buff_tx_;
+    size_t                         buff_size_;
+    SaiHandle::CallbackFunctionPtr callback_;
+    size_t                         dma_offset;
+    bool                           running_;
+    bool                           rx_event_pending_;
+};
+
+static SaiHandle::Impl sai_handles[2];
+
+#endif // ifndef UNIT_TEST
+
+float SaiHandle::Impl::GetSampleRate()
+{
+    switch(config_.sr)
+    {
+        case Config::SampleRate::SAI_8KHZ: return 8000.f;
+        case Config::SampleRate::SAI_16KHZ: return 16000.f;
+        case Config::SampleRate::SAI_32KHZ: return 32000.f;
+        case Config::SampleRate::SAI_48KHZ: return 48000.f;
+        case Config::SampleRate::SAI_96KHZ: return 96000.f;
+        default: return 48000.f;
+    }
+}
+size_t SaiHandle::Impl::GetBlockSize()
+{
+    // Buffer handled in halves, 2 samples per frame (1 per channel)
+    return buff_size_ / 2 / 2;
+}
+float SaiHandle::Impl::GetBlockRate()
+{
+    return GetSampleRate() / GetBlockSize();
+}
+
 // ================================================================
 // SaiHandle -> SaiHandle::Pimpl
 // ================================================================
@@ -587,5 +683,27 @@ size_t SaiHandle::GetOffset() const
     return pimpl_->dma_offset;
 }
 
+bool SaiHandle::IsRxDmaEventPending() const
+{
+    return pimpl_->IsRxDmaEventPending();
+}
+
+#ifdef UNIT_TEST
+void SaiHandle::TransferForUnitTest(const int32_t* rx)
+{
+    pimpl_->Transfer(rx);
+}
+
+const int32_t* SaiHandle::GetTxForUnitTest() const
+{
+    return pimpl_->buff_tx_ + pimpl_->dma_offset;
+}
+
+void SaiHandle::SetRxDmaEventPendingForUnitTest(bool pending)
+{
+    pimpl_->rx_event_pending_ = pending;
+}
+#endif
+
 
 } // namespace daisy
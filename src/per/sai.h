@@ -153,6 +153,26 @@ class SaiHandle
     /** Returns the current offset within the SAI buffer, will be either 0 or size/2 */
     size_t GetOffset() const;
 
+    /** Returns true if the receive DMA has flagged a half/complete transfer
+     ** that hasn't been serviced yet. Checked at the end of a callback, this
+     ** means the next block arrived while the callback was still running.
+     */
+    bool IsRxDmaEventPending() const;
+
+#ifdef UNIT_TEST
+    /** Host only: emulates the DMA completing the next half of the buffer.
+     ** Copies `rx` (half of the buffer size) into the next rx half,
+     ** and calls the callback with that half, if there is one.
+     */
+    void TransferForUnitTest(const int32_t* rx);
+
+    /** Host only: returns the tx half that belongs to the last transfer */
+    const int32_t* GetTxForUnitTest() const;
+
+    /** Host only: sets the value returned by IsRxDmaEventPending() */
+    void SetRxDmaEventPendingForUnitTest(bool pending);
+#endif
+
     inline bool IsInitialized() const
     {
         return pimpl_ == nullptr ? false : true;
@@ -65,6 +65,8 @@ class UartHandler::Impl
                        EndCallbackFunctionPtr   end_callback,
                        void*                    callback_context);
 
+    Result DmaTransmitAbort();
+
     Result DmaReceive(uint8_t*                 buff,
                       size_t                   size,
                       StartCallbackFunctionPtr start_callback,
@@ -133,6 +135,7 @@ class UartHandler::Impl
 
     static constexpr uint8_t      kNumUartWithDma = 9;
     static volatile int8_t        dma_active_peripheral_;
+    static volatile int8_t        dma_listening_peripheral_;
     static UartDmaJob             queued_dma_transfers_[kNumUartWithDma];
     static EndCallbackFunctionPtr next_end_callback_;
     static void*                  next_callback_context_;
@@ -187,7 +190,8 @@ UartHandler::Impl* MapInstanceToHandle(USART_TypeDef* instance)
 void UartHandler::Impl::GlobalInit()
 {
     // init the scheduler queue
-    dma_active_peripheral_ = -1;
+    dma_active_peripheral_    = -1;
+    dma_listening_peripheral_ = -1;
     for(int per = 0; per < kNumUartWithDma; per++)
         queued_dma_transfers_[per] = UartHandler::Impl::UartDmaJob();
 }
@@ -380,8 +384,9 @@ void UartHandler::Impl::DmaTransferFinished(UART_HandleTypeDef* huart,
 {
     ScopedIrqBlocker block;
 
-    // on an error, reinit the peripheral to clear any flags
-    if(result != UartHandler::Result::OK)
+    // on an error, reinit the peripheral to clear any flags. Aborted
+    // transfers pass no handle, the peripheral may still be listening.
+    if(result != UartHandler::Result::OK && huart)
         HAL_UART_Init(huart);
 
     dma_active_peripheral_ = -1;
@@ -530,7 +535,9 @@ UartHandler::Impl::DmaListenStart(uint8_t* buff,
     dsy_dma_invalidate_cache_for_buffer(buff, size);
     if(HAL_UART_Receive_DMA(&huart_, buff, size) != HAL_OK)
         return UartHandler::Result::ERR;
-    dma_active_peripheral_ = int(config_.periph);
+    // the listener keeps the Rx stream, but leaves the Tx stream free
+    // for transmissions in the meantime
+    dma_listening_peripheral_ = int(config_.periph);
     return UartHandler::Result::OK;
 }
 
@@ -543,6 +550,8 @@ UartHandler::Result UartHandler::Impl::DmaListenStop()
     /** Stop DMA */
     if(HAL_UART_DMAStop(&huart_) != HAL_OK)
         return UartHandler::Result::ERR;
+    if(dma_listening_peripheral_ == int(config_.periph))
+        dma_listening_peripheral_ = -1;
     return UartHandler::Result::OK;
 }
 
@@ -558,7 +567,8 @@ UartHandler::Result UartHandler::Impl::StartDmaTx(
     UartHandler::EndCallbackFunctionPtr   end_callback,
     void*                                 callback_context)
 {
-    while(HAL_UART_GetState(&huart_) != HAL_UART_STATE_READY) {};
+    // only wait for the transmitter, the receiver may be listening
+    while(huart_.gState != HAL_UART_STATE_READY) {};
 
     if(InitDma(false, true) != UartHandler::Result::OK)
     {
@@ -588,6 +598,30 @@ UartHandler::Result UartHandler::Impl::StartDmaTx(
     return UartHandler::Result::OK;
 }
 
+UartHandler::Result UartHandler::Impl::DmaTransmitAbort()
+{
+    ScopedIrqBlocker block;
+    const int        uart_idx = int(config_.periph);
+
+    // a job that hasn't started yet is dropped from the queue
+    if(IsDmaTransferQueuedFor(uart_idx)
+       && queued_dma_transfers_[uart_idx].direction
+              == UartHandler::DmaDirection::TX)
+    {
+        queued_dma_transfers_[uart_idx].Invalidate();
+        return UartHandler::Result::OK;
+    }
+
+    if(dma_active_peripheral_ != uart_idx
+       || huart_.gState == HAL_UART_STATE_READY)
+        return UartHandler::Result::OK;
+    if(HAL_UART_AbortTransmit(&huart_) != HAL_OK)
+        return UartHandler::Result::ERR;
+    // hand the DMA on to the next queued job
+    DmaTransferFinished(nullptr, UartHandler::Result::ERR);
+    return UartHandler::Result::OK;
+}
+
 UartHandler::Result UartHandler::Impl::DmaReceive(
     uint8_t*                              buff,
     size_t                                size,
@@ -631,7 +665,9 @@ UartHandler::Result UartHandler::Impl::StartDmaRx(
 {
     while(HAL_UART_GetState(&huart_) != HAL_UART_STATE_READY) {};
 
-    if(InitDma(true, false) != UartHandler::Result::OK)
+    // the Rx stream is taken by a listener
+    if(dma_listening_peripheral_ >= 0
+       || InitDma(true, false) != UartHandler::Result::OK)
     {
         if(end_callback)
             end_callback(callback_context, UartHandler::Result::ERR);
@@ -839,6 +875,7 @@ UartHandler::Result UartHandler::Impl::DeInitPins()
 }
 
 volatile int8_t UartHandler::Impl::dma_active_peripheral_;
+volatile int8_t UartHandler::Impl::dma_listening_peripheral_;
 UartHandler::Impl::UartDmaJob
     UartHandler::Impl::queued_dma_transfers_[kNumUartWithDma];
 
@@ -1057,9 +1094,11 @@ extern "C"
 void HalUartDmaRxStreamCallback(void)
 {
     ScopedIrqBlocker block;
-    if(UartHandler::Impl::dma_active_peripheral_ >= 0)
-        HAL_DMA_IRQHandler(
-            &uart_handles[UartHandler::Impl::dma_active_peripheral_].hdma_rx_);
+    const int8_t     per = UartHandler::Impl::dma_listening_peripheral_ >= 0
+                               ? UartHandler::Impl::dma_listening_peripheral_
+                               : UartHandler::Impl::dma_active_peripheral_;
+    if(per >= 0)
+        HAL_DMA_IRQHandler(&uart_handles[per].hdma_rx_);
 }
 extern "C" void DMA1_Stream5_IRQHandler(void)
 {
@@ -1113,6 +1152,11 @@ extern "C" void HAL_UART_ErrorCallback(UART_HandleTypeDef* huart)
      *  might want to change this to have a different fallthrough
      *  for "listener_mode_"
      */
+    auto* handle = MapInstanceToHandle(huart->Instance);
+    // a reception error while listening doesn't affect a transmission
+    // that is still running, let that one finish normally
+    if(handle->listener_mode_ && huart->gState == HAL_UART_STATE_BUSY_TX)
+        return;
     UartHandler::Impl::DmaTransferFinished(huart, UartHandler::Result::ERR);
 }
 
@@ -1170,6 +1214,11 @@ UartHandler::DmaTransmit(uint8_t*                              buff,
         buff, size, start_callback, end_callback, callback_context);
 }
 
+UartHandler::Result UartHandler::DmaTransmitAbort()
+{
+    return pimpl_->DmaTransmitAbort();
+}
+
 UartHandler::Result
 UartHandler::DmaReceive(uint8_t*                              buff,
                         size_t                                size,
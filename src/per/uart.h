@@ -168,6 +168,13 @@ class UartHandler
                        UartHandler::EndCallbackFunctionPtr   end_callback,
                        void*                                 callback_context);
 
+    /** Cancels a DMA transmission of this peripheral, running or queued
+     *  behind another peripheral's transfer. The end callback of a running
+     *  transmission is called with Result::ERR.
+     *  \return Result::ERR if the transmission couldn't be stopped
+     */
+    Result DmaTransmitAbort();
+
     /** DMA-based receive 
     \param *buff input buffer
     \param size  buffer size
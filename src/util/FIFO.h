@@ -3,6 +3,8 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <initializer_list>
+#include <new>
+#include <utility>
 
 namespace daisy
 {
@@ -58,6 +60,37 @@ class FIFOBase
         return false;
     }
 
+    /** Moves an element to the back of the buffer, returning true on
+        success */
+    bool PushBack(T&& elementToAdd)
+    {
+        if(!IsFull())
+        {
+            buffer_[bufferIn_++] = std::move(elementToAdd);
+            if(bufferIn_ >= bufferSize_)
+                bufferIn_ -= bufferSize_;
+            return true;
+        }
+        return false;
+    }
+
+    /** Constructs an element in place at the back of the buffer from the
+        given constructor arguments, returning true on success. This avoids
+        creating and copying a temporary element. */
+    template <typename... Args>
+    bool EmplaceBack(Args&&... args)
+    {
+        if(IsFull())
+            return false;
+        T* element = &buffer_[bufferIn_];
+        element->~T();
+        new(element) T(std::forward<Args>(args)...);
+        bufferIn_++;
+        if(bufferIn_ >= bufferSize_)
+            bufferIn_ -= bufferSize_;
+        return true;
+    }
+
     /** Adds multiple elements and returns the number of elements that were added */
     int PushBack(std::initializer_list<T> valuesToAdd)
     {
@@ -73,6 +106,30 @@ class FIFOBase
         return numAdded;
     }
 
+    /** Copies up to numElements elements from an array to the back of the
+        buffer and returns the number of elements that were added */
+    size_t PushBack(const T* elementsToAdd, size_t numElements)
+    {
+        const size_t numFree = GetCapacity() - GetNumElements();
+        if(numElements > numFree)
+            numElements = numFree;
+        // at most two contiguous parts: up to the end and from the start
+        size_t numAdded = 0;
+        while(numAdded < numElements)
+        {
+            size_t part = bufferSize_ - bufferIn_;
+            if(part > numElements - numAdded)
+                part = numElements - numAdded;
+            for(size_t i = 0; i < part; i++)
+                buffer_[bufferIn_ + i] = elementsToAdd[numAdded + i];
+            numAdded += part;
+            bufferIn_ += part;
+            if(bufferIn_ >= bufferSize_)
+                bufferIn_ -= bufferSize_;
+        }
+        return numAdded;
+    }
+
     /** returns a reference to the last element */
     T& Back()
     {
@@ -104,7 +161,7 @@ class FIFOBase
             return T();
         else
         {
-            const auto result = buffer_[bufferOut_];
+            T result = std::move(buffer_[bufferOut_]);
             bufferOut_++;
             if(bufferOut_ >= bufferSize_)
                 bufferOut_ -= bufferSize_;
@@ -112,6 +169,53 @@ class FIFOBase
         }
     }
 
+    /** Moves up to numElements elements from the front of the buffer to an
+        array and returns the number of elements that were removed */
+    size_t PopFront(T* destination, size_t numElements)
+    {
+        const size_t available = GetNumElements();
+        if(numElements > available)
+            numElements = available;
+        // at most two contiguous parts: up to the end and from the start
+        size_t numRemoved = 0;
+        while(numRemoved < numElements)
+        {
+            size_t part = bufferSize_ - bufferOut_;
+            if(part > numElements - numRemoved)
+                part = numElements - numRemoved;
+            for(size_t i = 0; i < part; i++)
+                destination[numRemoved + i]
+                    = std::move(buffer_[bufferOut_ + i]);
+            numRemoved += part;
+            bufferOut_ += part;
+            if(bufferOut_ >= bufferSize_)
+                bufferOut_ -= bufferSize_;
+        }
+        return numRemoved;
+    }
+
+    /** Removes up to numElements elements from the front of the buffer
+        without copying them and returns the number of elements that were 
+        removed. Together with Front() this consumes elements in place:
+        @code
+        while(!fifo.IsEmpty())
+        {
+            Process(fifo.Front());
+            fifo.DropFront();
+        }
+        @endcode
+    */
+    size_t DropFront(size_t numElements = 1)
+    {
+        const size_t available = GetNumElements();
+        if(numElements > available)
+            numElements = available;
+        bufferOut_ += numElements;
+        if(bufferOut_ >= bufferSize_)
+            bufferOut_ -= bufferSize_;
+        return numElements;
+    }
+
     /** returns a copy of the first element */
     T& Front()
     {
@@ -188,11 +292,11 @@ class FIFOBase
             PushBack(element);
             return true;
         }
-        // copy last element
-        PushBack(Back());
+        // move last element
+        PushBack(std::move(Back()));
         // move remaining elements: n => n+1
         for(int i = GetNumElements() - 2; i > int(idx); i--)
-            (*this)[i] = (*this)[i - 1];
+            (*this)[i] = std::move((*this)[i - 1]);
         // insert element
         (*this)[idx] = element;
         return true;
@@ -214,7 +318,7 @@ class FIFOBase
 
         while(nextIndex != bufferIn_)
         {
-            buffer_[index] = buffer_[nextIndex];
+            buffer_[index] = std::move(buffer_[nextIndex]);
             index++;
             nextIndex++;
             if(index >= bufferSize_)
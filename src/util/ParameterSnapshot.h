@@ -0,0 +1,137 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+namespace daisy
+{
+/** @brief Lock-free handover of a parameter struct to the audio callback
+ *  @ingroup utility
+ *
+ *  A triple buffer for passing a complete set of parameters (e.g. a preset
+ *  edited in a menu) from one writer, usually the main loop, to one reader,
+ *  usually the audio callback, without tearing.
+ *  Neither side ever blocks or masks interrupts: the writer edits its own
+ *  copy and publishes it with a single atomic exchange, and the reader
+ *  picks up the most recently published copy with another one. Copies that
+ *  are published faster than they are read are simply skipped.
+ *
+ *  Usage:
+ *  @code
+ *  struct Params { float cutoff; float resonance; };
+ *  ParameterSnapshot<Params> params;
+ *
+ *  // main loop
+ *  params.Edit().cutoff = 1000.f;
+ *  params.Publish();
+ *
+ *  // audio callback
+ *  const Params& p = params.Read();
+ *  @endcode
+ *
+ *  @tparam T the parameter type, must be copy-assignable
+ */
+template <typename T>
+class ParameterSnapshot
+{
+  public:
+    ParameterSnapshot() { Reset(T()); }
+    explicit ParameterSnapshot(const T& initial) { Reset(initial); }
+
+    /** Sets all copies to a value, with version 0.
+     *  Not thread-safe, call before the reader starts.
+     */
+    void Reset(const T& initial)
+    {
+        for(int i = 0; i < 3; i++)
+        {
+            slots_[i].value   = initial;
+            slots_[i].version = 0;
+        }
+        write_   = 0;
+        read_    = 1;
+        version_ = 0;
+        middle_.store(2, std::memory_order_release);
+    }
+
+    // ======== writer side ========
+
+    /** Returns the writer's copy, which holds the most recently published
+     *  value (or the initial value). Changes are invisible to the reader
+     *  until Publish() is called.
+     */
+    T& Edit() { return slots_[write_].value; }
+
+    /** Makes the writer's copy the latest version for the reader. */
+    void Publish()
+    {
+        Slot& published   = slots_[write_];
+        published.version = ++version_;
+        const uint8_t previous
+            = middle_.exchange(write_ | kUnread, std::memory_order_acq_rel);
+        write_ = previous & kIndexMask;
+        // carry the published value over, so Edit() continues from there
+        slots_[write_] = published;
+    }
+
+    /** Replaces the writer's copy with value and publishes it. */
+    void Publish(const T& value)
+    {
+        Edit() = value;
+        Publish();
+    }
+
+    /** Returns the version number of the last published value */
+    uint32_t GetPublishedVersion() const { return version_; }
+
+    // ======== reader side ========
+
+    /** Returns the most recently published value in O(1).
+     *  The reference stays valid and unchanged until the next call to Read().
+     */
+    const T& Read()
+    {
+        if(middle_.load(std::memory_order_relaxed) & kUnread)
+        {
+            const uint8_t previous
+                = middle_.exchange(read_, std::memory_order_acq_rel);
+            read_ = previous & kIndexMask;
+        }
+        return slots_[read_].value;
+    }
+
+    /** Returns true if a newer value was published since the last Read() */
+    bool HasUpdate() const
+    {
+        return middle_.load(std::memory_order_relaxed) & kUnread;
+    }
+
+    /** Returns the version of the value returned by the last Read(),
+     *  0 for the initial value.
+     */
+    uint32_t GetReadVersion() const { return slots_[read_].version; }
+
+  private:
+    struct Slot
+    {
+        T        value;
+        uint32_t version;
+    };
+
+    static constexpr uint8_t kIndexMask = 0x03;
+    static constexpr uint8_t kUnread    = 0x04;
+
+    Slot slots_[3];
+
+    /** Slot that is handed over next, and whether it's unread */
+    std::atomic<uint8_t> middle_;
+
+    // owned by the writer
+    uint8_t  write_;
+    uint32_t version_;
+
+    // owned by the reader
+    uint8_t read_;
+};
+
+} // namespace daisy
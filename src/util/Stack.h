@@ -3,6 +3,8 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <initializer_list>
+#include <new>
+#include <utility>
 
 namespace daisy
 {
@@ -55,6 +57,33 @@ class StackBase
         return false;
     }
 
+    /** Moves an element to the back of the buffer, returning true on
+        success */
+    bool PushBack(T&& elementToAdd)
+    {
+        if(!IsFull())
+        {
+            buffer_[bufferHead_++] = std::move(elementToAdd);
+            return true;
+        }
+        return false;
+    }
+
+    /** Constructs an element in place at the back of the buffer from the
+        given constructor arguments, returning true on success. This avoids
+        creating and copying a temporary element. */
+    template <typename... Args>
+    bool EmplaceBack(Args&&... args)
+    {
+        if(IsFull())
+            return false;
+        T* element = &buffer_[bufferHead_];
+        element->~T();
+        new(element) T(std::forward<Args>(args)...);
+        bufferHead_++;
+        return true;
+    }
+
     /** Adds multiple elements and returns the number of elements that were added */
     int PushBack(std::initializer_list<T> valuesToAdd)
     {
@@ -70,6 +99,18 @@ class StackBase
         return numAdded;
     }
 
+    /** Copies up to numElements elements from an array to the back of the
+        buffer and returns the number of elements that were added */
+    size_t PushBack(const T* elementsToAdd, size_t numElements)
+    {
+        if(numElements > bufferSize_ - bufferHead_)
+            numElements = bufferSize_ - bufferHead_;
+        for(size_t i = 0; i < numElements; i++)
+            buffer_[bufferHead_ + i] = elementsToAdd[i];
+        bufferHead_ += numElements;
+        return numElements;
+    }
+
     /** removes and returns an element from the back of the buffer */
     T PopBack()
     {
@@ -77,10 +118,52 @@ class StackBase
             return T();
         else
         {
-            return buffer_[--bufferHead_];
+            return std::move(buffer_[--bufferHead_]);
         }
     }
 
+    /** Moves up to numElements elements from the back of the buffer to an
+        array and returns the number of elements that were removed. The
+        elements are stored in the order PopBack() would return them, the
+        last element first. */
+    size_t PopBack(T* destination, size_t numElements)
+    {
+        if(numElements > bufferHead_)
+            numElements = bufferHead_;
+        for(size_t i = 0; i < numElements; i++)
+            destination[i] = std::move(buffer_[--bufferHead_]);
+        return numElements;
+    }
+
+    /** returns a reference to the last element */
+    T& Back()
+    {
+        if(IsEmpty())
+            // invalid, but better not pass a temporary T() object as a reference...
+            return buffer_[0];
+        return buffer_[bufferHead_ - 1];
+    }
+
+    /** returns a reference to the last element */
+    const T& Back() const
+    {
+        if(IsEmpty())
+            // invalid, but better not pass a temporary T() object as a reference...
+            return buffer_[0];
+        return buffer_[bufferHead_ - 1];
+    }
+
+    /** Removes up to numElements elements from the back of the buffer
+        without copying them and returns the number of elements that were
+        removed. Together with Back() this consumes elements in place. */
+    size_t DropBack(size_t numElements = 1)
+    {
+        if(numElements > bufferHead_)
+            numElements = bufferHead_;
+        bufferHead_ -= numElements;
+        return numElements;
+    }
+
     /** clears the buffer */
     void Clear() { bufferHead_ = 0; }
 
@@ -99,7 +182,7 @@ class StackBase
 
         for(uint32_t i = idx; i < bufferHead_ - 1; i++)
         {
-            buffer_[i] = buffer_[i + 1];
+            buffer_[i] = std::move(buffer_[i + 1]);
         }
         bufferHead_--;
         return true;
@@ -141,9 +224,9 @@ class StackBase
             return true;
         }
 
-        for(uint32_t i = bufferHead_ - 1; i >= idx; i--)
+        for(uint32_t i = bufferHead_; i > idx; i--)
         {
-            buffer_[i + 1] = buffer_[i];
+            buffer_[i] = std::move(buffer_[i - 1]);
         }
         buffer_[idx] = item;
         bufferHead_++;
@@ -0,0 +1,488 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "hid/MidiEvent.h"
+
+namespace daisy
+{
+/** @brief Assigns MIDI notes to a fixed number of synth voices
+ *  @ingroup utility
+ *  @details The allocator keeps track of which voice plays which note. The
+ *           synth reads the state of its voices with GetVoice(), typically
+ *           in the audio callback: the gate is on while the note is held or
+ *           sustained, and the trigger count changes whenever the voice
+ *           starts a new note.
+ *
+ *           Released voices are reused least recently released first, so
+ *           release tails ring out as long as possible and consecutive
+ *           notes cycle through the voices. When all voices are held, the
+ *           Mode selects the voice that is stolen.
+ *
+ *           Notes are told apart by channel, so the same note can play on
+ *           several voices in MPE, one per member channel. Pitch bend,
+ *           channel pressure and timbre (CC 74) are tracked per channel,
+ *           and the per-voice getters combine them with the master channel
+ *           in MPE mode.
+ *
+ *           Note on and note off take constant time, the voices are kept in
+ *           intrusive linked lists and a lookup table from channel and note
+ *           to voice. Releasing the sustain pedal goes through all voices.
+ *           Nothing is allocated, so the allocator can run in the audio
+ *           callback.
+ *
+ *  Usage:
+ *  @code
+ *  VoiceAllocator<8> voices;
+ *  voices.Init();
+ *
+ *  // in the audio callback
+ *  while(midi.HasEvents())
+ *      voices.HandleEvent(midi.PopCompactEvent());
+ *  for(size_t i = 0; i < voices.GetNumVoices(); i++)
+ *  {
+ *      const auto& voice = voices.GetVoice(i);
+ *      if(voice.trigger_count != last_trigger[i])
+ *          synth[i].Trigger(voice.note, voice.velocity);
+ *      last_trigger[i] = voice.trigger_count;
+ *      synth[i].SetGate(voice.IsGateOn());
+ *      synth[i].SetBend(voices.GetPitchBend(i));
+ *  }
+ *  @endcode
+ *  @tparam kNumVoices number of voices, up to 255
+ */
+template <size_t kNumVoices>
+class VoiceAllocator
+{
+    static_assert(kNumVoices > 0 && kNumVoices < 256,
+                  "1 to 255 voices are supported");
+
+  public:
+    /** Returned when there is no voice */
+    static constexpr size_t kNoVoice = kNumVoices;
+
+    /** Selects the voice to steal when all voices are held */
+    enum class Mode
+    {
+        /** the voice after the previously started one */
+        RoundRobin,
+        /** the voice that holds its note the longest */
+        StealOldest,
+        /** the voice with the lowest priority, and the oldest of those. A
+         *  note with a lower priority than all held notes isn't played. */
+        LowestPriority,
+    };
+
+    struct Config
+    {
+        Mode mode = Mode::StealOldest;
+        /** MPE with a single zone: notes are played on the member channels,
+         *  and the master channel controls all of them */
+        bool mpe = false;
+        /** 0 for the lower zone, 15 for the upper zone */
+        uint8_t mpe_master_channel = 0;
+    };
+
+    /** State of a voice */
+    struct Voice
+    {
+        enum State : uint8_t
+        {
+            Free,      /**< released, or never used */
+            Held,      /**< note is held */
+            Sustained, /**< note is released, the sustain pedal holds it */
+        };
+
+        State   state;
+        uint8_t channel;  /**< of the latest note */
+        uint8_t note;     /**< of the latest note */
+        uint8_t velocity; /**< of the latest note */
+        uint8_t priority; /**< of the latest note */
+        /** Increments with every note that the voice starts */
+        uint32_t trigger_count;
+
+        bool IsGateOn() const { return state != Free; }
+    };
+
+    VoiceAllocator() {}
+    ~VoiceAllocator() {}
+
+    /** Releases all voices and resets the controllers */
+    void Init(const Config& config)
+    {
+        config_           = config;
+        next_round_robin_ = 0;
+        free_.Clear();
+        held_.Clear();
+        for(size_t i = 0; i < kNumVoices; i++)
+        {
+            Voice& voice        = voices_[i];
+            voice.state         = Voice::Free;
+            voice.channel       = 0;
+            voice.note          = 0;
+            voice.velocity      = 0;
+            voice.priority      = 0;
+            voice.trigger_count = 0;
+            free_.PushBack(links_, i);
+        }
+        for(size_t p = 0; p < 128; p++)
+            priorities_[p].Clear();
+        for(size_t w = 0; w < 4; w++)
+            priority_mask_[w] = 0;
+        for(size_t ch = 0; ch < 16; ch++)
+        {
+            for(size_t n = 0; n < 128; n++)
+                note_voice_[ch][n] = kNil;
+            channels_[ch].bend     = 0;
+            channels_[ch].pressure = 0;
+            channels_[ch].timbre   = 64;
+            channels_[ch].sustain  = false;
+        }
+    }
+
+    /** Releases all voices and resets the controllers, with the default
+     *  Config */
+    void Init() { Init(Config()); }
+
+    /** Starts a note, with the velocity as its priority
+     *  \return the voice, or kNoVoice if the note isn't played
+     */
+    size_t NoteOn(uint8_t channel, uint8_t note, uint8_t velocity)
+    {
+        return NoteOn(channel, note, velocity, velocity);
+    }
+
+    /** Starts a note. A note that is already held on the channel is
+     *  retriggered on its voice.
+     *  \param priority 0 to 127, higher priorities are stolen last in
+     *         Mode::LowestPriority
+     *  \return the voice, or kNoVoice if the note isn't played
+     */
+    size_t NoteOn(uint8_t channel,
+                  uint8_t note,
+                  uint8_t velocity,
+                  uint8_t priority)
+    {
+        channel &= 0x0F;
+        note &= 0x7F;
+        priority &= 0x7F;
+
+        size_t v = note_voice_[channel][note];
+        if(v != kNil)
+            Unhold(v);
+        else if(!free_.IsEmpty())
+            v = free_.PopFront(links_);
+        else
+        {
+            v = Steal(priority);
+            if(v == kNil)
+                return kNoVoice;
+            Unhold(v);
+        }
+
+        Voice& voice   = voices_[v];
+        voice.state    = Voice::Held;
+        voice.channel  = channel;
+        voice.note     = note;
+        voice.velocity = velocity;
+        voice.priority = priority;
+        voice.trigger_count++;
+        Hold(v);
+        next_round_robin_ = v + 1 < kNumVoices ? v + 1 : 0;
+        return v;
+    }
+
+    /** Releases a note, or hands it over to the sustain pedal
+     *  \return the voice, or kNoVoice if the note isn't held
+     */
+    size_t NoteOff(uint8_t channel, uint8_t note)
+    {
+        channel &= 0x0F;
+        const size_t v = note_voice_[channel][note & 0x7F];
+        if(v == kNil || voices_[v].state != Voice::Held)
+            return kNoVoice;
+        if(IsSustained(channel))
+            voices_[v].state = Voice::Sustained;
+        else
+            Release(v);
+        return v;
+    }
+
+    /** Presses or releases the sustain pedal of a channel. In MPE mode the
+     *  pedal of the master channel sustains all notes. */
+    void SetSustain(uint8_t channel, bool sustain)
+    {
+        channel &= 0x0F;
+        channels_[channel].sustain = sustain;
+        if(sustain)
+            return;
+        for(size_t v = 0; v < kNumVoices; v++)
+            if(voices_[v].state == Voice::Sustained
+               && !IsSustained(voices_[v].channel))
+                Release(v);
+    }
+
+    /** Releases all notes of a channel, also the sustained ones */
+    void AllNotesOff(uint8_t channel)
+    {
+        for(size_t v = 0; v < kNumVoices; v++)
+            if(voices_[v].state != Voice::Free
+               && (voices_[v].channel == (channel & 0x0F)
+                   || IsMasterChannel(channel)))
+                Release(v);
+    }
+
+    /** Releases all notes */
+    void AllNotesOff()
+    {
+        for(size_t v = 0; v < kNumVoices; v++)
+            if(voices_[v].state != Voice::Free)
+                Release(v);
+    }
+
+    /** Handles note on, note off, sustain, all notes off, pitch bend,
+     *  channel pressure and timbre events. Works with MidiEvent and
+     *  CompactMidiEvent.
+     *  \return true if the event was used
+     */
+    template <typename Event>
+    bool HandleEvent(const Event& event)
+    {
+        const uint8_t ch = event.channel & 0x0F;
+        switch(event.type)
+        {
+            case MidiMessageType::NoteOn:
+                if(event.data[1] == 0)
+                    return NoteOff(ch, event.data[0]) != kNoVoice;
+                NoteOn(ch, event.data[0], event.data[1]);
+                return true;
+            case MidiMessageType::NoteOff:
+                return NoteOff(ch, event.data[0]) != kNoVoice;
+            case MidiMessageType::ControlChange:
+                if(event.data[0] == 64)
+                    SetSustain(ch, event.data[1] >= 64);
+                else if(event.data[0] == 74)
+                    channels_[ch].timbre = event.data[1];
+                else
+                    return false;
+                return true;
+            case MidiMessageType::ChannelMode:
+                // All Sound Off and All Notes Off
+                if(event.data[0] != 120 && event.data[0] != 123)
+                    return false;
+                AllNotesOff(ch);
+                return true;
+            case MidiMessageType::ChannelPressure:
+                channels_[ch].pressure = event.data[0];
+                return true;
+            case MidiMessageType::PitchBend:
+                channels_[ch].bend
+                    = ((event.data[1] & 0x7F) << 7 | (event.data[0] & 0x7F))
+                      - 8192;
+                return true;
+            default: return false;
+        }
+    }
+
+    const Voice& GetVoice(size_t voice) const { return voices_[voice]; }
+
+    /** Returns the voice that holds a note, or kNoVoice */
+    size_t FindVoice(uint8_t channel, uint8_t note) const
+    {
+        const size_t v = note_voice_[channel & 0x0F][note & 0x7F];
+        return v == kNil ? kNoVoice : v;
+    }
+
+    /** Returns the number of held and sustained notes */
+    size_t GetNumActive() const { return kNumVoices - free_.size; }
+
+    static constexpr size_t GetNumVoices() { return kNumVoices; }
+
+    /** Returns the pitch bend of a voice, -1 to 1, the master channel bend
+     *  is added in MPE mode */
+    float GetPitchBend(size_t voice) const
+    {
+        int bend = channels_[voices_[voice].channel].bend;
+        if(HasMaster(voices_[voice].channel))
+            bend += channels_[config_.mpe_master_channel].bend;
+        return bend / 8192.f;
+    }
+
+    /** Returns the channel pressure of a voice, 0 to 1, the larger of
+     *  member and master channel in MPE mode */
+    float GetPressure(size_t voice) const
+    {
+        uint8_t pressure = channels_[voices_[voice].channel].pressure;
+        if(HasMaster(voices_[voice].channel))
+        {
+            const uint8_t master
+                = channels_[config_.mpe_master_channel].pressure;
+            pressure = master > pressure ? master : pressure;
+        }
+        return pressure / 127.f;
+    }
+
+    /** Returns the timbre (CC 74) of a voice, 0 to 1, 0.5 by default */
+    float GetTimbre(size_t voice) const
+    {
+        return channels_[voices_[voice].channel].timbre / 127.f;
+    }
+
+  private:
+    static constexpr uint8_t kNil = 0xFF;
+
+    /** Links of a voice, into the free and held lists, and the list of its
+     *  priority */
+    struct Links
+    {
+        uint8_t prev, next;
+        uint8_t priority_prev, priority_next;
+    };
+
+    /** Intrusive doubly linked list of voices */
+    template <uint8_t Links::*kPrev, uint8_t Links::*kNext>
+    struct List
+    {
+        uint8_t head, tail, size;
+
+        void Clear()
+        {
+            head = tail = kNil;
+            size        = 0;
+        }
+        bool IsEmpty() const { return head == kNil; }
+        void PushBack(Links* links, size_t v)
+        {
+            links[v].*kPrev = tail;
+            links[v].*kNext = kNil;
+            if(tail != kNil)
+                links[tail].*kNext = v;
+            else
+                head = v;
+            tail = v;
+            size++;
+        }
+        void Remove(Links* links, size_t v)
+        {
+            const uint8_t prev = links[v].*kPrev, next = links[v].*kNext;
+            if(prev != kNil)
+                links[prev].*kNext = next;
+            else
+                head = next;
+            if(next != kNil)
+                links[next].*kPrev = prev;
+            else
+                tail = prev;
+            size--;
+        }
+        size_t PopFront(Links* links)
+        {
+            const size_t v = head;
+            Remove(links, v);
+            return v;
+        }
+    };
+
+    typedef List<&Links::prev, &Links::next> VoiceList;
+    typedef List<&Links::priority_prev, &Links::priority_next> PriorityList;
+
+    struct ChannelState
+    {
+        int16_t bend;
+        uint8_t pressure;
+        uint8_t timbre;
+        bool    sustain;
+    };
+
+    bool IsMasterChannel(uint8_t channel) const
+    {
+        return config_.mpe && (channel & 0x0F) == config_.mpe_master_channel;
+    }
+
+    /** True for member channels in MPE mode */
+    bool HasMaster(uint8_t channel) const
+    {
+        return config_.mpe && channel != config_.mpe_master_channel;
+    }
+
+    bool IsSustained(uint8_t channel) const
+    {
+        return channels_[channel].sustain
+               || (HasMaster(channel)
+                   && channels_[config_.mpe_master_channel].sustain);
+    }
+
+    /** Adds a held voice to the lists */
+    void Hold(size_t v)
+    {
+        const Voice& voice = voices_[v];
+        held_.PushBack(links_, v);
+        priorities_[voice.priority].PushBack(links_, v);
+        priority_mask_[voice.priority >> 5] |= 1u << (voice.priority & 31);
+        note_voice_[voice.channel][voice.note] = v;
+    }
+
+    /** Removes a held or sustained voice from the lists */
+    void Unhold(size_t v)
+    {
+        const Voice& voice = voices_[v];
+        held_.Remove(links_, v);
+        PriorityList& list = priorities_[voice.priority];
+        list.Remove(links_, v);
+        if(list.IsEmpty())
+        {
+            const uint32_t bit = 1u << (voice.priority & 31);
+            priority_mask_[voice.priority >> 5] &= ~bit;
+        }
+        note_voice_[voice.channel][voice.note] = kNil;
+    }
+
+    void Release(size_t v)
+    {
+        Unhold(v);
+        voices_[v].state = Voice::Free;
+        free_.PushBack(links_, v);
+    }
+
+    /** Returns the voice to steal for a new note, or kNil */
+    size_t Steal(uint8_t priority) const
+    {
+        switch(config_.mode)
+        {
+            case Mode::RoundRobin: return next_round_robin_;
+            case Mode::StealOldest: return held_.head;
+            case Mode::LowestPriority:
+                for(size_t w = 0; w < 4; w++)
+                {
+                    if(priority_mask_[w] == 0)
+                        continue;
+                    const size_t lowest
+                        = (w << 5) + __builtin_ctz(priority_mask_[w]);
+                    return lowest <= priority ? priorities_[lowest].head
+                                              : kNil;
+                }
+                return kNil;
+        }
+        return kNil;
+    }
+
+    Config    config_;
+    Voice     voices_[kNumVoices];
+    Links     links_[kNumVoices];
+    VoiceList free_; /**< in the order of release */
+    VoiceList held_; /**< held and sustained, in the order of note on */
+    /** held and sustained voices by priority, bit p of priority_mask_ is
+     *  set if priorities_[p] isn't empty */
+    PriorityList priorities_[128];
+    uint32_t     priority_mask_[4];
+    uint8_t      note_voice_[16][128]; /**< voice of each note, or kNil */
+    ChannelState channels_[16];
+    size_t       next_round_robin_; /**< next voice in round robin order */
+};
+
+template <size_t kNumVoices>
+constexpr size_t VoiceAllocator<kNumVoices>::kNoVoice;
+template <size_t kNumVoices>
+constexpr uint8_t VoiceAllocator<kNumVoices>::kNil;
+
+} // namespace daisy
@@ -1,41 +1,62 @@
 #pragma once
-#pragma once
+#include <atomic>
 #include "fatfs.h"
+#include "daisy_core.h"
+#include "util/wav_format.h"
+#include "util/wav_convert.h"
+#include "util/ringbuffer.h"
 
 namespace daisy
 {
 /** Audio Recording Module
- ** 
- ** Record audio into a working buffer that is gradually written to a WAV file on an SD Card. 
  **
- ** Recordings are made with floating point input, and will be converted to the 
- ** specified bits per sample internally 
+ ** Record audio into a working buffer that is gradually written to one or more
+ ** WAV files on an SD Card.
+ **
+ ** Recordings are made with floating point input, and will be converted to the
+ ** specified bits per sample internally
  **
- ** For now only 16-bit and 32-bit (signed int) formats are supported
- ** f32 and s24 formats will be added next
+ ** Supported formats: 16, 24 (packed) and 32-bit signed int, and 32-bit float
+ **
+ ** The audio callback hands whole blocks to the main loop through a lock-free
+ ** ring buffer for each file, so Sample() never waits on the SD card. When the
+ ** main loop falls behind, whole blocks are dropped (see GetDroppedFrames())
+ ** and every file skips the same frames, so multitrack files stay in sync.
  **
  ** The transfer size determines the amount of internal memory used, and can have an
  ** effect on the performance of the streaming behavior of the WavWriter.
- ** Memory use can be calculated as: (2 * transfer_size) bytes
+ ** Memory use can be calculated as: (max_files * 2 * transfer_size) bytes
  ** Performance optimal with sizes: 16384, 32768
- ** 
+ **
  ** To use:
  ** 1. Create a WavWriter<size> object (e.g. WavWriter<32768> writer)
  ** 2. Configure the settings as desired by creating a WavWriter<32768>::Config struct and setting the settings.
  ** 3. Initialize the object with the configuration struct.
  ** 4. Open a new file for writing with: writer.OpenFile("FileName.wav")
- ** 5. Write to it within your audio callback using: writer.Sample(value)
+ ** 5. Write to it within your audio callback using: writer.Sample(in, size)
  ** 6. Fill the Wav File on the SD Card with data from your main loop by running: writer.Write()
  ** 7. When finished with the recording finalize, and close the file with: writer.SaveFile();
- ** 
+ **
+ ** For multitrack recording, create a WavWriter<size, max_files> object, set
+ ** Config::channels_per_file, and open one file for each group of channels
+ ** with writer.OpenFiles(names).
+ **
  ** */
-template <size_t transfer_size>
+template <size_t transfer_size, size_t max_files = 1>
 class WavWriter
 {
+    static_assert(transfer_size > 0
+                      && (transfer_size & (transfer_size - 1)) == 0,
+                  "transfer_size must be a power of two");
+    static_assert(max_files > 0, "max_files must be at least 1");
+
   public:
     WavWriter() {}
     ~WavWriter() {}
 
+    /** Most channels recorded at once */
+    static constexpr size_t kMaxChannels = 32;
+
     /** Return values for write related functions */
     enum class Result
     {
@@ -49,158 +70,299 @@ class WavWriter
     {
         float   samplerate;
         int32_t channels;
-        int32_t bitspersample;
-    };
-
-    /** State of the internal Writing mechanism. 
-	 ** When the buffer is a certain amount full one section will write its contents
-	 ** while the other is still being written to. This is performed circularly
-	 ** so that audio will be uninterrupted during writing. */
-    enum class BufferState
-    {
-        IDLE,
-        FLUSH0,
-        FLUSH1,
+        int32_t bitspersample; /**< 16, 24 or 32 */
+        /** 32-bit IEEE float instead of signed int, bitspersample must be 32 */
+        bool floating_point = false;
+        /** Channels in each file, the last file gets what's left. 0 records
+         ** all channels to a single file. */
+        int32_t channels_per_file = 0;
     };
 
     /**  Initializes the WavFile header, and prepares the object for recording. */
     void Init(const Config &cfg)
     {
-        cfg_       = cfg;
-        num_samps_ = 0;
-        // Prep the wav header according to config.
-        // Certain things (i.e. Size, etc. will have to wait until the finalization of the file, or be updated while streaming).
-        wavheader_.ChunkId       = kWavFileChunkId;     /** "RIFF" */
-        wavheader_.FileFormat    = kWavFileWaveId;      /** "WAVE" */
-        wavheader_.SubChunk1ID   = kWavFileSubChunk1Id; /** "fmt " */
-        wavheader_.SubChunk1Size = 16;                  // for PCM
-        wavheader_.AudioFormat   = WAVE_FORMAT_PCM;
-        wavheader_.NbrChannels   = cfg.channels;
-        wavheader_.SampleRate    = static_cast<int>(cfg.samplerate);
-        wavheader_.ByteRate      = CalcByteRate();
-        wavheader_.BlockAlign    = cfg_.channels * cfg_.bitspersample / 8;
-        wavheader_.BitPerSample  = cfg_.bitspersample;
-        wavheader_.SubChunk2ID   = kWavFileSubChunk2Id; /** "data" */
-        /** Also calcs SubChunk2Size */
-        wavheader_.FileSize = CalcFileSize();
-        // This is calculated as part of the subchunk size
+        cfg_ = cfg;
+        if(cfg_.channels > (int32_t)kMaxChannels)
+            cfg_.channels = kMaxChannels;
+        format_ = GetWavSampleFormat(cfg_.floating_point
+                                         ? uint16_t(WAVE_FORMAT_IEEE_FLOAT)
+                                         : uint16_t(WAVE_FORMAT_PCM),
+                                     cfg_.bitspersample);
+        recording_.store(false, std::memory_order_release);
+        num_samps_.store(0, std::memory_order_relaxed);
+        dropped_.store(0, std::memory_order_relaxed);
+
+        // Split the channels into files
+        size_t per_file = cfg_.channels;
+        if(cfg_.channels_per_file > 0 && cfg_.channels_per_file < cfg_.channels)
+            per_file = cfg_.channels_per_file;
+        num_tracks_ = 0;
+        for(size_t ch = 0;
+            ch < (size_t)cfg_.channels && num_tracks_ < max_files;
+            ch += per_file)
+        {
+            Track &track        = tracks_[num_tracks_++];
+            track.first_channel = ch;
+            track.num_channels  = ch + per_file <= (size_t)cfg_.channels
+                                      ? per_file
+                                      : cfg_.channels - ch;
+            track.frame_size = track.num_channels * GetWavSampleSize(format_);
+            track.open       = false;
+        }
     }
 
-    /** Records the current sample into the working buffer,
-     ** queues writes to media when necessary. 
-     ** 
-     ** \param in should be a pointer to an array of samples */
-    void Sample(const float *in)
+    /** Records a block of audio into the working buffers, from the audio
+     ** callback. The block is dropped when the buffers are full.
+     **
+     ** \param in one pointer for each of the configured channels
+     ** \param frames number of samples in each channel */
+    void Sample(const float *const *in, size_t frames)
     {
-        for(size_t i = 0; i < cfg_.channels; i++)
+        if(!recording_.load(std::memory_order_acquire))
+            return;
+        // All files take the block or none of them do
+        for(size_t t = 0; t < num_tracks_; t++)
         {
-            switch(cfg_.bitspersample)
+            if(tracks_[t].ring.writable() < frames * tracks_[t].frame_size)
             {
-                case 16:
-                {
-                    int16_t *tp;
-                    tp            = (int16_t *)transfer_buff;
-                    tp[wptr_ + i] = f2s16(in[i]);
-                }
-                break;
-                case 32: transfer_buff[wptr_ + i] = f2s32(in[i]); break;
-                default: break;
+                dropped_.store(dropped_.load(std::memory_order_relaxed)
+                                   + frames,
+                               std::memory_order_relaxed);
+                return;
             }
         }
-        num_samps_++;
-        wptr_ += cfg_.channels;
-        size_t cap_point
-            = cfg_.bitspersample == 16 ? kTransferSamps * 2 : kTransferSamps;
-        if(wptr_ == cap_point)
-        {
-            bstate_ = BufferState::FLUSH0;
-        }
-        if(wptr_ >= cap_point * 2)
+        for(size_t t = 0; t < num_tracks_; t++)
+            Encode(tracks_[t], in + tracks_[t].first_channel, frames);
+        num_samps_.store(num_samps_.load(std::memory_order_relaxed) + frames,
+                         std::memory_order_relaxed);
+    }
+
+    /** Records the current sample into the working buffer.
+     **
+     ** \param in should be a pointer to an array of samples, one for each
+     **           channel */
+    void Sample(const float *in)
+    {
+        const float *channels[kMaxChannels];
+        for(size_t i = 0; i < (size_t)cfg_.channels; i++)
+            channels[i] = in + i;
+        Sample(channels, 1);
+    }
+
+    /** Writes the recorded audio to the files, from the main loop.
+     ** Only whole transfers are written, fullest buffer first. */
+    Result Write()
+    {
+        while(true)
         {
-            wptr_   = 0;
-            bstate_ = BufferState::FLUSH1;
+            Track *fullest = nullptr;
+            for(size_t t = 0; t < num_tracks_; t++)
+            {
+                Track &track = tracks_[t];
+                if(track.open && track.ring.readable() >= transfer_size
+                   && (!fullest
+                       || track.ring.readable() > fullest->ring.readable()))
+                    fullest = &track;
+            }
+            if(!fullest)
+                return Result::OK;
+            if(WriteTrack(*fullest, transfer_size) != Result::OK)
+                return Result::ERROR;
         }
     }
 
-    /** Check buffer state and write */
-    void Write()
+    /** Finalizes the writing of the WAV files.
+	 ** This writes whatever is left in the working buffers, overwrites the WAV
+	 ** Header with the correct final size, and closes the files. */
+    Result SaveFile()
     {
-        if(bstate_ != BufferState::IDLE && IsRecording())
+        recording_.store(false, std::memory_order_release);
+        Result result = Result::OK;
+        for(size_t t = 0; t < num_tracks_; t++)
         {
-            uint32_t     offset;
-            unsigned int bw = 0;
-            //offset          = bstate_ == BufferState::FLUSH0 ? 0 : transfer_size;
-            offset  = bstate_ == BufferState::FLUSH0 ? 0 : kTransferSamps;
-            bstate_ = BufferState::IDLE;
-            f_write(&fp_, &transfer_buff[offset], transfer_size, &bw);
+            Track &track = tracks_[t];
+            if(!track.open)
+                continue;
+            if(WriteTrack(track, track.ring.readable()) != Result::OK)
+                result = Result::ERROR;
+            // RIFF chunks are padded to an even size
+            UINT          bw  = 0;
+            const uint8_t pad = 0;
+            if(track.data_size & 1)
+                f_write(&track.fp, &pad, 1, &bw);
+            track.header.SubCHunk2Size = track.data_size;
+            track.header.FileSize
+                = 36 + track.data_size + (track.data_size & 1);
+            if(f_lseek(&track.fp, 0) != FR_OK
+               || f_write(&track.fp, &track.header, sizeof(track.header), &bw)
+                      != FR_OK
+               || bw != sizeof(track.header))
+                result = Result::ERROR;
+            if(f_close(&track.fp) != FR_OK)
+                result = Result::ERROR;
+            track.open = false;
         }
+        return result;
     }
 
-    /** Finalizes the writing of the WAV file.
-	 ** This overwrites the WAV Header with the correct
-	 ** final size, and closes the fptr. */
-    void SaveFile()
-    {
-        unsigned int bw = 0;
-        recording_      = false;
-        // We _should_ flush whatever's left in the transfer buff
-        // TODO: that.
-        wavheader_.FileSize = CalcFileSize();
-        f_lseek(&fp_, 0);
-        f_write(&fp_, &wavheader_, sizeof(wavheader_), &bw);
-        f_close(&fp_);
+    /** Opens a file for writing. Writes the initial WAV Header, and gets ready for stream-based recording.
+     ** Fails when the channels are split into more than one file. */
+    Result OpenFile(const char *name)
+    {
+        return num_tracks_ == 1 ? OpenFiles(&name) : Result::ERROR;
     }
 
-    /** Opens a file for writing. Writes the initial WAV Header, and gets ready for stream-based recording. */
-    void OpenFile(const char *name)
+    /** Opens one file for each group of channels, and starts recording.
+     ** \param names one name for each file, see GetNumFiles() */
+    Result OpenFiles(const char *const *names)
     {
-        if(f_open(&fp_, name, FA_WRITE | FA_CREATE_ALWAYS) == FR_OK)
+        if(recording_.load(std::memory_order_relaxed) || num_tracks_ == 0
+           || format_ == WavSampleFormat::UNSUPPORTED)
+            return Result::ERROR;
+        for(size_t t = 0; t < num_tracks_; t++)
         {
-            unsigned int bw = 0;
-            if(f_write(&fp_, &wavheader_, sizeof(wavheader_), &bw) == FR_OK)
+            Track &track = tracks_[t];
+            UINT   bw    = 0;
+            InitHeader(track);
+            track.ring.Init();
+            track.data_size = 0;
+            track.open
+                = f_open(&track.fp, names[t], FA_WRITE | FA_CREATE_ALWAYS)
+                  == FR_OK;
+            if(!track.open
+               || f_write(&track.fp, &track.header, sizeof(track.header), &bw)
+                      != FR_OK
+               || bw != sizeof(track.header))
             {
-                recording_ = true;
-                num_samps_ = 0;
+                for(size_t i = 0; i <= t; i++)
+                {
+                    if(tracks_[i].open)
+                        f_close(&tracks_[i].fp);
+                    tracks_[i].open = false;
+                }
+                return Result::ERROR;
             }
         }
+        num_samps_.store(0, std::memory_order_relaxed);
+        dropped_.store(0, std::memory_order_relaxed);
+        recording_.store(true, std::memory_order_release);
+        return Result::OK;
     }
 
     /** Returns whether recording is currently active or not. */
-    inline bool IsRecording() const { return recording_; }
+    inline bool IsRecording() const
+    {
+        return recording_.load(std::memory_order_acquire);
+    }
 
     /** Returns the current length in samples of the recording. */
-    inline uint32_t GetLengthSamps() { return num_samps_; }
+    inline uint32_t GetLengthSamps()
+    {
+        return num_samps_.load(std::memory_order_relaxed);
+    }
 
     /** Returns the current length of the recording in seconds. */
     inline float GetLengthSeconds()
     {
-        return (float)num_samps_ / (float)cfg_.samplerate;
+        return (float)GetLengthSamps() / (float)cfg_.samplerate;
+    }
+
+    /** Returns the number of frames dropped because Write() didn't keep up. */
+    inline uint32_t GetDroppedFrames()
+    {
+        return dropped_.load(std::memory_order_relaxed);
     }
 
+    /** Returns the number of files the channels are split into. */
+    inline size_t GetNumFiles() const { return num_tracks_; }
+
   private:
-    /** Calculate the file size based on current recording */
-    inline uint32_t CalcFileSize()
+    /** A file and the working buffer that feeds it */
+    struct Track
     {
-        wavheader_.SubCHunk2Size
-            = num_samps_ * cfg_.channels * cfg_.bitspersample / 8;
-        return 36 + wavheader_.SubCHunk2Size;
+        FIL                                        fp;
+        SpscRingBuffer<uint8_t, transfer_size * 2> ring;
+        WAV_FormatTypeDef                          header;
+        size_t   first_channel, num_channels, frame_size;
+        uint32_t data_size; /**< bytes written after the header */
+        bool     open;
+    };
+
+    /** Converts frames straight into the ring buffer of a track */
+    void Encode(Track &track, const float *const *in, size_t frames)
+    {
+        const float *src[kMaxChannels];
+        size_t       done = 0;
+        while(done < frames)
+        {
+            for(size_t ch = 0; ch < track.num_channels; ch++)
+                src[ch] = in[ch] + done;
+            auto   span = track.ring.PeekWrite();
+            size_t n    = span.num_elements / track.frame_size;
+            if(n > frames - done)
+                n = frames - done;
+            if(n > 0)
+            {
+                FloatToWav(src, track.num_channels, span.data, n, format_);
+                track.ring.CommitWrite(n * track.frame_size);
+            }
+            else
+            {
+                // A frame across the end of the ring buffer
+                uint8_t frame[kMaxChannels * 4];
+                FloatToWav(src, track.num_channels, frame, 1, format_);
+                track.ring.Write(frame, track.frame_size);
+                n = 1;
+            }
+            done += n;
+        }
     }
 
-    /** Compute the byte rate given the user settings. */
-    inline uint32_t CalcByteRate()
+    /** Writes size bytes from the ring buffer of a track to its file */
+    Result WriteTrack(Track &track, size_t size)
     {
-        return cfg_.samplerate * cfg_.channels * cfg_.bitspersample / 8;
+        while(size > 0)
+        {
+            auto span = track.ring.PeekRead();
+            UINT n    = span.num_elements < size ? span.num_elements : size;
+            UINT bw   = 0;
+            if(f_write(&track.fp, span.data, n, &bw) != FR_OK || bw != n)
+                return Result::ERROR;
+            track.ring.CommitRead(n);
+            track.data_size += n;
+            size -= n;
+        }
+        return Result::OK;
     }
 
-    static constexpr int kTransferSamps = transfer_size / sizeof(int32_t);
+    /** Prepares the WAV header of a track. The sizes are updated once the
+     ** recording is saved. */
+    void InitHeader(Track &track)
+    {
+        WAV_FormatTypeDef &header = track.header;
+        header.ChunkId            = kWavFileChunkId;     /** "RIFF" */
+        header.FileSize           = 36;
+        header.FileFormat         = kWavFileWaveId;      /** "WAVE" */
+        header.SubChunk1ID        = kWavFileSubChunk1Id; /** "fmt " */
+        header.SubChunk1Size      = 16;
+        header.AudioFormat        = format_ == WavSampleFormat::FLOAT_32
+                                        ? WAVE_FORMAT_IEEE_FLOAT
+                                        : WAVE_FORMAT_PCM;
+        header.NbrChannels        = track.num_channels;
+        header.SampleRate         = static_cast<int>(cfg_.samplerate);
+        header.ByteRate           = header.SampleRate * track.frame_size;
+        header.BlockAlign         = track.frame_size;
+        header.BitPerSample       = cfg_.bitspersample;
+        header.SubChunk2ID        = kWavFileSubChunk2Id; /** "data" */
+        header.SubCHunk2Size      = 0;
+    }
 
-    WAV_FormatTypeDef wavheader_;
-    uint32_t          num_samps_, wptr_;
-    Config            cfg_;
-    int32_t           transfer_buff[kTransferSamps * 2];
-    BufferState       bstate_;
-    bool              recording_;
-    FIL               fp_;
+    Config                cfg_;
+    WavSampleFormat       format_;
+    Track                 tracks_[max_files];
+    size_t                num_tracks_ = 0;
+    std::atomic<bool>     recording_{false};
+    std::atomic<uint32_t> num_samps_{0}, dropped_{0};
 };
 
 } // namespace daisy
@@ -2,7 +2,9 @@
 #ifndef DSY_RINGBUFFER_H
 #define DSY_RINGBUFFER_H
 
+#include <stddef.h>
 #include <algorithm>
+#include <atomic>
 
 namespace daisy
 {
@@ -194,6 +196,195 @@ class RingBuffer<T, 0>
   private:
 };
 
+/** Lock-free single-producer/single-consumer ring buffer
+
+Meant for passing data between an interrupt and the main loop, e.g. bytes
+received by a peripheral. Exactly one context may write, and exactly one
+(other) context may read. Neither side ever waits: writes to a full buffer
+and reads from an empty buffer fail instead.
+
+The read and write positions are free-running counters that are masked on
+access, so the size must be a power of two, and all `size` elements can be
+used. Elements are published to the reader with release/acquire ordering.
+
+Besides single and bulk element access, contiguous regions of the buffer can
+be accessed in place, e.g. to let a DMA or a parser work directly on them:
+\code
+auto span = buffer.PeekWrite();  // free space, up to the end of the buffer
+size_t n  = Receive(span.data, span.size);
+buffer.CommitWrite(n);           // make n elements readable
+\endcode
+*/
+template <typename T, size_t size>
+class SpscRingBuffer
+{
+  public:
+    static_assert(size > 0 && (size & (size - 1)) == 0,
+                  "SpscRingBuffer size must be a power of two");
+
+    /** A contiguous region of the buffer */
+    struct Span
+    {
+        T*     data;         /**< first element */
+        size_t num_elements; /**< number of elements */
+    };
+
+    SpscRingBuffer() { Init(); }
+
+    /** Empties the buffer. Not thread-safe, only call while neither side is active. */
+    inline void Init()
+    {
+        read_.store(0, std::memory_order_relaxed);
+        write_.store(0, std::memory_order_relaxed);
+    }
+
+    /** \return The total size of the ring buffer */
+    inline size_t capacity() const { return size; }
+
+    /** \return number of elements that can be written. Exact on the writer side. */
+    inline size_t writable() const
+    {
+        return size
+               - (write_.load(std::memory_order_relaxed)
+                  - read_.load(std::memory_order_acquire));
+    }
+
+    /** \return number of unread elements. Exact on the reader side. */
+    inline size_t readable() const
+    {
+        return write_.load(std::memory_order_acquire)
+               - read_.load(std::memory_order_relaxed);
+    }
+
+    /** \return True, if the buffer is empty. */
+    inline bool isEmpty() const { return readable() == 0; }
+
+    // ======== writer side ========
+
+    /** Writes a single element.
+    \param v Value to write
+    \return false if the buffer is full
+    */
+    inline bool Write(const T& v)
+    {
+        const size_t w = write_.load(std::memory_order_relaxed);
+        if(w - read_.load(std::memory_order_acquire) == size)
+            return false;
+        buffer_[w & kMask] = v;
+        write_.store(w + 1, std::memory_order_release);
+        return true;
+    }
+
+    /** Writes as many elements as fit.
+    \param source elements to write
+    \param num_elements number of elements in source
+    \return number of elements that were written
+    */
+    inline size_t Write(const T* source, size_t num_elements)
+    {
+        const size_t w     = write_.load(std::memory_order_relaxed);
+        const size_t free  = size - (w - read_.load(std::memory_order_acquire));
+        const size_t n     = num_elements < free ? num_elements : free;
+        const size_t idx   = w & kMask;
+        const size_t first = n < size - idx ? n : size - idx;
+        std::copy(source, source + first, &buffer_[idx]);
+        std::copy(source + first, source + n, &buffer_[0]);
+        write_.store(w + n, std::memory_order_release);
+        return n;
+    }
+
+    /** \return the free region after the write position, up to the end of the
+    buffer. If the free space wraps around, a second PeekWrite() after
+    CommitWrite() returns the rest.
+    */
+    inline Span PeekWrite()
+    {
+        const size_t w    = write_.load(std::memory_order_relaxed);
+        const size_t free = size - (w - read_.load(std::memory_order_acquire));
+        const size_t idx  = w & kMask;
+        return {&buffer_[idx], free < size - idx ? free : size - idx};
+    }
+
+    /** Makes elements written into the region returned by PeekWrite() readable.
+    \param num_elements at most the size of that region
+    */
+    inline void CommitWrite(size_t num_elements)
+    {
+        write_.store(write_.load(std::memory_order_relaxed) + num_elements,
+                     std::memory_order_release);
+    }
+
+    // ======== reader side ========
+
+    /** Reads a single element.
+    \param v receives the element
+    \return false if the buffer is empty
+    */
+    inline bool Read(T& v)
+    {
+        const size_t r = read_.load(std::memory_order_relaxed);
+        if(write_.load(std::memory_order_acquire) == r)
+            return false;
+        v = buffer_[r & kMask];
+        read_.store(r + 1, std::memory_order_release);
+        return true;
+    }
+
+    /** Reads as many elements as are available.
+    \param destination buffer to read into
+    \param num_elements size of destination
+    \return number of elements that were read
+    */
+    inline size_t Read(T* destination, size_t num_elements)
+    {
+        const size_t r     = read_.load(std::memory_order_relaxed);
+        const size_t avail = write_.load(std::memory_order_acquire) - r;
+        const size_t n     = num_elements < avail ? num_elements : avail;
+        const size_t idx   = r & kMask;
+        const size_t first = n < size - idx ? n : size - idx;
+        std::copy(&buffer_[idx], &buffer_[idx + first], destination);
+        std::copy(&buffer_[0], &buffer_[n - first], destination + first);
+        read_.store(r + n, std::memory_order_release);
+        return n;
+    }
+
+    /** \return the unread region after the read position, up to the end of the
+    buffer. The elements may be modified in place until CommitRead().
+    If the unread data wraps around, a second PeekRead() after CommitRead()
+    returns the rest.
+    */
+    inline Span PeekRead()
+    {
+        const size_t r     = read_.load(std::memory_order_relaxed);
+        const size_t avail = write_.load(std::memory_order_acquire) - r;
+        const size_t idx   = r & kMask;
+        return {&buffer_[idx], avail < size - idx ? avail : size - idx};
+    }
+
+    /** Releases elements of the region returned by PeekRead() to the writer.
+    \param num_elements at most the size of that region
+    */
+    inline void CommitRead(size_t num_elements)
+    {
+        read_.store(read_.load(std::memory_order_relaxed) + num_elements,
+                    std::memory_order_release);
+    }
+
+    /** Drops all unread elements. Must be called from the reader side. */
+    inline void Flush()
+    {
+        read_.store(write_.load(std::memory_order_acquire),
+                    std::memory_order_release);
+    }
+
+  private:
+    static constexpr size_t kMask = size - 1;
+
+    T                   buffer_[size];
+    std::atomic<size_t> read_;
+    std::atomic<size_t> write_;
+};
+
 /** @} */
 } // namespace daisy
 
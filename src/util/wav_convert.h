@@ -0,0 +1,266 @@
+#pragma once
+#ifndef DSY_WAV_CONVERT_H
+#define DSY_WAV_CONVERT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "daisy_core.h"
+#include "util/wav_format.h"
+
+/** @addtogroup utility
+    @{
+*/
+
+namespace daisy
+{
+/** Sample formats of the audio data in a WAV file */
+enum class WavSampleFormat : uint8_t
+{
+    PCM_U8,      /**< 8-bit unsigned */
+    PCM_S16,     /**< 16-bit signed */
+    PCM_S24,     /**< 24-bit signed, packed into 3 bytes */
+    PCM_S32,     /**< 32-bit signed */
+    FLOAT_32,    /**< 32-bit IEEE float */
+    UNSUPPORTED, /**< anything else, e.g. A-law or 20-bit PCM */
+};
+
+/** \return the sample format for the format code of a "fmt " chunk (the
+ *          sub-format for WAVE_FORMAT_EXTENSIBLE) and the container size
+ */
+inline WavSampleFormat GetWavSampleFormat(uint16_t format_code,
+                                          uint16_t bits_per_sample)
+{
+    if(format_code == WAVE_FORMAT_PCM)
+    {
+        switch(bits_per_sample)
+        {
+            case 8: return WavSampleFormat::PCM_U8;
+            case 16: return WavSampleFormat::PCM_S16;
+            case 24: return WavSampleFormat::PCM_S24;
+            case 32: return WavSampleFormat::PCM_S32;
+            default: break;
+        }
+    }
+    else if(format_code == WAVE_FORMAT_IEEE_FLOAT && bits_per_sample == 32)
+    {
+        return WavSampleFormat::FLOAT_32;
+    }
+    return WavSampleFormat::UNSUPPORTED;
+}
+
+/** \return the bytes per sample of a format, 0 if it isn't supported */
+inline size_t GetWavSampleSize(WavSampleFormat format)
+{
+    switch(format)
+    {
+        case WavSampleFormat::PCM_U8: return 1;
+        case WavSampleFormat::PCM_S16: return 2;
+        case WavSampleFormat::PCM_S24: return 3;
+        case WavSampleFormat::PCM_S32:
+        case WavSampleFormat::FLOAT_32: return 4;
+        default: return 0;
+    }
+}
+
+/** Per-format helpers used by the conversion kernels.
+ *  WAV data is little-endian and samples aren't aligned to their size, so
+ *  they are assembled from bytes (memcpy compiles to a single unaligned
+ *  load or store on Cortex-M7). Decode returns the sample in the same range
+ *  as s162f/s242f/s322f, and Encode clamps like f2s16/f2s24/f2s32.
+ */
+struct WavSampleU8
+{
+    static constexpr size_t kSize = 1;
+    static FORCE_INLINE float Decode(const uint8_t* p)
+    {
+        return (float)((int32_t)p[0] - 128) * (1.f / 128.f);
+    }
+    static FORCE_INLINE void Encode(float x, uint8_t* p)
+    {
+        p[0] = (uint8_t)(f2s8(x) + 128);
+    }
+};
+
+struct WavSampleS16
+{
+    static constexpr size_t kSize = 2;
+    static FORCE_INLINE float Decode(const uint8_t* p)
+    {
+        int16_t x;
+        memcpy(&x, p, sizeof(x));
+        return (float)x * S162F_SCALE;
+    }
+    static FORCE_INLINE void Encode(float x, uint8_t* p)
+    {
+        const int16_t y = f2s16(x);
+        memcpy(p, &y, sizeof(y));
+    }
+};
+
+struct WavSampleS24
+{
+    static constexpr size_t kSize = 3;
+    /** The 24 bits go to the top of an int32, which sign-extends them and
+     *  is exact in float. */
+    static FORCE_INLINE float Decode(const uint8_t* p)
+    {
+        const uint32_t x = ((uint32_t)p[0] << 8) | ((uint32_t)p[1] << 16)
+                           | ((uint32_t)p[2] << 24);
+        return (float)(int32_t)x * S322F_SCALE;
+    }
+    static FORCE_INLINE void Encode(float x, uint8_t* p)
+    {
+        const int32_t y = f2s24(x);
+        p[0]            = (uint8_t)y;
+        p[1]            = (uint8_t)(y >> 8);
+        p[2]            = (uint8_t)(y >> 16);
+    }
+};
+
+struct WavSampleS32
+{
+    static constexpr size_t kSize = 4;
+    static FORCE_INLINE float Decode(const uint8_t* p)
+    {
+        int32_t x;
+        memcpy(&x, p, sizeof(x));
+        return (float)x * S322F_SCALE;
+    }
+    static FORCE_INLINE void Encode(float x, uint8_t* p)
+    {
+        const int32_t y = f2s32(x);
+        memcpy(p, &y, sizeof(y));
+    }
+};
+
+struct WavSampleF32
+{
+    static constexpr size_t kSize = 4;
+    static FORCE_INLINE float Decode(const uint8_t* p)
+    {
+        float x;
+        memcpy(&x, p, sizeof(x));
+        return x;
+    }
+    static FORCE_INLINE void Encode(float x, uint8_t* p)
+    {
+        memcpy(p, &x, sizeof(x));
+    }
+};
+
+template <typename Format>
+inline void WavToFloatBlock(const uint8_t* __restrict in,
+                            size_t in_channels,
+                            float* const* out,
+                            size_t        out_channels,
+                            size_t        frames)
+{
+    const size_t stride = in_channels * Format::kSize;
+    for(size_t ch = 0; ch < out_channels; ch++)
+    {
+        const uint8_t* __restrict src = in + ch * Format::kSize;
+        float* __restrict dst         = out[ch];
+        for(size_t i = 0; i < frames; i++)
+            dst[i] = Format::Decode(src + i * stride);
+    }
+}
+
+template <typename Format>
+inline void FloatToWavBlock(const float* const* in,
+                            size_t              in_channels,
+                            uint8_t* __restrict out,
+                            size_t frames)
+{
+    const size_t stride = in_channels * Format::kSize;
+    for(size_t ch = 0; ch < in_channels; ch++)
+    {
+        const float* __restrict src = in[ch];
+        uint8_t* __restrict dst     = out + ch * Format::kSize;
+        for(size_t i = 0; i < frames; i++)
+            Format::Encode(src[i], dst + i * stride);
+    }
+}
+
+/** Decodes a block of interleaved WAV audio data into planar float.
+ *  \param in           audio data, whole frames
+ *  \param in_channels  channels in each frame of in
+ *  \param out          one destination for each of the first out_channels
+ *                      channels, must not overlap in
+ *  \param out_channels channels to decode, at most in_channels
+ *  \param frames       number of frames
+ *  \param format       sample format of in
+ */
+inline void WavToFloat(const uint8_t*  in,
+                       size_t          in_channels,
+                       float* const*   out,
+                       size_t          out_channels,
+                       size_t          frames,
+                       WavSampleFormat format)
+{
+    switch(format)
+    {
+        case WavSampleFormat::PCM_U8:
+            WavToFloatBlock<WavSampleU8>(
+                in, in_channels, out, out_channels, frames);
+            break;
+        case WavSampleFormat::PCM_S16:
+            WavToFloatBlock<WavSampleS16>(
+                in, in_channels, out, out_channels, frames);
+            break;
+        case WavSampleFormat::PCM_S24:
+            WavToFloatBlock<WavSampleS24>(
+                in, in_channels, out, out_channels, frames);
+            break;
+        case WavSampleFormat::PCM_S32:
+            WavToFloatBlock<WavSampleS32>(
+                in, in_channels, out, out_channels, frames);
+            break;
+        case WavSampleFormat::FLOAT_32:
+            WavToFloatBlock<WavSampleF32>(
+                in, in_channels, out, out_channels, frames);
+            break;
+        default: break;
+    }
+}
+
+/** Encodes planar float into a block of interleaved WAV audio data,
+ *  clamping to full scale.
+ *  \param in          one source for each channel
+ *  \param in_channels number of channels
+ *  \param out         audio data, frames * in_channels samples, must not
+ *                     overlap in
+ *  \param frames      number of frames
+ *  \param format      sample format of out
+ */
+inline void FloatToWav(const float* const* in,
+                       size_t              in_channels,
+                       uint8_t*            out,
+                       size_t              frames,
+                       WavSampleFormat     format)
+{
+    switch(format)
+    {
+        case WavSampleFormat::PCM_U8:
+            FloatToWavBlock<WavSampleU8>(in, in_channels, out, frames);
+            break;
+        case WavSampleFormat::PCM_S16:
+            FloatToWavBlock<WavSampleS16>(in, in_channels, out, frames);
+            break;
+        case WavSampleFormat::PCM_S24:
+            FloatToWavBlock<WavSampleS24>(in, in_channels, out, frames);
+            break;
+        case WavSampleFormat::PCM_S32:
+            FloatToWavBlock<WavSampleS32>(in, in_channels, out, frames);
+            break;
+        case WavSampleFormat::FLOAT_32:
+            FloatToWavBlock<WavSampleF32>(in, in_channels, out, frames);
+            break;
+        default: break;
+    }
+}
+
+} // namespace daisy
+
+#endif
+/** @} */
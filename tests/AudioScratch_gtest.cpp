@@ -0,0 +1,146 @@
+#include <gtest/gtest.h>
+#include <pthread.h>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+#include "hid/audio_scratch.h"
+#include "VirtualAudioDevice.h"
+
+using namespace daisy;
+
+namespace
+{
+constexpr size_t kMaxChannels  = 8;
+constexpr size_t kMaxBlockSize = 256;
+
+using Scratch = AudioScratchBuffer<kMaxChannels, kMaxBlockSize>;
+
+// Halves every channel, through AudioHandle's non-interleaved path:
+// SAI words -> planar float in the scratch pool -> callback -> SAI words
+size_t callback_channels = 2;
+void   HalfGain(AudioHandle::InputBuffer  in,
+                AudioHandle::OutputBuffer out,
+                size_t                    size)
+{
+    for(size_t ch = 0; ch < callback_channels; ch++)
+        for(size_t i = 0; i < size; i++)
+            out[ch][i] = in[ch][i] * 0.5f;
+}
+
+float Input(size_t channel, size_t frame)
+{
+    return 0.1f * (channel + 1) - 0.001f * (frame % 100);
+}
+
+// Sets up the device with the callback for a block shape
+void StartDevice(VirtualAudioDevice& device, bool dual_sai, size_t blocksize)
+{
+    VirtualAudioDevice::Config config;
+    config.dual_sai  = dual_sai;
+    config.blocksize = blocksize;
+    device.Init(config);
+    device.SetInputGenerator(Input);
+    callback_channels = device.GetChannels();
+    device.GetAudioHandle().Start(HalfGain);
+}
+
+struct RunJob
+{
+    VirtualAudioDevice* device;
+    size_t              blocks;
+};
+
+void* RunThread(void* arg)
+{
+    RunJob* job = static_cast<RunJob*>(arg);
+    job->device->Run(job->blocks);
+    return nullptr;
+}
+
+constexpr uint8_t kStackPaint = 0xA5;
+
+// Runs blocks on a thread with a painted stack, and returns how many bytes
+// of the stack were touched.
+size_t MeasureStackUsage(RunJob& job)
+{
+    constexpr size_t     stack_size = 256 * 1024;
+    std::vector<uint8_t> stack(stack_size, kStackPaint);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstack(&attr, stack.data(), stack.size());
+    pthread_t thread;
+    EXPECT_EQ(pthread_create(&thread, &attr, RunThread, &job), 0);
+    pthread_join(thread, nullptr);
+    pthread_attr_destroy(&attr);
+
+    // the stack grows downwards, find the deepest touched byte
+    size_t untouched = 0;
+    while(untouched < stack.size() && stack[untouched] == kStackPaint)
+        untouched++;
+    return stack.size() - untouched;
+}
+
+Scratch scratch;
+} // namespace
+
+TEST(hid_AudioScratch, a_preparePlanarLayout)
+{
+    for(size_t channels = 1; channels <= kMaxChannels; channels++)
+    {
+        ASSERT_TRUE(scratch.Prepare(channels, 48));
+        for(size_t ch = 0; ch < channels; ch++)
+        {
+            // channels are adjacent and within the pool
+            EXPECT_EQ(scratch.In()[ch], scratch.InterleavedIn() + ch * 48);
+            EXPECT_EQ(scratch.Out()[ch], scratch.InterleavedOut() + ch * 48);
+        }
+    }
+}
+
+TEST(hid_AudioScratch, b_rejectsBlocksThatDontFit)
+{
+    EXPECT_TRUE(scratch.Prepare(kMaxChannels, kMaxBlockSize));
+    EXPECT_FALSE(scratch.Prepare(kMaxChannels + 1, 48));
+    EXPECT_FALSE(scratch.Prepare(2, kMaxBlockSize + 1));
+    EXPECT_EQ(Scratch::GetMaxChannels(), kMaxChannels);
+    EXPECT_EQ(Scratch::GetMaxBlockSize(), kMaxBlockSize);
+}
+
+TEST(hid_AudioScratch, c_stackUsageIndependentOfBlockShape)
+{
+    // With the previous VLAs, 4 channels of 256 samples cost 8kB of stack.
+    // Using the pool, stack usage must not depend on the block shape.
+    VirtualAudioDevice device;
+    StartDevice(device, false, 16);
+    RunJob       small    = {&device, 1};
+    const size_t baseline = MeasureStackUsage(small);
+    for(bool dual_sai : {false, true})
+    {
+        StartDevice(device, dual_sai, DSY_AUDIO_MAX_BLOCKSIZE);
+        RunJob       large = {&device, 1};
+        const size_t used  = MeasureStackUsage(large);
+        EXPECT_LT(used, baseline + 256) << device.GetChannels() << " channels";
+    }
+}
+
+TEST(hid_AudioScratch, d_throughput)
+{
+    for(bool dual_sai : {false, true})
+    {
+        VirtualAudioDevice device;
+        StartDevice(device, dual_sai, 48);
+        const double blocks_per_s = device.Run(2000);
+        printf("[ bench    ] %zu channels: %.1f ns/block\n",
+               device.GetChannels(),
+               1e9 / blocks_per_s);
+
+        // the callback ran on every channel of every block
+        const auto&  out  = device.GetOutput();
+        const size_t chns = device.GetChannels();
+        for(size_t f = 0; f < out.size() / chns; f += 97)
+            for(size_t c = 0; c < chns; c++)
+                ASSERT_NEAR(out[f * chns + c], 0.5f * Input(c, f), 1e-5f)
+                    << "channel " << c << " frame " << f;
+    }
+}
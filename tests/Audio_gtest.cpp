@@ -0,0 +1,373 @@
+#include <gtest/gtest.h>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include "VirtualAudioDevice.h"
+#include "sys/system.h"
+
+using namespace daisy;
+
+namespace
+{
+float Sine(size_t channel, size_t frame)
+{
+    return 0.5f * sinf(0.01f * (channel + 1) * frame);
+}
+
+void InterleavedPassThrough(AudioHandle::InterleavingInputBuffer  in,
+                            AudioHandle::InterleavingOutputBuffer out,
+                            size_t                                size)
+{
+    for(size_t i = 0; i < size; i++)
+        out[i] = in[i];
+}
+
+// writes each input channel to the next output channel
+size_t rotate_channels = 2;
+void   RotateChannels(AudioHandle::InputBuffer  in,
+                      AudioHandle::OutputBuffer out,
+                      size_t                    size)
+{
+    const size_t chns = rotate_channels;
+    for(size_t c = 0; c < chns; c++)
+        for(size_t i = 0; i < size; i++)
+            out[(c + 1) % chns][i] = in[c][i];
+}
+
+AudioHandle::RawBuffer last_raw;
+void                   RawPassThrough(const AudioHandle::RawBuffer& buffer)
+{
+    last_raw = buffer;
+    for(size_t c = 0; c < buffer.num_sai * 2; c++)
+    {
+        const int32_t* in  = buffer.InChannel(c);
+        int32_t*       out = buffer.OutChannel(c);
+        for(size_t i = 0; i < buffer.size; i++)
+            out[i * buffer.stride] = in[i * buffer.stride];
+    }
+}
+
+// one 24-bit LSB
+constexpr float kTolerance = 2.f / 8388608.f;
+} // namespace
+
+TEST(hid_Audio, a_interleavedPassThrough)
+{
+    VirtualAudioDevice device;
+    ASSERT_EQ(device.Init(VirtualAudioDevice::Config()),
+              AudioHandle::Result::OK);
+    device.SetInputGenerator(Sine);
+    device.GetAudioHandle().Start(InterleavedPassThrough);
+    device.Run(10);
+
+    const auto& out = device.GetOutput();
+    ASSERT_EQ(out.size(), 10u * 48u * 2u);
+    for(size_t f = 0; f < out.size() / 2; f++)
+    {
+        EXPECT_NEAR(out[2 * f], Sine(0, f), kTolerance);
+        EXPECT_NEAR(out[2 * f + 1], Sine(1, f), kTolerance);
+    }
+}
+
+TEST(hid_Audio, b_nonInterleavedChannelMapping)
+{
+    VirtualAudioDevice device;
+    device.Init(VirtualAudioDevice::Config());
+    device.SetInputGenerator(Sine);
+    rotate_channels = 2;
+    device.GetAudioHandle().Start(RotateChannels);
+    device.Run(4);
+
+    const auto& out = device.GetOutput();
+    for(size_t f = 0; f < out.size() / 2; f++)
+    {
+        EXPECT_NEAR(out[2 * f], Sine(1, f), kTolerance);
+        EXPECT_NEAR(out[2 * f + 1], Sine(0, f), kTolerance);
+    }
+}
+
+TEST(hid_Audio, c_dualSaiChannelMapping)
+{
+    VirtualAudioDevice         device;
+    VirtualAudioDevice::Config config;
+    config.dual_sai = true;
+    device.Init(config);
+    ASSERT_EQ(device.GetAudioHandle().GetChannels(), 4u);
+    device.SetInputGenerator(Sine);
+    rotate_channels = 4;
+    device.GetAudioHandle().Start(RotateChannels);
+    device.Run(4);
+
+    const auto& out = device.GetOutput();
+    for(size_t f = 0; f < out.size() / 4; f++)
+        for(size_t c = 0; c < 4; c++)
+            EXPECT_NEAR(out[4 * f + (c + 1) % 4], Sine(c, f), kTolerance);
+}
+
+TEST(hid_Audio, d_postGainIsTransparent)
+{
+    VirtualAudioDevice         device;
+    VirtualAudioDevice::Config config;
+    config.postgain = 2.f;
+    device.Init(config);
+    device.SetInputGenerator(Sine);
+    device.GetAudioHandle().Start(InterleavedPassThrough);
+    device.Run(2);
+
+    const auto& out = device.GetOutput();
+    for(size_t f = 0; f < out.size() / 2; f++)
+        EXPECT_NEAR(out[2 * f], Sine(0, f), kTolerance);
+}
+
+TEST(hid_Audio, e_rawCallbackGetsDmaWords)
+{
+    VirtualAudioDevice         device;
+    VirtualAudioDevice::Config config;
+    config.dual_sai = true;
+    device.Init(config);
+    device.SetInputGenerator(Sine);
+    device.GetAudioHandle().Start(RawPassThrough);
+    device.Run(3);
+
+    EXPECT_EQ(last_raw.num_sai, 2u);
+    EXPECT_EQ(last_raw.stride, 2u);
+    EXPECT_EQ(last_raw.size, 48u);
+    EXPECT_EQ(last_raw.bit_depth, SaiHandle::Config::BitDepth::SAI_24BIT);
+    // the first SAI's words come first, in the half the DMA just filled
+    EXPECT_EQ(last_raw.out[0], device.GetSai(0).GetTxForUnitTest());
+
+    // without conversion, the words come out exactly as they went in
+    const auto& out = device.GetOutput();
+    for(size_t f = 0; f < out.size() / 4; f++)
+        for(size_t c = 0; c < 4; c++)
+            EXPECT_NEAR(out[4 * f + c], Sine(c, f), kTolerance);
+}
+
+TEST(hid_Audio, f_wavInputAndOutput)
+{
+    const std::string in_path  = ::testing::TempDir() + "hid_Audio_in.wav";
+    const std::string out_path = ::testing::TempDir() + "hid_Audio_out.wav";
+
+    // write a generated signal to a WAV file by passing it through once
+    VirtualAudioDevice device;
+    device.Init(VirtualAudioDevice::Config());
+    device.SetInputGenerator(Sine);
+    device.GetAudioHandle().Start(InterleavedPassThrough);
+    device.Run(5);
+    ASSERT_TRUE(device.WriteOutputWav(in_path.c_str()));
+    const std::vector<float> first = device.GetOutput();
+
+    // then play that file back
+    device.Init(VirtualAudioDevice::Config());
+    ASSERT_TRUE(device.LoadInputWav(in_path.c_str()));
+    device.GetAudioHandle().Start(InterleavedPassThrough);
+    device.Run(5);
+    ASSERT_TRUE(device.WriteOutputWav(out_path.c_str()));
+
+    ASSERT_EQ(device.GetOutput().size(), first.size());
+    for(size_t i = 0; i < first.size(); i++)
+        EXPECT_NEAR(device.GetOutput()[i], first[i], kTolerance);
+
+    EXPECT_FALSE(device.LoadInputWav("this/file/does/not/exist.wav"));
+
+    // sample sizes below 8 bits are rejected rather than divided by
+    const uint8_t bad[] = {
+        'R', 'I', 'F', 'F', 40,  0,    0,    0, 'W', 'A', 'V', 'E', // RIFF
+        'f', 'm', 't', ' ', 16,  0,    0,    0, 1,   0,   1,   0,   // PCM
+        0,   0,   0,   0,   0,   0,    0,    0, 1,   0,   4,   0,   // 4 bits
+        'd', 'a', 't', 'a', 4,   0,    0,    0, 1,   2,   3,   4,
+    };
+    FILE* file = fopen(in_path.c_str(), "wb");
+    ASSERT_NE(file, nullptr);
+    fwrite(bad, 1, sizeof(bad), file);
+    fclose(file);
+    EXPECT_FALSE(device.LoadInputWav(in_path.c_str()));
+
+    remove(in_path.c_str());
+    remove(out_path.c_str());
+}
+
+namespace
+{
+// advances the tick counter as if the callback took a while to run
+uint32_t callback_ticks = 0;
+void     SlowCallback(AudioHandle::InterleavingInputBuffer  in,
+                      AudioHandle::InterleavingOutputBuffer out,
+                      size_t                                size)
+{
+    InterleavedPassThrough(in, out, size);
+    System::SetTickForUnitTest(System::GetTick() + callback_ticks);
+}
+} // namespace
+
+TEST(hid_Audio, g_instrumentation)
+{
+    // 48 samples at 48kHz take 1ms, or 1000 ticks at 1MHz
+    System::SetTickFreqForUnitTest(1000000);
+    VirtualAudioDevice device;
+    device.Init(VirtualAudioDevice::Config());
+    AudioHandle& audio = device.GetAudioHandle();
+    audio.Start(SlowCallback);
+
+    auto stats = audio.GetStats();
+    EXPECT_EQ(stats.deadline_ticks, 1000u);
+    EXPECT_EQ(stats.blocks, 0u);
+
+    callback_ticks = 300;
+    device.Run(3);
+    callback_ticks = 1100;
+    device.Run(1);
+    callback_ticks = 100;
+    device.GetSai(0).SetRxDmaEventPendingForUnitTest(true);
+    device.Run(2);
+    device.GetSai(0).SetRxDmaEventPendingForUnitTest(false);
+
+    stats = audio.GetStats();
+    EXPECT_EQ(stats.blocks, 6u);
+    EXPECT_EQ(stats.last_ticks, 100u);
+    EXPECT_EQ(stats.max_ticks, 1100u);
+    EXPECT_EQ(stats.missed_deadlines, 1u);
+    EXPECT_EQ(stats.overlapped_events, 2u);
+    EXPECT_EQ(stats.histogram[0], 2u); // 100 ticks
+    EXPECT_EQ(stats.histogram[2], 3u); // 300 ticks
+    EXPECT_EQ(stats.histogram[8], 1u); // overrun
+
+    audio.ResetStats();
+    stats = audio.GetStats();
+    EXPECT_EQ(stats.blocks, 0u);
+    EXPECT_EQ(stats.missed_deadlines, 0u);
+    EXPECT_EQ(stats.deadline_ticks, 1000u);
+
+    // the deadline follows the block size
+    audio.SetBlockSize(24);
+    EXPECT_EQ(audio.GetStats().deadline_ticks, 500u);
+    callback_ticks = 600;
+    device.Run(1);
+    stats = audio.GetStats();
+    EXPECT_EQ(stats.missed_deadlines, 1u);
+    EXPECT_EQ(stats.histogram[AudioHandle::kStatsHistogramBuckets], 1u);
+    audio.SetBlockSize(48);
+    EXPECT_EQ(audio.GetStats().deadline_ticks, 1000u);
+}
+
+namespace
+{
+// counts how many blocks ran since the last control task
+size_t blocks_since_task = 0;
+size_t task_runs         = 0;
+void   CountingCallback(AudioHandle::InterleavingInputBuffer  in,
+                        AudioHandle::InterleavingOutputBuffer out,
+                        size_t                                size)
+{
+    InterleavedPassThrough(in, out, size);
+    blocks_since_task++;
+}
+void ControlTask(void* context)
+{
+    EXPECT_EQ(context, &task_runs);
+    // every 4th block, right before the callback
+    EXPECT_EQ(blocks_since_task, task_runs == 0 ? blocks_since_task : 4u);
+    blocks_since_task = 0;
+    task_runs++;
+}
+} // namespace
+
+TEST(hid_Audio, h_controlTasks)
+{
+    VirtualAudioDevice device;
+    device.Init(VirtualAudioDevice::Config());
+    AudioHandle& audio = device.GetAudioHandle();
+    size_t       id;
+    // 1kHz block rate
+    ASSERT_EQ(audio.AddControlTaskHz(ControlTask, &task_runs, 250.f, &id),
+              AudioHandle::Result::OK);
+    EXPECT_FLOAT_EQ(audio.GetControlTaskRate(id), 250.f);
+    audio.Start(CountingCallback);
+    device.Run(40);
+    EXPECT_EQ(task_runs, 10u);
+    EXPECT_EQ(audio.GetControlTaskStats(id).runs, 10u);
+
+    // the period follows the block size
+    audio.SetBlockSize(24);
+    EXPECT_FLOAT_EQ(audio.GetControlTaskRate(id), 250.f);
+
+    EXPECT_EQ(audio.RemoveControlTask(id), AudioHandle::Result::OK);
+    EXPECT_EQ(audio.RemoveControlTask(id), AudioHandle::Result::ERR);
+    EXPECT_EQ(audio.AddControlTask(ControlTask, nullptr, 0),
+              AudioHandle::Result::ERR);
+}
+
+namespace
+{
+// maps fixed timestamps relative to the tick at the start of the block
+AudioHandle* offset_audio = nullptr;
+size_t       offsets[5];
+void         OffsetCallback(AudioHandle::InterleavingInputBuffer  in,
+                            AudioHandle::InterleavingOutputBuffer out,
+                            size_t                                size)
+{
+    InterleavedPassThrough(in, out, size);
+    const uint32_t start = offset_audio->GetBlockStartTick();
+    EXPECT_EQ(start, System::GetTick());
+    // the previous block period starts 1000 ticks earlier
+    offsets[0] = offset_audio->GetSampleOffset(start - 2000);
+    offsets[1] = offset_audio->GetSampleOffset(start - 1000);
+    offsets[2] = offset_audio->GetSampleOffset(start - 500);
+    offsets[3] = offset_audio->GetSampleOffset(start - 1);
+    offsets[4] = offset_audio->GetSampleOffset(start + 10);
+}
+} // namespace
+
+TEST(hid_Audio, i_sampleOffsets)
+{
+    // 48 samples at 48kHz take 1ms, or 1000 ticks at 1MHz
+    System::SetTickFreqForUnitTest(1000000);
+    // close to wrapping around, which must not matter
+    System::SetTickForUnitTest(0xffffff00);
+    VirtualAudioDevice device;
+    device.Init(VirtualAudioDevice::Config());
+    offset_audio = &device.GetAudioHandle();
+    offset_audio->Start(OffsetCallback);
+    device.Run(1);
+
+    EXPECT_EQ(offsets[0], 0u);
+    EXPECT_EQ(offsets[1], 0u);
+    EXPECT_EQ(offsets[2], 24u);
+    EXPECT_EQ(offsets[3], 47u);
+    EXPECT_EQ(offsets[4], 47u);
+
+    // the mapping follows the block size, a block now takes 2000 ticks
+    offset_audio->SetBlockSize(96);
+    device.Run(1);
+    EXPECT_EQ(offsets[0], 0u);
+    EXPECT_EQ(offsets[1], 48u);
+    EXPECT_EQ(offsets[2], 72u);
+    EXPECT_EQ(offsets[3], 95u);
+}
+
+// Not a pass/fail test: prints the throughput of the complete callback path
+// for each callback type, so changes can be compared offline.
+TEST(hid_Audio, z_benchmark)
+{
+    VirtualAudioDevice         device;
+    VirtualAudioDevice::Config config;
+    config.dual_sai = true;
+    device.Init(config);
+    device.SetInputGenerator(Sine);
+
+    rotate_channels = 4;
+    device.GetAudioHandle().Start(RotateChannels);
+    const double non_interleaved = device.Run(2000);
+    device.GetAudioHandle().Start(RawPassThrough);
+    const double raw = device.Run(2000);
+    device.Init(VirtualAudioDevice::Config());
+    device.SetInputGenerator(Sine);
+    device.GetAudioHandle().Start(InterleavedPassThrough);
+    const double interleaved = device.Run(2000);
+
+    printf("[ bench    ] non-interleaved 4ch: %.0f blocks/s, raw 4ch: %.0f "
+           "blocks/s, interleaved 2ch: %.0f blocks/s\n",
+           non_interleaved,
+           raw,
+           interleaved);
+}
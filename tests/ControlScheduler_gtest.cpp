@@ -0,0 +1,185 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include "hid/control_scheduler.h"
+
+using namespace daisy;
+
+namespace
+{
+using Scheduler = ControlScheduler<8>;
+
+// Records in which block each task ran
+struct TaskLog
+{
+    size_t              block = 0;
+    std::vector<size_t> runs;
+};
+
+void LogTask(void* context)
+{
+    TaskLog* log = static_cast<TaskLog*>(context);
+    log->runs.push_back(log->block);
+}
+
+uint32_t task_ticks = 0;
+void     SlowTask(void*)
+{
+    System::SetTickForUnitTest(System::GetTick() + task_ticks);
+}
+
+void RunBlocks(Scheduler& scheduler, std::vector<TaskLog*> logs, size_t n)
+{
+    for(size_t b = 0; b < n; b++)
+    {
+        for(auto log : logs)
+            log->block++;
+        scheduler.Process();
+    }
+}
+} // namespace
+
+TEST(hid_ControlScheduler, a_runsEveryPeriod)
+{
+    Scheduler scheduler;
+    scheduler.Init(1000.f);
+    TaskLog every, third;
+    size_t  id;
+    EXPECT_TRUE(scheduler.Add(LogTask, &every, 1));
+    EXPECT_TRUE(scheduler.Add(LogTask, &third, 3, &id));
+    EXPECT_EQ(scheduler.GetPeriod(id), 3u);
+    RunBlocks(scheduler, {&every, &third}, 30);
+
+    EXPECT_EQ(every.runs.size(), 30u);
+    ASSERT_EQ(third.runs.size(), 10u);
+    for(size_t i = 1; i < third.runs.size(); i++)
+        EXPECT_EQ(third.runs[i] - third.runs[i - 1], 3u);
+}
+
+TEST(hid_ControlScheduler, b_spreadsTasksAcrossBlocks)
+{
+    Scheduler scheduler;
+    scheduler.Init(1000.f);
+    TaskLog logs[4];
+    for(auto& log : logs)
+        EXPECT_TRUE(scheduler.Add(LogTask, &log, 4));
+    RunBlocks(scheduler, {&logs[0], &logs[1], &logs[2], &logs[3]}, 16);
+
+    // each of the 4 tasks lands in a different block
+    std::vector<size_t> tasks_per_block(17, 0);
+    for(auto& log : logs)
+    {
+        EXPECT_EQ(log.runs.size(), 4u);
+        for(auto block : log.runs)
+            tasks_per_block[block]++;
+    }
+    for(size_t b = 1; b <= 16; b++)
+        EXPECT_EQ(tasks_per_block[b], 1u) << "block " << b;
+}
+
+TEST(hid_ControlScheduler, c_spreadsMixedPeriods)
+{
+    Scheduler scheduler;
+    scheduler.Init(1000.f);
+    TaskLog a, b, c;
+    scheduler.Add(LogTask, &a, 2);
+    scheduler.Add(LogTask, &b, 4);
+    scheduler.Add(LogTask, &c, 4);
+    RunBlocks(scheduler, {&a, &b, &c}, 64);
+
+    std::vector<size_t> tasks_per_block(65, 0);
+    for(auto log : {&a, &b, &c})
+        for(auto block : log->runs)
+            tasks_per_block[block]++;
+    for(size_t block = 1; block <= 64; block++)
+        EXPECT_EQ(tasks_per_block[block], 1u) << "block " << block;
+}
+
+TEST(hid_ControlScheduler, d_rateInHz)
+{
+    Scheduler scheduler;
+    // 48kHz / 48 samples
+    scheduler.Init(1000.f);
+    TaskLog log;
+    size_t  id;
+    EXPECT_TRUE(scheduler.AddHz(LogTask, &log, 250.f, &id));
+    EXPECT_EQ(scheduler.GetPeriod(id), 4u);
+    EXPECT_FLOAT_EQ(scheduler.GetRate(id), 250.f);
+
+    // rates above the block rate run every block
+    size_t fast;
+    EXPECT_TRUE(scheduler.AddHz(LogTask, &log, 5000.f, &fast));
+    EXPECT_EQ(scheduler.GetPeriod(fast), 1u);
+
+    // a smaller block size raises the block rate, and the period follows
+    scheduler.SetBlockRate(4000.f);
+    EXPECT_EQ(scheduler.GetPeriod(id), 16u);
+    EXPECT_FLOAT_EQ(scheduler.GetRate(id), 250.f);
+
+    EXPECT_FALSE(scheduler.AddHz(LogTask, &log, 0.f));
+    EXPECT_FALSE(scheduler.AddHz(LogTask, &log, -1.f));
+
+    // long periods start within the placement horizon
+    Scheduler slow_scheduler;
+    slow_scheduler.Init(1500.f);
+    TaskLog slow;
+    EXPECT_TRUE(slow_scheduler.AddHz(LogTask, &slow, 0.1f, &id));
+    EXPECT_EQ(slow_scheduler.GetPeriod(id), 15000u);
+    RunBlocks(slow_scheduler, {&slow}, 15256);
+    ASSERT_EQ(slow.runs.size(), 2u);
+    EXPECT_LE(slow.runs[0], 256u);
+    EXPECT_EQ(slow.runs[1] - slow.runs[0], 15000u);
+}
+
+TEST(hid_ControlScheduler, e_addAndRemove)
+{
+    Scheduler scheduler;
+    scheduler.Init(1000.f);
+    TaskLog log;
+    size_t  ids[Scheduler::GetMaxTasks()];
+    for(auto& id : ids)
+        EXPECT_TRUE(scheduler.Add(LogTask, &log, 1, &id));
+    EXPECT_FALSE(scheduler.Add(LogTask, &log, 1));
+    EXPECT_FALSE(scheduler.Add(nullptr, &log, 1));
+
+    EXPECT_TRUE(scheduler.Remove(ids[3]));
+    EXPECT_FALSE(scheduler.Remove(ids[3]));
+    EXPECT_FALSE(scheduler.Remove(Scheduler::GetMaxTasks()));
+    EXPECT_EQ(scheduler.GetPeriod(ids[3]), 0u);
+    EXPECT_EQ(scheduler.GetRate(ids[3]), 0.f);
+
+    // the freed slot is reused
+    size_t id;
+    EXPECT_TRUE(scheduler.Add(LogTask, &log, 2, &id));
+    EXPECT_EQ(id, ids[3]);
+    EXPECT_FALSE(scheduler.Add(LogTask, &log, 0));
+
+    scheduler.Init(1000.f);
+    log.runs.clear();
+    scheduler.Process();
+    EXPECT_TRUE(log.runs.empty());
+}
+
+TEST(hid_ControlScheduler, f_measuresTaskCost)
+{
+    Scheduler scheduler;
+    scheduler.Init(1000.f);
+    size_t id;
+    scheduler.Add(SlowTask, nullptr, 1, &id);
+
+    task_ticks = 50;
+    scheduler.Process();
+    task_ticks = 200;
+    scheduler.Process();
+    task_ticks = 10;
+    scheduler.Process();
+
+    auto stats = scheduler.GetStats(id);
+    EXPECT_EQ(stats.runs, 3u);
+    EXPECT_EQ(stats.last_ticks, 10u);
+    EXPECT_EQ(stats.max_ticks, 200u);
+
+    scheduler.ResetStats();
+    stats = scheduler.GetStats(id);
+    EXPECT_EQ(stats.runs, 0u);
+    EXPECT_EQ(stats.max_ticks, 0u);
+}
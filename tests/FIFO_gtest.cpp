@@ -1,4 +1,6 @@
 #include <gtest/gtest.h>
+#include <chrono>
+#include <cstdio>
 #include "util/FIFO.h"
 
 using namespace daisy;
@@ -204,4 +206,184 @@ TEST_F(util_FIFO, j_countEqualTo)
 
     EXPECT_EQ(fifo_.CountEqualTo(2), 2u);
     EXPECT_EQ(fifo_.CountEqualTo(3), 1u);
-}
\ No newline at end of file
+}
+namespace
+{
+// Counts how often elements are copied, moved or constructed in place
+struct Tracked
+{
+    static int copies, moves;
+    int        value;
+
+    Tracked(int v = 0) : value(v) {}
+    Tracked(int a, int b) : value(a + b) {}
+    Tracked(const Tracked& other) : value(other.value) { copies++; }
+    Tracked(Tracked&& other) : value(other.value) { moves++; }
+    Tracked& operator=(const Tracked& other)
+    {
+        value = other.value;
+        copies++;
+        return *this;
+    }
+    Tracked& operator=(Tracked&& other)
+    {
+        value = other.value;
+        moves++;
+        return *this;
+    }
+    static void ResetCounts() { copies = moves = 0; }
+};
+int Tracked::copies = 0;
+int Tracked::moves  = 0;
+} // namespace
+
+TEST_F(util_FIFO, k_emplaceAndMove)
+{
+    FIFO<Tracked, 3> fifo;
+    Tracked::ResetCounts();
+
+    // constructed in place, neither copied nor moved
+    EXPECT_TRUE(fifo.EmplaceBack(1, 2));
+    EXPECT_TRUE(fifo.EmplaceBack(4));
+    EXPECT_EQ(Tracked::copies, 0);
+    EXPECT_EQ(Tracked::moves, 0);
+
+    // temporaries are moved
+    EXPECT_TRUE(fifo.PushBack(Tracked(5)));
+    EXPECT_EQ(Tracked::copies, 0);
+    EXPECT_EQ(Tracked::moves, 1);
+    EXPECT_FALSE(fifo.EmplaceBack(6));
+    EXPECT_FALSE(fifo.PushBack(Tracked(6)));
+
+    // popped elements are moved out
+    Tracked::ResetCounts();
+    EXPECT_EQ(fifo.PopFront().value, 3);
+    EXPECT_EQ(Tracked::copies, 0);
+
+    // make the contents wrap around, then shift them with Insert/Remove
+    EXPECT_TRUE(fifo.EmplaceBack(6));
+    EXPECT_TRUE(fifo.Remove(0));
+    EXPECT_TRUE(fifo.Insert(0, Tracked(7)));
+    EXPECT_EQ(fifo[0].value, 7);
+    EXPECT_EQ(fifo[1].value, 5);
+    EXPECT_EQ(fifo[2].value, 6);
+    // only the inserted element itself is copied
+    EXPECT_EQ(Tracked::copies, 1);
+}
+
+TEST_F(util_FIFO, l_bulkPushAndPop)
+{
+    FIFO<int, 5> fifo;
+    int          in[]   = {1, 2, 3, 4, 5, 6, 7};
+    int          out[7] = {};
+
+    // only what fits is added
+    EXPECT_EQ(fifo.PushBack(in, 3), 3u);
+    EXPECT_EQ(fifo.PushBack(in + 3, 4), 2u);
+    EXPECT_TRUE(fifo.IsFull());
+    EXPECT_EQ(fifo.PushBack(in, 1), 0u);
+
+    EXPECT_EQ(fifo.PopFront(out, 4), 4u);
+    for(int i = 0; i < 4; i++)
+        EXPECT_EQ(out[i], i + 1);
+
+    // these wrap around the buffer's end
+    EXPECT_EQ(fifo.PushBack(in + 5, 2), 2u);
+    EXPECT_EQ(fifo.GetNumElements(), 3u);
+    EXPECT_EQ(fifo[0], 5);
+    EXPECT_EQ(fifo[1], 6);
+    EXPECT_EQ(fifo[2], 7);
+
+    // only what's available is removed
+    EXPECT_EQ(fifo.PopFront(out, 7), 3u);
+    EXPECT_EQ(out[0], 5);
+    EXPECT_EQ(out[1], 6);
+    EXPECT_EQ(out[2], 7);
+    EXPECT_TRUE(fifo.IsEmpty());
+    EXPECT_EQ(fifo.PopFront(out, 1), 0u);
+}
+
+TEST_F(util_FIFO, m_frontAndDrop)
+{
+    fifo_.PushBack({1, 2, 3});
+    EXPECT_EQ(fifo_.Front(), 1);
+    EXPECT_EQ(fifo_.DropFront(), 1u);
+    EXPECT_EQ(fifo_.Front(), 2);
+
+    // make contents wrap around the buffer
+    fifo_.PushBack(4);
+    EXPECT_EQ(fifo_.DropFront(2), 2u);
+    EXPECT_EQ(fifo_.Front(), 4);
+    EXPECT_EQ(fifo_.GetNumElements(), 1u);
+
+    // can't drop more than there is
+    EXPECT_EQ(fifo_.DropFront(5), 1u);
+    EXPECT_TRUE(fifo_.IsEmpty());
+    EXPECT_EQ(fifo_.DropFront(), 0u);
+}
+
+namespace
+{
+// About the size of a MidiEvent
+struct BenchEvent
+{
+    uint8_t data[140];
+    BenchEvent() {}
+    BenchEvent(uint8_t value) { data[0] = data[139] = value; }
+};
+
+constexpr size_t kBenchEvents = 1 << 20;
+constexpr size_t kBenchChunk  = 16;
+
+FIFO<BenchEvent, 256> bench_fifo;
+
+template <typename Fn>
+double MillionsPerSecond(Fn fn)
+{
+    const auto t0 = std::chrono::steady_clock::now();
+    fn();
+    const auto t1 = std::chrono::steady_clock::now();
+    return kBenchEvents / std::chrono::duration<double>(t1 - t0).count() / 1e6;
+}
+} // namespace
+
+// Not a pass/fail test: prints how many 140-byte events per second pass
+// through a FIFO with the different push and pop functions.
+TEST_F(util_FIFO, z_benchmark)
+{
+    uint32_t   sum = 0;
+    BenchEvent chunk[kBenchChunk];
+
+    const double copy = MillionsPerSecond([&]() {
+        for(size_t i = 0; i < kBenchEvents; i++)
+        {
+            BenchEvent event(i);
+            bench_fifo.PushBack(event);
+            sum += bench_fifo.PopFront().data[0];
+        }
+    });
+    const double in_place = MillionsPerSecond([&]() {
+        for(size_t i = 0; i < kBenchEvents; i++)
+        {
+            bench_fifo.EmplaceBack(i);
+            sum += bench_fifo.Front().data[0];
+            bench_fifo.DropFront();
+        }
+    });
+    const double bulk = MillionsPerSecond([&]() {
+        for(size_t i = 0; i < kBenchEvents; i += kBenchChunk)
+        {
+            chunk[0].data[0] = i;
+            bench_fifo.PushBack(chunk, kBenchChunk);
+            bench_fifo.PopFront(chunk, kBenchChunk);
+            sum += chunk[kBenchChunk - 1].data[0];
+        }
+    });
+
+    printf("[ bench    ] FIFO: PushBack/PopFront %.1f M/s, "
+           "EmplaceBack/Front/DropFront %.1f M/s, bulk %.1f M/s\n",
+           copy,
+           in_place,
+           bulk);
+    EXPECT_NE(sum, 1u); // keeps the loops from being optimized away
+}
@@ -0,0 +1,113 @@
+#include <cstring>
+#include "FatFsImage.h"
+
+// The FatFs module itself, built for the host
+#include "ff.c"
+#include "option/unicode.c"
+#include "diskio.h"
+
+static const size_t         kSectorSize = 512;
+static std::vector<uint8_t> image;
+static size_t               num_sector_reads    = 0;
+static size_t               num_unaligned_reads = 0;
+static FATFS                fs;
+
+DSTATUS disk_initialize(BYTE pdrv)
+{
+    return pdrv == 0 && !image.empty() ? 0 : STA_NOINIT;
+}
+
+DSTATUS disk_status(BYTE pdrv)
+{
+    return disk_initialize(pdrv);
+}
+
+DRESULT disk_read(BYTE pdrv, BYTE* buff, DWORD sector, UINT count)
+{
+    if(pdrv != 0 || (sector + count) * kSectorSize > image.size())
+        return RES_PARERR;
+    memcpy(buff, &image[sector * kSectorSize], count * kSectorSize);
+    num_sector_reads++;
+    if(count > 1 && reinterpret_cast<uintptr_t>(buff) % 32 != 0)
+        num_unaligned_reads++;
+    return RES_OK;
+}
+
+DRESULT disk_write(BYTE pdrv, const BYTE* buff, DWORD sector, UINT count)
+{
+    if(pdrv != 0 || (sector + count) * kSectorSize > image.size())
+        return RES_PARERR;
+    memcpy(&image[sector * kSectorSize], buff, count * kSectorSize);
+    return RES_OK;
+}
+
+DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void* buff)
+{
+    if(pdrv != 0)
+        return RES_PARERR;
+    switch(cmd)
+    {
+        case CTRL_SYNC: return RES_OK;
+        case GET_SECTOR_COUNT:
+            *static_cast<DWORD*>(buff) = image.size() / kSectorSize;
+            return RES_OK;
+        case GET_SECTOR_SIZE:
+            *static_cast<WORD*>(buff) = kSectorSize;
+            return RES_OK;
+        case GET_BLOCK_SIZE: *static_cast<DWORD*>(buff) = 1; return RES_OK;
+        default: return RES_PARERR;
+    }
+}
+
+DWORD get_fattime(void)
+{
+    // 2020-01-01 00:00:00
+    return (DWORD)(2020 - 1980) << 25 | (DWORD)1 << 21 | (DWORD)1 << 16;
+}
+
+bool FatFsImage::Format(size_t num_sectors)
+{
+    f_mount(nullptr, "0:", 0);
+    image.assign(num_sectors * kSectorSize, 0);
+    num_sector_reads    = 0;
+    num_unaligned_reads = 0;
+    static BYTE work[_MAX_SS];
+    if(f_mkfs("0:", FM_ANY, 0, work, sizeof(work)) != FR_OK)
+        return false;
+    return f_mount(&fs, "0:", 1) == FR_OK;
+}
+
+bool FatFsImage::WriteFile(const char* path, const void* data, size_t size)
+{
+    FIL  fil;
+    UINT written = 0;
+    if(f_open(&fil, path, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK)
+        return false;
+    const FRESULT result = f_write(&fil, data, size, &written);
+    f_close(&fil);
+    return result == FR_OK && written == size;
+}
+
+std::vector<uint8_t> FatFsImage::ReadFile(const char* path)
+{
+    FIL                  fil;
+    std::vector<uint8_t> data;
+    if(f_open(&fil, path, FA_READ) != FR_OK)
+        return data;
+    data.resize(f_size(&fil));
+    UINT read = 0;
+    f_read(&fil, data.data(), data.size(), &read);
+    data.resize(read);
+    f_close(&fil);
+    return data;
+}
+
+size_t FatFsImage::GetNumSectorReads()
+{
+    return num_sector_reads;
+}
+
+size_t FatFsImage::GetNumUnalignedReads()
+{
+    return num_unaligned_reads;
+}
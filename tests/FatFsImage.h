@@ -0,0 +1,41 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "ff.h"
+
+/** A FatFs volume for host tests.
+ *
+ *  The real FatFs module is compiled for the host, on top of a disk image in
+ *  memory, so code that reads and writes files can be tested exactly as it
+ *  runs on the SD card. Each Format() starts over with an empty FAT volume
+ *  that is mounted as "0:/".
+ */
+class FatFsImage
+{
+  public:
+    /** Creates an empty volume and mounts it
+     *  \param num_sectors size of the volume in 512 byte sectors
+     */
+    static bool Format(size_t num_sectors = 8192);
+
+    /** Writes a whole file */
+    static bool WriteFile(const char* path, const void* data, size_t size);
+
+    static bool WriteFile(const char* path, const std::vector<uint8_t>& data)
+    {
+        return WriteFile(path, data.data(), data.size());
+    }
+
+    /** Reads a whole file, empty if it doesn't exist */
+    static std::vector<uint8_t> ReadFile(const char* path);
+
+    /** Number of disk_read() calls since Format() */
+    static size_t GetNumSectorReads();
+
+    /** Number of disk_read() calls of several sectors since Format() to a
+     *  buffer that isn't 32-byte aligned, which the SD card DMA can't do.
+     *  Single sectors may go to the buffers of FatFs, which aren't checked.
+     */
+    static size_t GetNumUnalignedReads();
+};
@@ -0,0 +1,305 @@
+#include <gtest/gtest.h>
+#include <math.h>
+#include <cstdio>
+#include <random>
+#include <vector>
+#include "hid/midi_clock.h"
+#include "hid/midi_parser.h"
+#include "sys/system.h"
+
+using namespace daisy;
+
+namespace
+{
+constexpr float    kSampleRate = 48000.f;
+constexpr size_t   kBlockSize  = 48;
+constexpr uint32_t kTickFreq   = 1000000;
+constexpr uint32_t kBlockTicks = 1000;
+
+/** Drives a MidiClockFollower with a simulated clock source and audio
+ *  callback, on a tick counter that wraps around during the test.
+ */
+class ClockSim
+{
+  public:
+    ClockSim(uint32_t seed = 1) : rng_(seed), tick_(0xfff00000)
+    {
+        System::SetTickFreqForUnitTest(kTickFreq);
+        clock_.Init(kSampleRate);
+    }
+
+    /** Schedules clocks at a tempo, starting one period after the last
+     *  scheduled clock, or from now on if that has passed.
+     *  \param jitter the timestamps are off by up to this many ticks
+     *  \return the (undisturbed) time of the first new clock
+     */
+    double AddClocks(double bpm, size_t count, double jitter = 0.)
+    {
+        const double period = Period(bpm);
+        std::uniform_real_distribution<double> dist(-jitter, jitter);
+        ideal_ = std::max(ideal_, elapsed_);
+        for(size_t i = 0; i < count; i++)
+        {
+            ideal_ += period;
+            pending_.push_back(tick_ + (uint32_t)llround(ideal_ + dist(rng_)));
+        }
+        return ideal_ - (count - 1) * period;
+    }
+
+    /** Leaves a gap in the clock for a number of ticks */
+    void AddGap(double ticks) { ideal_ += ticks; }
+
+    /** Runs audio blocks, delivering each clock before the first block
+     *  that starts after it, and records the position at each sample.
+     */
+    void Run(size_t blocks)
+    {
+        for(size_t b = 0; b < blocks; b++)
+        {
+            elapsed_ += kBlockTicks;
+            const uint32_t block_start = tick_ + elapsed_;
+            while(next_ < pending_.size()
+                  && (int32_t)(pending_[next_] - block_start) <= 0)
+            {
+                clock_.Clock(pending_[next_]);
+                next_++;
+            }
+            clock_.BeginBlock(block_start, kBlockSize);
+            for(size_t i = 0; i < kBlockSize; i++)
+            {
+                clock_.Process();
+                positions.push_back(Position());
+            }
+        }
+    }
+
+    /** Runs audio blocks until a point in time */
+    void RunUntil(double ticks)
+    {
+        while(elapsed_ < ticks)
+            Run(1);
+    }
+
+    /** Time of the last sample of the last block */
+    double Now() const { return elapsed_; }
+
+    /** Song position in clocks, at the last sample */
+    double Position() const
+    {
+        return clock_.GetPulse() + (double)clock_.GetPulsePhase();
+    }
+
+    static double Period(double bpm) { return 60. * kTickFreq / (bpm * 24.); }
+
+    MidiClockFollower   clock_;
+    std::vector<double> positions;
+
+  private:
+    std::mt19937          rng_;
+    uint32_t              tick_;
+    double                elapsed_ = 0.;
+    double                ideal_   = 0.;
+    std::vector<uint32_t> pending_;
+    size_t                next_ = 0;
+};
+
+double Max(const std::vector<double>& values)
+{
+    double max = 0.;
+    for(double v : values)
+        max = std::max(max, fabs(v));
+    return max;
+}
+} // namespace
+
+TEST(hid_MidiClock, a_locksToJitteredClock)
+{
+    // 120 BPM, so a clock every 20833 ticks, with +/- 1ms of USB-like
+    // jitter
+    ClockSim sim;
+    sim.clock_.Start();
+    const double first  = sim.AddClocks(120., 24 * 40, 1000.);
+    const double period = ClockSim::Period(120.);
+    sim.Run(1);
+    EXPECT_FALSE(sim.clock_.IsRunning());
+
+    // 10 seconds of audio, in steps of a 10ms
+    std::vector<double> errors;
+    for(size_t step = 0; step < 1000; step++)
+    {
+        sim.Run(10);
+        // give it 2 seconds to settle
+        if(step >= 200)
+            errors.push_back(sim.Position() - (sim.Now() - first) / period);
+    }
+    EXPECT_TRUE(sim.clock_.IsRunning());
+    EXPECT_TRUE(sim.clock_.IsLocked());
+    EXPECT_NEAR(sim.clock_.GetTempo(), 120.f, 0.2f);
+
+    // the raw clock is off by up to 0.048 clocks, at least halve that
+    const double max_error = Max(errors);
+    EXPECT_LT(max_error, 0.025);
+    printf("[ pll      ] 120 BPM, +/-1ms jitter: max error %.4f clocks\n",
+           max_error);
+}
+
+TEST(hid_MidiClock, b_phaseIsSmooth)
+{
+    ClockSim sim;
+    sim.clock_.Start();
+    sim.AddClocks(120., 24 * 20, 1000.);
+    sim.Run(10000);
+
+    // 120 BPM at 48kHz is 1/1000 clocks per sample
+    const double nominal = 1. / 1000.;
+    double       min_step = 1., max_step = 0.;
+    for(size_t i = 48000 + 1; i < sim.positions.size(); i++)
+    {
+        const double step = sim.positions[i] - sim.positions[i - 1];
+        min_step          = std::min(min_step, step);
+        max_step          = std::max(max_step, step);
+    }
+    // never runs backwards, and doesn't stall or jump
+    EXPECT_GT(min_step, nominal * 0.8);
+    EXPECT_LT(max_step, nominal * 1.2);
+}
+
+TEST(hid_MidiClock, c_followsTempoChanges)
+{
+    ClockSim sim;
+    sim.clock_.Start();
+    sim.AddClocks(120., 24 * 8, 500.);
+    sim.Run(4000);
+    EXPECT_NEAR(sim.clock_.GetTempo(), 120.f, 0.5f);
+
+    // a ramp from 120 to 140 BPM over a bar
+    for(int bpm = 121; bpm <= 140; bpm++)
+        sim.AddClocks(bpm, 4, 500.);
+    sim.AddClocks(140., 24 * 8, 500.);
+    sim.Run(1700);
+    EXPECT_NEAR(sim.clock_.GetTempo(), 140.f, 1.f);
+
+    // a sudden jump restarts the loop
+    sim.AddClocks(90., 24 * 8, 500.);
+    sim.Run(5000);
+    EXPECT_NEAR(sim.clock_.GetTempo(), 90.f, 0.5f);
+    EXPECT_TRUE(sim.clock_.IsLocked());
+}
+
+TEST(hid_MidiClock, d_startStopContinue)
+{
+    ClockSim     sim;
+    const double period = ClockSim::Period(120.);
+    // the clock runs while stopped, the song doesn't
+    sim.AddClocks(120., 24 * 4);
+    sim.Run(2000);
+    EXPECT_FALSE(sim.clock_.IsRunning());
+    EXPECT_EQ(sim.clock_.GetPulse(), 0u);
+    EXPECT_NEAR(sim.clock_.GetTempo(), 120.f, 0.1f);
+
+    // after Start, the song begins with the next clock
+    sim.clock_.Start();
+    sim.Run(1);
+    EXPECT_EQ(sim.clock_.GetBeatPhase(), 0.f);
+    double first = sim.AddClocks(120., 25);
+    sim.RunUntil(first - kBlockTicks);
+    EXPECT_FALSE(sim.clock_.IsRunning());
+    EXPECT_EQ(sim.Position(), 0.);
+    sim.RunUntil(first + 24 * period);
+    EXPECT_TRUE(sim.clock_.IsRunning());
+    EXPECT_NEAR(sim.Position(), (sim.Now() - first) / period, 0.02);
+
+    sim.clock_.Stop();
+    sim.Run(1);
+    const double stopped = sim.Position();
+    sim.Run(200);
+    EXPECT_EQ(sim.Position(), stopped);
+    EXPECT_FALSE(sim.clock_.IsRunning());
+
+    // Continue picks up with the next clock after the last one played
+    sim.clock_.Continue();
+    sim.Run(1);
+    const uint32_t resumed = sim.clock_.GetPulse();
+    EXPECT_EQ(resumed, 25u);
+    EXPECT_EQ(sim.clock_.GetPulsePhase(), 0.f);
+    first                  = sim.AddClocks(120., 24);
+    sim.RunUntil(first + 12 * period);
+    EXPECT_NEAR(
+        sim.Position(), resumed + (sim.Now() - first) / period, 0.02);
+}
+
+TEST(hid_MidiClock, e_songPosition)
+{
+    ClockSim     sim;
+    const double period = ClockSim::Period(120.);
+    sim.AddClocks(120., 24);
+    sim.Run(500);
+
+    // SPP counts 16th notes
+    sim.clock_.SetSongPosition(16);
+    sim.Run(1);
+    EXPECT_EQ(sim.clock_.GetPulse(), 96u);
+    EXPECT_FALSE(sim.clock_.IsRunning());
+
+    sim.clock_.Continue();
+    const double first = sim.AddClocks(120., 24);
+    sim.RunUntil(first + 12 * period);
+    EXPECT_NEAR(sim.Position(), 96. + (sim.Now() - first) / period, 0.02);
+    EXPECT_NEAR(sim.clock_.GetBeatPhase(), 0.5f, 0.01f);
+}
+
+TEST(hid_MidiClock, f_dropout)
+{
+    ClockSim sim;
+    sim.clock_.Start();
+    const double first = sim.AddClocks(120., 48);
+    sim.RunUntil(first + 47 * ClockSim::Period(120.));
+    EXPECT_NEAR(sim.Position(), 47., 0.05);
+
+    // the clock stops without a Stop message: the phase runs on until
+    // one clock past the next expected one, then waits
+    sim.AddGap(1000000.);
+    sim.Run(1000);
+    EXPECT_NEAR(sim.Position(), 49., 0.01);
+
+    // when clocks arrive again, the phase picks up from there
+    sim.AddClocks(120., 48);
+    sim.Run(1000);
+    EXPECT_NEAR(sim.clock_.GetTempo(), 120.f, 0.5f);
+    EXPECT_GT(sim.Position(), 49.);
+}
+
+TEST(hid_MidiClock, g_midiEvents)
+{
+    System::SetTickFreqForUnitTest(kTickFreq);
+    MidiClockFollower clock;
+    clock.Init(kSampleRate);
+    MidiParser       parser;
+    CompactMidiEvent event;
+    parser.Init();
+
+    // SPP to bar 2, Continue, and clocks at 120 BPM
+    const uint8_t spp[] = {0xf2, 0x10, 0x00};
+    for(uint8_t byte : spp)
+        if(parser.Parse(byte, &event))
+            clock.ProcessEvent(event);
+    ASSERT_TRUE(parser.Parse(0xfb, &event));
+    clock.ProcessEvent(event);
+    for(uint32_t i = 0; i < 4; i++)
+    {
+        parser.SetTimestamp(20833 * i);
+        ASSERT_TRUE(parser.Parse(0xf8, &event));
+        clock.ProcessEvent(event);
+    }
+    // other messages are ignored
+    MidiEvent note;
+    note.type = NoteOn;
+    clock.ProcessEvent(note);
+
+    clock.BeginBlock(20833 * 3, kBlockSize);
+    for(size_t i = 0; i < kBlockSize; i++)
+        clock.Process();
+    EXPECT_TRUE(clock.IsRunning());
+    EXPECT_NEAR(clock.GetPulse() + clock.GetPulsePhase(), 16 * 6 + 3, 0.01f);
+    EXPECT_NEAR(clock.GetTempo(), 120.f, 0.01f);
+}
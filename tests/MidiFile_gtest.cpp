@@ -0,0 +1,399 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+#include "FatFsImage.h"
+#include "hid/midi_file.h"
+
+using namespace daisy;
+
+namespace
+{
+/** Builds Standard MIDI Files */
+class SmfBuilder
+{
+  public:
+    SmfBuilder(uint16_t format, uint16_t division)
+    : format_(format), division_(division)
+    {
+    }
+
+    /** Starts a new track */
+    SmfBuilder& Track()
+    {
+        tracks_.emplace_back();
+        return *this;
+    }
+
+    /** Adds an event to the current track */
+    SmfBuilder& Event(uint32_t delta, std::vector<uint8_t> bytes)
+    {
+        VarLen(delta);
+        Append(bytes);
+        return *this;
+    }
+
+    SmfBuilder& Tempo(uint32_t delta, uint32_t tempo)
+    {
+        return Event(delta,
+                     {0xFF,
+                      0x51,
+                      0x03,
+                      (uint8_t)(tempo >> 16),
+                      (uint8_t)(tempo >> 8),
+                      (uint8_t)tempo});
+    }
+
+    SmfBuilder& EndOfTrack(uint32_t delta)
+    {
+        return Event(delta, {0xFF, 0x2F, 0x00});
+    }
+
+    std::vector<uint8_t> Build() const
+    {
+        std::vector<uint8_t> file = {'M', 'T', 'h', 'd', 0, 0, 0, 6};
+        Append16(file, format_);
+        Append16(file, tracks_.size());
+        Append16(file, division_);
+        for(const auto& track : tracks_)
+        {
+            file.insert(file.end(), {'M', 'T', 'r', 'k'});
+            Append16(file, track.size() >> 16);
+            Append16(file, track.size());
+            file.insert(file.end(), track.begin(), track.end());
+        }
+        return file;
+    }
+
+  private:
+    void VarLen(uint32_t value)
+    {
+        uint8_t bytes[4];
+        size_t  n = 0;
+        do
+        {
+            bytes[n++] = value & 0x7F;
+            value >>= 7;
+        } while(value);
+        while(n-- > 0)
+            tracks_.back().push_back(bytes[n] | (n > 0 ? 0x80 : 0));
+    }
+
+    void Append(const std::vector<uint8_t>& bytes)
+    {
+        tracks_.back().insert(tracks_.back().end(), bytes.begin(), bytes.end());
+    }
+
+    static void Append16(std::vector<uint8_t>& file, uint32_t value)
+    {
+        file.push_back(value >> 8);
+        file.push_back(value);
+    }
+
+    uint16_t                          format_, division_;
+    std::vector<std::vector<uint8_t>> tracks_;
+};
+
+struct PlayedEvent
+{
+    uint32_t sample;
+    uint8_t  type, channel, data0, data1;
+
+    bool operator==(const PlayedEvent& other) const
+    {
+        return sample == other.sample && type == other.type
+               && channel == other.channel && data0 == other.data0
+               && data1 == other.data1;
+    }
+};
+
+std::ostream& operator<<(std::ostream& os, const PlayedEvent& e)
+{
+    return os << "{" << e.sample << ", " << int(e.type) << ", "
+              << int(e.channel) << ", " << int(e.data0) << ", "
+              << int(e.data1) << "}";
+}
+
+/** Runs the player like an audio callback and a main loop would */
+std::vector<PlayedEvent>
+Play(MidiFilePlayer& player, size_t num_blocks, size_t block_size = 48)
+{
+    std::vector<PlayedEvent> played;
+    for(size_t b = 0; b < num_blocks; b++)
+    {
+        player.BeginBlock(block_size);
+        CompactMidiEvent event;
+        size_t           offset;
+        while(player.PopEvent(&event, &offset))
+        {
+            EXPECT_LT(offset, block_size);
+            played.push_back({player.GetPosition() + (uint32_t)offset,
+                              event.type,
+                              event.channel,
+                              event.data[0],
+                              event.data[1]});
+        }
+        player.Prepare();
+    }
+    return played;
+}
+
+/** 120 bpm, 96 ticks per quarter: 250 samples per tick at 48 kHz */
+constexpr float kSampleRate = 48000.f;
+
+} // namespace
+
+class hid_MidiFile : public ::testing::Test
+{
+  protected:
+    void SetUp() override
+    {
+        ASSERT_TRUE(FatFsImage::Format());
+        player.Init(kSampleRate);
+    }
+
+    MidiFilePlayer player;
+};
+
+TEST_F(hid_MidiFile, a_openErrors)
+{
+    EXPECT_EQ(player.Open("0:/missing.mid"),
+              MidiFilePlayer::Result::ERR_FILE_OPEN);
+
+    FatFsImage::WriteFile("0:/short.mid", std::vector<uint8_t>{'M', 'T'});
+    EXPECT_EQ(player.Open("0:/short.mid"),
+              MidiFilePlayer::Result::ERR_FILE_READ);
+
+    FatFsImage::WriteFile("0:/fmt2.mid",
+                          SmfBuilder(2, 96).Track().EndOfTrack(0).Build());
+    EXPECT_EQ(player.Open("0:/fmt2.mid"), MidiFilePlayer::Result::ERR_FORMAT);
+
+    SmfBuilder many(1, 96);
+    for(size_t t = 0; t <= MidiFilePlayer::kMaxTracks; t++)
+        many.Track().EndOfTrack(0);
+    FatFsImage::WriteFile("0:/many.mid", many.Build());
+    EXPECT_EQ(player.Open("0:/many.mid"),
+              MidiFilePlayer::Result::ERR_TOO_MANY_TRACKS);
+
+    // unknown chunks are skipped
+    std::vector<uint8_t> file = SmfBuilder(0, 96).Build();
+    file[11]                  = 1;
+    file.insert(file.end(), {'X', 'Y', 'Z', 'W', 0, 0, 0, 2, 0, 0});
+    const auto track = SmfBuilder(0, 96).Track().EndOfTrack(0).Build();
+    file.insert(file.end(), track.begin() + 14, track.end());
+    FatFsImage::WriteFile("0:/chunk.mid", file);
+    EXPECT_EQ(player.Open("0:/chunk.mid"), MidiFilePlayer::Result::OK);
+    EXPECT_EQ(player.GetNumTracks(), 1);
+    EXPECT_EQ(player.GetTicksPerQuarter(), 96);
+
+    // a chunk size that would wrap the offset around ends the scan
+    std::vector<uint8_t> bogus = SmfBuilder(0, 96).Build();
+    bogus[11]                  = 1;
+    bogus.insert(bogus.end(), {'X', 'Y', 'Z', 'W', 0xff, 0xff, 0xff, 0xf8});
+    bogus.insert(bogus.end(), track.begin() + 14, track.end());
+    FatFsImage::WriteFile("0:/bogus.mid", bogus);
+    EXPECT_EQ(player.Open("0:/bogus.mid"), MidiFilePlayer::Result::ERR_FORMAT);
+
+    // the tracks before it are kept
+    std::vector<uint8_t> after = SmfBuilder(0, 96).Build();
+    after[11]                  = 2;
+    after.insert(after.end(), track.begin() + 14, track.end());
+    after.insert(after.end(), {'X', 'Y', 'Z', 'W', 0xff, 0xff, 0xff, 0xf8});
+    after.insert(after.end(), track.begin() + 14, track.end());
+    FatFsImage::WriteFile("0:/after.mid", after);
+    EXPECT_EQ(player.Open("0:/after.mid"), MidiFilePlayer::Result::OK);
+    EXPECT_EQ(player.GetNumTracks(), 1);
+}
+
+TEST_F(hid_MidiFile, b_mergesTracksSampleAccurately)
+{
+    FatFsImage::WriteFile("0:/song.mid",
+                          SmfBuilder(1, 96)
+                              .Track()
+                              .Event(0, {0x90, 60, 100})
+                              .Event(1, {0x80, 60, 0})
+                              .Event(1, {0xB0, 7, 90})
+                              .EndOfTrack(0)
+                              .Track()
+                              .Event(1, {0x91, 64, 100})
+                              .Event(0, {0xC1, 5})
+                              .Event(4, {0x91, 64, 0})
+                              .EndOfTrack(0)
+                              .Build());
+    ASSERT_EQ(player.Open("0:/song.mid"), MidiFilePlayer::Result::OK);
+    EXPECT_EQ(player.GetNumTracks(), 2);
+    player.Start();
+
+    const std::vector<PlayedEvent> expected = {
+        {0, NoteOn, 0, 60, 100},
+        {250, NoteOff, 0, 60, 0},
+        {250, NoteOn, 1, 64, 100},
+        {250, ProgramChange, 1, 5, 0},
+        {500, ControlChange, 0, 7, 90},
+        {1250, NoteOff, 1, 64, 0},
+    };
+    EXPECT_EQ(Play(player, 100), expected);
+    EXPECT_TRUE(player.IsFinished());
+}
+
+TEST_F(hid_MidiFile, c_tempoRunningStatusAndSkippedEvents)
+{
+    FatFsImage::WriteFile(
+        "0:/tempo.mid",
+        SmfBuilder(0, 96)
+            .Track()
+            .Event(0, {0xFF, 0x03, 0x03, 'a', 'b', 'c'}) // track name
+            .Event(0, {0x90, 60, 100})
+            .Event(96, {62, 100}) // running status
+            .Tempo(0, 250000)     // 240 bpm
+            .Event(0, {0xF0, 0x03, 0x7E, 0x01, 0xF7}) // SysEx
+            .Event(96, {0x90, 64, 100})
+            .Event(96, {64, 0})
+            .EndOfTrack(0)
+            .Build());
+    ASSERT_EQ(player.Open("0:/tempo.mid"), MidiFilePlayer::Result::OK);
+    player.Start();
+
+    const std::vector<PlayedEvent> expected = {
+        {0, NoteOn, 0, 60, 100},
+        {24000, NoteOn, 0, 62, 100},
+        {36000, NoteOn, 0, 64, 100},
+        {48000, NoteOff, 0, 64, 0},
+    };
+    EXPECT_EQ(Play(player, 2000), expected);
+    EXPECT_EQ(player.GetTempo(), 250000u);
+}
+
+TEST_F(hid_MidiFile, d_stopAndSmpte)
+{
+    // 25 fps, 40 ticks per frame: 1 ms per tick
+    FatFsImage::WriteFile("0:/smpte.mid",
+                          SmfBuilder(0, 0xE728)
+                              .Track()
+                              .Tempo(0, 1000000) // ignored
+                              .Event(10, {0x90, 60, 100})
+                              .Event(10, {0x80, 60, 0})
+                              .EndOfTrack(0)
+                              .Build());
+    ASSERT_EQ(player.Open("0:/smpte.mid"), MidiFilePlayer::Result::OK);
+    EXPECT_EQ(player.GetTicksPerQuarter(), 0);
+
+    // nothing happens while stopped
+    EXPECT_TRUE(Play(player, 100).empty());
+    player.Start();
+    const std::vector<PlayedEvent> expected = {
+        {480, NoteOn, 0, 60, 100},
+        {960, NoteOff, 0, 60, 0},
+    };
+    EXPECT_EQ(Play(player, 100), expected);
+}
+
+TEST_F(hid_MidiFile, e_looping)
+{
+    FatFsImage::WriteFile("0:/loop.mid",
+                          SmfBuilder(0, 96)
+                              .Track()
+                              .Event(0, {0x90, 60, 100})
+                              .Event(2, {0x80, 60, 0})
+                              .EndOfTrack(2)
+                              .Build());
+    ASSERT_EQ(player.Open("0:/loop.mid"), MidiFilePlayer::Result::OK);
+    player.SetLooping(true);
+    player.Start();
+
+    const auto played = Play(player, 60, 32);
+    ASSERT_GE(played.size(), 4u);
+    EXPECT_EQ(played[0].sample, 0u);
+    EXPECT_EQ(played[1].sample, 500u);
+    EXPECT_EQ(played[2].sample, 1000u);
+    EXPECT_EQ(played[3].sample, 1500u);
+    EXPECT_FALSE(player.IsFinished());
+
+    // songs without channel messages end instead of looping forever
+    FatFsImage::WriteFile("0:/tempo.mid",
+                          SmfBuilder(1, 96)
+                              .Track()
+                              .Tempo(0, 400000)
+                              .Tempo(96, 600000)
+                              .EndOfTrack(96)
+                              .Track()
+                              .EndOfTrack(384)
+                              .Build());
+    ASSERT_EQ(player.Open("0:/tempo.mid"), MidiFilePlayer::Result::OK);
+    player.SetLooping(true);
+    player.Start();
+    EXPECT_TRUE(Play(player, 10).empty());
+    EXPECT_TRUE(player.IsFinished());
+}
+
+/** A long song, with a tempo change and two interleaved tracks */
+static std::vector<uint8_t> MakeLongSong()
+{
+    SmfBuilder song(1, 96);
+    song.Track();
+    for(size_t bar = 0; bar < 50; bar++)
+        song.Tempo(bar == 0 ? 0 : 384, 500000 - bar * 1000);
+    song.EndOfTrack(0);
+    for(uint8_t ch = 0; ch < 2; ch++)
+    {
+        song.Track();
+        for(size_t i = 0; i < 400; i++)
+        {
+            const uint8_t note = i % 128;
+            song.Event(ch * 3, {(uint8_t)(0x90 | ch), note, 100});
+            song.Event(48 - ch * 3, {(uint8_t)(0x80 | ch), note, 0});
+        }
+        song.EndOfTrack(0);
+    }
+    return song.Build();
+}
+
+TEST_F(hid_MidiFile, f_seek)
+{
+    FatFsImage::WriteFile("0:/long.mid", MakeLongSong());
+    ASSERT_EQ(player.Open("0:/long.mid"), MidiFilePlayer::Result::OK);
+    player.Start();
+
+    // play it all as a reference
+    const auto all = Play(player, 80000, 64);
+    ASSERT_EQ(all.size(), 1600u);
+    EXPECT_TRUE(player.IsFinished());
+
+    // seeking without an index
+    const uint32_t tick = 384 * 40 + 24;
+    player.Seek(tick);
+    const size_t reads_before = FatFsImage::GetNumSectorReads();
+    Play(player, 1, 64);
+    const size_t reads_unindexed
+        = FatFsImage::GetNumSectorReads() - reads_before;
+    auto         played          = Play(player, 80000, 64);
+    // notes 0 to 320 have started and 0 to 319 have ended on both channels
+    const size_t first = 4 * 320 + 2;
+    ASSERT_EQ(played.size(), all.size() - first);
+    EXPECT_EQ(played.front(), all[first]);
+    EXPECT_EQ(played.back(), all.back());
+
+    // the same with an index that has to be thinned out
+    MidiFilePlayer::SeekPoint points[16];
+    const size_t num_points = player.BuildIndex(points, 16, 384);
+    EXPECT_GT(num_points, 8u);
+    EXPECT_LE(num_points, 16u);
+    for(size_t i = 1; i < num_points; i++)
+        EXPECT_GT(points[i].tick, points[i - 1].tick);
+    EXPECT_GE(points[num_points - 1].tick, 384u * 40);
+
+    player.Seek(tick);
+    const size_t reads_before_indexed = FatFsImage::GetNumSectorReads();
+    Play(player, 1, 64);
+    const size_t reads_indexed
+        = FatFsImage::GetNumSectorReads() - reads_before_indexed;
+    EXPECT_LT(reads_indexed * 2, reads_unindexed);
+    played = Play(player, 80000, 64);
+    ASSERT_EQ(played.size(), all.size() - first);
+    for(size_t i = 0; i < played.size(); i++)
+        ASSERT_EQ(played[i], all[first + i]);
+
+    // and with the song position pointer, to the beginning
+    player.SetSongPosition(0);
+    played = Play(player, 80000, 64);
+    EXPECT_EQ(played, all);
+}
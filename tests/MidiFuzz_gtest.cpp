@@ -0,0 +1,268 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+#include "hid/midi.h"
+#include "fuzz/MidiRefDecoder.h"
+
+using namespace daisy;
+
+// fuzz/MidiParser_fuzz.cpp, aborts when a check fails
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size);
+
+namespace
+{
+class FuzzTestTransport
+{
+  public:
+    struct Config
+    {
+    };
+    void    Init(Config) {}
+    void    StartRx() {}
+    size_t  Readable() { return 0; }
+    void    FlushRx() {}
+    void    Tx(uint8_t*, size_t) {}
+    uint8_t Rx() { return 0; }
+    bool    RxActive() { return true; }
+};
+
+using FuzzTestHandler = MidiHandler<FuzzTestTransport>;
+
+/** Random bytes that are likely to trip up a parser: status bytes in the
+ *  middle of messages, Real-Time bytes everywhere, SysEx messages that are
+ *  cut short or never end, and data bytes without a status.
+ */
+std::vector<uint8_t> MakeAdversarialStream(uint32_t seed, size_t size)
+{
+    std::vector<uint8_t> bytes;
+    uint32_t             rng  = seed * 2654435761u + 1;
+    auto                 next = [&rng]() {
+        rng = rng * 1664525u + 1013904223u;
+        return uint8_t(rng >> 24);
+    };
+    while(bytes.size() < size)
+    {
+        const uint8_t pick = next() % 80;
+        if(pick < 50)
+            bytes.push_back(next() & 0x7f);
+        else if(pick < 60)
+            bytes.push_back(0x80 | (next() % 0x70));
+        else if(pick < 65)
+            bytes.push_back(0xf8 | (next() & 0x07));
+        else if(pick < 68)
+            bytes.push_back(0xf0);
+        else if(pick < 71)
+            bytes.push_back(0xf7);
+        else if(pick < 74)
+            bytes.push_back(0xf1 + next() % 6);
+        else
+        {
+            // a SysEx message, longer than the buffers at times
+            bytes.push_back(0xf0);
+            for(int n = next() % 4 == 0 ? 200 : next() % 24; n > 0; n--)
+                bytes.push_back(next() & 0x7f);
+            if(next() % 4 != 0)
+                bytes.push_back(0xf7);
+        }
+    }
+    bytes.resize(size);
+    return bytes;
+}
+
+std::vector<CompactMidiEvent> ParseAll(const std::vector<uint8_t>& bytes)
+{
+    MidiParser                    parser;
+    MidiSysExBuffer<256>          sysex;
+    std::vector<CompactMidiEvent> events;
+    CompactMidiEvent              event;
+    parser.Init();
+    parser.SetSysExBuffer(&sysex);
+    for(auto byte : bytes)
+    {
+        if(parser.Parse(byte, &event))
+            events.push_back(event);
+    }
+    return events;
+}
+
+void Fuzz(const std::vector<uint8_t>& bytes, uint8_t seed = 0)
+{
+    std::vector<uint8_t> input(1, seed);
+    input.insert(input.end(), bytes.begin(), bytes.end());
+    LLVMFuzzerTestOneInput(input.data(), input.size());
+}
+} // namespace
+
+TEST(MidiFuzz, a_realTimeWithinMessages)
+{
+    // clock bytes between the bytes of a note, of running status, and of
+    // a SysEx message don't interrupt them
+    const std::vector<uint8_t> bytes
+        = {0x90, 60, 0xf8, 100, 62, 0xfe, 100, 0xf0, 1, 0xf8, 2, 0xf7};
+    const auto events = ParseAll(bytes);
+    ASSERT_EQ(events.size(), 6u);
+    EXPECT_EQ(events[0].type, SystemRealTime);
+    EXPECT_EQ(events[1].type, NoteOn);
+    EXPECT_EQ(events[1].data[0], 60);
+    EXPECT_EQ(events[1].data[1], 100);
+    EXPECT_EQ(events[2].srt_type, ActiveSensing);
+    EXPECT_EQ(events[3].type, NoteOn);
+    EXPECT_EQ(events[3].data[0], 62);
+    EXPECT_EQ(events[4].type, SystemRealTime);
+    EXPECT_EQ(events[5].sc_type, SystemExclusive);
+    EXPECT_EQ(events[5].sysex_length, 2u);
+    Fuzz(bytes);
+}
+
+TEST(MidiFuzz, b_truncatedSysEx)
+{
+    // a status byte cuts the first message short, which is dropped, and
+    // the note is parsed as usual
+    FuzzTestHandler midi;
+    midi.Init(FuzzTestHandler::Config());
+    const std::vector<uint8_t> bytes = {0xf0, 1, 2, 3, 0x90, 60, 100, 0xf0, 4};
+    midi.Parse(bytes.data(), bytes.size());
+    uint8_t payload[4];
+    ASSERT_TRUE(midi.HasEvents());
+    EXPECT_EQ(midi.PopCompactEvent().type, NoteOn);
+    EXPECT_EQ(midi.ReadSysEx(payload, 4), 0u);
+    EXPECT_FALSE(midi.HasEvents());
+    Fuzz(bytes);
+
+    // the unfinished message is dropped when the next one starts
+    for(uint8_t i = 0; i < 100; i++)
+        midi.Parse(0xf0);
+    midi.Parse(5);
+    midi.Parse(0xf7);
+    ASSERT_TRUE(midi.HasEvents());
+    EXPECT_EQ(midi.PopCompactEvent().sysex_length, 1u);
+    EXPECT_EQ(midi.ReadSysEx(payload, 4), 1u);
+    EXPECT_EQ(payload[0], 5);
+    EXPECT_FALSE(midi.HasEvents());
+}
+
+TEST(MidiFuzz, c_runningStatusAcrossSysEx)
+{
+    // SysEx and System Common messages cancel the running status, so the
+    // data bytes after them are ignored, and a Song Position after a
+    // Control Change isn't taken for a Channel Mode message
+    const std::vector<uint8_t> bytes = {0x90, 60, 100, 0xf0, 1, 0xf7, 62, 100,
+                                        0xb0, 7,  64,  0xf2, 121, 0, 1, 2};
+    const auto events = ParseAll(bytes);
+    ASSERT_EQ(events.size(), 4u);
+    EXPECT_EQ(events[0].type, NoteOn);
+    EXPECT_EQ(events[1].sc_type, SystemExclusive);
+    EXPECT_EQ(events[2].type, ControlChange);
+    EXPECT_EQ(events[3].type, SystemCommon);
+    EXPECT_EQ(events[3].sc_type, SongPositionPointer);
+    EXPECT_EQ(events[3].data[0], 121);
+    Fuzz(bytes);
+
+    // a Song Select doesn't make the next Control Change one byte long
+    const auto cc = ParseAll({0xf3, 5, 0xb0, 7, 64, 121, 0, 10, 20});
+    ASSERT_EQ(cc.size(), 4u);
+    EXPECT_EQ(cc[1].type, ControlChange);
+    EXPECT_EQ(cc[1].data[1], 64);
+    // running status applies to each Control Change on its own
+    EXPECT_EQ(cc[2].type, ChannelMode);
+    EXPECT_EQ(cc[3].type, ControlChange);
+}
+
+TEST(MidiFuzz, d_randomStreams)
+{
+    for(uint32_t seed = 0; seed < 2000; seed++)
+        Fuzz(MakeAdversarialStream(seed, 16 + seed % 512), seed);
+
+    // uniformly random bytes, mostly status bytes in a row
+    for(uint32_t seed = 0; seed < 200; seed++)
+    {
+        std::vector<uint8_t> bytes(256 + seed);
+        uint32_t             rng = seed;
+        for(auto& byte : bytes)
+        {
+            rng  = rng * 1664525u + 1013904223u;
+            byte = rng >> 24;
+        }
+        Fuzz(bytes, seed);
+    }
+}
+
+// Not a pass/fail test: prints how many bytes per second go through
+// MidiHandler, from Parse() to PopCompactEvent() and ReadSysEx(), for a well
+// formed stream of notes, and for the adversarial stream of the fuzz tests.
+// The stream is fed in 64-byte chunks, and the queue is drained after each.
+//
+// Absolute numbers depend on the machine, so each stream is also run through
+// the reference decoder of the fuzz target, and the speed is printed relative
+// to it. Compare that ratio between builds.
+//
+// Results go to midi_benchmark_sink, so the loops aren't optimized away.
+volatile uint32_t midi_benchmark_sink;
+
+TEST(MidiFuzz, z_benchmark)
+{
+    constexpr size_t kChunk   = 64;
+    constexpr int    kRepeats = 32;
+
+    std::vector<uint8_t> notes;
+    while(notes.size() < (1 << 16))
+    {
+        const uint8_t note = 36 + notes.size() % 48;
+        notes.insert(notes.end(), {0x91, note, 100, 0xf8, 0x81, note, 0});
+    }
+    const std::vector<uint8_t> streams[]
+        = {notes, MakeAdversarialStream(1, 1 << 16)};
+    const char* names[] = {"notes", "adversarial"};
+
+    static FuzzTestHandler midi;
+    uint8_t                payload[1024];
+    midi.Init(FuzzTestHandler::Config());
+    for(size_t s = 0; s < 2; s++)
+    {
+        const std::vector<uint8_t>& bytes = streams[s];
+        const size_t                n = bytes.size() - bytes.size() % kChunk;
+
+        uint32_t   sum = 0;
+        const auto t0  = std::chrono::steady_clock::now();
+        for(int r = 0; r < kRepeats; r++)
+        {
+            for(size_t i = 0; i < n; i += kChunk)
+            {
+                midi.Parse(&bytes[i], kChunk);
+                while(midi.HasEvents())
+                {
+                    const CompactMidiEvent event = midi.PopCompactEvent();
+                    sum += event.data[0];
+                    if(event.sysex_length > 0)
+                        sum += midi.ReadSysEx(payload, sizeof(payload));
+                }
+            }
+        }
+        const auto t1       = std::chrono::steady_clock::now();
+        midi_benchmark_sink = sum;
+
+        RefDecoder ref;
+        RefEvent   event;
+        sum = 0;
+        for(int r = 0; r < kRepeats; r++)
+        {
+            for(size_t i = 0; i < n; i++)
+            {
+                if(ref.Feed(bytes[i], &event))
+                    sum += event.data[0] + event.sysex.size();
+            }
+        }
+        const auto t2       = std::chrono::steady_clock::now();
+        midi_benchmark_sink = sum;
+
+        const double handler_s = std::chrono::duration<double>(t1 - t0).count();
+        const double ref_s     = std::chrono::duration<double>(t2 - t1).count();
+        printf("[ bench    ] MidiHandler %s %.1f MB/s, %.2fx the reference "
+               "decoder (%.1f MB/s)\n",
+               names[s],
+               n * kRepeats / handler_s / 1e6,
+               ref_s / handler_s,
+               n * kRepeats / ref_s / 1e6);
+    }
+}
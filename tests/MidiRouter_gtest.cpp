@@ -0,0 +1,241 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include "hid/midi.h"
+#include "hid/midi_router.h"
+
+using namespace daisy;
+
+/** Records what is sent, one instance per port number */
+template <int kPort>
+class RouterTestTransport
+{
+  public:
+    struct Config
+    {
+    };
+
+    void    Init(Config) {}
+    void    StartRx() {}
+    size_t  Readable() { return 0; }
+    void    FlushRx() {}
+    uint8_t Rx() { return 0; }
+    bool    RxActive() { return true; }
+    void    Tx(uint8_t* buff, size_t size)
+    {
+        sent.insert(sent.end(), buff, buff + size);
+    }
+
+    static std::vector<uint8_t> sent;
+};
+
+template <int kPort>
+std::vector<uint8_t> RouterTestTransport<kPort>::sent;
+
+using RouterMidiA = MidiHandler<RouterTestTransport<0>>;
+using RouterMidiB = MidiHandler<RouterTestTransport<1>>;
+// room for two messages
+using RouterMidiC = MidiHandler<RouterTestTransport<2>, 16, 2>;
+
+class hid_MidiRouter : public ::testing::Test
+{
+  protected:
+    void SetUp() override
+    {
+        a.Init(RouterMidiA::Config());
+        b.Init(RouterMidiB::Config());
+        c.Init(RouterMidiC::Config());
+        RouterTestTransport<0>::sent.clear();
+        RouterTestTransport<1>::sent.clear();
+        RouterTestTransport<2>::sent.clear();
+        router.Init();
+    }
+
+    template <typename Handler>
+    static void Receive(Handler& handler, std::vector<uint8_t> bytes)
+    {
+        handler.Parse(bytes.data(), bytes.size());
+    }
+
+    RouterMidiA a;
+    RouterMidiB b;
+    RouterMidiC c;
+    MidiRouter  router;
+};
+
+TEST_F(hid_MidiRouter, a_routesAndMerges)
+{
+    const size_t port_a = router.AddPort(a);
+    const size_t port_b = router.AddPort(b);
+    const size_t port_c = router.AddPort(c);
+    EXPECT_EQ(router.GetNumPorts(), 3u);
+    router.Connect(port_a, port_c);
+    router.Connect(port_b, port_c);
+    router.Connect(port_b, port_b); // thru
+
+    Receive(a, {0x90, 60, 100});
+    Receive(b, {0xB1, 7, 64, 0xF8});
+    router.Process();
+
+    // whole messages, in port order
+    EXPECT_EQ(RouterTestTransport<0>::sent, std::vector<uint8_t>());
+    EXPECT_EQ(RouterTestTransport<1>::sent,
+              std::vector<uint8_t>({0xB1, 7, 64, 0xF8}));
+    // c only has room for two messages
+    EXPECT_EQ(RouterTestTransport<2>::sent,
+              std::vector<uint8_t>({0x90, 60, 100, 0xB1, 7, 64}));
+    EXPECT_FALSE(a.HasEvents());
+    EXPECT_FALSE(b.HasEvents());
+
+    EXPECT_EQ(router.GetStats(port_a).rx_events, 1u);
+    EXPECT_EQ(router.GetStats(port_b).rx_events, 2u);
+    EXPECT_EQ(router.GetStats(port_b).tx_events, 2u);
+    EXPECT_EQ(router.GetStats(port_b).tx_bytes, 4u);
+    EXPECT_EQ(router.GetStats(port_c).tx_events, 2u);
+    EXPECT_EQ(router.GetStats(port_c).tx_bytes, 6u);
+    EXPECT_EQ(router.GetStats(port_c).dropped, 1u);
+
+    // disconnected ports are quiet
+    router.Connect(port_b, port_c, false);
+    Receive(b, {0xC2, 5});
+    router.Process();
+    EXPECT_EQ(RouterTestTransport<2>::sent.size(), 6u);
+    EXPECT_EQ(RouterTestTransport<1>::sent.size(), 6u);
+
+    router.ResetStats(port_c);
+    EXPECT_EQ(router.GetStats(port_c).dropped, 0u);
+}
+
+TEST_F(hid_MidiRouter, b_filtersAndRemaps)
+{
+    MidiRouter::PortConfig config;
+    config.in.channels = 0x0003; // channels 1 and 2
+    config.in.types &= ~MidiRouter::Filter::TypeBit(ControlChange);
+    config.channel_map[1] = 9;
+    const size_t port_a   = router.AddPort(a, config);
+
+    MidiRouter::PortConfig out_config;
+    out_config.out.types &= ~MidiRouter::Filter::TypeBit(SystemRealTime);
+    const size_t port_b = router.AddPort(b, out_config);
+    router.Connect(port_a, port_b);
+
+    Receive(a,
+            {0x90, 60, 100,  // passes
+             0x91, 61, 100,  // remapped
+             0x92, 62, 100,  // channel filtered
+             0xB0, 1,  2,    // type filtered
+             0xF8,           // filtered on the way out
+             0xD1, 30});     // remapped
+    router.Process();
+
+    EXPECT_EQ(RouterTestTransport<1>::sent,
+              std::vector<uint8_t>(
+                  {0x90, 60, 100, 0x99, 61, 100, 0xD9, 30}));
+    EXPECT_EQ(router.GetStats(port_a).rx_events, 6u);
+    EXPECT_EQ(router.GetStats(port_a).filtered, 2u);
+    EXPECT_EQ(router.GetStats(port_b).tx_events, 3u);
+    EXPECT_EQ(router.GetStats(port_b).dropped, 0u);
+    EXPECT_EQ(router.GetPortConfig(port_a).channel_map[1], 9);
+}
+
+TEST_F(hid_MidiRouter, c_sysEx)
+{
+    const size_t port_a = router.AddPort(a);
+    const size_t port_b = router.AddPort(b);
+    router.Connect(port_a, port_b);
+
+    Receive(a, {0xF0, 0x7E, 0x01, 0x02, 0xF7, 0xF2, 0x10, 0x20});
+    router.Process();
+    EXPECT_EQ(RouterTestTransport<1>::sent,
+              std::vector<uint8_t>(
+                  {0xF0, 0x7E, 0x01, 0x02, 0xF7, 0xF2, 0x10, 0x20}));
+
+    // too long to forward
+    RouterTestTransport<1>::sent.clear();
+    std::vector<uint8_t> sysex(SYSEX_BUFFER_LEN + 10, 0x11);
+    sysex.front() = 0xF0;
+    sysex.back()  = 0xF7;
+    Receive(a, sysex);
+    Receive(a, {0xF6});
+    router.Process();
+    EXPECT_EQ(RouterTestTransport<1>::sent, std::vector<uint8_t>({0xF6}));
+    EXPECT_EQ(router.GetStats(port_b).dropped, 1u);
+}
+
+struct RouterCallbackLog
+{
+    std::vector<MidiMessageType> types;
+    std::vector<size_t>          ports;
+    std::vector<uint8_t>         sysex;
+};
+
+static void RouterCallback(const CompactMidiEvent& event,
+                           const uint8_t*          sysex,
+                           size_t                  port,
+                           void*                   context)
+{
+    RouterCallbackLog* log = static_cast<RouterCallbackLog*>(context);
+    log->types.push_back(event.type);
+    log->ports.push_back(port);
+    if(sysex)
+        log->sysex.insert(log->sysex.end(), sysex, sysex + event.sysex_length);
+}
+
+TEST_F(hid_MidiRouter, d_callback)
+{
+    RouterCallbackLog      log;
+    MidiRouter::PortConfig config;
+    config.in.types = MidiRouter::Filter::TypeBit(NoteOn)
+                      | MidiRouter::Filter::TypeBit(SystemCommon);
+    router.AddPort(a);
+    router.AddPort(b, config);
+    router.SetEventCallback(RouterCallback, &log);
+
+    Receive(a, {0x80, 60, 0});
+    Receive(b, {0x90, 60, 1, 0xB0, 1, 1, 0xF0, 0x01, 0x02, 0xF7});
+    router.Process();
+
+    EXPECT_EQ(log.types,
+              std::vector<MidiMessageType>({NoteOff, NoteOn, SystemCommon}));
+    EXPECT_EQ(log.ports, std::vector<size_t>({0, 1, 1}));
+    EXPECT_EQ(log.sysex, std::vector<uint8_t>({0x01, 0x02}));
+    // nothing is connected
+    EXPECT_TRUE(RouterTestTransport<0>::sent.empty());
+    EXPECT_TRUE(RouterTestTransport<1>::sent.empty());
+}
+
+TEST_F(hid_MidiRouter, e_toBytes)
+{
+    RouterMidiA midi;
+    midi.Init(RouterMidiA::Config());
+    const std::vector<std::vector<uint8_t>> messages = {{0x85, 1, 2},
+                                                        {0x9F, 3, 4},
+                                                        {0xA0, 5, 6},
+                                                        {0xB1, 7, 8},
+                                                        {0xB2, 121, 0},
+                                                        {0xC3, 9},
+                                                        {0xD4, 10},
+                                                        {0xE5, 11, 12},
+                                                        {0xF1, 13},
+                                                        {0xF2, 14, 15},
+                                                        {0xF3, 16},
+                                                        {0xF6},
+                                                        {0xF8},
+                                                        {0xFA},
+                                                        {0xFF}};
+    for(const auto& message : messages)
+    {
+        midi.Parse(message.data(), message.size());
+        ASSERT_TRUE(midi.HasEvents());
+        const CompactMidiEvent event = midi.PopCompactEvent();
+        uint8_t                bytes[3];
+        const size_t size = MidiRouter::ToBytes(event, nullptr, bytes);
+        EXPECT_EQ(std::vector<uint8_t>(bytes, bytes + size), message);
+    }
+
+    router.AddPort(a);
+    router.AddPort(b);
+    router.AddPort(c);
+    router.AddPort(midi);
+    EXPECT_EQ(router.AddPort(midi), MidiRouter::kMaxPorts);
+    EXPECT_EQ(router.GetNumPorts(), MidiRouter::kMaxPorts);
+}
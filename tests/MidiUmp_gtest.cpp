@@ -0,0 +1,347 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "hid/midi_parser.h"
+#include "hid/midi_ump.h"
+
+using namespace daisy;
+
+namespace
+{
+/** Parses MIDI 1.0 bytes and translates the events to packets */
+std::vector<UmpPacket> Translate(UmpTranslator&              translator,
+                                 const std::vector<uint8_t>& bytes)
+{
+    MidiParser             parser;
+    CompactMidiEvent       event;
+    UmpPacket              packet;
+    std::vector<UmpPacket> packets;
+    parser.Init();
+    for(uint8_t byte : bytes)
+        if(parser.Parse(byte, &event) && translator.ToUmp(event, &packet))
+            packets.push_back(packet);
+    return packets;
+}
+
+/** Translates packets back to MIDI 1.0 bytes */
+std::vector<uint8_t> ToBytes(const UmpTranslator&          translator,
+                             const std::vector<UmpPacket>& packets)
+{
+    std::vector<uint8_t> bytes;
+    for(const UmpPacket& packet : packets)
+    {
+        uint8_t      buffer[12];
+        const size_t size = translator.ToMidi(packet, buffer, sizeof(buffer));
+        bytes.insert(bytes.end(), buffer, buffer + size);
+    }
+    return bytes;
+}
+} // namespace
+
+TEST(hid_MidiUmp, a_packetSizes)
+{
+    EXPECT_EQ(UmpPacket::GetNumWords(UmpMessageType::Utility), 1);
+    EXPECT_EQ(UmpPacket::GetNumWords(UmpMessageType::System), 1);
+    EXPECT_EQ(UmpPacket::GetNumWords(UmpMessageType::Midi1ChannelVoice), 1);
+    EXPECT_EQ(UmpPacket::GetNumWords(UmpMessageType::Data64), 2);
+    EXPECT_EQ(UmpPacket::GetNumWords(UmpMessageType::Midi2ChannelVoice), 2);
+    EXPECT_EQ(UmpPacket::GetNumWords(UmpMessageType::Data128), 4);
+    EXPECT_EQ(UmpPacket::GetNumWords(UmpMessageType::FlexData), 4);
+    EXPECT_EQ(UmpPacket::GetNumWords(UmpMessageType::UmpStream), 4);
+
+    const UmpPacket packet = UmpPacket::Midi1(3, 0x92, 60, 100);
+    EXPECT_EQ(packet.words[0], 0x23923c64u);
+    EXPECT_EQ(packet.GetMessageType(), UmpMessageType::Midi1ChannelVoice);
+    EXPECT_EQ(packet.GetGroup(), 3);
+    EXPECT_EQ(packet.GetStatus(), 0x92);
+    EXPECT_EQ(packet.GetChannel(), 2);
+    EXPECT_EQ(packet.GetNumWords(), 1);
+    EXPECT_EQ(UmpPacket::Midi1(0, 0xf8).words[0], 0x10f80000u);
+}
+
+TEST(hid_MidiUmp, b_midi2Messages)
+{
+    Midi2Event event;
+    UmpPacket  packet = UmpPacket::NoteOn(1, 5, 60, 0xabcd, 3, 0x1234);
+    EXPECT_EQ(packet.words[0], 0x41953c03u);
+    EXPECT_EQ(packet.words[1], 0xabcd1234u);
+    ASSERT_TRUE(packet.Decode(&event));
+    EXPECT_EQ(event.type, Midi2Event::NoteOn);
+    EXPECT_EQ(event.group, 1);
+    EXPECT_EQ(event.channel, 5);
+    EXPECT_EQ(event.index, 60);
+    EXPECT_EQ(event.velocity, 0xabcd);
+    EXPECT_EQ(event.flags, 3);
+    EXPECT_EQ(event.attribute, 0x1234);
+
+    packet = UmpPacket::ControlChange(0, 0, 74, 0x12345678);
+    ASSERT_TRUE(packet.Decode(&event));
+    EXPECT_EQ(event.type, Midi2Event::ControlChange);
+    EXPECT_EQ(event.index, 74);
+    EXPECT_EQ(event.value, 0x12345678u);
+
+    packet = UmpPacket::RegisteredController(0, 1, 0, 2, 0x80000000);
+    ASSERT_TRUE(packet.Decode(&event));
+    EXPECT_EQ(event.type, Midi2Event::RegisteredController);
+    EXPECT_EQ(event.bank, 0);
+    EXPECT_EQ(event.index, 2);
+    EXPECT_EQ(event.value, 0x80000000u);
+
+    packet = UmpPacket::ProgramChange(0, 9, 12, true, 1, 2);
+    EXPECT_EQ(packet.words[1], 0x0c000102u);
+    ASSERT_TRUE(packet.Decode(&event));
+    EXPECT_EQ(event.type, Midi2Event::ProgramChange);
+    EXPECT_EQ(event.index, 12);
+    EXPECT_EQ(event.flags, 1);
+    EXPECT_EQ(event.bank, 1);
+    EXPECT_EQ(event.value, 2u);
+
+    // only MIDI 2.0 channel voice messages are decoded
+    EXPECT_FALSE(UmpPacket::Midi1(0, 0x90, 60, 100).Decode(&event));
+}
+
+TEST(hid_MidiUmp, c_scaling)
+{
+    // minimum, center and maximum are kept
+    EXPECT_EQ(UmpTranslator::Upscale(0, 7, 16), 0u);
+    EXPECT_EQ(UmpTranslator::Upscale(64, 7, 16), 0x8000u);
+    EXPECT_EQ(UmpTranslator::Upscale(127, 7, 16), 0xffffu);
+    EXPECT_EQ(UmpTranslator::Upscale(127, 7, 32), 0xffffffffu);
+    EXPECT_EQ(UmpTranslator::Upscale(8192, 14, 32), 0x80000000u);
+    EXPECT_EQ(UmpTranslator::Upscale(16383, 14, 32), 0xffffffffu);
+
+    // scaling down undoes scaling up, and is monotonic
+    uint32_t last = 0;
+    for(uint32_t v = 0; v < 128; v++)
+    {
+        const uint32_t up = UmpTranslator::Upscale(v, 7, 32);
+        EXPECT_EQ(UmpTranslator::Downscale(up, 32, 7), v);
+        EXPECT_GE(up, last);
+        last = up;
+    }
+    for(uint32_t v = 0; v < 16384; v += 7)
+        EXPECT_EQ(UmpTranslator::Downscale(
+                      UmpTranslator::Upscale(v, 14, 32), 32, 14),
+                  v);
+}
+
+TEST(hid_MidiUmp, d_midi1ToMidi2)
+{
+    UmpTranslator translator;
+    translator.Init(2);
+    const auto packets = Translate(
+        translator,
+        {
+            0x90, 60, 127,       // note on
+            60,   0,             // note on with velocity 0, running status
+            0xb1, 0,    1,       // bank select MSB
+            32,   5,             // bank select LSB
+            0xc1, 7,             // program change
+            0xb0, 101,  0,       // RPN 0, pitch bend range
+            100,  0,    6,  12,  // data entry MSB
+            38,   64,            // data entry LSB
+            74,   64,            // filter cutoff
+            0xe0, 0x00, 0x40,    // pitch bend center
+            0xf0, 1,    2,  0xf7 // SysEx isn't translated here
+        });
+
+    ASSERT_EQ(packets.size(), 7u);
+    Midi2Event event;
+    for(const UmpPacket& packet : packets)
+    {
+        ASSERT_TRUE(packet.Decode(&event));
+        EXPECT_EQ(event.group, 2);
+    }
+
+    packets[0].Decode(&event);
+    EXPECT_EQ(event.type, Midi2Event::NoteOn);
+    EXPECT_EQ(event.velocity, 0xffff);
+    packets[1].Decode(&event);
+    EXPECT_EQ(event.type, Midi2Event::NoteOff);
+    EXPECT_EQ(event.velocity, 0);
+
+    packets[2].Decode(&event);
+    EXPECT_EQ(event.type, Midi2Event::ProgramChange);
+    EXPECT_EQ(event.channel, 1);
+    EXPECT_EQ(event.index, 7);
+    EXPECT_EQ(event.flags, 1);
+    EXPECT_EQ(event.bank, 1);
+    EXPECT_EQ(event.value, 5u);
+
+    // the RPN is sent with the MSB, and again with the LSB
+    packets[3].Decode(&event);
+    EXPECT_EQ(event.type, Midi2Event::RegisteredController);
+    EXPECT_EQ(event.index, 0);
+    EXPECT_EQ(event.value, UmpTranslator::Upscale(12 << 7, 14, 32));
+    packets[4].Decode(&event);
+    EXPECT_EQ(event.value, UmpTranslator::Upscale(12 << 7 | 64, 14, 32));
+
+    packets[5].Decode(&event);
+    EXPECT_EQ(event.type, Midi2Event::ControlChange);
+    EXPECT_EQ(event.index, 74);
+    EXPECT_EQ(event.value, 0x80000000u);
+    packets[6].Decode(&event);
+    EXPECT_EQ(event.type, Midi2Event::PitchBend);
+    EXPECT_EQ(event.value, 0x80000000u);
+
+    // system messages are wrapped as they are
+    const auto system = Translate(translator, {0xf8, 0xf2, 0x10, 0x02});
+    ASSERT_EQ(system.size(), 2u);
+    EXPECT_EQ(system[0].words[0], 0x12f80000u);
+    EXPECT_EQ(system[1].words[0], 0x12f21002u);
+}
+
+TEST(hid_MidiUmp, e_midi2ToMidi1)
+{
+    UmpTranslator translator;
+    translator.Init(0);
+
+    // channel messages survive the round trip
+    const std::vector<uint8_t> midi1 = {0x90, 60,  127, 0x80, 60,   64,
+                                        0xa3, 60,  10,  0xb0, 74,   33,
+                                        0xc1, 7,   0xd2, 99,  0xe0, 0x12,
+                                        0x34, 0xf8};
+    EXPECT_EQ(ToBytes(translator, Translate(translator, midi1)), midi1);
+
+    // a quiet MIDI 2.0 note on doesn't turn into a note off
+    EXPECT_EQ(ToBytes(translator, {UmpPacket::NoteOn(0, 0, 60, 0x0100)}),
+              std::vector<uint8_t>({0x90, 60, 1}));
+    // RPNs and bank selects become control change sequences
+    const std::vector<uint8_t> rpn = {0xb0, 101, 0,  0xb0, 100, 2,
+                                      0xb0, 6,   64, 0xb0, 38,  0};
+    const UmpPacket pitch_bend_range
+        = UmpPacket::RegisteredController(0, 0, 0, 2, 0x80000000);
+    EXPECT_EQ(ToBytes(translator, {pitch_bend_range}), rpn);
+    const std::vector<uint8_t> program
+        = {0xb5, 0, 1, 0xb5, 32, 2, 0xc5, 9};
+    EXPECT_EQ(ToBytes(translator,
+                      {UmpPacket::ProgramChange(0, 5, 9, true, 1, 2)}),
+              program);
+
+    // messages that don't fit aren't cut off
+    uint8_t buffer[11];
+    EXPECT_EQ(translator.ToMidi(
+                  UmpPacket::AssignableController(0, 0, 1, 2, 0), buffer, 11),
+              0u);
+    // per-note messages have no MIDI 1.0 equivalent
+    EXPECT_EQ(translator.ToMidi(
+                  UmpPacket::PerNotePitchBend(0, 0, 60, 0), buffer, 11),
+              0u);
+}
+
+TEST(hid_MidiUmp, f_sysEx)
+{
+    uint8_t payload[14];
+    for(uint8_t i = 0; i < 14; i++)
+        payload[i] = i + 1;
+
+    UmpPacket packets[3];
+    ASSERT_EQ(UmpTranslator::SysExToUmp(1, payload, 14, packets, 3), 3u);
+    EXPECT_EQ(packets[0].GetMessageType(), UmpMessageType::Data64);
+    EXPECT_EQ(packets[0].words[0], 0x31160102u); // start, 6 bytes
+    EXPECT_EQ(packets[0].words[1], 0x03040506u);
+    EXPECT_EQ(packets[1].GetStatus(), 0x26); // continue, 6 bytes
+    EXPECT_EQ(packets[2].GetStatus(), 0x32); // end, 2 bytes
+    EXPECT_EQ(UmpTranslator::SysExToUmp(1, payload, 14, packets, 2), 0u);
+
+    UmpTranslator translator;
+    translator.Init(0);
+    std::vector<uint8_t> expected = {0xf0};
+    expected.insert(expected.end(), payload, payload + 14);
+    expected.push_back(0xf7);
+    EXPECT_EQ(ToBytes(translator, {packets[0], packets[1], packets[2]}),
+              expected);
+
+    // a short message fits into one packet
+    ASSERT_EQ(UmpTranslator::SysExToUmp(0, payload, 0, packets, 3), 1u);
+    EXPECT_EQ(ToBytes(translator, {packets[0]}),
+              std::vector<uint8_t>({0xf0, 0xf7}));
+}
+
+TEST(hid_MidiUmp, g_queue)
+{
+    UmpQueue<8> queue;
+    UmpPacket   packet;
+    EXPECT_TRUE(queue.IsEmpty());
+    EXPECT_FALSE(queue.PopFront(&packet));
+
+    // packets take up only their own words
+    EXPECT_TRUE(queue.PushBack(UmpPacket::Midi1(0, 0xf8)));
+    EXPECT_TRUE(queue.PushBack(UmpPacket::NoteOn(0, 0, 60, 1000)));
+    EXPECT_TRUE(queue.PushBack(UmpPacket::NoteOff(0, 0, 60, 1000)));
+    EXPECT_EQ(queue.GetNumWords(), 5u);
+    // a packet is only added as a whole
+    UmpPacket data128    = {};
+    data128.words[0]     = 0x50000000;
+    EXPECT_FALSE(queue.PushBack(data128));
+    EXPECT_TRUE(queue.PushBack(UmpPacket::PitchBend(0, 0, 0)));
+
+    ASSERT_TRUE(queue.PopFront(&packet));
+    EXPECT_EQ(packet.GetMessageType(), UmpMessageType::System);
+    ASSERT_TRUE(queue.PopFront(&packet));
+    EXPECT_EQ(packet.GetStatus(), 0x90);
+    EXPECT_EQ(packet.words[1] >> 16, 1000u);
+
+    // wraps around
+    EXPECT_TRUE(queue.PushBack(data128));
+    ASSERT_TRUE(queue.PopFront(&packet));
+    EXPECT_EQ(packet.GetStatus(), 0x80);
+    ASSERT_TRUE(queue.PopFront(&packet));
+    EXPECT_EQ(packet.GetStatus(), 0xe0);
+    ASSERT_TRUE(queue.PopFront(&packet));
+    EXPECT_EQ(packet.GetMessageType(), UmpMessageType::Data128);
+    EXPECT_TRUE(queue.IsEmpty());
+
+    // a word stream is split into packets, a partial one is left over
+    const uint32_t words[] = {0x20903c64, 0x40903c00, 0xffff0000, 0x40803c00};
+    EXPECT_EQ(queue.PushWords(words, 4), 3u);
+    EXPECT_EQ(queue.GetNumWords(), 3u);
+    queue.Flush();
+    EXPECT_TRUE(queue.IsEmpty());
+}
+
+TEST(hid_MidiUmp, h_queueThreads)
+{
+    // packets of 1, 2 and 4 words from one thread always arrive whole
+    constexpr uint32_t num_packets = 100000;
+    static UmpQueue<64> queue;
+    std::atomic<bool>   failed(false);
+    queue.Init();
+
+    std::thread producer([&]() {
+        for(uint32_t i = 0; i < num_packets;)
+        {
+            UmpPacket packet = {};
+            const uint32_t type = i % 3 == 0 ? 0x2 : i % 3 == 1 ? 0x4 : 0x5;
+            packet.words[0]     = type << 28 | (i & 0xffffff);
+            for(int w = 1; w < 4; w++)
+                packet.words[w] = i;
+            if(queue.PushBack(packet))
+                i++;
+            else
+                std::this_thread::yield();
+        }
+    });
+    std::thread consumer([&]() {
+        for(uint32_t i = 0; i < num_packets && !failed;)
+        {
+            UmpPacket packet;
+            if(!queue.PopFront(&packet))
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            if((packet.words[0] & 0xffffff) != (i & 0xffffff))
+                failed = true;
+            for(int w = 1; w < packet.GetNumWords(); w++)
+                if(packet.words[w] != i)
+                    failed = true;
+            i++;
+        }
+    });
+    producer.join();
+    consumer.join();
+    EXPECT_FALSE(failed);
+    EXPECT_TRUE(queue.IsEmpty());
+}
@@ -1,4 +1,7 @@
 #include <gtest/gtest.h>
+#include <chrono>
+#include <cstdio>
+#include <vector>
 #include "hid/midi.h"
 #include "sys/system.h"
 
@@ -510,10 +513,11 @@ TEST_F(MidiTest, systemRealTime)
 
 TEST_F(MidiTest, systemExclusive)
 {
+    // payload bytes are data bytes, a status byte would end the message
     uint8_t msgs[135];
     for(int i = 0; i < 135; i++)
     {
-        msgs[i] = (uint8_t)i;
+        msgs[i] = (uint8_t)(i & 0x7f);
     }
 
     // short message
@@ -781,4 +785,809 @@ TEST_F(MidiTest, singleByteRunningStatusTest)
     }
 
     EXPECT_FALSE(midi.HasEvents());
-}
\ No newline at end of file
+}
+// ================ Compact Events and SysEx Buffer ================
+
+TEST_F(MidiTest, compactEvents)
+{
+    EXPECT_LE(sizeof(CompactMidiEvent), 12u);
+
+    uint8_t msgs[] = {0x93, 0x40, 0x64, 0xB3, 123, 0, 0xE1, 0x00, 0x40, 0xf8};
+    Parse(msgs, sizeof(msgs));
+
+    CompactMidiEvent event = midi.PopCompactEvent();
+    EXPECT_EQ(event.type, NoteOn);
+    EXPECT_EQ(event.AsNoteOn().channel, 3);
+    EXPECT_EQ(event.AsNoteOn().note, 0x40);
+    EXPECT_EQ(event.AsNoteOn().velocity, 0x64);
+    EXPECT_EQ(event.sysex_length, 0u);
+
+    event = midi.PopCompactEvent();
+    EXPECT_EQ(event.type, ChannelMode);
+    EXPECT_EQ(event.AsChannelMode().event_type, AllNotesOff);
+    EXPECT_EQ(event.ToMidiEvent().cm_type, AllNotesOff);
+
+    event = midi.PopCompactEvent();
+    EXPECT_EQ(event.type, PitchBend);
+    EXPECT_EQ(event.AsPitchBend().channel, 1);
+    EXPECT_EQ(event.AsPitchBend().value, 0);
+
+    event = midi.PopCompactEvent();
+    EXPECT_EQ(event.type, SystemRealTime);
+    EXPECT_EQ(event.srt_type, TimingClock);
+    EXPECT_FALSE(midi.HasEvents());
+}
+
+TEST_F(MidiTest, longSysExInParts)
+{
+    // much longer than SYSEX_BUFFER_LEN, with notes before and after
+    uint8_t msgs[600];
+    for(size_t i = 0; i < sizeof(msgs); i++)
+        msgs[i] = i & 0x7f;
+    uint8_t note[] = {0x90, 0x30, 0x40};
+
+    Parse(note, 3);
+    midi.Parse(0xf0);
+    Parse(msgs, sizeof(msgs));
+    midi.Parse(0xf7);
+    Parse(note, 3);
+
+    EXPECT_EQ(midi.PopCompactEvent().type, NoteOn);
+    CompactMidiEvent event = midi.PopCompactEvent();
+    EXPECT_EQ(event.type, SystemCommon);
+    EXPECT_EQ(event.sc_type, SystemExclusive);
+    ASSERT_EQ(event.sysex_length, sizeof(msgs));
+
+    uint8_t part[256];
+    size_t  total = 0;
+    while(size_t n = midi.ReadSysEx(part, sizeof(part)))
+    {
+        for(size_t i = 0; i < n; i++)
+            EXPECT_EQ(part[i], msgs[total + i]);
+        total += n;
+    }
+    EXPECT_EQ(total, sizeof(msgs));
+
+    event = midi.PopCompactEvent();
+    EXPECT_EQ(event.type, NoteOn);
+    EXPECT_EQ(midi.ReadSysEx(part, sizeof(part)), 0u);
+    EXPECT_FALSE(midi.HasEvents());
+}
+
+TEST_F(MidiTest, unreadSysExIsSkipped)
+{
+    uint8_t msgs[] = {0xf0, 1, 2, 3, 4, 0xf7, 0xf0, 5, 6, 0xf7};
+    Parse(msgs, sizeof(msgs));
+
+    uint8_t data[4];
+    EXPECT_EQ(midi.PopCompactEvent().sysex_length, 4u);
+    EXPECT_EQ(midi.ReadSysEx(data, 1), 1u);
+    EXPECT_EQ(data[0], 1);
+
+    // the rest of the first payload is dropped
+    EXPECT_EQ(midi.PopCompactEvent().sysex_length, 2u);
+    EXPECT_EQ(midi.ReadSysEx(data, 4), 2u);
+    EXPECT_EQ(data[0], 5);
+    EXPECT_EQ(data[1], 6);
+}
+
+TEST(MidiSysExBuffer, truncatesWhenFull)
+{
+    MidiHandler<MidiTestTransport, 4, 4, 4, 32, 16> midi;
+    midi.Init(MidiHandler<MidiTestTransport, 4, 4, 4, 32, 16>::Config());
+
+    midi.Parse(0xf0);
+    for(uint8_t i = 0; i < 20; i++)
+        midi.Parse(i);
+    midi.Parse(0xf7);
+    // the second message doesn't fit at all until the first is read
+    midi.Parse(0xf0);
+    midi.Parse(0x42);
+    midi.Parse(0xf7);
+
+    uint8_t data[20];
+    EXPECT_EQ(midi.PopCompactEvent().sysex_length, 16u);
+    EXPECT_EQ(midi.ReadSysEx(data, 20), 16u);
+    EXPECT_EQ(data[15], 15);
+    EXPECT_EQ(midi.PopCompactEvent().sysex_length, 0u);
+
+    // with space available again, SysEx is received as usual
+    midi.Parse(0xf0);
+    midi.Parse(0x42);
+    midi.Parse(0xf7);
+    MidiEvent event = midi.PopEvent();
+    EXPECT_EQ(event.sc_type, SystemExclusive);
+    EXPECT_EQ(event.AsSystemExclusive().length, 1);
+    EXPECT_EQ(event.AsSystemExclusive().data[0], 0x42);
+}
+
+TEST(MidiSysExBuffer, droppedEventsDropTheirPayload)
+{
+    MidiHandler<MidiTestTransport, 1, 4, 4, 32, 16> midi;
+    midi.Init(MidiHandler<MidiTestTransport, 1, 4, 4, 32, 16>::Config());
+
+    uint8_t msgs[] = {0xf0, 1, 2, 0xf7, 0xf0, 3, 4, 0xf7};
+    for(auto byte : msgs)
+        midi.Parse(byte);
+
+    // the queue holds a single event, the second message is lost entirely
+    uint8_t data[4];
+    EXPECT_EQ(midi.PopCompactEvent().sysex_length, 2u);
+    EXPECT_EQ(midi.ReadSysEx(data, 4), 2u);
+    EXPECT_EQ(data[1], 2);
+    EXPECT_FALSE(midi.HasEvents());
+    EXPECT_EQ(midi.ReadSysEx(data, 4), 0u);
+}
+
+TEST(MidiSysExBuffer, parserWithoutHandler)
+{
+    MidiParser          parser;
+    MidiSysExBuffer<64> buffer;
+    parser.Init();
+    parser.SetSysExBuffer(&buffer);
+
+    uint8_t          msgs[] = {0xf0, 7, 8, 9, 0xf7};
+    CompactMidiEvent event;
+    for(size_t i = 0; i < sizeof(msgs) - 1; i++)
+        EXPECT_FALSE(parser.Parse(msgs[i], &event));
+    EXPECT_TRUE(parser.Parse(msgs[4], &event));
+    EXPECT_EQ(event.sysex_length, 3u);
+
+    // nothing can be read until the payload is committed
+    EXPECT_EQ(buffer.GetReadable(), 0u);
+    buffer.CommitMessage();
+    uint8_t data[3];
+    EXPECT_EQ(buffer.Read(data, 3), 3u);
+    EXPECT_EQ(data[2], 9);
+
+    // the legacy MidiEvent still gets a copy of the payload
+    MidiEvent legacy;
+    for(auto byte : msgs)
+        parser.Parse(byte, &legacy);
+    EXPECT_EQ(legacy.sysex_message_len, 3);
+    EXPECT_EQ(legacy.sysex_data[0], 7);
+    buffer.DiscardMessage();
+    EXPECT_EQ(buffer.GetReadable(), 0u);
+}
+
+// ================ Timestamps ================
+
+TEST_F(MidiTest, timestamps)
+{
+    uint8_t note_on[] = {0x90, 0x40, 0x64};
+    uint8_t clock     = 0xf8;
+
+    // the status byte arrives first, the event completes later
+    System::SetTickForUnitTest(1000);
+    Parse(note_on, 2);
+    System::SetTickForUnitTest(1500);
+    Parse(note_on + 2, 1);
+    System::SetTickForUnitTest(2000);
+    midi.Parse(&clock, 1);
+    // bytes from the same transfer share a timestamp
+    System::SetTickForUnitTest(3000);
+    midi.Parse(note_on, 3);
+
+    EXPECT_EQ(midi.PopCompactEvent().timestamp, 1500u);
+    EXPECT_EQ(midi.PopEvent().timestamp, 2000u);
+    MidiEvent event = midi.PopEvent();
+    EXPECT_EQ(event.type, NoteOn);
+    EXPECT_EQ(event.timestamp, 3000u);
+}
+
+// ================ Parsing Spans ================
+
+namespace
+{
+/** A dense, deterministic stream of MIDI bytes: notes and controllers with
+ *  and without running status, pitch bend, clock bytes in between, and some
+ *  SysEx messages. Roughly what a busy MIDI cable carries.
+ */
+std::vector<uint8_t> MakeDenseCapture(size_t size)
+{
+    std::vector<uint8_t> bytes;
+    uint32_t             rng = 1;
+    auto                 next = [&rng]() {
+        rng = rng * 1664525u + 1013904223u;
+        return uint8_t(rng >> 24);
+    };
+    while(bytes.size() < size)
+    {
+        const uint8_t channel = next() & 0x0f;
+        switch(next() % 8)
+        {
+            case 0:
+            case 1:
+            case 2:
+                // a chord with running status, then release it
+                bytes.push_back(0x90 | channel);
+                for(int i = 0; i < 4; i++)
+                {
+                    bytes.push_back(0x30 + i * 4);
+                    bytes.push_back(next() & 0x7f);
+                    bytes.push_back(0x30 + i * 4);
+                    bytes.push_back(0);
+                }
+                break;
+            case 3:
+            case 4:
+                // a controller sweep with running status
+                bytes.push_back(0xB0 | channel);
+                for(int i = 0; i < 8; i++)
+                {
+                    bytes.push_back(74);
+                    bytes.push_back(next() & 0x7f);
+                }
+                break;
+            case 5:
+                bytes.push_back(0xE0 | channel);
+                bytes.push_back(next() & 0x7f);
+                bytes.push_back(next() & 0x7f);
+                break;
+            case 6: bytes.push_back(0xf8); break;
+            case 7:
+                if(next() < 16)
+                {
+                    bytes.push_back(0xf0);
+                    for(int i = 0; i < 64; i++)
+                        bytes.push_back(next() & 0x7f);
+                    bytes.push_back(0xf7);
+                }
+                else
+                {
+                    bytes.push_back(0xC0 | channel);
+                    bytes.push_back(next() & 0x7f);
+                }
+                break;
+        }
+    }
+    return bytes;
+}
+
+/** Records every event it is given */
+struct EventLog
+{
+    std::vector<CompactMidiEvent> events;
+    bool                          accept = true;
+
+    bool PushBack(const CompactMidiEvent& event)
+    {
+        if(accept)
+            events.push_back(event);
+        return accept;
+    }
+};
+
+bool IsSameEvent(const CompactMidiEvent& a, const CompactMidiEvent& b)
+{
+    return a.type == b.type && a.channel == b.channel
+           && a.data[0] == b.data[0] && a.data[1] == b.data[1]
+           && a.sysex_length == b.sysex_length;
+}
+} // namespace
+
+TEST(MidiParser, spanMatchesSingleBytes)
+{
+    const auto capture = MakeDenseCapture(8192);
+
+    MidiParser       single;
+    EventLog         expected;
+    CompactMidiEvent event;
+    single.Init();
+    for(auto byte : capture)
+        if(single.Parse(byte, &event))
+            expected.PushBack(event);
+    ASSERT_GT(expected.events.size(), 1000u);
+
+    // the span can be split anywhere, e.g. at USB packet or DMA boundaries
+    for(size_t chunk : {size_t(1), size_t(3), size_t(64), capture.size()})
+    {
+        MidiParser parser;
+        EventLog   spans;
+        parser.Init();
+        size_t num_events = 0;
+        for(size_t i = 0; i < capture.size(); i += chunk)
+        {
+            const size_t n = std::min(chunk, capture.size() - i);
+            num_events += parser.Parse(&capture[i], n, spans);
+        }
+        EXPECT_EQ(num_events, expected.events.size()) << "chunk " << chunk;
+        EXPECT_TRUE(std::equal(spans.events.begin(),
+                               spans.events.end(),
+                               expected.events.begin(),
+                               expected.events.end(),
+                               IsSameEvent))
+            << "chunk " << chunk;
+    }
+}
+
+TEST(MidiParser, spanCommitsAcceptedSysEx)
+{
+    MidiParser          parser;
+    MidiSysExBuffer<64> buffer;
+    EventLog            log;
+    parser.Init();
+    parser.SetSysExBuffer(&buffer);
+
+    const uint8_t msgs[] = {0xf0, 1, 2, 0xf7, 0xf0, 3, 4, 5, 0xf7};
+    EXPECT_EQ(parser.Parse(msgs, 4, log), 1u);
+    EXPECT_EQ(buffer.GetReadable(), 2u);
+
+    // rejected events don't leave their payload behind
+    log.accept = false;
+    EXPECT_EQ(parser.Parse(msgs + 4, 5, log), 0u);
+    EXPECT_EQ(buffer.GetReadable(), 2u);
+    EXPECT_EQ(log.events.size(), 1u);
+    EXPECT_EQ(log.events[0].sysex_length, 2u);
+}
+
+// Not a pass/fail test: prints how many bytes of a dense MIDI stream per
+// second are parsed and queued, one byte at a time into MidiEvents as the
+// MidiHandler used to, one byte at a time into CompactMidiEvents, and span
+// by span straight into the queue. The stream is fed in 64-byte chunks,
+// like USB packets or UART DMA transfers, and the queue is drained after
+// each chunk.
+TEST(MidiParser, z_benchmark)
+{
+    constexpr size_t kChunk   = 64;
+    constexpr int    kRepeats = 64;
+    const auto       capture  = MakeDenseCapture(1 << 16);
+    const size_t     n        = capture.size() - capture.size() % kChunk;
+    uint32_t         sum      = 0;
+
+    static FIFO<MidiEvent, 64>        legacy_q;
+    static FIFO<CompactMidiEvent, 64> compact_q;
+    MidiSysExBuffer<1024>             sysex;
+    MidiParser                        parser;
+    parser.Init();
+
+    auto megabytes_per_second = [&](auto replay) {
+        const auto t0 = std::chrono::steady_clock::now();
+        for(int r = 0; r < kRepeats; r++)
+            replay();
+        const auto t1 = std::chrono::steady_clock::now();
+        return n * kRepeats / std::chrono::duration<double>(t1 - t0).count()
+               / 1e6;
+    };
+
+    const double legacy = megabytes_per_second([&]() {
+        for(size_t i = 0; i < n; i += kChunk)
+        {
+            for(size_t j = 0; j < kChunk; j++)
+            {
+                MidiEvent event;
+                if(parser.Parse(capture[i + j], &event))
+                    legacy_q.PushBack(event);
+            }
+            while(!legacy_q.IsEmpty())
+                sum += legacy_q.PopFront().data[0];
+        }
+    });
+
+    parser.SetSysExBuffer(&sysex);
+    const double single = megabytes_per_second([&]() {
+        for(size_t i = 0; i < n; i += kChunk)
+        {
+            for(size_t j = 0; j < kChunk; j++)
+            {
+                CompactMidiEvent event;
+                if(parser.Parse(capture[i + j], &event))
+                {
+                    compact_q.PushBack(event);
+                    sysex.DiscardMessage();
+                }
+            }
+            while(!compact_q.IsEmpty())
+                sum += compact_q.PopFront().data[0];
+        }
+    });
+    const double span = megabytes_per_second([&]() {
+        for(size_t i = 0; i < n; i += kChunk)
+        {
+            parser.Parse(&capture[i], kChunk, compact_q);
+            while(!compact_q.IsEmpty())
+            {
+                const CompactMidiEvent& event = compact_q.Front();
+                sum += event.data[0];
+                if(event.sysex_length > 0)
+                    sysex.Skip(event.sysex_length);
+                compact_q.DropFront();
+            }
+        }
+    });
+
+    printf("[ bench    ] MidiEvent per byte %.1f MB/s, CompactMidiEvent per "
+           "byte %.1f MB/s, span %.1f MB/s\n",
+           legacy,
+           single,
+           span);
+    EXPECT_NE(sum, 1u); // keeps the loops from being optimized away
+}
+
+// ================ USB-MIDI packets ================
+
+namespace
+{
+/** Packs a MIDI byte stream into USB-MIDI event packets on a cable,
+ *  like a USB-MIDI device sends them, with running status expanded.
+ */
+std::vector<uint8_t> ToUsbPackets(const std::vector<uint8_t>& bytes,
+                                  uint8_t                     cable = 0)
+{
+    std::vector<uint8_t> packets;
+    auto add = [&](uint8_t cin, uint8_t b0, uint8_t b1, uint8_t b2) {
+        packets.insert(packets.end(), {uint8_t(cable << 4 | cin), b0, b1, b2});
+    };
+    uint8_t              status = 0;
+    std::vector<uint8_t> data;
+    for(uint8_t byte : bytes)
+    {
+        if(byte >= 0xf8)
+        {
+            add(0xf, byte, 0, 0);
+        }
+        else if(byte == 0xf0)
+        {
+            status = byte;
+            data   = {byte};
+        }
+        else if(status == 0xf0)
+        {
+            data.push_back(byte);
+            if(byte == 0xf7 || data.size() == 3)
+            {
+                // CIN 4 continues, 5 to 7 end with 1 to 3 bytes
+                const uint8_t cin = byte == 0xf7 ? 0x4 + data.size() : 0x4;
+                data.resize(3, 0);
+                add(cin, data[0], data[1], data[2]);
+                data.clear();
+                if(byte == 0xf7)
+                    status = 0;
+            }
+        }
+        else if(byte & 0x80)
+        {
+            status = byte;
+            data.clear();
+        }
+        else
+        {
+            data.push_back(byte);
+            const size_t size = (status & 0xe0) == 0xc0 ? 1 : 2;
+            if(data.size() == size)
+            {
+                add(status >> 4, status, data[0], size == 2 ? data[1] : 0);
+                data.clear();
+            }
+        }
+    }
+    return packets;
+}
+
+/** Like IsSameEvent, but ignores the data bytes that the byte parser
+ *  leaves over from earlier messages */
+bool IsSameUsbEvent(const CompactMidiEvent& a, const CompactMidiEvent& b)
+{
+    if(a.type != b.type || a.channel != b.channel
+       || a.sysex_length != b.sysex_length)
+        return false;
+    if(b.type == SystemRealTime)
+        return a.srt_type == b.srt_type;
+    if(b.type == SystemCommon && b.sc_type == SystemExclusive)
+        return true;
+    const bool one_byte = b.type == ProgramChange || b.type == ChannelPressure;
+    return a.data[0] == b.data[0] && (one_byte || a.data[1] == b.data[1]);
+}
+} // namespace
+
+TEST(MidiParser, usbPacketsMatchBytes)
+{
+    const auto capture = MakeDenseCapture(8192);
+    const auto packets = ToUsbPackets(capture, 1);
+
+    MidiParser single;
+    EventLog   expected;
+    single.Init();
+    single.Parse(capture.data(), capture.size(), expected);
+    ASSERT_GT(expected.events.size(), 1000u);
+
+    // USB transfers hold whole packets
+    for(size_t chunk : {size_t(4), size_t(64), packets.size()})
+    {
+        MidiParser parser;
+        EventLog   log;
+        parser.Init();
+        size_t num_events = 0;
+        for(size_t i = 0; i < packets.size(); i += chunk)
+        {
+            const size_t n = std::min(chunk, packets.size() - i);
+            num_events += parser.ParseUsbPackets(&packets[i], n, log);
+        }
+        EXPECT_EQ(num_events, expected.events.size()) << "chunk " << chunk;
+        EXPECT_TRUE(std::equal(log.events.begin(),
+                               log.events.end(),
+                               expected.events.begin(),
+                               expected.events.end(),
+                               IsSameUsbEvent))
+            << "chunk " << chunk;
+    }
+}
+
+TEST(MidiParser, recordedUsbPackets)
+{
+    // recorded from a USB keyboard on cable 0: a note, the mod wheel,
+    // a bend, a patch change and the reply to an identity request,
+    // interrupted by a clock, and the zero padding of the transfer
+    const uint8_t packets[] = {
+        0x09, 0x90, 0x3c, 0x64, // note on
+        0x0b, 0xb0, 0x01, 0x40, // mod wheel
+        0x0e, 0xe0, 0x00, 0x50, // pitch bend
+        0x09, 0x90, 0x3c, 0x00, // note on, velocity 0
+        0x0c, 0xc0, 0x05, 0x00, // program change
+        0x04, 0xf0, 0x7e, 0x7f, // sysex start
+        0x0f, 0xf8, 0x00, 0x00, // clock
+        0x04, 0x06, 0x02, 0x41, // sysex continues
+        0x06, 0x10, 0xf7, 0x00, // sysex ends with 2 bytes
+        0x0b, 0xb0, 0x7b, 0x00, // all notes off
+        0x03, 0xf2, 0x10, 0x00, // song position
+        0x00, 0x00, 0x00, 0x00, // padding
+        0x08, 0x81,             // partial packet
+    };
+    MidiParser          parser;
+    MidiSysExBuffer<64> sysex;
+    EventLog            log;
+    parser.Init();
+    parser.SetSysExBuffer(&sysex);
+    ASSERT_EQ(parser.ParseUsbPackets(packets, sizeof(packets), log), 9u);
+
+    const auto& e = log.events;
+    EXPECT_EQ(e[0].type, NoteOn);
+    EXPECT_EQ(e[0].data[0], 0x3c);
+    EXPECT_EQ(e[0].data[1], 0x64);
+    EXPECT_EQ(e[1].type, ControlChange);
+    EXPECT_EQ(e[1].data[1], 0x40);
+    EXPECT_EQ(e[2].type, PitchBend);
+    EXPECT_EQ(e[2].AsPitchBend().value, 0x2800 - 8192);
+    EXPECT_EQ(e[3].type, NoteOff);
+    EXPECT_EQ(e[4].type, ProgramChange);
+    EXPECT_EQ(e[4].data[0], 5);
+    EXPECT_EQ(e[5].type, SystemRealTime);
+    EXPECT_EQ(e[5].srt_type, TimingClock);
+    EXPECT_EQ(e[6].type, SystemCommon);
+    EXPECT_EQ(e[6].sc_type, SystemExclusive);
+    EXPECT_EQ(e[6].sysex_length, 6u);
+    EXPECT_EQ(e[7].type, ChannelMode);
+    EXPECT_EQ(e[7].GetChannelModeType(), AllNotesOff);
+    EXPECT_EQ(e[8].sc_type, SongPositionPointer);
+    EXPECT_EQ(e[8].data[0], 0x10);
+
+    const uint8_t expected[] = {0x7e, 0x7f, 0x06, 0x02, 0x41, 0x10};
+    uint8_t       payload[8];
+    ASSERT_EQ(sysex.Read(payload, sizeof(payload)), 6u);
+    EXPECT_TRUE(std::equal(payload, payload + 6, expected));
+}
+
+TEST(MidiParser, invalidUsbPackets)
+{
+    const uint8_t packets[] = {
+        0x09, 0x80, 0x3c, 0x64, // CIN doesn't match the status
+        0x01, 0x90, 0x3c, 0x64, // cable event
+        0x0f, 0x3c, 0x00, 0x00, // single data byte, without a status
+    };
+    MidiParser parser;
+    EventLog   log;
+    parser.Init();
+    EXPECT_EQ(parser.ParseUsbPackets(packets, sizeof(packets), log), 0u);
+}
+
+/** Delivers USB-MIDI packets, like the MidiUsbTransport */
+class MidiUsbPacketTestTransport : public MidiTestTransport
+{
+  public:
+    typedef void (*MidiRxPacketCallback)(const uint8_t* packets,
+                                         size_t         size,
+                                         void*          context);
+
+    void StartRxPackets(MidiRxPacketCallback callback, void* context)
+    {
+        callback_ = callback;
+        context_  = context;
+    }
+
+    static void Receive(const std::vector<uint8_t>& packets)
+    {
+        callback_(packets.data(), packets.size(), context_);
+    }
+
+  private:
+    static MidiRxPacketCallback callback_;
+    static void*                context_;
+};
+
+MidiUsbPacketTestTransport::MidiRxPacketCallback
+      MidiUsbPacketTestTransport::callback_ = nullptr;
+void* MidiUsbPacketTestTransport::context_  = nullptr;
+
+TEST(MidiUsbPackets, handlerReceivesPackets)
+{
+    MidiHandler<MidiUsbPacketTestTransport> midi;
+    midi.Init(MidiHandler<MidiUsbPacketTestTransport>::Config());
+    midi.StartReceive();
+
+    System::SetTickForUnitTest(1234);
+    MidiUsbPacketTestTransport::Receive(
+        ToUsbPackets({0x92, 60, 100, 0xf0, 1, 2, 3, 4, 0xf7, 0xfa}));
+
+    ASSERT_TRUE(midi.HasEvents());
+    MidiEvent event = midi.PopEvent();
+    EXPECT_EQ(event.type, NoteOn);
+    EXPECT_EQ(event.channel, 2);
+    EXPECT_EQ(event.timestamp, 1234u);
+    event = midi.PopEvent();
+    EXPECT_EQ(event.sc_type, SystemExclusive);
+    ASSERT_EQ(event.sysex_message_len, 4u);
+    EXPECT_EQ(event.sysex_data[3], 4);
+    event = midi.PopEvent();
+    EXPECT_EQ(event.srt_type, Start);
+    EXPECT_FALSE(midi.HasEvents());
+}
+
+// Not a pass/fail test: prints how many USB-MIDI packets per second are
+// parsed into the queue, unpacked into a byte stream first as the
+// MidiUsbTransport used to, and decoded straight from the packets.
+// Transfers are 64 bytes, as on a full speed USB bulk endpoint.
+TEST(MidiUsbPackets, z_benchmark)
+{
+    constexpr size_t kTransfer = 64;
+    constexpr int    kRepeats  = 64;
+    const auto       packets   = ToUsbPackets(MakeDenseCapture(1 << 16));
+    const size_t     n = packets.size() - packets.size() % kTransfer;
+    uint32_t         sum = 0;
+
+    static FIFO<CompactMidiEvent, 64> queue;
+    MidiParser                        parser;
+    parser.Init();
+
+    auto packets_per_second = [&](auto replay) {
+        const auto t0 = std::chrono::steady_clock::now();
+        for(int r = 0; r < kRepeats; r++)
+            replay();
+        const auto t1 = std::chrono::steady_clock::now();
+        return n / 4 * kRepeats
+               / std::chrono::duration<double>(t1 - t0).count() / 1e6;
+    };
+    auto drain = [&]() {
+        while(!queue.IsEmpty())
+            sum += queue.PopFront().data[0];
+    };
+
+    const uint8_t sizes[16] = {0, 0, 2, 3, 3, 1, 2, 3, 3, 3, 3, 3, 2, 2, 3, 1};
+    const double  bytes     = packets_per_second([&]() {
+        uint8_t stream[kTransfer];
+        for(size_t i = 0; i < n; i += kTransfer)
+        {
+            size_t size = 0;
+            for(size_t p = i; p < i + kTransfer; p += 4)
+                for(uint8_t b = 0; b < sizes[packets[p] & 0xf]; b++)
+                    stream[size++] = packets[p + 1 + b];
+            parser.Parse(stream, size, queue);
+            drain();
+        }
+    });
+    const double direct = packets_per_second([&]() {
+        for(size_t i = 0; i < n; i += kTransfer)
+        {
+            parser.ParseUsbPackets(&packets[i], kTransfer, queue);
+            drain();
+        }
+    });
+
+    printf("[ bench    ] USB-MIDI: unpacked to bytes %.1f M packets/s, "
+           "decoded %.1f M packets/s\n",
+           bytes,
+           direct);
+    EXPECT_NE(sum, 1u); // keeps the loops from being optimized away
+}
+
+// ================ Transmit ================
+
+/** Records the bytes of each Tx call */
+class MidiTxTestTransport : public MidiTestTransport
+{
+  public:
+    void Tx(uint8_t* buff, size_t size)
+    {
+        transfers.emplace_back(buff, buff + size);
+    }
+
+    static std::vector<std::vector<uint8_t>> transfers;
+};
+
+std::vector<std::vector<uint8_t>> MidiTxTestTransport::transfers;
+
+TEST(MidiTransmit, queuesAreSentInOneTransfer)
+{
+    MidiHandler<MidiTxTestTransport> midi;
+    midi.Init(MidiHandler<MidiTxTestTransport>::Config());
+    MidiTxTestTransport::transfers.clear();
+
+    midi.SendMessage(MidiTxMessage::NoteOn(0, 60, 100));
+    midi.SendMessage(MidiTxMessage::NoteOff(0, 60, 0));
+    midi.SendMessageFromISR(MidiTxMessage::SystemRealtimeClock());
+    midi.TransmitMessages();
+
+    // ISR messages go first
+    const std::vector<uint8_t> expected = {0xf8, 0x90, 60, 100, 0x80, 60, 0};
+    ASSERT_EQ(MidiTxTestTransport::transfers.size(), 1u);
+    EXPECT_EQ(MidiTxTestTransport::transfers[0], expected);
+
+    // nothing left to send
+    midi.TransmitMessages();
+    EXPECT_EQ(MidiTxTestTransport::transfers.size(), 1u);
+}
+
+TEST(MidiTransmit, runningStatus)
+{
+    MidiHandler<MidiTxTestTransport>::Config config;
+    config.running_status_enabled = true;
+    MidiHandler<MidiTxTestTransport> midi;
+    midi.Init(config);
+    MidiTxTestTransport::transfers.clear();
+
+    midi.SendMessage(MidiTxMessage::NoteOn(0, 60, 100));
+    midi.SendMessage(MidiTxMessage::NoteOn(0, 62, 100));
+    // real-time messages don't interrupt the running status
+    midi.SendMessage(MidiTxMessage::SystemRealtimeClock());
+    midi.SendMessage(MidiTxMessage::NoteOn(0, 64, 100));
+    // other system messages do
+    midi.SendMessage(MidiTxMessage::SystemRealtimeStart());
+    MidiTxMessage spp;
+    spp.data[0] = 0xf2;
+    spp.data[1] = 0x10;
+    spp.data[2] = 0x00;
+    spp.size    = 3;
+    midi.SendMessage(spp);
+    midi.SendMessage(MidiTxMessage::NoteOn(0, 65, 100));
+    midi.SendMessage(MidiTxMessage::NoteOn(1, 65, 100));
+    midi.TransmitMessages();
+
+    const std::vector<uint8_t> expected = {0x90, 60, 100, // note on
+                                           62,   100,     // running status
+                                           0xf8,          // clock
+                                           64,   100,     // running status
+                                           0xfa,          // start
+                                           0xf2, 0x10, 0x00, // spp
+                                           0x90, 65,   100,  // note on
+                                           0x91, 65,   100};
+    ASSERT_EQ(MidiTxTestTransport::transfers.size(), 1u);
+    EXPECT_EQ(MidiTxTestTransport::transfers[0], expected);
+
+    // the running status ends with the transfer
+    midi.SendMessage(MidiTxMessage::NoteOn(1, 67, 100));
+    midi.TransmitMessages();
+    ASSERT_EQ(MidiTxTestTransport::transfers.size(), 2u);
+    EXPECT_EQ(MidiTxTestTransport::transfers[1].size(), 3u);
+}
+
+TEST(MidiTransmit, overflowStaysQueued)
+{
+    // room for two note messages per transfer
+    MidiHandler<MidiTxTestTransport, 4, 8, 4, 7> midi;
+    midi.Init(MidiHandler<MidiTxTestTransport, 4, 8, 4, 7>::Config());
+    MidiTxTestTransport::transfers.clear();
+
+    for(uint8_t i = 0; i < 5; i++)
+        midi.SendMessage(MidiTxMessage::NoteOn(0, i, 100));
+    midi.TransmitMessages();
+    midi.TransmitMessages();
+    midi.TransmitMessages();
+
+    ASSERT_EQ(MidiTxTestTransport::transfers.size(), 3u);
+    EXPECT_EQ(MidiTxTestTransport::transfers[0].size(), 6u);
+    EXPECT_EQ(MidiTxTestTransport::transfers[1].size(), 6u);
+    EXPECT_EQ(MidiTxTestTransport::transfers[2].size(), 3u);
+    uint8_t note = 0;
+    for(const auto& transfer : MidiTxTestTransport::transfers)
+        for(size_t i = 0; i < transfer.size(); i += 3)
+            EXPECT_EQ(transfer[i + 1], note++);
+}
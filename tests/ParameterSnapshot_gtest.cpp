@@ -0,0 +1,153 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <thread>
+#include "util/ParameterSnapshot.h"
+
+using namespace daisy;
+
+namespace
+{
+// Every field holds the same value, so a torn read is easy to detect
+struct Params
+{
+    static constexpr size_t kNumFields = 32;
+    uint32_t                fields[kNumFields];
+
+    Params(uint32_t value = 0) { Set(value); }
+    void Set(uint32_t value)
+    {
+        for(auto& field : fields)
+            field = value;
+    }
+    bool IsConsistent() const
+    {
+        for(auto field : fields)
+            if(field != fields[0])
+                return false;
+        return true;
+    }
+};
+constexpr size_t Params::kNumFields;
+} // namespace
+
+TEST(util_ParameterSnapshot, a_initialValue)
+{
+    ParameterSnapshot<Params> snapshot(Params(7));
+    EXPECT_FALSE(snapshot.HasUpdate());
+    EXPECT_EQ(snapshot.Read().fields[0], 7u);
+    EXPECT_EQ(snapshot.GetReadVersion(), 0u);
+    EXPECT_EQ(snapshot.Edit().fields[0], 7u);
+    EXPECT_EQ(snapshot.GetPublishedVersion(), 0u);
+}
+
+TEST(util_ParameterSnapshot, b_publishAndRead)
+{
+    ParameterSnapshot<int> snapshot;
+    snapshot.Edit() = 1;
+    // not visible until published
+    EXPECT_EQ(snapshot.Read(), 0);
+    snapshot.Publish();
+    EXPECT_TRUE(snapshot.HasUpdate());
+    EXPECT_EQ(snapshot.Read(), 1);
+    EXPECT_FALSE(snapshot.HasUpdate());
+    EXPECT_EQ(snapshot.GetReadVersion(), 1u);
+
+    // the same value is returned until the next publish
+    EXPECT_EQ(snapshot.Read(), 1);
+    EXPECT_EQ(snapshot.GetReadVersion(), 1u);
+}
+
+TEST(util_ParameterSnapshot, c_readerSkipsToLatest)
+{
+    ParameterSnapshot<int> snapshot;
+    for(int i = 1; i <= 5; i++)
+        snapshot.Publish(i * 10);
+    EXPECT_EQ(snapshot.GetPublishedVersion(), 5u);
+    EXPECT_EQ(snapshot.Read(), 50);
+    EXPECT_EQ(snapshot.GetReadVersion(), 5u);
+}
+
+TEST(util_ParameterSnapshot, d_editContinuesFromLastPublish)
+{
+    ParameterSnapshot<Params> snapshot;
+    snapshot.Edit().fields[0] = 1;
+    snapshot.Publish();
+    snapshot.Edit().fields[1] = 2;
+    snapshot.Publish();
+    snapshot.Edit().fields[2] = 3;
+    snapshot.Publish();
+    const Params& p = snapshot.Read();
+    EXPECT_EQ(p.fields[0], 1u);
+    EXPECT_EQ(p.fields[1], 2u);
+    EXPECT_EQ(p.fields[2], 3u);
+}
+
+TEST(util_ParameterSnapshot, e_referenceIsStableWhileWriting)
+{
+    ParameterSnapshot<int> snapshot;
+    snapshot.Publish(1);
+    const int& value = snapshot.Read();
+    // the writer must never touch the copy the reader holds
+    for(int i = 2; i < 10; i++)
+        snapshot.Publish(i);
+    EXPECT_EQ(value, 1);
+    EXPECT_EQ(snapshot.Read(), 9);
+}
+
+TEST(util_ParameterSnapshot, f_threadStressTest)
+{
+    // one writer and one reader thread hammer the snapshot. The reader must
+    // only ever see complete values, and versions must never go backwards.
+    constexpr uint32_t        num_publishes = 200000;
+    ParameterSnapshot<Params> snapshot;
+    std::atomic<bool>         done(false);
+    uint32_t                  torn_reads = 0, out_of_order = 0, reads = 0;
+    uint32_t                  distinct_versions = 0;
+
+    std::thread reader([&]() {
+        uint32_t last_version = 0;
+        while(!done.load())
+        {
+            const Params&  p       = snapshot.Read();
+            const uint32_t version = snapshot.GetReadVersion();
+            reads++;
+            if(!p.IsConsistent())
+                torn_reads++;
+            // the value written for each version equals the version
+            if(p.fields[0] != version)
+                torn_reads++;
+            if(version < last_version)
+                out_of_order++;
+            if(version != last_version)
+                distinct_versions++;
+            last_version = version;
+            std::this_thread::yield();
+        }
+    });
+
+    std::thread writer([&]() {
+        for(uint32_t i = 1; i <= num_publishes; i++)
+        {
+            snapshot.Edit().Set(i);
+            snapshot.Publish();
+            // let the reader in now and then, even on a single core
+            if(i % 64 == 0)
+                std::this_thread::yield();
+        }
+        done.store(true);
+    });
+
+    writer.join();
+    reader.join();
+
+    EXPECT_EQ(torn_reads, 0u);
+    EXPECT_EQ(out_of_order, 0u);
+    EXPECT_GT(reads, 0u);
+    // the final value is always picked up
+    EXPECT_EQ(snapshot.Read().fields[0], num_publishes);
+    EXPECT_EQ(snapshot.GetReadVersion(), num_publishes);
+    printf("[ stress   ] %u reads saw %u of %u versions\n",
+           reads,
+           distinct_versions,
+           num_publishes);
+}
@@ -0,0 +1,256 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include "util/ringbuffer.h"
+
+using namespace daisy;
+
+TEST(util_SpscRingBuffer, a_singleElements)
+{
+    SpscRingBuffer<int, 4> buffer;
+    EXPECT_EQ(buffer.capacity(), 4u);
+    EXPECT_TRUE(buffer.isEmpty());
+    EXPECT_EQ(buffer.writable(), 4u);
+
+    int v;
+    EXPECT_FALSE(buffer.Read(v));
+    // all elements can be used
+    for(int i = 0; i < 4; i++)
+        EXPECT_TRUE(buffer.Write(i));
+    EXPECT_FALSE(buffer.Write(4));
+    EXPECT_EQ(buffer.readable(), 4u);
+    EXPECT_EQ(buffer.writable(), 0u);
+
+    for(int i = 0; i < 4; i++)
+    {
+        EXPECT_TRUE(buffer.Read(v));
+        EXPECT_EQ(v, i);
+    }
+    EXPECT_FALSE(buffer.Read(v));
+    EXPECT_TRUE(buffer.isEmpty());
+}
+
+TEST(util_SpscRingBuffer, b_bulkWrapsAround)
+{
+    SpscRingBuffer<int, 8> buffer;
+    int                    in[12], out[12];
+    for(int i = 0; i < 12; i++)
+        in[i] = i;
+
+    // move the positions off zero, so the bulk access has to wrap
+    EXPECT_EQ(buffer.Write(in, 5), 5u);
+    EXPECT_EQ(buffer.Read(out, 5), 5u);
+
+    // only what fits is written
+    EXPECT_EQ(buffer.Write(in, 12), 8u);
+    EXPECT_EQ(buffer.Write(in, 1), 0u);
+    // only what is available is read
+    EXPECT_EQ(buffer.Read(out, 12), 8u);
+    for(int i = 0; i < 8; i++)
+        EXPECT_EQ(out[i], i);
+    EXPECT_EQ(buffer.Read(out, 1), 0u);
+}
+
+TEST(util_SpscRingBuffer, c_spans)
+{
+    SpscRingBuffer<uint8_t, 8> buffer;
+    uint8_t                    scratch[6];
+    buffer.Write(scratch, 6);
+    buffer.Read(scratch, 6);
+
+    // 2 elements up to the end, then 6 from the start
+    auto span = buffer.PeekWrite();
+    ASSERT_EQ(span.num_elements, 2u);
+    span.data[0] = 10;
+    span.data[1] = 11;
+    // nothing is readable before the commit
+    EXPECT_EQ(buffer.PeekRead().num_elements, 0u);
+    buffer.CommitWrite(2);
+
+    span = buffer.PeekWrite();
+    ASSERT_EQ(span.num_elements, 6u);
+    EXPECT_EQ(span.data, buffer.PeekWrite().data);
+    for(size_t i = 0; i < 3; i++)
+        span.data[i] = 12 + i;
+    buffer.CommitWrite(3);
+    EXPECT_EQ(buffer.readable(), 5u);
+
+    auto read = buffer.PeekRead();
+    ASSERT_EQ(read.num_elements, 2u);
+    EXPECT_EQ(read.data[0], 10);
+    EXPECT_EQ(read.data[1], 11);
+    buffer.CommitRead(2);
+    read = buffer.PeekRead();
+    ASSERT_EQ(read.num_elements, 3u);
+    EXPECT_EQ(read.data[0], 12);
+    EXPECT_EQ(read.data[2], 14);
+    // partial commits are allowed
+    buffer.CommitRead(1);
+    EXPECT_EQ(buffer.PeekRead().data[0], 13);
+
+    buffer.Flush();
+    EXPECT_TRUE(buffer.isEmpty());
+    EXPECT_EQ(buffer.writable(), 8u);
+}
+
+TEST(util_SpscRingBuffer, d_threadStressTest)
+{
+    // A producer thread writes a counting sequence, alternating between
+    // single writes and spans, and a consumer thread checks the sequence.
+    constexpr uint32_t           num_values = 200000;
+    SpscRingBuffer<uint32_t, 64> buffer;
+    std::atomic<bool>            failed(false);
+
+    std::thread producer([&]() {
+        uint32_t next = 0;
+        while(next < num_values)
+        {
+            const uint32_t prev = next;
+            if(next % 2)
+            {
+                if(buffer.Write(next))
+                    next++;
+            }
+            else
+            {
+                auto   span = buffer.PeekWrite();
+                size_t n    = 0;
+                while(n < span.num_elements && next < num_values)
+                    span.data[n++] = next++;
+                buffer.CommitWrite(n);
+            }
+            // let the consumer in when full, even on a single core
+            if(next == prev)
+                std::this_thread::yield();
+        }
+    });
+
+    std::thread consumer([&]() {
+        uint32_t expected = 0;
+        uint32_t values[16];
+        while(expected < num_values && !failed)
+        {
+            const size_t n = buffer.Read(values, 16);
+            for(size_t i = 0; i < n; i++)
+                if(values[i] != expected++)
+                    failed = true;
+            auto span = buffer.PeekRead();
+            for(size_t i = 0; i < span.num_elements; i++)
+                if(span.data[i] != expected++)
+                    failed = true;
+            buffer.CommitRead(span.num_elements);
+            if(n == 0 && span.num_elements == 0)
+                std::this_thread::yield();
+        }
+    });
+
+    producer.join();
+    consumer.join();
+    EXPECT_FALSE(failed);
+    EXPECT_TRUE(buffer.isEmpty());
+}
+
+namespace
+{
+constexpr size_t kBenchSize  = 1024;
+constexpr size_t kBenchBytes = 1 << 24;
+constexpr size_t kBenchChunk = 48;
+
+template <typename Fn>
+double MegabytesPerSecond(Fn fn)
+{
+    const auto   t0 = std::chrono::steady_clock::now();
+    const size_t n  = fn();
+    const auto   t1 = std::chrono::steady_clock::now();
+    return n / std::chrono::duration<double>(t1 - t0).count() / 1e6;
+}
+
+RingBuffer<uint8_t, kBenchSize>     legacy;
+SpscRingBuffer<uint8_t, kBenchSize> spsc;
+} // namespace
+
+// Not a pass/fail test: prints the throughput of RingBuffer and
+// SpscRingBuffer, element by element and in chunks (like a USB packet
+// or a DMA transfer) that are summed up by the reader, so changes can
+// be compared.
+TEST(util_SpscRingBuffer, z_benchmark)
+{
+    uint8_t  chunk[kBenchChunk] = {};
+    uint32_t sum                = 0;
+
+    const double legacy_single = MegabytesPerSecond([&]() {
+        legacy.Init();
+        for(size_t i = 0; i < kBenchBytes; i++)
+        {
+            legacy.Write((uint8_t)i);
+            sum += legacy.Read();
+        }
+        return kBenchBytes;
+    });
+    const double spsc_single = MegabytesPerSecond([&]() {
+        spsc.Init();
+        for(size_t i = 0; i < kBenchBytes; i++)
+        {
+            uint8_t v;
+            spsc.Write((uint8_t)i);
+            spsc.Read(v);
+            sum += v;
+        }
+        return kBenchBytes;
+    });
+    const double legacy_bulk = MegabytesPerSecond([&]() {
+        legacy.Init();
+        for(size_t i = 0; i < kBenchBytes; i += kBenchChunk)
+        {
+            legacy.Overwrite(chunk, kBenchChunk);
+            legacy.ImmediateRead(chunk, kBenchChunk);
+            for(size_t j = 0; j < kBenchChunk; j++)
+                sum += chunk[j];
+            chunk[i % kBenchChunk]++;
+        }
+        return kBenchBytes;
+    });
+    const double spsc_bulk = MegabytesPerSecond([&]() {
+        spsc.Init();
+        for(size_t i = 0; i < kBenchBytes; i += kBenchChunk)
+        {
+            spsc.Write(chunk, kBenchChunk);
+            spsc.Read(chunk, kBenchChunk);
+            for(size_t j = 0; j < kBenchChunk; j++)
+                sum += chunk[j];
+            chunk[i % kBenchChunk]++;
+        }
+        return kBenchBytes;
+    });
+    const double spsc_span = MegabytesPerSecond([&]() {
+        spsc.Init();
+        for(size_t i = 0; i < kBenchBytes; i += kBenchChunk)
+        {
+            spsc.Write(chunk, kBenchChunk);
+            // consume in place, like the USB MIDI parser does
+            for(int part = 0; part < 2; part++)
+            {
+                auto span = spsc.PeekRead();
+                for(size_t j = 0; j < span.num_elements; j++)
+                    sum += span.data[j];
+                spsc.CommitRead(span.num_elements);
+            }
+            chunk[i % kBenchChunk]++;
+        }
+        return kBenchBytes;
+    });
+
+    printf("[ bench    ] single: RingBuffer %.1f MB/s, SpscRingBuffer %.1f "
+           "MB/s\n",
+           legacy_single,
+           spsc_single);
+    printf("[ bench    ] %zu-byte chunks: RingBuffer %.1f MB/s, "
+           "SpscRingBuffer %.1f MB/s (copy), %.1f MB/s (in place)\n",
+           kBenchChunk,
+           legacy_bulk,
+           spsc_bulk,
+           spsc_span);
+    EXPECT_NE(sum, 1u); // keeps the loops from being optimized away
+}
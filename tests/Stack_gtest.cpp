@@ -157,4 +157,88 @@ TEST_F(util_Stack, i_countEqualTo)
     EXPECT_EQ(stack_.CountEqualTo(1), 1u);
     EXPECT_EQ(stack_.CountEqualTo(2), 2u);
     EXPECT_EQ(stack_.CountEqualTo(3), 0u);
-}
\ No newline at end of file
+}
+namespace
+{
+// Counts how often elements are copied
+struct Tracked
+{
+    static int copies;
+    int        value;
+
+    Tracked(int v = 0) : value(v) {}
+    Tracked(int a, int b) : value(a + b) {}
+    Tracked(const Tracked& other) : value(other.value) { copies++; }
+    Tracked(Tracked&& other) : value(other.value) {}
+    Tracked& operator=(const Tracked& other)
+    {
+        value = other.value;
+        copies++;
+        return *this;
+    }
+    Tracked& operator=(Tracked&& other)
+    {
+        value = other.value;
+        return *this;
+    }
+};
+int Tracked::copies = 0;
+} // namespace
+
+TEST_F(util_Stack, j_emplaceAndMove)
+{
+    Stack<Tracked, 4> stack;
+    Tracked::copies = 0;
+
+    EXPECT_TRUE(stack.EmplaceBack(1, 2));
+    EXPECT_TRUE(stack.PushBack(Tracked(4)));
+    EXPECT_TRUE(stack.EmplaceBack(5));
+    EXPECT_EQ(stack.PopBack().value, 5);
+    // elements are shifted by moving them
+    EXPECT_TRUE(stack.Remove(0));
+    EXPECT_EQ(Tracked::copies, 0);
+
+    // inserting at the front works, too
+    EXPECT_TRUE(stack.Insert(0, Tracked(6)));
+    EXPECT_EQ(Tracked::copies, 1);
+    EXPECT_EQ(stack[0].value, 6);
+    EXPECT_EQ(stack[1].value, 4);
+
+    EXPECT_TRUE(stack.EmplaceBack(7));
+    EXPECT_TRUE(stack.EmplaceBack(8));
+    EXPECT_FALSE(stack.EmplaceBack(9));
+}
+
+TEST_F(util_Stack, k_bulkPushAndPop)
+{
+    int in[]   = {1, 2, 3, 4};
+    int out[4] = {};
+
+    // only what fits is added
+    EXPECT_EQ(stack_.PushBack(in, 2), 2u);
+    EXPECT_EQ(stack_.PushBack(in + 2, 2), 1u);
+    EXPECT_TRUE(stack_.IsFull());
+    EXPECT_EQ(stack_[2], 3);
+
+    // popped in the order PopBack() would return them
+    EXPECT_EQ(stack_.PopBack(out, 2), 2u);
+    EXPECT_EQ(out[0], 3);
+    EXPECT_EQ(out[1], 2);
+    EXPECT_EQ(stack_.PopBack(out, 4), 1u);
+    EXPECT_EQ(out[0], 1);
+    EXPECT_TRUE(stack_.IsEmpty());
+}
+
+TEST_F(util_Stack, l_backAndDrop)
+{
+    stack_.PushBack({1, 2, 3});
+    EXPECT_EQ(stack_.Back(), 3);
+    stack_.Back() = 4;
+    EXPECT_EQ(stack_[2], 4);
+
+    EXPECT_EQ(stack_.DropBack(), 1u);
+    EXPECT_EQ(stack_.Back(), 2);
+    // can't drop more than there is
+    EXPECT_EQ(stack_.DropBack(5), 2u);
+    EXPECT_TRUE(stack_.IsEmpty());
+}
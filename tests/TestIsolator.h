@@ -55,7 +55,10 @@ class TestIsolator
   private:
     std::string GetCurrentTestName()
     {
-        return ::testing::UnitTest::GetInstance()->current_test_info()->name();
+        // outside of a test, e.g. in the fuzz targets, there's a single state
+        const auto info
+            = ::testing::UnitTest::GetInstance()->current_test_info();
+        return info != nullptr ? info->name() : "";
     }
 
     std::mutex                                    mutex_;
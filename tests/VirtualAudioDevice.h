@@ -0,0 +1,291 @@
+#pragma once
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <vector>
+#include "hid/audio.h"
+#include "hid/audio_convert.h"
+#include "util/wav_format.h"
+
+namespace daisy
+{
+/** Runs an AudioHandle on the host, using the host implementation of
+ *  SaiHandle that is compiled for unit tests.
+ *
+ *  Input comes from a WAV file or a generator function, and every block is
+ *  converted to SAI words, passed through the registered audio callback
+ *  (including all of AudioHandle's format conversion), and collected as float.
+ *  Blocks are processed as fast as possible, and the throughput is measured,
+ *  which makes it usable for offline A/B comparisons of callback code.
+ *
+ *  Usage:
+ *      VirtualAudioDevice device;
+ *      device.Init(VirtualAudioDevice::Config());
+ *      device.SetInputGenerator([](size_t chn, size_t frame) { return 0.f; });
+ *      device.GetAudioHandle().Start(MyCallback);
+ *      device.Run(1000);
+ *      device.WriteOutputWav("out.wav");
+ */
+class VirtualAudioDevice
+{
+  public:
+    struct Config
+    {
+        size_t                      blocksize  = 48;
+        SaiHandle::Config::BitDepth bit_depth  = SaiHandle::Config::BitDepth::SAI_24BIT;
+        SaiHandle::Config::SampleRate samplerate
+            = SaiHandle::Config::SampleRate::SAI_48KHZ;
+        /** use two SAIs for 4 channels of audio */
+        bool  dual_sai = false;
+        float postgain = 1.f;
+    };
+
+    /** Returns a sample for a channel and an absolute frame index */
+    using Generator = std::function<float(size_t channel, size_t frame)>;
+
+    /** Initializes the host SAIs and the AudioHandle. */
+    AudioHandle::Result Init(const Config& config)
+    {
+        config_ = config;
+        SaiHandle::Config sai_config;
+        sai_config.periph    = SaiHandle::Config::Peripheral::SAI_1;
+        sai_config.sr        = config.samplerate;
+        sai_config.bit_depth = config.bit_depth;
+        sai_config.a_sync    = SaiHandle::Config::Sync::MASTER;
+        sai_config.b_sync    = SaiHandle::Config::Sync::SLAVE;
+        sai_config.a_dir     = SaiHandle::Config::Direction::TRANSMIT;
+        sai_config.b_dir     = SaiHandle::Config::Direction::RECEIVE;
+        sai_[0].Init(sai_config);
+        sai_config.periph = SaiHandle::Config::Peripheral::SAI_2;
+        sai_[1].Init(sai_config);
+
+        AudioHandle::Config audio_config;
+        audio_config.blocksize  = config.blocksize;
+        audio_config.samplerate = config.samplerate;
+        audio_config.postgain   = config.postgain;
+        const auto result
+            = config.dual_sai ? audio_.Init(audio_config, sai_[0], sai_[1])
+                              : audio_.Init(audio_config, sai_[0]);
+        input_.clear();
+        output_.clear();
+        generator_    = nullptr;
+        frames_run_   = 0;
+        blocks_per_s_ = 0.0;
+        return result;
+    }
+
+    AudioHandle& GetAudioHandle() { return audio_; }
+
+    /** Returns the SAI, e.g. for simulating DMA events */
+    SaiHandle& GetSai(size_t idx) { return sai_[idx]; }
+
+    size_t GetChannels() const { return config_.dual_sai ? 4 : 2; }
+
+    /** Uses a generator function as the input signal */
+    void SetInputGenerator(Generator generator)
+    {
+        generator_ = generator;
+        input_.clear();
+    }
+
+    /** Uses interleaved float samples as the input signal.
+     *  The input is looped if more blocks are run than it contains. */
+    void SetInput(const std::vector<float>& interleaved, size_t channels)
+    {
+        generator_ = nullptr;
+        input_.assign(interleaved.size() / channels * GetChannels(), 0.f);
+        const size_t frames = interleaved.size() / channels;
+        for(size_t f = 0; f < frames; f++)
+            for(size_t c = 0; c < channels && c < GetChannels(); c++)
+                input_[f * GetChannels() + c] = interleaved[f * channels + c];
+    }
+
+    /** Loads a 16/24/32-bit PCM or 32-bit float WAV file as the input signal.
+     *  \return false if the file can't be read or has an unsupported format */
+    bool LoadInputWav(const char* path)
+    {
+        FILE* f = fopen(path, "rb");
+        if(!f)
+            return false;
+        std::vector<uint8_t> file;
+        uint8_t              chunk[4096];
+        size_t               n;
+        while((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+            file.insert(file.end(), chunk, chunk + n);
+        fclose(f);
+
+        if(file.size() < 12 || ReadU32(&file[0]) != kWavFileChunkId
+           || ReadU32(&file[8]) != kWavFileWaveId)
+            return false;
+
+        uint16_t       format = 0, channels = 0, bits = 0;
+        const uint8_t* data      = nullptr;
+        size_t         data_size = 0;
+        for(size_t pos = 12; pos + 8 <= file.size();)
+        {
+            const uint32_t id   = ReadU32(&file[pos]);
+            const uint32_t size = ReadU32(&file[pos + 4]);
+            const size_t   body = pos + 8;
+            if(body + size > file.size())
+                break;
+            if(id == kWavFileSubChunk1Id && size >= 16)
+            {
+                format   = ReadU16(&file[body]);
+                channels = ReadU16(&file[body + 2]);
+                bits     = ReadU16(&file[body + 14]);
+            }
+            else if(id == kWavFileSubChunk2Id)
+            {
+                data      = &file[body];
+                data_size = size;
+            }
+            pos = body + size + (size & 1);
+        }
+        if(!data || channels == 0)
+            return false;
+        const bool pcm = format == WAVE_FORMAT_PCM
+                         && (bits == 16 || bits == 24 || bits == 32);
+        if(!pcm && !(format == WAVE_FORMAT_IEEE_FLOAT && bits == 32))
+            return false;
+
+        const size_t       bytes = bits / 8;
+        std::vector<float> samples(data_size / bytes);
+        for(size_t i = 0; i < samples.size(); i++)
+        {
+            const uint8_t* p = data + i * bytes;
+            if(format == WAVE_FORMAT_PCM && bits == 16)
+                samples[i] = s162f((int16_t)ReadU16(p));
+            else if(format == WAVE_FORMAT_PCM && bits == 24)
+                samples[i] = s242f(p[0] | (p[1] << 8) | (p[2] << 16));
+            else if(format == WAVE_FORMAT_PCM && bits == 32)
+                samples[i] = s322f((int32_t)ReadU32(p));
+            else if(format == WAVE_FORMAT_IEEE_FLOAT && bits == 32)
+                memcpy(&samples[i], p, sizeof(float));
+            else
+                return false;
+        }
+        SetInput(samples, channels);
+        return true;
+    }
+
+    /** Processes a number of blocks through the audio callback as fast as
+     *  possible. The AudioHandle must be started before calling this.
+     *  \return the number of blocks per second that were processed */
+    double Run(size_t num_blocks)
+    {
+        const size_t blocksize = audio_.GetConfig().blocksize;
+        const size_t chns      = GetChannels();
+        const auto   bd        = config_.bit_depth;
+        const size_t num_sai   = chns / 2;
+
+        std::vector<float>   frame_in(blocksize * 2);
+        std::vector<float>   frame_out(blocksize * 2);
+        std::vector<int32_t> rx(blocksize * 2);
+
+        const size_t first = output_.size() / chns;
+        output_.resize(output_.size() + num_blocks * blocksize * chns);
+
+        double seconds = 0.0;
+        for(size_t b = 0; b < num_blocks; b++)
+        {
+            const size_t frame0 = frames_run_;
+            // the second SAI has no callback, so it has to be transferred
+            // first, just like its DMA runs in lock-step on hardware.
+            for(size_t s = num_sai; s-- > 0;)
+            {
+                for(size_t i = 0; i < blocksize; i++)
+                {
+                    frame_in[2 * i]     = InputSample(2 * s, frame0 + i);
+                    frame_in[2 * i + 1] = InputSample(2 * s + 1, frame0 + i);
+                }
+                FloatToSai(frame_in.data(), rx.data(), rx.size(), bd, 1.f);
+                const auto t0 = std::chrono::steady_clock::now();
+                sai_[s].TransferForUnitTest(rx.data());
+                const auto t1 = std::chrono::steady_clock::now();
+                seconds += std::chrono::duration<double>(t1 - t0).count();
+            }
+            for(size_t s = 0; s < num_sai; s++)
+            {
+                SaiToFloat(sai_[s].GetTxForUnitTest(),
+                           frame_out.data(),
+                           frame_out.size(),
+                           bd,
+                           1.f);
+                float* dest = &output_[(first + b * blocksize) * chns];
+                for(size_t i = 0; i < blocksize; i++)
+                {
+                    dest[i * chns + 2 * s]     = frame_out[2 * i];
+                    dest[i * chns + 2 * s + 1] = frame_out[2 * i + 1];
+                }
+            }
+            frames_run_ += blocksize;
+        }
+        blocks_per_s_ = seconds > 0.0 ? num_blocks / seconds : 0.0;
+        return blocks_per_s_;
+    }
+
+    /** Returns the interleaved output of all blocks run so far */
+    const std::vector<float>& GetOutput() const { return output_; }
+
+    /** Returns the throughput measured by the last call to Run() */
+    double GetBlocksPerSecond() const { return blocks_per_s_; }
+
+    /** Writes the output collected so far as a 32-bit float WAV file */
+    bool WriteOutputWav(const char* path)
+    {
+        FILE* f = fopen(path, "wb");
+        if(!f)
+            return false;
+        WAV_FormatTypeDef header;
+        const uint32_t    data_size = output_.size() * sizeof(float);
+        const uint32_t    rate      = (uint32_t)audio_.GetSampleRate();
+        header.ChunkId       = kWavFileChunkId;
+        header.FileSize      = sizeof(header) - 8 + data_size;
+        header.FileFormat    = kWavFileWaveId;
+        header.SubChunk1ID   = kWavFileSubChunk1Id;
+        header.SubChunk1Size = 16;
+        header.AudioFormat   = WAVE_FORMAT_IEEE_FLOAT;
+        header.NbrChannels   = GetChannels();
+        header.SampleRate    = rate;
+        header.ByteRate      = rate * GetChannels() * sizeof(float);
+        header.BlockAlign    = GetChannels() * sizeof(float);
+        header.BitPerSample  = 32;
+        header.SubChunk2ID   = kWavFileSubChunk2Id;
+        header.SubCHunk2Size = data_size;
+        const bool ok
+            = fwrite(&header, sizeof(header), 1, f) == 1
+              && fwrite(output_.data(), sizeof(float), output_.size(), f)
+                     == output_.size();
+        fclose(f);
+        return ok;
+    }
+
+  private:
+    float InputSample(size_t channel, size_t frame) const
+    {
+        if(generator_)
+            return generator_(channel, frame);
+        if(input_.empty())
+            return 0.f;
+        const size_t frames = input_.size() / GetChannels();
+        return input_[(frame % frames) * GetChannels() + channel];
+    }
+
+    static uint16_t ReadU16(const uint8_t* p) { return p[0] | (p[1] << 8); }
+    static uint32_t ReadU32(const uint8_t* p)
+    {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+
+    Config             config_;
+    SaiHandle          sai_[2];
+    AudioHandle        audio_;
+    Generator          generator_;
+    std::vector<float> input_;
+    std::vector<float> output_;
+    size_t             frames_run_   = 0;
+    double             blocks_per_s_ = 0.0;
+};
+
+} // namespace daisy
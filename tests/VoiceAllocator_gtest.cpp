@@ -0,0 +1,195 @@
+#include <gtest/gtest.h>
+#include "util/VoiceAllocator.h"
+
+using namespace daisy;
+
+using Allocator = VoiceAllocator<4>;
+
+static Allocator::Config MakeConfig(Allocator::Mode mode)
+{
+    Allocator::Config config;
+    config.mode = mode;
+    return config;
+}
+
+static CompactMidiEvent
+MakeEvent(MidiMessageType type, uint8_t channel, uint8_t d0, uint8_t d1 = 0)
+{
+    CompactMidiEvent event;
+    event.type         = type;
+    event.channel      = channel;
+    event.data[0]      = d0;
+    event.data[1]      = d1;
+    event.sysex_length = 0;
+    return event;
+}
+
+TEST(util_VoiceAllocator, a_reusesReleasedVoicesInTurn)
+{
+    Allocator voices;
+    voices.Init();
+    EXPECT_EQ(voices.GetNumActive(), 0u);
+
+    // staccato notes cycle through the voices
+    for(size_t i = 0; i < 6; i++)
+    {
+        EXPECT_EQ(voices.NoteOn(0, 60 + i, 100), i % 4);
+        EXPECT_TRUE(voices.GetVoice(i % 4).IsGateOn());
+        EXPECT_EQ(voices.NoteOff(0, 60 + i), i % 4);
+        EXPECT_FALSE(voices.GetVoice(i % 4).IsGateOn());
+    }
+    EXPECT_EQ(voices.GetVoice(1).trigger_count, 2u);
+    EXPECT_EQ(voices.GetVoice(3).trigger_count, 1u);
+
+    // a voice released early is reused last
+    voices.NoteOn(0, 60, 100); // 2
+    voices.NoteOn(0, 61, 100); // 3
+    voices.NoteOff(0, 60);
+    EXPECT_EQ(voices.NoteOn(0, 62, 100), 0u);
+    EXPECT_EQ(voices.NoteOn(0, 63, 100), 1u);
+    EXPECT_EQ(voices.NoteOn(0, 64, 100), 2u);
+    EXPECT_EQ(voices.GetNumActive(), 4u);
+
+    // unknown notes
+    EXPECT_EQ(voices.NoteOff(0, 65), Allocator::kNoVoice);
+    EXPECT_EQ(voices.NoteOff(1, 64), Allocator::kNoVoice);
+    EXPECT_EQ(voices.FindVoice(0, 64), 2u);
+    EXPECT_EQ(voices.FindVoice(0, 60), Allocator::kNoVoice);
+}
+
+TEST(util_VoiceAllocator, b_retrigger)
+{
+    Allocator voices;
+    voices.Init();
+    voices.NoteOn(0, 60, 100);
+    voices.NoteOn(0, 62, 100);
+    EXPECT_EQ(voices.NoteOn(0, 60, 50), 0u);
+    EXPECT_EQ(voices.GetVoice(0).trigger_count, 2u);
+    EXPECT_EQ(voices.GetVoice(0).velocity, 50);
+    EXPECT_EQ(voices.GetNumActive(), 2u);
+    // on another channel, the note gets its own voice
+    EXPECT_EQ(voices.NoteOn(1, 60, 100), 2u);
+}
+
+TEST(util_VoiceAllocator, c_stealOldest)
+{
+    Allocator voices;
+    voices.Init(MakeConfig(Allocator::Mode::StealOldest));
+    for(uint8_t n = 0; n < 4; n++)
+        voices.NoteOn(0, 60 + n, 100);
+    // retriggering makes a note young again
+    voices.NoteOn(0, 60, 100);
+    EXPECT_EQ(voices.NoteOn(0, 70, 100), 1u);
+    EXPECT_EQ(voices.NoteOn(0, 71, 100), 2u);
+    EXPECT_EQ(voices.FindVoice(0, 61), Allocator::kNoVoice);
+    EXPECT_EQ(voices.NoteOff(0, 61), Allocator::kNoVoice);
+    EXPECT_EQ(voices.GetVoice(1).note, 70);
+    EXPECT_EQ(voices.GetNumActive(), 4u);
+}
+
+TEST(util_VoiceAllocator, d_roundRobin)
+{
+    Allocator voices;
+    voices.Init(MakeConfig(Allocator::Mode::RoundRobin));
+    for(uint8_t n = 0; n < 4; n++)
+        voices.NoteOn(0, 60 + n, 100);
+    voices.NoteOn(0, 61, 100); // retrigger voice 1
+    EXPECT_EQ(voices.NoteOn(0, 70, 100), 2u);
+    EXPECT_EQ(voices.NoteOn(0, 71, 100), 3u);
+    EXPECT_EQ(voices.NoteOn(0, 72, 100), 0u);
+}
+
+TEST(util_VoiceAllocator, e_lowestPriority)
+{
+    Allocator voices;
+    voices.Init(MakeConfig(Allocator::Mode::LowestPriority));
+    voices.NoteOn(0, 60, 100);
+    voices.NoteOn(0, 61, 20);
+    voices.NoteOn(0, 62, 50);
+    voices.NoteOn(0, 63, 20);
+
+    // the oldest of the lowest
+    EXPECT_EQ(voices.NoteOn(0, 70, 30), 1u);
+    EXPECT_EQ(voices.NoteOn(0, 71, 30), 3u);
+    EXPECT_EQ(voices.NoteOn(0, 72, 30), 1u);
+    // lower than all held notes
+    EXPECT_EQ(voices.NoteOn(0, 73, 10), Allocator::kNoVoice);
+    // explicit priorities
+    EXPECT_EQ(voices.NoteOn(0, 74, 1, 127), 3u);
+    EXPECT_EQ(voices.NoteOn(0, 75, 127, 0), Allocator::kNoVoice);
+    EXPECT_EQ(voices.NoteOn(0, 76, 64), 1u);
+    EXPECT_EQ(voices.NoteOn(0, 77, 64), 2u);
+    EXPECT_EQ(voices.GetVoice(0).note, 60);
+}
+
+TEST(util_VoiceAllocator, f_sustain)
+{
+    Allocator voices;
+    voices.Init();
+    voices.HandleEvent(MakeEvent(NoteOn, 0, 60, 100));
+    voices.HandleEvent(MakeEvent(ControlChange, 0, 64, 127));
+    voices.HandleEvent(MakeEvent(NoteOn, 0, 62, 100));
+    voices.HandleEvent(MakeEvent(NoteOff, 0, 60));
+    voices.HandleEvent(MakeEvent(NoteOn, 0, 62, 0));
+    EXPECT_EQ(voices.GetVoice(0).state, Allocator::Voice::Sustained);
+    EXPECT_EQ(voices.GetVoice(1).state, Allocator::Voice::Sustained);
+    EXPECT_TRUE(voices.GetVoice(0).IsGateOn());
+
+    // the pedal of another channel doesn't release them
+    voices.HandleEvent(MakeEvent(ControlChange, 1, 64, 0));
+    EXPECT_EQ(voices.GetNumActive(), 2u);
+
+    // replaying a sustained note retriggers it
+    voices.HandleEvent(MakeEvent(NoteOn, 0, 60, 90));
+    EXPECT_EQ(voices.GetVoice(0).state, Allocator::Voice::Held);
+    EXPECT_EQ(voices.GetVoice(0).trigger_count, 2u);
+
+    voices.HandleEvent(MakeEvent(ControlChange, 0, 64, 0));
+    EXPECT_EQ(voices.GetVoice(0).state, Allocator::Voice::Held);
+    EXPECT_EQ(voices.GetVoice(1).state, Allocator::Voice::Free);
+    EXPECT_EQ(voices.GetNumActive(), 1u);
+
+    // all notes off
+    voices.HandleEvent(MakeEvent(NoteOn, 2, 40, 1));
+    EXPECT_TRUE(voices.HandleEvent(MakeEvent(ChannelMode, 0, 123)));
+    EXPECT_EQ(voices.GetNumActive(), 1u);
+    voices.AllNotesOff();
+    EXPECT_EQ(voices.GetNumActive(), 0u);
+}
+
+TEST(util_VoiceAllocator, g_mpe)
+{
+    Allocator::Config config;
+    config.mpe = true;
+    Allocator voices;
+    voices.Init(config);
+
+    // the same note on two member channels
+    EXPECT_EQ(voices.NoteOn(1, 60, 100), 0u);
+    EXPECT_EQ(voices.NoteOn(2, 60, 100), 1u);
+
+    voices.HandleEvent(MakeEvent(PitchBend, 1, 0, 0x60)); // +0.5
+    voices.HandleEvent(MakeEvent(PitchBend, 0, 0, 0x48)); // master +0.125
+    voices.HandleEvent(MakeEvent(ChannelPressure, 2, 127));
+    voices.HandleEvent(MakeEvent(ControlChange, 1, 74, 0));
+    EXPECT_FLOAT_EQ(voices.GetPitchBend(0), 0.625f);
+    EXPECT_FLOAT_EQ(voices.GetPitchBend(1), 0.125f);
+    EXPECT_FLOAT_EQ(voices.GetPressure(0), 0.f);
+    EXPECT_FLOAT_EQ(voices.GetPressure(1), 1.f);
+    EXPECT_FLOAT_EQ(voices.GetTimbre(0), 0.f);
+    EXPECT_FLOAT_EQ(voices.GetTimbre(1), 64 / 127.f);
+
+    // the master pedal sustains all member channels
+    voices.SetSustain(0, true);
+    voices.NoteOff(1, 60);
+    voices.NoteOff(2, 60);
+    EXPECT_EQ(voices.GetNumActive(), 2u);
+    voices.SetSustain(0, false);
+    EXPECT_EQ(voices.GetNumActive(), 0u);
+
+    // all notes off on the master channel
+    voices.NoteOn(3, 60, 100);
+    voices.NoteOn(4, 61, 100);
+    voices.AllNotesOff(0);
+    EXPECT_EQ(voices.GetNumActive(), 0u);
+}
@@ -0,0 +1,794 @@
+#include <gtest/gtest.h>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "FatFsImage.h"
+#include "hid/wavplayer.h"
+
+using namespace daisy;
+
+namespace
+{
+/** Layout of a generated WAV file */
+struct WavSpec
+{
+    uint16_t format       = WAVE_FORMAT_PCM;
+    uint16_t bits         = 16;
+    uint16_t num_channels = 1;
+    uint32_t samplerate   = 48000;
+    /** WAVE_FORMAT_EXTENSIBLE, with format as the sub-format */
+    bool extensible = false;
+    /** chunks before, between and after "fmt " and "data", one of them odd
+     *  sized, and an 18 byte "fmt " chunk */
+    bool extra_chunks = false;
+};
+
+/** A WAV file of interleaved samples in [-1, 1) */
+std::vector<uint8_t> MakeWav(const WavSpec&           spec,
+                             const std::vector<float>& samples)
+{
+    std::vector<uint8_t> file, data;
+    auto add = [](std::vector<uint8_t>& to, uint32_t value, int bytes) {
+        for(int i = 0; i < bytes; i++)
+            to.push_back(value >> (i * 8));
+    };
+    auto add_chunk = [&](const char* id, const std::vector<uint8_t>& body) {
+        file.insert(file.end(), id, id + 4);
+        add(file, body.size(), 4);
+        file.insert(file.end(), body.begin(), body.end());
+        if(body.size() & 1)
+            file.push_back(0);
+    };
+    for(float sample : samples)
+    {
+        const double x = sample;
+        switch(spec.bits)
+        {
+            case 8: add(data, uint8_t(x * 128 + 128), 1); break;
+            case 16: add(data, int32_t(x * 32768), 2); break;
+            case 24: add(data, int32_t(x * 8388608), 3); break;
+            default:
+                if(spec.format == WAVE_FORMAT_IEEE_FLOAT)
+                {
+                    uint32_t bits;
+                    memcpy(&bits, &sample, 4);
+                    add(data, bits, 4);
+                }
+                else
+                {
+                    add(data, int32_t(x * 2147483648.0), 4);
+                }
+        }
+    }
+
+    const uint16_t       block_align = spec.num_channels * spec.bits / 8;
+    std::vector<uint8_t> fmt;
+    add(fmt,
+        spec.extensible ? uint16_t(WAVE_FORMAT_EXTENSIBLE) : spec.format,
+        2);
+    add(fmt, spec.num_channels, 2);
+    add(fmt, spec.samplerate, 4);
+    add(fmt, spec.samplerate * block_align, 4);
+    add(fmt, block_align, 2);
+    add(fmt, spec.bits, 2);
+    if(spec.extensible)
+    {
+        add(fmt, 22, 2);
+        add(fmt, spec.bits, 2);
+        add(fmt, 0, 4);
+        add(fmt, spec.format, 2);
+        fmt.insert(fmt.end(), 14, 0x11);
+    }
+    else if(spec.extra_chunks)
+    {
+        add(fmt, 0, 2);
+    }
+
+    file.insert(file.end(),
+                {'R', 'I', 'F', 'F', 0, 0, 0, 0, 'W', 'A', 'V', 'E'});
+    if(spec.extra_chunks)
+        add_chunk("LIST", {'I', 'N', 'F', 'O', 'x'});
+    add_chunk("fmt ", fmt);
+    if(spec.extra_chunks)
+        add_chunk("fact", {1, 2, 3, 4});
+    add_chunk("data", data);
+    if(spec.extra_chunks)
+        add_chunk("id3 ", std::vector<uint8_t>(99, 0x7f));
+    const uint32_t riff_size = file.size() - 8;
+    memcpy(&file[4], &riff_size, 4);
+    return file;
+}
+
+/** A 16-bit PCM WAV file with a canonical 44 byte header */
+std::vector<uint8_t> MakeWav16(const std::vector<int16_t>& samples,
+                               uint16_t                    num_channels)
+{
+    WavSpec spec;
+    spec.num_channels = num_channels;
+    std::vector<float> values;
+    for(int16_t sample : samples)
+        values.push_back(sample / 32768.f);
+    return MakeWav(spec, values);
+}
+
+/** Distinct samples for each file and position */
+std::vector<int16_t> MakeSamples(size_t size, int seed)
+{
+    std::vector<int16_t> samples(size);
+    for(size_t i = 0; i < size; i++)
+        samples[i] = int16_t((i * 7 + seed * 1000) % 60000 - 30000);
+    return samples;
+}
+
+/** Renders a voice block by block, calling Prepare() before each block */
+std::vector<float> Render(WavPlayer& player,
+                          size_t     voice,
+                          size_t     num_frames,
+                          size_t     num_channels = 1,
+                          bool       prepare      = true,
+                          size_t*    played       = nullptr)
+{
+    constexpr size_t   kBlock = 48;
+    std::vector<float> out(num_frames * num_channels);
+    float              block[2][kBlock];
+    float*             channels[] = {block[0], block[1]};
+    for(size_t i = 0; i < num_frames; i += kBlock)
+    {
+        if(prepare)
+            player.Prepare();
+        const size_t n = std::min(kBlock, num_frames - i);
+        const size_t streamed = player.Stream(voice, channels, num_channels, n);
+        if(played)
+            *played += streamed;
+        for(size_t ch = 0; ch < num_channels; ch++)
+            for(size_t j = 0; j < n; j++)
+                out[(i + j) * num_channels + ch] = block[ch][j];
+    }
+    return out;
+}
+
+void ExpectSamples(const std::vector<float>&   out,
+                   const std::vector<int16_t>& samples,
+                   size_t                      offset = 0)
+{
+    for(size_t i = 0; i < samples.size(); i++)
+    {
+        ASSERT_EQ(out[offset + i], s162f(samples[i])) << "at " << i;
+    }
+}
+} // namespace
+
+TEST(hid_WavPlayer, a_singleFile)
+{
+    ASSERT_TRUE(FatFsImage::Format());
+    const auto samples = MakeSamples(3000, 1);
+    ASSERT_TRUE(FatFsImage::WriteFile("0:/a.wav", MakeWav16(samples, 1)));
+
+    // the single file functions play the first file on voice 0
+    WavPlayer player;
+    player.Init("0:/");
+    ASSERT_EQ(player.GetNumberFiles(), 1u);
+    EXPECT_TRUE(player.IsPlaying(0));
+    for(size_t i = 0; i < samples.size(); i++)
+    {
+        if(i % 256 == 0)
+            player.Prepare();
+        ASSERT_NEAR(player.Stream(), samples[i], 1) << "at " << i;
+    }
+    EXPECT_EQ(player.Stream(), 0);
+    EXPECT_FALSE(player.IsPlaying(0));
+
+    // once restarted, it loops
+    player.SetLooping(true);
+    player.Restart();
+    for(size_t i = 0; i < samples.size() * 2; i++)
+    {
+        if(i % 256 == 0)
+            player.Prepare();
+        ASSERT_NEAR(player.Stream(), samples[i % samples.size()], 1);
+    }
+    EXPECT_TRUE(player.IsPlaying(0));
+    EXPECT_EQ(player.GetStats(0).underruns, 0u);
+}
+
+TEST(hid_WavPlayer, b_voices)
+{
+    ASSERT_TRUE(FatFsImage::Format());
+    const auto mono   = MakeSamples(20000, 1);
+    const auto stereo = MakeSamples(2 * 15000, 2);
+    const auto loop   = MakeSamples(999, 3);
+    ASSERT_TRUE(FatFsImage::WriteFile("0:/mono.wav", MakeWav16(mono, 1)));
+    ASSERT_TRUE(FatFsImage::WriteFile("0:/stereo.wav", MakeWav16(stereo, 2)));
+    ASSERT_TRUE(FatFsImage::WriteFile("0:/loop.wav", MakeWav16(loop, 1)));
+
+    WavPlayer player;
+    player.Init("0:/");
+    ASSERT_EQ(player.GetNumberFiles(), 3u);
+    ASSERT_TRUE(player.Play(1, 1));
+    ASSERT_TRUE(player.Play(2, 2, true));
+    ASSERT_TRUE(player.Play(3, 0));
+
+    // the voices are rendered in turns, like in an audio callback
+    std::vector<float> out[4];
+    constexpr size_t   kBlock = 48;
+    float              block[2][kBlock];
+    float*             channels[] = {block[0], block[1]};
+    for(size_t i = 0; i < 24000; i += kBlock)
+    {
+        player.Prepare();
+        for(size_t voice = 1; voice < 4; voice++)
+        {
+            player.Stream(voice, channels, 2, kBlock);
+            for(size_t j = 0; j < kBlock; j++)
+            {
+                out[voice].push_back(block[0][j]);
+                out[voice].push_back(block[1][j]);
+            }
+        }
+    }
+
+    ExpectSamples(out[1], stereo);
+    for(size_t i = 0; i < 24000; i++)
+    {
+        // mono files play on both channels
+        ASSERT_EQ(out[3][2 * i], i < 20000 ? s162f(mono[i]) : 0.f);
+        ASSERT_EQ(out[3][2 * i + 1], out[3][2 * i]);
+        ASSERT_EQ(out[2][2 * i], s162f(loop[i % loop.size()]));
+    }
+    EXPECT_FALSE(player.IsPlaying(1));
+    EXPECT_TRUE(player.IsPlaying(2));
+    EXPECT_FALSE(player.IsPlaying(3));
+    for(size_t voice = 0; voice < WavPlayer::kMaxVoices; voice++)
+        EXPECT_EQ(player.GetStats(voice).underruns, 0u);
+}
+
+TEST(hid_WavPlayer, c_starvation)
+{
+    ASSERT_TRUE(FatFsImage::Format());
+    const auto samples = MakeSamples(40000, 4);
+    ASSERT_TRUE(FatFsImage::WriteFile("0:/long.wav", MakeWav16(samples, 1)));
+
+    WavPlayer player;
+    player.Init("0:/");
+    ASSERT_TRUE(player.Play(0, 0));
+
+    // without Prepare(), the voice runs dry and plays silence
+    const auto starved = Render(player, 0, 8000, 1, false);
+    const auto stats   = player.GetStats(0);
+    EXPECT_GT(stats.underruns, 0u);
+    EXPECT_EQ(stats.min_buffered, 0u);
+    const size_t played = 8000 - stats.missing_frames;
+    EXPECT_GE(played, WavPlayer::kVoiceBufferSize / 2 - 512);
+    for(size_t i = 0; i < played; i++)
+        ASSERT_EQ(starved[i], s162f(samples[i]));
+    for(size_t i = played; i < starved.size(); i++)
+        ASSERT_EQ(starved[i], 0.f);
+
+    // it carries on where it stopped once the main loop catches up
+    player.ResetStats();
+    const auto rest = Render(player, 0, samples.size() - played);
+    for(size_t i = 0; i < rest.size(); i++)
+        ASSERT_EQ(rest[i], s162f(samples[played + i])) << "at " << i;
+    EXPECT_EQ(player.GetStats(0).underruns, 0u);
+    EXPECT_GT(player.GetStats(0).min_buffered, 0u);
+}
+
+TEST(hid_WavPlayer, d_stopAndPlay)
+{
+    ASSERT_TRUE(FatFsImage::Format());
+    const auto samples = MakeSamples(10000, 5);
+    ASSERT_TRUE(FatFsImage::WriteFile("0:/a.wav", MakeWav16(samples, 1)));
+
+    WavPlayer player;
+    player.Init("0:/");
+    ASSERT_TRUE(player.Play(5, 0, true));
+    Render(player, 5, 1000);
+
+    // Stop() takes effect right away, also from the audio callback
+    player.Stop(5);
+    EXPECT_FALSE(player.IsPlaying(5));
+    for(float sample : Render(player, 5, 480))
+        ASSERT_EQ(sample, 0.f);
+
+    // and the voice starts over with the next Play()
+    ASSERT_TRUE(player.Play(5, 0));
+    ExpectSamples(Render(player, 5, samples.size()), samples);
+
+    // files and voices that don't exist
+    EXPECT_FALSE(player.Play(WavPlayer::kMaxVoices, 0));
+    EXPECT_FALSE(player.Play(0, 1));
+    EXPECT_FALSE(player.IsPlaying(WavPlayer::kMaxVoices));
+}
+
+TEST(hid_WavPlayer, e_formats)
+{
+    struct Case
+    {
+        const char*     name;
+        uint16_t        format, bits, num_channels;
+        bool            extensible;
+        WavSampleFormat expected;
+    };
+    const Case cases[] = {
+        {"u8", WAVE_FORMAT_PCM, 8, 1, false, WavSampleFormat::PCM_U8},
+        {"s16", WAVE_FORMAT_PCM, 16, 2, false, WavSampleFormat::PCM_S16},
+        {"s24", WAVE_FORMAT_PCM, 24, 2, false, WavSampleFormat::PCM_S24},
+        {"s32", WAVE_FORMAT_PCM, 32, 1, false, WavSampleFormat::PCM_S32},
+        {"f32",
+         WAVE_FORMAT_IEEE_FLOAT,
+         32,
+         2,
+         false,
+         WavSampleFormat::FLOAT_32},
+        {"s24 ext", WAVE_FORMAT_PCM, 24, 2, true, WavSampleFormat::PCM_S24},
+        {"f32 ext",
+         WAVE_FORMAT_IEEE_FLOAT,
+         32,
+         1,
+         true,
+         WavSampleFormat::FLOAT_32},
+        {"s16 x4", WAVE_FORMAT_PCM, 16, 4, false, WavSampleFormat::PCM_S16},
+    };
+    for(const Case& c : cases)
+    {
+        SCOPED_TRACE(c.name);
+        // multiples of 1/128 are exact in every format
+        constexpr size_t   kFrames = 5000;
+        std::vector<float> samples(kFrames * c.num_channels);
+        for(size_t i = 0; i < samples.size(); i++)
+            samples[i] = int((i * 37 + i / 7) % 256 - 128) / 128.f;
+        WavSpec spec;
+        spec.format       = c.format;
+        spec.bits         = c.bits;
+        spec.num_channels = c.num_channels;
+        spec.extensible   = c.extensible;
+        ASSERT_TRUE(FatFsImage::Format());
+        ASSERT_TRUE(FatFsImage::WriteFile("0:/f.wav", MakeWav(spec, samples)));
+
+        WavPlayer player;
+        player.Init("0:/");
+        ASSERT_EQ(player.GetNumberFiles(), 1u);
+        EXPECT_EQ(player.GetFileInfo(0)->format, c.expected);
+        EXPECT_EQ(player.GetFileInfo(0)->raw_data.NbrChannels, c.num_channels);
+
+        size_t     played = 0;
+        const auto out    = Render(player, 0, kFrames + 100, 2, true, &played);
+        EXPECT_EQ(played, kFrames);
+        for(size_t i = 0; i < kFrames; i++)
+        {
+            // mono plays on both channels, and past the second are ignored
+            const size_t n = c.num_channels;
+            ASSERT_EQ(out[2 * i], samples[i * n]) << "at " << i;
+            ASSERT_EQ(out[2 * i + 1], samples[i * n + (n > 1 ? 1 : 0)])
+                << "at " << i;
+        }
+        EXPECT_FALSE(player.IsPlaying(0));
+        EXPECT_EQ(player.GetStats(0).underruns, 0u);
+    }
+}
+
+TEST(hid_WavPlayer, f_chunks)
+{
+    ASSERT_TRUE(FatFsImage::Format());
+    const auto         samples = MakeSamples(3001, 6);
+    std::vector<float> values;
+    for(int16_t sample : samples)
+        values.push_back(sample / 32768.f);
+    WavSpec spec;
+    spec.extra_chunks = true;
+    ASSERT_TRUE(FatFsImage::WriteFile("0:/a.wav", MakeWav(spec, values)));
+
+    // a "data" chunk that claims more than is in the file, as left behind
+    // by a recorder that didn't finish
+    auto unfinished = MakeWav16(samples, 1);
+    unfinished[40] = unfinished[41] = unfinished[42] = unfinished[43] = 0xff;
+    ASSERT_TRUE(FatFsImage::WriteFile("0:/b.wav", unfinished));
+
+    // files that are skipped
+    WavSpec alaw;
+    alaw.format = WAVE_FORMAT_ALAW;
+    alaw.bits   = 8;
+    ASSERT_TRUE(FatFsImage::WriteFile("0:/c.wav", MakeWav(alaw, values)));
+    WavSpec s20;
+    s20.bits = 20;
+    ASSERT_TRUE(FatFsImage::WriteFile("0:/d.wav", MakeWav(s20, {})));
+    ASSERT_TRUE(FatFsImage::WriteFile("0:/e.wav", {'R', 'I', 'F', 'F', 0, 0}));
+    auto no_fmt = MakeWav16(samples, 1);
+    no_fmt.erase(no_fmt.begin() + 12, no_fmt.begin() + 36);
+    ASSERT_TRUE(FatFsImage::WriteFile("0:/f.wav", no_fmt));
+
+    WavPlayer player;
+    player.Init("0:/");
+    ASSERT_EQ(player.GetNumberFiles(), 2u);
+    EXPECT_EQ(player.GetFileInfo(2), nullptr);
+    // RIFF header, "LIST" with its pad byte, "fmt ", "fact", "data" header
+    const WavFileInfo* info = player.GetFileInfo(0);
+    EXPECT_STREQ(info->name, "0:/a.wav");
+    EXPECT_EQ(info->data_offset, 12u + 14 + 26 + 12 + 8);
+    EXPECT_EQ(info->raw_data.SubCHunk2Size, samples.size() * 2);
+    EXPECT_EQ(player.GetFileInfo(1)->data_offset, 44u);
+    EXPECT_EQ(player.GetFileInfo(1)->raw_data.SubCHunk2Size,
+              samples.size() * 2);
+
+    for(size_t file = 0; file < 2; file++)
+    {
+        ASSERT_TRUE(player.Play(0, file));
+        size_t played = 0;
+        ExpectSamples(Render(player, 0, 4000, 1, true, &played), samples);
+        EXPECT_EQ(played, samples.size());
+    }
+}
+
+TEST(hid_WavPlayer, g_rateConversion)
+{
+    ASSERT_TRUE(FatFsImage::Format());
+    // a ramp at half the rate is played at every other frame, and in
+    // between, where cubic interpolation is exact for straight lines
+    constexpr size_t   kRamp = 2000;
+    std::vector<float> ramp(kRamp);
+    for(size_t i = 0; i < kRamp; i++)
+        ramp[i] = i / 4096.f - 0.25f;
+    WavSpec half;
+    half.format     = WAVE_FORMAT_IEEE_FLOAT;
+    half.bits       = 32;
+    half.samplerate = 24000;
+    ASSERT_TRUE(FatFsImage::WriteFile("0:/a.wav", MakeWav(half, ramp)));
+
+    // a sine at 44.1kHz
+    constexpr size_t   kSine = 20000;
+    std::vector<float> sine(kSine * 2);
+    for(size_t i = 0; i < kSine; i++)
+    {
+        sine[2 * i]     = 0.5f * std::sin(2 * M_PI * 1000 * i / 44100.);
+        sine[2 * i + 1] = -sine[2 * i];
+    }
+    WavSpec cd;
+    cd.bits         = 24;
+    cd.num_channels = 2;
+    cd.samplerate   = 44100;
+    ASSERT_TRUE(FatFsImage::WriteFile("0:/b.wav", MakeWav(cd, sine)));
+
+    WavPlayer player;
+    player.Init("0:/");
+    ASSERT_EQ(player.GetNumberFiles(), 2u);
+
+    ASSERT_TRUE(player.Play(0, 0));
+    size_t     played = 0;
+    const auto out    = Render(player, 0, 2 * kRamp + 100, 1, true, &played);
+    // up to the position of the frame after the last one
+    EXPECT_EQ(played, 2 * kRamp);
+    for(size_t i = 0; i < kRamp; i++)
+        ASSERT_EQ(out[2 * i], ramp[i]) << "at " << i;
+    // the first and last frames are next to silence
+    for(size_t i = 2; i < 2 * kRamp - 4; i++)
+        ASSERT_NEAR(out[i], i / 8192.f - 0.25f, 1e-6) << "at " << i;
+
+    ASSERT_TRUE(player.Play(1, 1));
+    played = 0;
+    const auto cd_out = Render(player, 1, 23000, 2, true, &played);
+    EXPECT_EQ(played, (kSine * 48000 + 44099) / 44100);
+    for(size_t i = 4; i < played - 4; i++)
+    {
+        const double expected = 0.5 * std::sin(2 * M_PI * 1000 * i / 48000.);
+        ASSERT_NEAR(cd_out[2 * i], expected, 1e-3) << "at " << i;
+        ASSERT_NEAR(cd_out[2 * i + 1], -expected, 1e-3) << "at " << i;
+    }
+
+    // and the other way around, every other frame
+    player.SetSampleRate(12000);
+    ASSERT_TRUE(player.Play(2, 0));
+    played = 0;
+    const auto down = Render(player, 2, kRamp, 1, true, &played);
+    EXPECT_EQ(played, kRamp / 2);
+    for(size_t i = 0; i < kRamp / 2; i++)
+        ASSERT_EQ(down[i], ramp[i * 2]) << "at " << i;
+    for(size_t voice = 0; voice < 3; voice++)
+        EXPECT_EQ(player.GetStats(voice).underruns, 0u);
+}
+
+TEST(hid_WavPlayer, h_seek)
+{
+    // a file in more fragments than the cluster link map table holds, and
+    // one in fewer, written a piece at a time next to another file
+    ASSERT_TRUE(FatFsImage::Format());
+    const auto   samples  = MakeSamples(24000, 7);
+    const auto   wav      = MakeWav16(samples, 1);
+    const char*  paths[]  = {"0:/few.wav", "0:/many.wav"};
+    const char*  others[] = {"0:/a.dat", "0:/b.dat"};
+    const size_t pieces[] = {4096, 1024};
+    for(size_t f = 0; f < 2; f++)
+    {
+        FIL  fil, other;
+        UINT written;
+        ASSERT_EQ(f_open(&fil, paths[f], FA_WRITE | FA_CREATE_ALWAYS), FR_OK);
+        ASSERT_EQ(f_open(&other, others[f], FA_WRITE | FA_CREATE_ALWAYS),
+                  FR_OK);
+        for(size_t i = 0; i < wav.size(); i += pieces[f])
+        {
+            const size_t n = std::min(pieces[f], wav.size() - i);
+            ASSERT_EQ(f_write(&fil, &wav[i], n, &written), FR_OK);
+            ASSERT_EQ(f_sync(&fil), FR_OK);
+            ASSERT_EQ(f_write(&other, &wav[i], pieces[f], &written), FR_OK);
+            ASSERT_EQ(f_sync(&other), FR_OK);
+        }
+        f_close(&fil);
+        f_close(&other);
+    }
+
+    WavPlayer player;
+    player.Init("0:/");
+    ASSERT_EQ(player.GetNumberFiles(), 2u);
+    for(size_t file = 0; file < 2; file++)
+    {
+        SCOPED_TRACE(file);
+        ASSERT_TRUE(player.Play(0, file));
+        Render(player, 0, 1000);
+
+        // back and forth, and each seek refills the voice with one read
+        for(uint32_t frame : {20000u, 3000u, 11111u, 0u})
+        {
+            const size_t reads = FatFsImage::GetNumSectorReads();
+            ASSERT_TRUE(player.Seek(0, frame));
+            EXPECT_LE(FatFsImage::GetNumSectorReads() - reads,
+                      WavPlayer::kVoiceBufferSize / 512 + 1);
+            const auto   out = Render(player, 0, 2000);
+            const size_t n   = std::min<size_t>(2000, samples.size() - frame);
+            for(size_t i = 0; i < n; i++)
+                ASSERT_EQ(out[i], s162f(samples[frame + i])) << frame + i;
+        }
+        EXPECT_FALSE(player.Seek(0, samples.size()));
+        EXPECT_EQ(player.GetStats(0).underruns, 0u);
+    }
+
+    // a voice that doesn't play can't seek
+    EXPECT_FALSE(player.Seek(1, 0));
+    player.Stop(0);
+    player.Prepare();
+    EXPECT_FALSE(player.Seek(0, 0));
+}
+
+TEST(hid_WavPlayer, i_loopPoints)
+{
+    ASSERT_TRUE(FatFsImage::Format());
+    const auto samples = MakeSamples(40000, 8);
+    ASSERT_TRUE(FatFsImage::WriteFile("0:/a.wav", MakeWav16(samples, 1)));
+
+    WavPlayer player;
+    player.Init("0:/");
+    ASSERT_TRUE(player.Play(0, 0, true));
+    EXPECT_FALSE(player.SetLoopPoints(0, 100, 100));
+    EXPECT_FALSE(player.SetLoopPoints(0, 0, 40001));
+    EXPECT_FALSE(player.SetLoopPoints(1, 0, 100));
+
+    // the file plays up to the end of the loop, then the loop repeats
+    ASSERT_TRUE(player.SetLoopPoints(0, 5000, 17000));
+    const auto out = Render(player, 0, 17000 + 12000 * 3);
+    for(size_t i = 0; i < out.size(); i++)
+    {
+        const size_t frame = i < 17000 ? i : 5000 + (i - 17000) % 12000;
+        ASSERT_EQ(out[i], s162f(samples[frame])) << "at " << i;
+    }
+
+    // a short loop plays from memory, without reading the card
+    ASSERT_TRUE(player.SetLoopPoints(0, 30100, 30600));
+    ASSERT_TRUE(player.Seek(0, 30000));
+    auto short_loop = Render(player, 0, 20000);
+    const size_t reads = FatFsImage::GetNumSectorReads();
+    const auto   more  = Render(player, 0, 20000);
+    EXPECT_EQ(FatFsImage::GetNumSectorReads(), reads);
+    short_loop.insert(short_loop.end(), more.begin(), more.end());
+    for(size_t i = 0; i < short_loop.size(); i++)
+    {
+        const size_t frame = i < 600 ? 30000 + i : 30100 + (i - 600) % 500;
+        ASSERT_EQ(short_loop[i], s162f(samples[frame])) << "at " << i;
+    }
+
+    // and without looping, the file plays on to its end
+    player.SetLooping(0, false);
+    size_t played = 0;
+    Render(player, 0, 20000, 1, true, &played);
+    EXPECT_LT(played, 20000u);
+    EXPECT_FALSE(player.IsPlaying(0));
+    EXPECT_EQ(player.GetStats(0).underruns, 0u);
+}
+
+TEST(hid_WavPlayer, j_speed)
+{
+    ASSERT_TRUE(FatFsImage::Format());
+    constexpr size_t   kFrames = 40000;
+    std::vector<float> ramp(kFrames);
+    for(size_t i = 0; i < kFrames; i++)
+        ramp[i] = i / 65536.f - 0.25f;
+    WavSpec spec;
+    spec.format = WAVE_FORMAT_IEEE_FLOAT;
+    spec.bits   = 32;
+    ASSERT_TRUE(FatFsImage::WriteFile("0:/a.wav", MakeWav(spec, ramp)));
+
+    WavPlayer player;
+    player.Init("0:/");
+    ASSERT_TRUE(player.Play(0, 0));
+
+    // the position moves on at the speed of each block
+    const float speeds[] = {1.f, 0.5f, 2.f, 0.3f, 1.7f, 1.f};
+    double      position = 0;
+    for(float speed : speeds)
+    {
+        SCOPED_TRACE(speed);
+        player.SetSpeed(0, speed);
+        for(float sample : Render(player, 0, 4800))
+        {
+            if(position >= 2)
+            {
+                ASSERT_NEAR(sample, position / 65536.f - 0.25f, 1e-6)
+                    << "at " << position;
+            }
+            position += speed;
+        }
+    }
+
+    // speed 0 holds the current sample
+    player.SetSpeed(0, -1.f);
+    for(float sample : Render(player, 0, 480))
+        ASSERT_NEAR(sample, position / 65536.f - 0.25f, 1e-6);
+    EXPECT_TRUE(player.IsPlaying(0));
+
+    // each Play() starts at speed 1
+    ASSERT_TRUE(player.Play(0, 0));
+    const auto out = Render(player, 0, 480);
+    for(size_t i = 0; i < out.size(); i++)
+        ASSERT_EQ(out[i], ramp[i]);
+    EXPECT_EQ(player.GetStats(0).underruns, 0u);
+}
+
+TEST(hid_WavPlayer, k_index)
+{
+    ASSERT_TRUE(FatFsImage::Format());
+    const auto a = MakeSamples(1000, 1);
+    const auto b = MakeSamples(2000, 2);
+    ASSERT_TRUE(FatFsImage::WriteFile("0:/a.wav", MakeWav16(a, 1)));
+    ASSERT_TRUE(FatFsImage::WriteFile("0:/b.WAV", MakeWav16(b, 2)));
+    ASSERT_TRUE(FatFsImage::WriteFile("0:/bad.wav", {'R', 'I', 'F', 'F'}));
+    ASSERT_TRUE(FatFsImage::WriteFile("0:/c.wav.txt", MakeWav16(a, 1)));
+
+    // the first Init() reads every header, and writes the index
+    size_t reads = FatFsImage::GetNumSectorReads();
+    {
+        WavPlayer player;
+        player.Init("0:/");
+        ASSERT_EQ(player.GetNumberFiles(), 2u);
+    }
+    const size_t first_reads = FatFsImage::GetNumSectorReads() - reads;
+    EXPECT_FALSE(FatFsImage::ReadFile("0:/WAVPLAY.IDX").empty());
+
+    // A file that is changed in place, with the same size and time, isn't
+    // opened again, which shows that its header comes from the index
+    auto changed = MakeWav16(a, 1);
+    changed[24]  = 0x44; // 48000 -> 47940 Hz
+    ASSERT_TRUE(FatFsImage::WriteFile("0:/a.wav", changed));
+    const auto index = FatFsImage::ReadFile("0:/WAVPLAY.IDX");
+    WavPlayer  player;
+    reads = FatFsImage::GetNumSectorReads();
+    player.Init("0:/");
+    ASSERT_EQ(player.GetNumberFiles(), 2u);
+    EXPECT_LT(FatFsImage::GetNumSectorReads() - reads, first_reads);
+    EXPECT_EQ(player.GetFileInfo(0)->raw_data.SampleRate, 48000u);
+    EXPECT_STREQ(player.GetFileInfo(1)->name, "0:/b.WAV");
+    EXPECT_EQ(player.GetFileInfo(1)->raw_data.NbrChannels, 2u);
+    // and the index is only written when the directory changes
+    EXPECT_EQ(FatFsImage::ReadFile("0:/WAVPLAY.IDX"), index);
+    ASSERT_TRUE(player.Play(1, 1));
+    ExpectSamples(Render(player, 1, 2000, 2), b);
+
+    // new and changed files are read, the rest still comes from the index
+    const auto d = MakeSamples(3000, 4);
+    ASSERT_TRUE(FatFsImage::WriteFile("0:/d.wav", MakeWav16(d, 1)));
+    changed.push_back(0);
+    ASSERT_TRUE(FatFsImage::WriteFile("0:/bad.wav", changed));
+    player.Init("0:/");
+    ASSERT_EQ(player.GetNumberFiles(), 4u);
+    EXPECT_EQ(player.GetFileInfo(0)->raw_data.SampleRate, 48000u);
+    EXPECT_STREQ(player.GetFileInfo(2)->name, "0:/bad.wav");
+    EXPECT_EQ(player.GetFileInfo(2)->raw_data.SampleRate, 47940u);
+    EXPECT_STREQ(player.GetFileInfo(3)->name, "0:/d.wav");
+    ASSERT_TRUE(player.Play(0, 3));
+    ExpectSamples(Render(player, 0, 3000), d);
+
+    // removed files drop out
+    ASSERT_EQ(f_unlink("0:/b.WAV"), FR_OK);
+    player.Init("0:/");
+    ASSERT_EQ(player.GetNumberFiles(), 3u);
+    EXPECT_STREQ(player.GetFileInfo(1)->name, "0:/bad.wav");
+    EXPECT_STREQ(player.GetFileInfo(2)->name, "0:/d.wav");
+
+    // a damaged index is rebuilt, and the index can be left out
+    ASSERT_TRUE(FatFsImage::WriteFile("0:/WAVPLAY.IDX", {1, 2, 3}));
+    player.Init("0:/");
+    ASSERT_EQ(player.GetNumberFiles(), 3u);
+    EXPECT_EQ(player.GetFileInfo(0)->raw_data.SampleRate, 47940u);
+    EXPECT_GT(FatFsImage::ReadFile("0:/WAVPLAY.IDX").size(), 3u);
+    ASSERT_EQ(f_unlink("0:/WAVPLAY.IDX"), FR_OK);
+    player.Init("0:/", false);
+    ASSERT_EQ(player.GetNumberFiles(), 3u);
+    EXPECT_TRUE(FatFsImage::ReadFile("0:/WAVPLAY.IDX").empty());
+}
+
+TEST(hid_WavPlayer, l_dmaAlignment)
+{
+    // 6 byte frames after an odd sized header, so reads start anywhere in a
+    // cache line, and the SD card DMA may still only write whole lines
+    ASSERT_TRUE(FatFsImage::Format());
+    constexpr size_t   kFrames = 30000;
+    std::vector<float> samples(kFrames * 2);
+    for(size_t i = 0; i < samples.size(); i++)
+        samples[i] = int32_t((i * 7919) % 16000000) / 8388608.f - 0.95f;
+    WavSpec spec;
+    spec.bits         = 24;
+    spec.num_channels = 2;
+    spec.extra_chunks = true;
+    ASSERT_TRUE(FatFsImage::WriteFile("0:/a.wav", MakeWav(spec, samples)));
+
+    WavPlayer player;
+    player.Init("0:/");
+    const uint32_t data_offset = player.GetFileInfo(0)->data_offset;
+    ASSERT_NE(data_offset % 32, 0u);
+    DWORD  free_clusters;
+    FATFS* fs;
+    ASSERT_EQ(f_getfree("0:", &free_clusters, &fs), FR_OK);
+    const size_t cluster_size = fs->csize * 512;
+
+    auto expect_frames = [&](const std::vector<float>& out,
+                             size_t                    first,
+                             size_t                    loop_start,
+                             size_t                    loop_end) {
+        size_t frame = first;
+        for(size_t i = 0; i < out.size() / 2; i++)
+        {
+            for(size_t ch = 0; ch < 2; ch++)
+            {
+                ASSERT_NEAR(out[i * 2 + ch], samples[frame * 2 + ch], 1e-6f)
+                    << "at " << i;
+            }
+            if(++frame == loop_end)
+                frame = loop_start;
+        }
+    };
+
+    // a seek is one read, straight into the ring, that FatFs splits at
+    // cluster boundaries
+    ASSERT_TRUE(player.Play(0, 0, true));
+    expect_frames(Render(player, 0, 5000, 2), 0, 0, kFrames);
+    for(uint32_t frame : {1u, 12345u, 777u, 29000u})
+    {
+        SCOPED_TRACE(frame);
+        const size_t reads = FatFsImage::GetNumSectorReads();
+        ASSERT_TRUE(player.Seek(0, frame));
+        EXPECT_LE(FatFsImage::GetNumSectorReads() - reads,
+                  WavPlayer::kVoiceBufferSize / cluster_size + 2);
+        expect_frames(Render(player, 0, 6000, 2), frame, 0, kFrames);
+    }
+
+    // Loop ends at another offset in a cache line than the loop start read
+    // the card about as often as loop ends in step with it, which never
+    // need a gap in the ring. The rest is where the clusters split reads.
+    uint32_t in_step = 1000;
+    while((data_offset + in_step * 6) % 32 != 0)
+        in_step++;
+    const uint32_t loops[][2] = {{in_step, in_step + 4016}, {1001, 5007}};
+    size_t         reads[2];
+    for(size_t l = 0; l < 2; l++)
+    {
+        SCOPED_TRACE(l);
+        ASSERT_TRUE(player.SetLoopPoints(0, loops[l][0], loops[l][1]));
+        ASSERT_TRUE(player.Seek(0, loops[l][0]));
+        const size_t before = FatFsImage::GetNumSectorReads();
+        expect_frames(Render(player, 0, kFrames, 2),
+                      loops[l][0],
+                      loops[l][0],
+                      loops[l][1]);
+        reads[l] = FatFsImage::GetNumSectorReads() - before;
+    }
+    EXPECT_LE(reads[1], reads[0] + reads[0] / 5);
+    EXPECT_EQ(FatFsImage::GetNumUnalignedReads(), 0u);
+    EXPECT_EQ(player.GetStats(0).underruns, 0u);
+}
@@ -0,0 +1,290 @@
+#include <gtest/gtest.h>
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include "FatFsImage.h"
+#include "util/WavWriter.h"
+
+using namespace daisy;
+
+namespace
+{
+/** A recorded WAV file */
+struct Recording
+{
+    WAV_FormatTypeDef    header;
+    std::vector<uint8_t> data;
+    size_t               file_size;
+};
+
+Recording Load(const char* path)
+{
+    const std::vector<uint8_t> file = FatFsImage::ReadFile(path);
+    Recording                  rec  = {};
+    rec.file_size                   = file.size();
+    if(file.size() >= sizeof(rec.header))
+    {
+        memcpy(&rec.header, file.data(), sizeof(rec.header));
+        const size_t size = std::min<size_t>(rec.header.SubCHunk2Size,
+                                             file.size() - sizeof(rec.header));
+        rec.data.assign(file.begin() + sizeof(rec.header),
+                        file.begin() + sizeof(rec.header) + size);
+    }
+    return rec;
+}
+
+/** Distinct values for each channel and frame, a few of them out of range */
+float Signal(size_t channel, size_t frame)
+{
+    if(frame % 1000 == 999)
+        return channel & 1 ? -1.5f : 1.5f;
+    return 0.9f * std::sin(0.01f * (frame + 1) * (channel + 1));
+}
+
+/** Records frames of Signal() in blocks, calling Write() after each block */
+template <typename Writer>
+void Record(Writer& writer,
+            size_t  num_channels,
+            size_t  frames,
+            size_t  block,
+            bool    write = true)
+{
+    std::vector<std::vector<float>> in(num_channels, std::vector<float>(block));
+    std::vector<const float*>        ptrs;
+    for(auto& channel : in)
+        ptrs.push_back(channel.data());
+    for(size_t done = 0; done < frames; done += block)
+    {
+        const size_t n = std::min(block, frames - done);
+        for(size_t ch = 0; ch < num_channels; ch++)
+            for(size_t i = 0; i < n; i++)
+                in[ch][i] = Signal(ch, done + i);
+        writer.Sample(ptrs.data(), n);
+        if(write)
+        {
+            EXPECT_EQ(writer.Write(), Writer::Result::OK);
+        }
+    }
+}
+
+/** Checks the header and audio of a recording of channels [first, first +
+ *  num_channels) of Signal() */
+void ExpectRecording(const Recording& rec,
+                     WavSampleFormat  format,
+                     size_t           first,
+                     size_t           num_channels,
+                     size_t           frames,
+                     float            tolerance)
+{
+    const size_t frame_size = num_channels * GetWavSampleSize(format);
+    ASSERT_EQ(rec.data.size(), frames * frame_size);
+    EXPECT_EQ(rec.header.ChunkId, kWavFileChunkId);
+    EXPECT_EQ(rec.header.FileSize, rec.file_size - 8);
+    EXPECT_EQ(rec.header.AudioFormat,
+              format == WavSampleFormat::FLOAT_32
+                  ? uint16_t(WAVE_FORMAT_IEEE_FLOAT)
+                  : uint16_t(WAVE_FORMAT_PCM));
+    EXPECT_EQ(rec.header.NbrChannels, num_channels);
+    EXPECT_EQ(rec.header.SampleRate, 48000u);
+    EXPECT_EQ(rec.header.ByteRate, 48000u * frame_size);
+    EXPECT_EQ(rec.header.BlockAlign, frame_size);
+    EXPECT_EQ(rec.header.BitPerSample, GetWavSampleSize(format) * 8);
+    EXPECT_EQ(rec.header.SubCHunk2Size, frames * frame_size);
+
+    std::vector<std::vector<float>> out(num_channels,
+                                        std::vector<float>(frames));
+    std::vector<float*>             ptrs;
+    for(auto& channel : out)
+        ptrs.push_back(channel.data());
+    WavToFloat(rec.data.data(),
+               num_channels,
+               ptrs.data(),
+               num_channels,
+               frames,
+               format);
+    for(size_t ch = 0; ch < num_channels; ch++)
+    {
+        for(size_t i = 0; i < frames; i++)
+        {
+            const float x = Signal(first + ch, i);
+            ASSERT_NEAR(out[ch][i],
+                        x > FBIPMAX ? FBIPMAX : x < FBIPMIN ? FBIPMIN : x,
+                        tolerance)
+                << "channel " << ch << " frame " << i;
+        }
+    }
+}
+} // namespace
+
+TEST(util_WavWriter, a_formats)
+{
+    struct Format
+    {
+        int32_t         bits;
+        bool            floating_point;
+        WavSampleFormat format;
+        float           tolerance;
+    };
+    // f2s16 and friends truncate, and scale by one less than the decoder
+    const Format formats[] = {
+        {16, false, WavSampleFormat::PCM_S16, 2.f / 32767},
+        {24, false, WavSampleFormat::PCM_S24, 2.f / 8388607},
+        {32, false, WavSampleFormat::PCM_S32, 1e-6f},
+        {32, true, WavSampleFormat::FLOAT_32, 1.5f},
+    };
+    for(const Format& f : formats)
+    {
+        SCOPED_TRACE(f.bits);
+        ASSERT_TRUE(FatFsImage::Format());
+        WavWriter<4096>         writer;
+        WavWriter<4096>::Config cfg;
+        cfg.samplerate     = 48000;
+        cfg.channels       = 2;
+        cfg.bitspersample  = f.bits;
+        cfg.floating_point = f.floating_point;
+        writer.Init(cfg);
+        ASSERT_EQ(writer.OpenFile("0:/rec.wav"), WavWriter<4096>::Result::OK);
+        EXPECT_TRUE(writer.IsRecording());
+        Record(writer, 2, 10007, 48);
+        EXPECT_EQ(writer.GetLengthSamps(), 10007u);
+        EXPECT_EQ(writer.GetDroppedFrames(), 0u);
+        EXPECT_EQ(writer.SaveFile(), WavWriter<4096>::Result::OK);
+        EXPECT_FALSE(writer.IsRecording());
+
+        const Recording rec = Load("0:/rec.wav");
+        if(f.floating_point)
+        {
+            // floats aren't clamped, and are stored exactly
+            ASSERT_EQ(rec.data.size(), 10007u * 8);
+            float x;
+            memcpy(&x, &rec.data[999 * 8], 4);
+            EXPECT_EQ(x, 1.5f);
+            memcpy(&x, &rec.data[5 * 8 + 4], 4);
+            EXPECT_EQ(x, Signal(1, 5));
+        }
+        else
+        {
+            ExpectRecording(rec, f.format, 0, 2, 10007, f.tolerance);
+        }
+    }
+
+    // unsupported depths don't record
+    WavWriter<4096>         writer;
+    WavWriter<4096>::Config cfg = {48000, 2, 20};
+    writer.Init(cfg);
+    EXPECT_EQ(writer.OpenFile("0:/bad.wav"), WavWriter<4096>::Result::ERROR);
+    EXPECT_FALSE(writer.IsRecording());
+}
+
+TEST(util_WavWriter, b_tailFlush)
+{
+    // less than a transfer, and an odd data size, so SaveFile() writes all
+    // of the audio and a pad byte
+    ASSERT_TRUE(FatFsImage::Format());
+    WavWriter<4096>         writer;
+    WavWriter<4096>::Config cfg = {48000, 1, 24};
+    writer.Init(cfg);
+    ASSERT_EQ(writer.OpenFile("0:/tail.wav"), WavWriter<4096>::Result::OK);
+    Record(writer, 1, 1001, 32);
+    EXPECT_EQ(writer.SaveFile(), WavWriter<4096>::Result::OK);
+
+    const Recording rec = Load("0:/tail.wav");
+    EXPECT_EQ(rec.file_size, 44u + 3004);
+    EXPECT_EQ(FatFsImage::ReadFile("0:/tail.wav").back(), 0);
+    ExpectRecording(rec, WavSampleFormat::PCM_S24, 0, 1, 1001, 2.f / 8388607);
+
+    // the same after some whole transfers
+    ASSERT_EQ(writer.OpenFile("0:/tail.wav"), WavWriter<4096>::Result::OK);
+    Record(writer, 1, 5001, 100);
+    EXPECT_EQ(writer.SaveFile(), WavWriter<4096>::Result::OK);
+    ExpectRecording(Load("0:/tail.wav"),
+                    WavSampleFormat::PCM_S24,
+                    0,
+                    1,
+                    5001,
+                    2.f / 8388607);
+}
+
+TEST(util_WavWriter, c_multitrack)
+{
+    // 5 channels in pairs, the last file gets the odd one
+    ASSERT_TRUE(FatFsImage::Format());
+    using Writer = WavWriter<4096, 4>;
+    Writer         writer;
+    Writer::Config cfg;
+    cfg.samplerate        = 48000;
+    cfg.channels          = 5;
+    cfg.bitspersample     = 16;
+    cfg.channels_per_file = 2;
+    writer.Init(cfg);
+    ASSERT_EQ(writer.GetNumFiles(), 3u);
+    EXPECT_EQ(writer.OpenFile("0:/one.wav"), Writer::Result::ERROR);
+
+    const char* names[] = {"0:/a.wav", "0:/b.wav", "0:/c.wav"};
+    ASSERT_EQ(writer.OpenFiles(names), Writer::Result::OK);
+    Record(writer, 5, 7777, 64);
+    EXPECT_EQ(writer.GetDroppedFrames(), 0u);
+    EXPECT_EQ(writer.SaveFile(), Writer::Result::OK);
+    ExpectRecording(
+        Load("0:/a.wav"), WavSampleFormat::PCM_S16, 0, 2, 7777, 2.f / 32767);
+    ExpectRecording(
+        Load("0:/b.wav"), WavSampleFormat::PCM_S16, 2, 2, 7777, 2.f / 32767);
+    ExpectRecording(
+        Load("0:/c.wav"), WavSampleFormat::PCM_S16, 4, 1, 7777, 2.f / 32767);
+
+    // more files than max_files leaves the extra channels out
+    cfg.channels_per_file = 1;
+    writer.Init(cfg);
+    EXPECT_EQ(writer.GetNumFiles(), 4u);
+}
+
+TEST(util_WavWriter, d_overflow)
+{
+    // without Write() the ring buffer (2048 stereo 16-bit frames) fills up,
+    // and whole blocks are dropped from then on
+    ASSERT_TRUE(FatFsImage::Format());
+    WavWriter<4096>         writer;
+    WavWriter<4096>::Config cfg = {48000, 2, 16};
+    writer.Init(cfg);
+    ASSERT_EQ(writer.OpenFile("0:/over.wav"), WavWriter<4096>::Result::OK);
+    Record(writer, 2, 20000, 64, false);
+    EXPECT_EQ(writer.GetLengthSamps(), 2048u);
+    EXPECT_EQ(writer.GetDroppedFrames(), 20000u - 2048);
+    EXPECT_EQ(writer.SaveFile(), WavWriter<4096>::Result::OK);
+    ExpectRecording(
+        Load("0:/over.wav"), WavSampleFormat::PCM_S16, 0, 2, 2048, 2.f / 32767);
+
+    // the next recording starts over
+    ASSERT_EQ(writer.OpenFile("0:/over.wav"), WavWriter<4096>::Result::OK);
+    EXPECT_EQ(writer.GetLengthSamps(), 0u);
+    EXPECT_EQ(writer.GetDroppedFrames(), 0u);
+    writer.SaveFile();
+
+    // nothing is recorded before a file is opened
+    WavWriter<4096> idle;
+    idle.Init(cfg);
+    Record(idle, 2, 100, 10, false);
+    EXPECT_EQ(idle.GetLengthSamps(), 0u);
+}
+
+TEST(util_WavWriter, e_singleFrame)
+{
+    // interleaved frames, one at a time
+    ASSERT_TRUE(FatFsImage::Format());
+    WavWriter<4096>         writer;
+    WavWriter<4096>::Config cfg = {48000, 3, 32};
+    writer.Init(cfg);
+    ASSERT_EQ(writer.OpenFile("0:/frame.wav"), WavWriter<4096>::Result::OK);
+    for(size_t i = 0; i < 2777; i++)
+    {
+        const float frame[3] = {Signal(0, i), Signal(1, i), Signal(2, i)};
+        writer.Sample(frame);
+        if(i % 100 == 0)
+            writer.Write();
+    }
+    EXPECT_EQ(writer.GetLengthSamps(), 2777u);
+    EXPECT_FLOAT_EQ(writer.GetLengthSeconds(), 2777.f / 48000);
+    EXPECT_EQ(writer.SaveFile(), WavWriter<4096>::Result::OK);
+    ExpectRecording(
+        Load("0:/frame.wav"), WavSampleFormat::PCM_S32, 0, 3, 2777, 1e-6f);
+}
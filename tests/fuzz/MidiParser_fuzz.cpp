@@ -0,0 +1,334 @@
+/** Fuzz target for the MIDI parser.
+ *
+ *  Drives MidiParser and MidiHandler with an arbitrary byte stream, and
+ *  checks that they agree with a plain reference decoder of the MIDI 1.0
+ *  byte protocol, that SysEx payloads stay inside their buffers, and that
+ *  the event queue never grows past its size.
+ *
+ *  The first byte of the input chooses how the stream is cut into chunks,
+ *  the rest is the stream itself. A failed check prints the line and aborts.
+ *
+ *  The target is built into the unit tests, which run it on generated
+ *  streams (MidiFuzz_gtest.cpp), and with `make fuzz` into a libFuzzer
+ *  binary, which needs clang:
+ *  @code
+ *  cd tests
+ *  make fuzz
+ *  ./build/bin/midi_parser_fuzz -max_len=4096
+ *  @endcode
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "hid/midi.h"
+#include "MidiRefDecoder.h"
+
+using namespace daisy;
+
+#define FUZZ_CHECK(cond)                                                     \
+    do                                                                       \
+    {                                                                        \
+        if(!(cond))                                                          \
+        {                                                                    \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+                    #cond);                                                  \
+            abort();                                                         \
+        }                                                                    \
+    } while(0)
+
+namespace
+{
+/** Checks the fields of an event that any input may produce */
+void CheckRange(const CompactMidiEvent& event, size_t sysex_capacity)
+{
+    FUZZ_CHECK(event.type < MessageLast);
+    FUZZ_CHECK(event.channel < 16);
+    FUZZ_CHECK(event.data[0] < 0x80 && event.data[1] < 0x80);
+    FUZZ_CHECK(event.sc_type < SystemCommonLast);
+    FUZZ_CHECK(event.srt_type < SystemRealTimeLast);
+    FUZZ_CHECK(event.sysex_length <= sysex_capacity);
+    FUZZ_CHECK(event.sysex_length == 0
+               || (event.type == SystemCommon
+                   && event.sc_type == SystemExclusive));
+}
+
+/** Compares a parsed event with the reference, without the payload */
+bool IsSame(const CompactMidiEvent& event, const RefEvent& ref)
+{
+    if(ref.status >= 0xf8)
+        return event.type == SystemRealTime
+               && event.srt_type == (ref.status & 0x07)
+               && event.channel == (ref.status & 0x0f);
+    if(ref.status >= 0xf0)
+        return event.type == SystemCommon
+               && event.sc_type == (ref.status & 0x07)
+               && (ref.status < 0xf1 || ref.status > 0xf3
+                   || event.data[0] == ref.data[0])
+               && (ref.status != 0xf2 || event.data[1] == ref.data[1]);
+
+    MidiMessageType type = static_cast<MidiMessageType>((ref.status >> 4) - 8);
+    if(type == NoteOn && ref.data[1] == 0)
+        type = NoteOff;
+    else if(type == ControlChange && ref.data[0] > 119)
+        type = ChannelMode;
+    return event.type == type && event.channel == (ref.status & 0x0f)
+           && event.data[0] == ref.data[0]
+           && (RefDecoder::GetNumData(ref.status) < 2
+               || event.data[1] == ref.data[1]);
+}
+
+/** Returns true if a payload is the start of the reference payload, which
+ *  is truncated when the buffer is full */
+bool IsPayloadStart(const uint8_t* data, size_t size, const RefEvent& ref)
+{
+    return size <= ref.sysex.size()
+           && (size == 0 || memcmp(data, ref.sysex.data(), size) == 0);
+}
+
+/** A SysEx buffer between two guard areas, to catch writes past it even
+ *  without AddressSanitizer */
+struct GuardedSysExBuffer
+{
+    static constexpr size_t  kCapacity = 64;
+    static constexpr uint8_t kGuard    = 0xa5;
+
+    GuardedSysExBuffer()
+    {
+        memset(front, kGuard, sizeof(front));
+        memset(back, kGuard, sizeof(back));
+    }
+
+    void CheckGuards() const
+    {
+        for(size_t i = 0; i < sizeof(front); i++)
+            FUZZ_CHECK(front[i] == kGuard && back[i] == kGuard);
+    }
+
+    uint8_t                    front[32];
+    MidiSysExBuffer<kCapacity> buffer;
+    uint8_t                    back[32];
+};
+
+constexpr size_t  GuardedSysExBuffer::kCapacity;
+constexpr uint8_t GuardedSysExBuffer::kGuard;
+
+/** Sink for the span parsers, that accepts events on a pattern */
+struct CheckingSink
+{
+    std::vector<CompactMidiEvent> events;
+    uint32_t                      reject_mask = 0;
+    size_t                        sysex_bytes = 0;
+
+    bool PushBack(const CompactMidiEvent& event)
+    {
+        CheckRange(event, GuardedSysExBuffer::kCapacity);
+        if((reject_mask >> (events.size() & 31)) & 1)
+        {
+            events.push_back(CompactMidiEvent());
+            return false;
+        }
+        events.push_back(event);
+        sysex_bytes += event.sysex_length;
+        return true;
+    }
+};
+
+/** Transport stub for MidiHandler */
+class FuzzTransport
+{
+  public:
+    struct Config
+    {
+    };
+    void    Init(Config) {}
+    void    StartRx() {}
+    size_t  Readable() { return 0; }
+    void    FlushRx() {}
+    void    Tx(uint8_t*, size_t) {}
+    uint8_t Rx() { return 0; }
+    bool    RxActive() { return true; }
+};
+
+/** Chunk sizes and pop counts, from the first byte of the input */
+class Chunker
+{
+  public:
+    explicit Chunker(uint8_t seed) : state_(seed * 2654435761u + 1) {}
+
+    size_t Next(size_t max)
+    {
+        state_ = state_ * 1664525u + 1013904223u;
+        return (state_ >> 16) % (max + 1);
+    }
+
+  private:
+    uint32_t state_;
+};
+
+void FuzzBytes(const uint8_t* data, size_t size, uint8_t seed)
+{
+    // the expected events
+    std::vector<RefEvent> ref;
+    {
+        RefDecoder decoder;
+        RefEvent   event;
+        for(size_t i = 0; i < size; i++)
+        {
+            if(decoder.Feed(data[i], &event))
+                ref.push_back(event);
+        }
+    }
+    FUZZ_CHECK(ref.size() <= size);
+
+    // one byte at a time, into CompactMidiEvent and MidiEvent
+    {
+        GuardedSysExBuffer sysex;
+        MidiParser         parser, legacy;
+        parser.Init();
+        parser.SetSysExBuffer(&sysex.buffer);
+        legacy.Init();
+
+        size_t           num_events = 0;
+        CompactMidiEvent event;
+        MidiEvent        legacy_event;
+        uint8_t          payload[GuardedSysExBuffer::kCapacity];
+        for(size_t i = 0; i < size; i++)
+        {
+            const bool parsed = parser.Parse(data[i], &event);
+            FUZZ_CHECK(parsed == legacy.Parse(data[i], &legacy_event));
+            sysex.CheckGuards();
+            if(!parsed)
+                continue;
+
+            FUZZ_CHECK(num_events < ref.size());
+            const RefEvent& expected = ref[num_events++];
+            CheckRange(event, GuardedSysExBuffer::kCapacity);
+            FUZZ_CHECK(IsSame(event, expected));
+            FUZZ_CHECK(legacy_event.type == event.type);
+
+            if(event.type == SystemCommon && event.sc_type == SystemExclusive)
+            {
+                // the payload is truncated to the buffer, which is empty
+                FUZZ_CHECK(event.sysex_length
+                           == std::min(expected.sysex.size(),
+                                       GuardedSysExBuffer::kCapacity));
+                sysex.buffer.CommitMessage();
+                FUZZ_CHECK(sysex.buffer.Read(payload, sizeof(payload))
+                           == event.sysex_length);
+                FUZZ_CHECK(
+                    IsPayloadStart(payload, event.sysex_length, expected));
+
+                FUZZ_CHECK(legacy_event.sysex_message_len
+                           == std::min(expected.sysex.size(),
+                                       size_t(SYSEX_BUFFER_LEN)));
+                FUZZ_CHECK(IsPayloadStart(legacy_event.sysex_data,
+                                          legacy_event.sysex_message_len,
+                                          expected));
+            }
+            FUZZ_CHECK(sysex.buffer.GetReadable() == 0);
+        }
+        FUZZ_CHECK(num_events == ref.size());
+    }
+
+    // spans in chunks, with all events accepted, and with some rejected
+    for(uint32_t reject_mask : {0u, 0x5a5a5a5au})
+    {
+        GuardedSysExBuffer sysex;
+        MidiParser         parser;
+        CheckingSink       sink;
+        Chunker            chunker(seed);
+        parser.Init();
+        parser.SetSysExBuffer(&sysex.buffer);
+        sink.reject_mask = reject_mask;
+
+        size_t accepted = 0;
+        for(size_t i = 0; i < size;)
+        {
+            const size_t chunk = std::min(size - i, chunker.Next(32));
+            accepted += parser.Parse(data + i, chunk, sink);
+            i += chunk;
+            sysex.CheckGuards();
+        }
+        FUZZ_CHECK(sink.events.size() == ref.size());
+        FUZZ_CHECK(sink.sysex_bytes <= GuardedSysExBuffer::kCapacity);
+        FUZZ_CHECK(sysex.buffer.GetReadable() == sink.sysex_bytes);
+
+        size_t num_accepted = 0;
+        for(size_t i = 0; i < ref.size(); i++)
+        {
+            if((reject_mask >> (i & 31)) & 1)
+                continue;
+            FUZZ_CHECK(IsSame(sink.events[i], ref[i]));
+            num_accepted++;
+        }
+        FUZZ_CHECK(accepted == num_accepted);
+    }
+
+    // the handler, popping some events between chunks, so that the queue
+    // fills up and events are dropped
+    {
+        using Handler = MidiHandler<FuzzTransport, 16, 4, 4, 32, 256>;
+        Handler handler;
+        handler.Init(Handler::Config());
+        Chunker chunker(seed);
+
+        size_t  next_ref = 0;
+        uint8_t payload[256];
+        auto    pop = [&]() {
+            const CompactMidiEvent event = handler.PopCompactEvent();
+            const size_t           read  = handler.ReadSysEx(payload, 256);
+            CheckRange(event, 256);
+            FUZZ_CHECK(read == event.sysex_length);
+            // events are dropped, but not reordered
+            while(next_ref < ref.size())
+            {
+                const RefEvent& expected = ref[next_ref++];
+                if(IsSame(event, expected)
+                   && IsPayloadStart(payload, read, expected))
+                    return;
+            }
+            FUZZ_CHECK(!"popped an event that was never sent");
+        };
+
+        for(size_t i = 0; i < size;)
+        {
+            const size_t chunk = std::min(size - i, chunker.Next(48));
+            handler.Parse(data + i, chunk);
+            i += chunk;
+            for(size_t n = chunker.Next(4); n > 0 && handler.HasEvents(); n--)
+                pop();
+        }
+        size_t num_queued = 0;
+        while(handler.HasEvents())
+        {
+            pop();
+            num_queued++;
+        }
+        FUZZ_CHECK(num_queued <= 16);
+    }
+
+    // the same bytes as USB-MIDI event packets
+    {
+        GuardedSysExBuffer sysex;
+        MidiParser         parser;
+        CheckingSink       sink;
+        parser.Init();
+        parser.SetSysExBuffer(&sysex.buffer);
+        parser.ParseUsbPackets(data, size, sink);
+        sysex.CheckGuards();
+        FUZZ_CHECK(sink.events.size() <= size / 4 * 3);
+        FUZZ_CHECK(sysex.buffer.GetReadable() == sink.sysex_bytes);
+    }
+}
+
+} // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    if(size == 0)
+        return 0;
+    FuzzBytes(data + 1, size - 1, data[0]);
+    return 0;
+}
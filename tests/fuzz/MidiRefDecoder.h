@@ -0,0 +1,105 @@
+#pragma once
+#include <stdint.h>
+#include <vector>
+
+/** An event as the MIDI 1.0 specification describes it */
+struct RefEvent
+{
+    uint8_t              status;
+    uint8_t              data[2];
+    std::vector<uint8_t> sysex;
+};
+
+/** A plain decoder of the byte protocol, written from the specification
+ *  rather than for speed:
+ *  - Real-Time bytes are complete messages wherever they come
+ *  - any status byte but End of Exclusive cuts a SysEx message, which is
+ *    dropped, and an unfinished message
+ *  - data bytes without a status repeat the last channel status, which
+ *    SysEx and System Common messages cancel
+ */
+class RefDecoder
+{
+  public:
+    bool Feed(uint8_t byte, RefEvent* out)
+    {
+        if(byte >= 0xf8)
+        {
+            out->status = byte;
+            return true;
+        }
+        if(byte & 0x80)
+        {
+            const bool sysex_end = in_sysex_ && byte == 0xf7;
+            in_sysex_            = false;
+            status_              = 0;
+            num_data_            = 0;
+            if(sysex_end)
+            {
+                out->status = 0xf0;
+                out->sysex  = sysex_;
+                return true;
+            }
+            if(byte < 0xf0)
+            {
+                running_ = byte;
+                status_  = byte;
+                return false;
+            }
+            running_ = 0;
+            if(byte == 0xf0)
+            {
+                in_sysex_ = true;
+                sysex_.clear();
+                return false;
+            }
+            if(byte <= 0xf3)
+            {
+                status_ = byte;
+                return false;
+            }
+            out->status = byte;
+            return true;
+        }
+        if(in_sysex_)
+        {
+            sysex_.push_back(byte);
+            return false;
+        }
+        if(status_ == 0)
+        {
+            if(running_ == 0)
+                return false;
+            status_ = running_;
+        }
+        data_[num_data_++] = byte;
+        if(num_data_ < GetNumData(status_))
+            return false;
+
+        out->status  = status_;
+        out->data[0] = data_[0];
+        out->data[1] = num_data_ > 1 ? data_[1] : 0;
+        status_      = 0;
+        num_data_    = 0;
+        return true;
+    }
+
+    static uint8_t GetNumData(uint8_t status)
+    {
+        switch(status & 0xf0)
+        {
+            case 0xc0:
+            case 0xd0: return 1;
+            case 0xf0: return status == 0xf2 ? 2 : 1;
+            default: return 2;
+        }
+    }
+
+  private:
+    uint8_t              status_   = 0;
+    uint8_t              running_  = 0;
+    uint8_t              data_[2]  = {};
+    uint8_t              num_data_ = 0;
+    bool                 in_sysex_ = false;
+    std::vector<uint8_t> sysex_;
+};
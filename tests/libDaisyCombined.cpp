@@ -5,3 +5,11 @@
 #include "util/oled_fonts.c"
 #include "per/qspi.cpp"
 #include "hid/midi_parser.cpp"
+#include "hid/midi_util.cpp"
+#include "per/sai.cpp"
+#include "hid/audio.cpp"
+#include "hid/midi_clock.cpp"
+#include "hid/midi_ump.cpp"
+#include "hid/midi_router.cpp"
+#include "hid/midi_file.cpp"
+#include "hid/wavplayer.cpp"